@@ -12,17 +12,34 @@ typedef struct {
     allocate_fn alloc;
 } allocator_t;
 
+/* Source location of the allocation being made. The macros below record it
+ * before calling the allocator so that profilers (see alloc_profile.h) can
+ * attribute allocations to their call sites. */
+typedef struct {
+    const char* file;
+    int line;
+} alloc_site;
+
+extern _Thread_local alloc_site alloc_current_site;
+
+#define ALLOC_AT_SITE(call) \
+    (alloc_current_site = (alloc_site){__FILE__, __LINE__}, (call))
+
 #define ALLOC(allocator, type) \
-    ((allocator)->alloc((allocator)->ctx, NULL, 0, sizeof(type)))
+    ALLOC_AT_SITE((allocator)->alloc((allocator)->ctx, NULL, 0, sizeof(type)))
 #define FREE(allocator, ptr, type) \
-    ((allocator)->alloc((allocator)->ctx, ptr, sizeof(type), 0))
+    ALLOC_AT_SITE((allocator)->alloc((allocator)->ctx, ptr, sizeof(type), 0))
 
 #define ALLOC_ARRAY(allocator, type, count) \
-    ((allocator)->alloc((allocator)->ctx, NULL, 0, sizeof(type) * count))
+    ALLOC_AT_SITE(                          \
+        (allocator)->alloc((allocator)->ctx, NULL, 0, sizeof(type) * count) \
+    )
 #define FREE_ARRAY(allocator, ptr, type, count) \
-    ((allocator)->alloc((allocator)->ctx, ptr, sizeof(type) * count, 0))
+    ALLOC_AT_SITE(                              \
+        (allocator)->alloc((allocator)->ctx, ptr, sizeof(type) * count, 0) \
+    )
 #define RESIZE_ARRAY(allocator, ptr, type, old_count, new_count) \
-    ((allocator)->alloc(                                         \
+    ALLOC_AT_SITE((allocator)->alloc(                            \
         (allocator)->ctx,                                        \
         ptr,                                                     \
         sizeof(type) * old_count,                                \
@@ -0,0 +1,525 @@
+#include "alloc_profile.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Sizes are bucketed by the position of their highest set bit */
+#define HISTOGRAM_BUCKETS 65
+
+/* Number of call sites listed by the table, the JSON lists all of them */
+#define TABLE_SITES 20
+
+#define LIVE_INITIAL_CAPACITY 1024
+#define SITES_INITIAL_CAPACITY 64
+
+typedef struct {
+    alloc_site site;
+
+    size_t allocations;
+    size_t resizes;
+    size_t frees;
+
+    size_t total_bytes;
+    size_t current_bytes;
+    size_t peak_bytes;
+} site_stats;
+
+/* An allocation that has not been freed yet */
+typedef struct {
+    /* 0 marks an empty slot */
+    uintptr_t ptr;
+    size_t size;
+
+    /* Index of the site that made the allocation */
+    size_t site;
+} live_entry;
+
+struct _alloc_profiler {
+    allocator_t* inner;
+
+    /* Allocations may come from several threads */
+    atomic_flag lock;
+
+    /* Open addressed, linearly probed, capacity is a power of two */
+    live_entry* live;
+    size_t live_len;
+    size_t live_capacity;
+
+    /* Sites in the order they were first seen */
+    site_stats* sites;
+    size_t sites_len;
+    size_t sites_capacity;
+
+    /* Open addressed index into `sites`, holds index + 1 or 0 when empty.
+     * Twice the capacity of `sites`. */
+    size_t* site_index;
+
+    size_t histogram[HISTOGRAM_BUCKETS];
+    alloc_profile_totals totals;
+};
+
+static size_t hash_ptr(uintptr_t ptr) {
+    return (size_t) ((ptr * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+static size_t hash_site(alloc_site site) {
+    return hash_ptr((uintptr_t) site.file ^ ((uintptr_t) site.line << 48));
+}
+
+alloc_profiler* alloc_profiler_make(allocator_t* inner) {
+    alloc_profiler* self = ALLOC(gpa(), alloc_profiler);
+
+    *self = (alloc_profiler){
+        .inner = inner,
+        .lock = ATOMIC_FLAG_INIT,
+        .live_capacity = LIVE_INITIAL_CAPACITY,
+        .sites_capacity = SITES_INITIAL_CAPACITY,
+    };
+
+    self->live = ALLOC_ARRAY(gpa(), live_entry, self->live_capacity);
+    memset(self->live, 0, sizeof(live_entry) * self->live_capacity);
+
+    self->sites = ALLOC_ARRAY(gpa(), site_stats, self->sites_capacity);
+
+    self->site_index = ALLOC_ARRAY(gpa(), size_t, self->sites_capacity * 2);
+    memset(self->site_index, 0, sizeof(size_t) * self->sites_capacity * 2);
+
+    return self;
+}
+
+void alloc_profiler_destroy(alloc_profiler* self) {
+    FREE_ARRAY(gpa(), self->live, live_entry, self->live_capacity);
+    FREE_ARRAY(gpa(), self->sites, site_stats, self->sites_capacity);
+    FREE_ARRAY(gpa(), self->site_index, size_t, self->sites_capacity * 2);
+    FREE(gpa(), self, alloc_profiler);
+}
+
+static void profiler_lock(alloc_profiler* self) {
+    while (atomic_flag_test_and_set_explicit(&self->lock, memory_order_acquire)
+    ) {
+    }
+}
+
+static void profiler_unlock(alloc_profiler* self) {
+    atomic_flag_clear_explicit(&self->lock, memory_order_release);
+}
+
+static void site_index_insert(alloc_profiler* self, size_t index) {
+    size_t mask = self->sites_capacity * 2 - 1;
+    size_t i = hash_site(self->sites[index].site) & mask;
+
+    while (self->site_index[i] != 0) {
+        i = (i + 1) & mask;
+    }
+
+    self->site_index[i] = index + 1;
+}
+
+/* Returns the index of the site's stats, adding them if needed */
+static size_t site_of(alloc_profiler* self, alloc_site site) {
+    size_t mask = self->sites_capacity * 2 - 1;
+    size_t i = hash_site(site) & mask;
+
+    while (self->site_index[i] != 0) {
+        site_stats* stats = &self->sites[self->site_index[i] - 1];
+
+        if (stats->site.file == site.file && stats->site.line == site.line) {
+            return self->site_index[i] - 1;
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    if (self->sites_len == self->sites_capacity) {
+        size_t old_capacity = self->sites_capacity;
+        self->sites_capacity *= 2;
+
+        self->sites = RESIZE_ARRAY(
+            gpa(), self->sites, site_stats, old_capacity, self->sites_capacity
+        );
+
+        FREE_ARRAY(gpa(), self->site_index, size_t, old_capacity * 2);
+        self->site_index =
+            ALLOC_ARRAY(gpa(), size_t, self->sites_capacity * 2);
+        memset(self->site_index, 0, sizeof(size_t) * self->sites_capacity * 2);
+
+        for (size_t j = 0; j < self->sites_len; j++) {
+            site_index_insert(self, j);
+        }
+    }
+
+    size_t index = self->sites_len++;
+    self->sites[index] = (site_stats){.site = site};
+    site_index_insert(self, index);
+
+    return index;
+}
+
+static void live_insert(alloc_profiler* self, live_entry entry) {
+    size_t mask = self->live_capacity - 1;
+    size_t i = hash_ptr(entry.ptr) & mask;
+
+    while (self->live[i].ptr != 0) {
+        i = (i + 1) & mask;
+    }
+
+    self->live[i] = entry;
+    self->live_len++;
+}
+
+static void live_grow(alloc_profiler* self) {
+    live_entry* old = self->live;
+    size_t old_capacity = self->live_capacity;
+
+    self->live_capacity *= 2;
+    self->live = ALLOC_ARRAY(gpa(), live_entry, self->live_capacity);
+    memset(self->live, 0, sizeof(live_entry) * self->live_capacity);
+    self->live_len = 0;
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].ptr != 0) {
+            live_insert(self, old[i]);
+        }
+    }
+
+    FREE_ARRAY(gpa(), old, live_entry, old_capacity);
+}
+
+/* Removes the entry for `ptr` into `out`, returns false if there is none */
+static bool live_remove(alloc_profiler* self, uintptr_t ptr, live_entry* out) {
+    size_t mask = self->live_capacity - 1;
+    size_t i = hash_ptr(ptr) & mask;
+
+    while (self->live[i].ptr != ptr) {
+        if (self->live[i].ptr == 0) {
+            return false;
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    *out = self->live[i];
+    self->live_len--;
+
+    /* Shift back the entries that probed past the removed one so lookups
+     * never stop at the hole */
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+
+        if (self->live[j].ptr == 0) {
+            break;
+        }
+
+        size_t home = hash_ptr(self->live[j].ptr) & mask;
+        bool reachable = i <= j ? (home > i && home <= j)
+                                : (home > i || home <= j);
+
+        if (!reachable) {
+            self->live[i] = self->live[j];
+            i = j;
+        }
+    }
+
+    self->live[i].ptr = 0;
+
+    return true;
+}
+
+static size_t histogram_bucket(size_t size) {
+    return size == 0 ? 0 : 64 - __builtin_clzll(size);
+}
+
+static void record(
+    alloc_profiler* self,
+    alloc_site site,
+    void* ptr,
+    void* new_ptr,
+    size_t new_size
+) {
+    alloc_profile_totals* totals = &self->totals;
+    site_stats* stats = &self->sites[site_of(self, site)];
+    size_t old_size = 0;
+
+    if (ptr != NULL) {
+        live_entry old;
+
+        if (live_remove(self, (uintptr_t) ptr, &old)) {
+            old_size = old.size;
+            self->sites[old.site].current_bytes -= old.size;
+            totals->current_bytes -= old.size;
+        } else {
+            totals->unknown_frees++;
+        }
+    }
+
+    if (new_size == 0) {
+        totals->frees++;
+        stats->frees++;
+        return;
+    }
+
+    if (ptr == NULL) {
+        totals->allocations++;
+        stats->allocations++;
+    } else {
+        totals->resizes++;
+        stats->resizes++;
+    }
+
+    size_t grown = new_size > old_size ? new_size - old_size : 0;
+    totals->total_bytes += grown;
+    stats->total_bytes += grown;
+
+    self->histogram[histogram_bucket(new_size)]++;
+
+    if ((self->live_len + 1) * 2 > self->live_capacity) {
+        live_grow(self);
+    }
+
+    live_insert(
+        self,
+        (live_entry){
+            .ptr = (uintptr_t) new_ptr,
+            .size = new_size,
+            .site = stats - self->sites,
+        }
+    );
+
+    totals->current_bytes += new_size;
+    if (totals->current_bytes > totals->peak_bytes) {
+        totals->peak_bytes = totals->current_bytes;
+    }
+
+    stats->current_bytes += new_size;
+    if (stats->current_bytes > stats->peak_bytes) {
+        stats->peak_bytes = stats->current_bytes;
+    }
+}
+
+static void* profiled_alloc(
+    void* ctx, void* ptr, size_t old_size, size_t new_size
+) {
+    alloc_profiler* self = (alloc_profiler*) ctx;
+
+    /* The wrapped allocator may make allocations of its own */
+    alloc_site site = alloc_current_site;
+
+    void* ret = self->inner->alloc(self->inner->ctx, ptr, old_size, new_size);
+
+    if ((ptr == NULL && new_size == 0) || (new_size != 0 && ret == NULL)) {
+        return ret;
+    }
+
+    profiler_lock(self);
+    record(self, site, ptr, ret, new_size);
+    profiler_unlock(self);
+
+    return ret;
+}
+
+allocator_t alloc_profiler_get_alloc(alloc_profiler* self) {
+    return (allocator_t){
+        .alloc = profiled_alloc,
+        .ctx = self,
+    };
+}
+
+alloc_profile_totals alloc_profiler_get_totals(alloc_profiler* self) {
+    profiler_lock(self);
+    alloc_profile_totals totals = self->totals;
+    profiler_unlock(self);
+
+    return totals;
+}
+
+static int compare_sites(const void* left, const void* right) {
+    const site_stats* l = *(const site_stats**) left;
+    const site_stats* r = *(const site_stats**) right;
+
+    if (l->total_bytes != r->total_bytes) {
+        return l->total_bytes < r->total_bytes ? 1 : -1;
+    }
+
+    return l->allocations < r->allocations   ? 1
+           : l->allocations > r->allocations ? -1
+                                             : 0;
+}
+
+static const char* site_file(const site_stats* stats) {
+    return stats->site.file != NULL ? stats->site.file : "<unknown>";
+}
+
+static void print_json_string(FILE* out, const char* str) {
+    fputc('"', out);
+
+    for (const char* c = str; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', out);
+        }
+        fputc(*c, out);
+    }
+
+    fputc('"', out);
+}
+
+static void print_table(
+    alloc_profiler* self, FILE* out, site_stats** sorted
+) {
+    alloc_profile_totals* totals = &self->totals;
+
+    fprintf(
+        out,
+        "allocations: %zu, resizes: %zu, frees: %zu (%zu unknown)\n"
+        "bytes: %zu KiB current, %zu KiB peak, %zu KiB allocated in total\n"
+        "\n",
+        totals->allocations,
+        totals->resizes,
+        totals->frees,
+        totals->unknown_frees,
+        totals->current_bytes / 1024,
+        totals->peak_bytes / 1024,
+        totals->total_bytes / 1024
+    );
+
+    fprintf(
+        out,
+        "%-32s %10s %10s %10s %12s %12s\n",
+        "site",
+        "allocs",
+        "resizes",
+        "frees",
+        "total KiB",
+        "peak KiB"
+    );
+
+    size_t shown = self->sites_len < TABLE_SITES ? self->sites_len
+                                                 : TABLE_SITES;
+
+    for (size_t i = 0; i < shown; i++) {
+        char location[256];
+        snprintf(
+            location,
+            sizeof(location),
+            "%s:%d",
+            site_file(sorted[i]),
+            sorted[i]->site.line
+        );
+
+        fprintf(
+            out,
+            "%-32s %10zu %10zu %10zu %12zu %12zu\n",
+            location,
+            sorted[i]->allocations,
+            sorted[i]->resizes,
+            sorted[i]->frees,
+            sorted[i]->total_bytes / 1024,
+            sorted[i]->peak_bytes / 1024
+        );
+    }
+
+    if (shown < self->sites_len) {
+        fprintf(out, "(%zu more sites)\n", self->sites_len - shown);
+    }
+
+    fprintf(out, "\n%-32s %10s\n", "size", "count");
+
+    for (size_t b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        if (self->histogram[b] == 0) {
+            continue;
+        }
+
+        char range[64];
+        size_t min = b == 0 ? 0 : (size_t) 1 << (b - 1);
+        snprintf(range, sizeof(range), "%zu-%zu", min, min * 2 - (b != 0));
+
+        fprintf(out, "%-32s %10zu\n", range, self->histogram[b]);
+    }
+}
+
+static void print_json(alloc_profiler* self, FILE* out, site_stats** sorted) {
+    alloc_profile_totals* totals = &self->totals;
+
+    fprintf(
+        out,
+        "{\"allocations\": %zu, \"resizes\": %zu, \"frees\": %zu, "
+        "\"unknown_frees\": %zu, \"current_bytes\": %zu, "
+        "\"peak_bytes\": %zu, \"total_bytes\": %zu, \"sites\": [",
+        totals->allocations,
+        totals->resizes,
+        totals->frees,
+        totals->unknown_frees,
+        totals->current_bytes,
+        totals->peak_bytes,
+        totals->total_bytes
+    );
+
+    for (size_t i = 0; i < self->sites_len; i++) {
+        fprintf(out, "%s{\"file\": ", i == 0 ? "" : ", ");
+        print_json_string(out, site_file(sorted[i]));
+        fprintf(
+            out,
+            ", \"line\": %d, \"allocations\": %zu, \"resizes\": %zu, "
+            "\"frees\": %zu, \"total_bytes\": %zu, \"current_bytes\": %zu, "
+            "\"peak_bytes\": %zu}",
+            sorted[i]->site.line,
+            sorted[i]->allocations,
+            sorted[i]->resizes,
+            sorted[i]->frees,
+            sorted[i]->total_bytes,
+            sorted[i]->current_bytes,
+            sorted[i]->peak_bytes
+        );
+    }
+
+    fprintf(out, "], \"histogram\": [");
+
+    bool first = true;
+    for (size_t b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        if (self->histogram[b] == 0) {
+            continue;
+        }
+
+        size_t min = b == 0 ? 0 : (size_t) 1 << (b - 1);
+        fprintf(
+            out,
+            "%s{\"min\": %zu, \"max\": %zu, \"count\": %zu}",
+            first ? "" : ", ",
+            min,
+            min * 2 - (b != 0),
+            self->histogram[b]
+        );
+        first = false;
+    }
+
+    fprintf(out, "]}\n");
+}
+
+void alloc_profiler_print(
+    alloc_profiler* self, FILE* out, alloc_profile_format format
+) {
+    profiler_lock(self);
+
+    site_stats** sorted = ALLOC_ARRAY(gpa(), site_stats*, self->sites_len);
+    for (size_t i = 0; i < self->sites_len; i++) {
+        sorted[i] = &self->sites[i];
+    }
+    qsort(sorted, self->sites_len, sizeof(site_stats*), compare_sites);
+
+    switch (format) {
+        case ALLOC_PROFILE_TABLE:
+            print_table(self, out, sorted);
+            break;
+
+        case ALLOC_PROFILE_JSON:
+            print_json(self, out, sorted);
+            break;
+    }
+
+    FREE_ARRAY(gpa(), sorted, site_stats*, self->sites_len);
+
+    profiler_unlock(self);
+}
@@ -0,0 +1,62 @@
+/**
+ * Allocation profiler
+ *
+ * Wraps any allocator and records what goes through it: live allocations
+ * (kept in a hash table keyed by pointer), current and peak bytes, counters
+ * per call site and a histogram of allocation sizes. Call sites are the ones
+ * recorded by the ALLOC family of macros.
+ */
+
+#ifndef ALLOC_PROFILE_H
+#define ALLOC_PROFILE_H
+
+#include <stdio.h>
+
+#include "alloc.h"
+
+typedef struct _alloc_profiler alloc_profiler;
+
+typedef struct {
+    size_t allocations;
+    size_t resizes;
+    size_t frees;
+
+    /* Frees and resizes of pointers the profiler has not seen allocated */
+    size_t unknown_frees;
+
+    size_t current_bytes;
+    size_t peak_bytes;
+
+    /* Sum of all the allocated and grown sizes */
+    size_t total_bytes;
+} alloc_profile_totals;
+
+typedef enum {
+    ALLOC_PROFILE_TABLE,
+    ALLOC_PROFILE_JSON,
+} alloc_profile_format;
+
+/**
+ * Makes a profiler for allocations made through `inner`.
+ */
+alloc_profiler* alloc_profiler_make(allocator_t* inner);
+
+void alloc_profiler_destroy(alloc_profiler* self);
+
+/**
+ * Returns the allocator which forwards to the wrapped allocator and records
+ * every call. It is safe to share between threads if the wrapped allocator
+ * is.
+ */
+allocator_t alloc_profiler_get_alloc(alloc_profiler* self);
+
+alloc_profile_totals alloc_profiler_get_totals(alloc_profiler* self);
+
+/**
+ * Prints a summary of the recorded allocations.
+ */
+void alloc_profiler_print(
+    alloc_profiler* self, FILE* out, alloc_profile_format format
+);
+
+#endif  // ALLOC_PROFILE_H
@@ -3,29 +3,84 @@
 #include <string.h>
 #include <stdint.h>
 
-typedef struct _allocation {
-    uintptr_t ptr;
+#include "mmio.h"
+
+/* Header placed at the start of every block obtained from the base allocator.
+ * Blocks form a singly linked list, most recent first. The head of the list
+ * is always the block we are currently bumping into. */
+typedef struct _block {
+    struct _block* prev;
+
+    /* Size of the block, including this header */
+    size_t size;
+
+    /* Order in which blocks were allocated, used to find the blocks
+     * allocated after a checkpoint. */
+    size_t serial;
+
+    /* Was this block allocated for a single large allocation? */
+    bool dedicated;
+} block;
+
+#ifndef ARENA_NO_TAIL_REUSE
+
+/* Number of tail size classes. Class `n` holds tails of size [2^n, 2^(n+1)) */
+#define TAIL_CLASSES (sizeof(size_t) * 8)
+
+/* Tails smaller than this are not worth tracking */
+#define TAIL_MIN_SIZE 64
 
+/* Unused space left at the end of a retired block. The header is stored
+ * within the tail itself. */
+typedef struct _tail {
+    struct _tail* next;
     size_t size;
-    size_t offset;
+} tail;
 
-    struct _allocation* prev;
-} allocation;
+#endif  // ARENA_NO_TAIL_REUSE
 
 struct _arena {
     /* The base allocator to get memory from */
     allocator_t* base;
 
-    /* List of allocations made with base */
-    allocation* list;
+    /* List of blocks allocated with base, the head is the current block */
+    block* list;
 
-    /* Total available unused memory we can use for future allocations */
-    size_t free;
+    /* Bump pointer and the end of the free space in the current block */
+    uintptr_t ptr;
+    uintptr_t end;
 
-    /* Size of blocks to allocate from base allocator.
+    /* Size of the next block to allocate from base allocator.
      * Actual size of the block MAY be greater than this if an allocation
      * greater than block size is requested. */
     size_t block_size;
+
+    /* Blocks grow up to this size */
+    size_t max_block_size;
+
+    bool huge_pages;
+
+    /* Serial number of the next block */
+    size_t serial;
+
+    /* A block released by arena_reset, kept to avoid going back to the base
+     * allocator when the arena grows again */
+    block* spare;
+
+    /* Allocations in `floor_block` that start below `floor` were made
+     * before the latest checkpoint and must not be resized in place. */
+    block* floor_block;
+    uintptr_t floor;
+
+    arena_stats stats;
+
+#ifndef ARENA_NO_TAIL_REUSE
+    /* Free tails of retired blocks, bucketed by size class */
+    tail* tails[TAIL_CLASSES];
+
+    /* Bit `n` is set when `tails[n]` is non-empty */
+    size_t tail_classes;
+#endif
 };
 
 static inline uintptr_t align_up(uintptr_t ptr) {
@@ -33,73 +88,292 @@ static inline uintptr_t align_up(uintptr_t ptr) {
            ~(uintptr_t)(_Alignof(max_align_t) - 1);
 }
 
-/* Allocates a block from base allocator */
-static allocation* allocate_block(allocator_t* base, size_t size,
-                                  allocation* prev) {
-    void* raw = ALLOC_ARRAY(base, char, size);
+/* Rounds block sizes that span huge pages up to whole huge pages, so that
+ * the base allocator can align them. */
+static size_t block_size_for(arena* self, size_t size) {
+    if (!self->huge_pages || size < MMIO_HUGE_PAGE_SIZE) {
+        return size;
+    }
+
+    return (size + MMIO_HUGE_PAGE_SIZE - 1) & ~(MMIO_HUGE_PAGE_SIZE - 1);
+}
 
-    uintptr_t block = (uintptr_t) raw;
-    allocation* header = (allocation*) raw;
+/* Allocates a block from base allocator */
+static block* allocate_block(allocator_t* base, size_t size, bool dedicated) {
+    block* header = (block*) ALLOC_ARRAY(base, char, size);
 
-    *header = (allocation){
-        .ptr = block,
+    *header = (block){
+        .prev = NULL,
         .size = size,
-        .offset = (size_t) (align_up(block + sizeof(allocation)) - block),
-        .prev = prev,
+        .dedicated = dedicated,
     };
 
     return header;
 }
 
-static void* allocate_in_block(allocation* block, size_t size) {
-    void* ret = (void*) (block->ptr + block->offset);
-    block->offset = align_up((uintptr_t) (block->ptr + block->offset + size)) - block->ptr;
-    return ret;
+static void count_block(arena* self, block* b) {
+    b->serial = self->serial++;
+
+    self->stats.blocks++;
+    self->stats.dedicated_blocks += b->dedicated;
+    self->stats.bytes += b->size;
+
+    if (b->size > self->stats.largest_block) {
+        self->stats.largest_block = b->size;
+    }
 }
 
-static void* allocate_in_new_block(arena* self, size_t size) {
-    size_t header = align_up(sizeof(allocation));
-    size_t needed = header + align_up(size);
+static inline uintptr_t block_start(block* b) {
+    return align_up((uintptr_t) b + sizeof(block));
+}
 
-    size_t block_size = needed > self->block_size ? needed : self->block_size;
+static inline uintptr_t block_end(block* b) {
+    return (uintptr_t) b + b->size;
+}
 
-    self->list = allocate_block(
-        self->base,
-        block_size,
-        self->list
-    );
+#ifndef ARENA_NO_TAIL_REUSE
 
-    void* ret = allocate_in_block(self->list, size);
+static inline size_t floor_log2(size_t n) {
+    return sizeof(unsigned long long) * 8 - 1 -
+           __builtin_clzll((unsigned long long) n);
+}
 
-    self->free += self->list->size - self->list->offset;
+static void tail_put(arena* self, uintptr_t start, uintptr_t end) {
+    size_t size = end - start;
+    if (size < TAIL_MIN_SIZE) {
+        return;
+    }
 
-    return ret;
+    size_t class = floor_log2(size);
+
+    tail* t = (tail*) start;
+    t->next = self->tails[class];
+    t->size = size;
+
+    self->tails[class] = t;
+    self->tail_classes |= (size_t) 1 << class;
+}
+
+/* Finds a tail that can fit `size` bytes in O(1). Only classes whose every
+ * member is large enough are considered, so the first tail found fits. */
+static void* tail_take(arena* self, size_t size) {
+    size_t class = floor_log2(size);
+    if (((size_t) 1 << class) < size) {
+        class++;
+    }
+
+    if (class >= TAIL_CLASSES) {
+        return NULL;
+    }
+
+    size_t candidates = self->tail_classes & ~(((size_t) 1 << class) - 1);
+    if (candidates == 0) {
+        return NULL;
+    }
+
+    class = __builtin_ctzll((unsigned long long) candidates);
+
+    tail* t = self->tails[class];
+    self->tails[class] = t->next;
+    if (t->next == NULL) {
+        self->tail_classes &= ~((size_t) 1 << class);
+    }
+
+    uintptr_t start = (uintptr_t) t;
+    tail_put(self, start + size, start + t->size);
+
+    return (void*) start;
+}
+
+#endif  // ARENA_NO_TAIL_REUSE
+
+/* Slow path of arena_alloc, taken when the current block can not fit `size`
+ * bytes. `size` must already be aligned. */
+static void* allocate_slow(arena* self, size_t size) {
+    size_t needed = align_up(sizeof(block)) + size;
+
+    /* Allocations larger than a block get a dedicated block. It is linked in
+     * behind the current block so that we keep bumping into the latter. */
+    if (needed > self->block_size) {
+        block* dedicated =
+            allocate_block(self->base, block_size_for(self, needed), true);
+        count_block(self, dedicated);
+
+        dedicated->prev = self->list->prev;
+        self->list->prev = dedicated;
+
+        return (void*) block_start(dedicated);
+    }
+
+#ifndef ARENA_NO_TAIL_REUSE
+    void* ret = tail_take(self, size);
+    if (ret != NULL) {
+        return ret;
+    }
+
+    tail_put(self, self->ptr, self->end);
+#endif
+
+    block* next;
+
+    if (self->spare != NULL &&
+        block_end(self->spare) - block_start(self->spare) >= size) {
+        next = self->spare;
+        self->spare = NULL;
+    } else {
+        next = allocate_block(self->base, self->block_size, false);
+    }
+
+    count_block(self, next);
+
+    next->prev = self->list;
+    self->list = next;
+
+    /* Grow geometrically so that large inputs need few blocks */
+    if (self->block_size < self->max_block_size) {
+        size_t grown = self->block_size * 2;
+        if (grown > self->max_block_size) {
+            grown = self->max_block_size;
+        }
+
+        self->block_size = block_size_for(self, grown);
+    }
+
+    uintptr_t start = block_start(next);
+    self->ptr = start + size;
+    self->end = block_end(next);
+
+    return (void*) start;
 }
 
 arena* arena_make(allocator_t* base, size_t block_size) {
-    allocation* list = allocate_block(base, block_size, NULL);
-    arena* ret = allocate_in_block(list, sizeof(arena));
+    return arena_make_with_options(
+        base,
+        &(arena_options){
+            .block_size = block_size,
+            .max_block_size = block_size,
+            .huge_pages = false,
+        }
+    );
+}
+
+arena* arena_make_with_options(allocator_t* base, const arena_options* options) {
+    size_t max_block_size = options->max_block_size < options->block_size
+                                ? options->block_size
+                                : options->max_block_size;
+
+    block* list = allocate_block(base, options->block_size, false);
+
+    uintptr_t start = block_start(list);
+    arena* ret = (arena*) start;
 
     *ret = (arena) {
         .base = base,
         .list = list,
-        .free = list->size - list->offset,
-        .block_size = block_size,
+        .ptr = align_up(start + sizeof(arena)),
+        .end = block_end(list),
+        .block_size = options->block_size,
+        .max_block_size = max_block_size,
+        .huge_pages = options->huge_pages,
     };
 
+    count_block(ret, list);
+
+    /* The first block is as large as the initial block size, the second one
+     * is the first to grow. */
+    if (ret->block_size < ret->max_block_size) {
+        ret->block_size = block_size_for(ret, ret->block_size * 2);
+    }
+
     return ret;
 }
 
+arena_stats arena_get_stats(arena* self) {
+    return self->stats;
+}
+
+static void free_block(arena* self, block* b) {
+    self->stats.blocks--;
+    self->stats.dedicated_blocks -= b->dedicated;
+    self->stats.bytes -= b->size;
+
+    FREE_ARRAY(self->base, (void*) b, char, b->size);
+}
+
+arena_checkpoint arena_mark(arena* self) {
+    arena_checkpoint mark = (arena_checkpoint){
+        .block = self->list,
+        .ptr = (void*) self->ptr,
+        .serial = self->serial,
+    };
+
+    self->floor_block = self->list;
+    self->floor = self->ptr;
+
+    return mark;
+}
+
+void arena_reset(arena* self, arena_checkpoint mark) {
+    block* current = (block*) mark.block;
+    bool retired = self->list != current;
+
+    /* Release every block allocated after the checkpoint. These are the
+     * blocks in front of the checkpoint's block and dedicated blocks that
+     * have been linked in behind it. */
+    block** link = &self->list;
+    while (*link != NULL) {
+        block* b = *link;
+
+        if (b->serial < mark.serial) {
+            link = &b->prev;
+            continue;
+        }
+
+        *link = b->prev;
+
+        if (!b->dedicated && self->spare == NULL) {
+            self->stats.blocks--;
+            self->stats.bytes -= b->size;
+            self->spare = b;
+        } else {
+            free_block(self, b);
+        }
+    }
+
+    self->list = current;
+    self->ptr = (uintptr_t) mark.ptr;
+    self->end = block_end(current);
+
+    self->floor_block = current;
+    self->floor = self->ptr;
+
+#ifndef ARENA_NO_TAIL_REUSE
+    /* Tails of blocks retired after the checkpoint may overlap the space we
+     * just reclaimed. */
+    if (retired) {
+        memset(self->tails, 0, sizeof(self->tails));
+        self->tail_classes = 0;
+    }
+#else
+    (void) retired;
+#endif
+}
+
 void arena_destroy(arena* self) {
-    allocation* curr = self->list;
+    block* curr = self->list;
+    allocator_t* base = self->base;
+
+    if (self->spare != NULL) {
+        FREE_ARRAY(base, (void*) self->spare, char, self->spare->size);
+    }
 
     while (curr != NULL) {
-        allocation* t = curr;
+        block* t = curr;
         curr = curr->prev;
 
-        /* The allocation object itself is allocated within its block.
-           Freeing this frees allocation object. */
-        FREE_ARRAY(self->base, (void*) t->ptr, char, t->size);
+        /* The block header itself is allocated within its block.
+           Freeing this frees the header. */
+        FREE_ARRAY(base, (void*) t, char, t->size);
     }
 
 
@@ -107,47 +381,95 @@ void arena_destroy(arena* self) {
        the block frees it as well. */
 }
 
+/* Returns the block if `ptr` is the start of the dedicated block right behind
+ * the current block, i.e. the most recent dedicated allocation. */
+static block* dedicated_block_of(arena* self, void* ptr) {
+    block* b = self->list->prev;
+
+    if (b == NULL || !b->dedicated || block_start(b) != (uintptr_t) ptr) {
+        return NULL;
+    }
+
+    return b;
+}
+
+/* Resizes or frees the most recent dedicated allocation through the base
+ * allocator, which may be able to do so without copying. */
+static void* resize_dedicated(arena* self, block* b, size_t new_size) {
+    if (new_size == 0) {
+        self->list->prev = b->prev;
+        free_block(self, b);
+        return NULL;
+    }
+
+    size_t needed = align_up(sizeof(block)) + align_up(new_size);
+    if (needed <= self->block_size) {
+        /* Too small to stay dedicated, let the caller move it */
+        return NULL;
+    }
+
+    needed = block_size_for(self, needed);
+
+    block* resized =
+        (block*) RESIZE_ARRAY(self->base, (void*) b, char, b->size, needed);
+    self->stats.bytes += needed - resized->size;
+    if (needed > self->stats.largest_block) {
+        self->stats.largest_block = needed;
+    }
+
+    resized->size = needed;
+    self->list->prev = resized;
+
+    return (void*) block_start(resized);
+}
+
 static void* arena_alloc(void* ctx, void* ptr, size_t old_size,
                          size_t new_size) {
-    void* ret = NULL;
     arena* self = (arena*) ctx;
 
-    if (new_size > self->free) {
-        ret = allocate_in_new_block(self, new_size);
-    } else {
-        /* cumulative free space available in current block we are seeing + all
-         * the blocks that come after. */
-        size_t cum_free = self->free;
-
-        for (allocation* curr = self->list;
-             /* Stop early if cumulative free space is less than `new_size` as
-              * no existing block can satisfy it. */
-             curr != NULL && cum_free >= new_size;
-             curr = curr->prev) {
-
-            size_t available = curr->size - curr->offset;
-
-            if (available >= new_size) {
-                /* Allocate_in_block may increate offset more than new_size to
-                 * account for alignment. We can't determine the actual value
-                 * without duplicating that logic here.
-                 *
-                 * Instead, we subtract all of that block's free size and
-                 * restore it again after allocate_in_block call. */
-                self->free -= curr->size - curr->offset;
-                ret = allocate_in_block(curr, new_size);
-                self->free += curr->size - curr->offset;
-                break;
-            }
+    size_t size = align_up(new_size);
+    void* ret;
+
+    if (ptr != NULL) {
+        uintptr_t start = (uintptr_t) ptr;
+
+        /* The most recent allocation in the current block can be grown,
+         * shrunk or freed by moving the bump pointer. */
+        if (start + align_up(old_size) == self->ptr &&
+            size <= self->end - start &&
+            (self->floor_block != self->list || start >= self->floor)) {
+            self->ptr = start + size;
+            return new_size == 0 ? NULL : ptr;
+        }
 
-            cum_free -= available;
+        block* dedicated = dedicated_block_of(self, ptr);
+        if (dedicated != NULL) {
+            ret = resize_dedicated(self, dedicated, new_size);
+            if (ret != NULL || new_size == 0) {
+                return ret;
+            }
         }
 
-        if (ret == NULL) {
-            ret = allocate_in_new_block(self, new_size);
+        /* Shrinking never needs to move */
+        if (new_size <= old_size) {
+            return new_size == 0 ? NULL : ptr;
         }
     }
 
+    /* Other frees are ignored, that memory is reclaimed all at once when
+     * the arena is destroyed. */
+    if (new_size == 0) {
+        return NULL;
+    }
+
+    /* Fast path: bump the pointer in the current block */
+    if (size <= self->end - self->ptr) {
+        ret = (void*) self->ptr;
+        self->ptr += size;
+    } else {
+        ret = allocate_slow(self, size);
+    }
+
     if (ptr != NULL) {
         memcpy(ret, ptr, old_size < new_size ? old_size : new_size);
     }
@@ -161,4 +483,3 @@ allocator_t arena_get_alloc(arena* self) {
         .alloc = arena_alloc,
     };
 }
-
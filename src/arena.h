@@ -1,14 +1,49 @@
 /**
  * Arena allocator
+ *
+ * Allocations are made by bumping a pointer in the current block. When a
+ * block runs out of space, its unused tail is kept on a size-class list and
+ * handed out to later allocations that do not fit the current block.
+ * Define ARENA_NO_TAIL_REUSE to disable tail reuse.
  */
 
 #ifndef ARENA_H
 #define ARENA_H
 
+#include <stdbool.h>
+
 #include "alloc.h"
 
 typedef struct _arena arena;
 
+typedef struct {
+    /* Size of the first block to allocate from the base allocator */
+    size_t block_size;
+
+    /* Every new block is twice the size of the previous one, up to this
+     * size. Set to `block_size` (or less) for fixed size blocks. */
+    size_t max_block_size;
+
+    /* Round blocks of at least MMIO_HUGE_PAGE_SIZE up to whole huge pages.
+     * mmio_alloc aligns such blocks and backs them with transparent huge
+     * pages. */
+    bool huge_pages;
+} arena_options;
+
+typedef struct {
+    /* Number of blocks currently allocated from the base allocator,
+     * including dedicated ones */
+    size_t blocks;
+
+    /* Blocks allocated for a single allocation larger than a block */
+    size_t dedicated_blocks;
+
+    /* Total size of all the blocks */
+    size_t bytes;
+
+    size_t largest_block;
+} arena_stats;
+
 /**
  * Initializes a new arena allocator.
  *
@@ -18,6 +53,34 @@ typedef struct _arena arena;
  */
 arena* arena_make(allocator_t* base, size_t block_size);
 
+/**
+ * Initializes a new arena allocator with the given growth policy.
+ *
+ * @param base The base allocator to get memory from
+ */
+arena* arena_make_with_options(allocator_t* base, const arena_options* options);
+
+/**
+ * A point in the arena's allocation history that it can be reset to.
+ */
+typedef struct {
+    void* block;
+    void* ptr;
+    size_t serial;
+} arena_checkpoint;
+
+/**
+ * Records the current state of the arena.
+ */
+arena_checkpoint arena_mark(arena* self);
+
+/**
+ * Frees all allocations made since `mark` was taken, in one go. Allocations
+ * made before it are left intact. Checkpoints taken after `mark` become
+ * invalid.
+ */
+void arena_reset(arena* self, arena_checkpoint mark);
+
 /**
  * Destroys the arena and frees all the allocations made.
  */
@@ -28,5 +91,10 @@ void arena_destroy(arena* self);
  */
 allocator_t arena_get_alloc(arena* self);
 
+/**
+ * Returns statistics about the blocks held by the arena.
+ */
+arena_stats arena_get_stats(arena* self);
+
 #endif  // ARENA_H
 
@@ -13,11 +13,11 @@ ast_typename* make_ast_typename(
 }
 
 ast_typename* make_ast_typename_unit(allocator_t* allocator) {
-    return make_ast_typename_tuple(allocator, (vec_typename)vec_make(allocator));
+    return make_ast_typename_tuple(allocator, (slice_typename)slice_empty());
 }
 
 ast_typename* make_ast_typename_tuple(
-    allocator_t* allocator, vec_typename items
+    allocator_t* allocator, slice_typename items
 ) {
     ast_typename* ret = make_ast_typename(allocator, TYPE_NAME_TUPLE);
     ret->as.tuple.items = items;
@@ -34,7 +34,7 @@ ast_typename* make_ast_typename_integer(
 }
 
 ast_typename* make_ast_typename_function(
-    allocator_t* allocator, vec_typename params, ast_typename* return_type
+    allocator_t* allocator, slice_typename params, ast_typename* return_type
 ) {
     ast_typename* ret = make_ast_typename(allocator, TYPE_NAME_FUNCTION);
     ret->as.function.params = params;
@@ -54,7 +54,7 @@ void free_ast_typename(allocator_t* allocator, ast_typename* node) {
             vec_foreach(&node->as.tuple.items, item) {
                 free_ast_typename(allocator, *item);
             }
-            vec_free(&node->as.tuple.items);
+            slice_free(allocator, &node->as.tuple.items);
         }; break;
 
         case TYPE_NAME_FUNCTION: {
@@ -62,7 +62,7 @@ void free_ast_typename(allocator_t* allocator, ast_typename* node) {
             vec_foreach(&node->as.function.params, param) {
                 free_ast_typename(allocator, *param);
             }
-            vec_free(&node->as.function.params);
+            slice_free(allocator, &node->as.function.params);
 
             free_ast_typename(allocator, node->as.function.return_type);
         }; break;
@@ -73,8 +73,14 @@ void free_ast_typename(allocator_t* allocator, ast_typename* node) {
 
 static void free_params(allocator_t* allocator, ast_param* params);
 
+ast_expr_node expr_node_defaults = {
+    .value_type = NULL,
+};
+
 ast_expr_node* make_ast_num(allocator_t* allocator, double long value) {
     ast_expr_node* node = ALLOC(allocator, ast_expr_node);
+    *node = expr_node_defaults;
+
     node->type = AST_NUM;
     node->num.value = value;
 
@@ -83,6 +89,8 @@ ast_expr_node* make_ast_num(allocator_t* allocator, double long value) {
 
 ast_expr_node* make_ast_bool(allocator_t* allocator, bool value) {
     ast_expr_node* node = ALLOC(allocator, ast_expr_node);
+    *node = expr_node_defaults;
+
     node->type = AST_BOOL;
     node->boolean.value = value;
 
@@ -93,6 +101,8 @@ ast_expr_node* make_ast_str(
     allocator_t* allocator, char* str, size_t len, size_t size
 ) {
     ast_expr_node* node = ALLOC(allocator, ast_expr_node);
+    *node = expr_node_defaults;
+
     node->type = AST_STR;
     node->str.str = str;
     node->str.len = len;
@@ -105,9 +115,14 @@ ast_expr_node* make_ast_identifier(
     allocator_t* allocator, char* start, size_t len
 ) {
     ast_expr_node* node = ALLOC(allocator, ast_expr_node);
+    *node = expr_node_defaults;
+
     node->type = AST_IDEN;
-    node->identifier.start = start;
-    node->identifier.len = len;
+    node->identifier = (ast_node_identifier){
+        .start = start,
+        .len = len,
+        .binding = {.kind = AST_BINDING_UNRESOLVED},
+    };
 
     return node;
 }
@@ -119,6 +134,8 @@ ast_expr_node* make_ast_binary(
     ast_expr_node* right
 ) {
     ast_expr_node* node = ALLOC(allocator, ast_expr_node);
+    *node = expr_node_defaults;
+
     node->type = AST_BINARY;
     node->binary.op = op;
     node->binary.left = left;
@@ -131,6 +148,8 @@ ast_expr_node* make_ast_unary(
     allocator_t* allocator, token_type op, ast_expr_node* expr
 ) {
     ast_expr_node* node = ALLOC(allocator, ast_expr_node);
+    *node = expr_node_defaults;
+
     node->type = AST_UNARY;
     node->unary.op = op;
     node->unary.expr = expr;
@@ -139,13 +158,17 @@ ast_expr_node* make_ast_unary(
 }
 
 ast_expr_node* make_ast_call(
-    allocator_t* allocator, ast_expr_node* function, vec_expr args
+    allocator_t* allocator, ast_expr_node* function, slice_expr args
 ) {
     ast_expr_node* node = ALLOC(allocator, ast_expr_node);
+    *node = expr_node_defaults;
+
     node->type = AST_CALL;
     node->call = (ast_node_call){
         .function = function,
         .args = args,
+        .lambda = NULL,
+        .tail = false,
     };
 
     return node;
@@ -158,11 +181,17 @@ ast_expr_node* make_ast_lambda(
     ast_typename* return_type
 ) {
     ast_expr_node* node = ALLOC(allocator, ast_expr_node);
+    *node = expr_node_defaults;
+
     node->type = AST_LAMBDA;
     node->lambda = (ast_node_lambda){
         .body = body,
         .params = params,
         .return_type = return_type,
+        .index = 0,
+        .captures = slice_empty(),
+        .closure = AST_CLOSURE_NONE,
+        .env_slot = 0,
     };
 
     return node;
@@ -186,7 +215,7 @@ void free_ast_expr(allocator_t* allocator, ast_expr_node* node) {
         }
 
         case AST_CALL: {
-            vec_free(&node->call.args);
+            slice_free(allocator, &node->call.args);
             free_ast_expr(allocator, node->call.function);
             break;
         }
@@ -233,6 +262,7 @@ ast_stmt_node* make_ast_var_decl(
     node->var_decl.typename = typename;
     node->var_decl.value = value;
     node->var_decl.mut = mut;
+    node->var_decl.slot = 0;
 
     return node;
 }
@@ -21,7 +21,7 @@ typedef enum {
 
 struct _ast_typename;
 
-typedef VEC(struct _ast_typename*) vec_typename;
+typedef SLICE(struct _ast_typename*) slice_typename;
 
 typedef struct {
 } ast_typename_string, ast_typename_boolean;
@@ -32,11 +32,11 @@ typedef struct {
 } ast_typename_integer;
 
 typedef struct {
-    vec_typename items;
+    slice_typename items;
 } ast_typename_tuple;
 
 typedef struct {
-    vec_typename params;
+    slice_typename params;
     struct _ast_typename* return_type;
 } ast_typename_function;
 
@@ -57,7 +57,7 @@ ast_typename* make_ast_typename(allocator_t* allocator, ast_typename_type type);
 ast_typename* make_ast_typename_unit(allocator_t* allocator);
 
 ast_typename* make_ast_typename_tuple(
-    allocator_t* allocator, vec_typename items
+    allocator_t* allocator, slice_typename items
 );
 
 ast_typename* make_ast_typename_integer(
@@ -65,7 +65,7 @@ ast_typename* make_ast_typename_integer(
 );
 
 ast_typename* make_ast_typename_function(
-    allocator_t* allocator, vec_typename params, ast_typename* return_type
+    allocator_t* allocator, slice_typename params, ast_typename* return_type
 );
 
 void free_ast_typename(allocator_t* allocator, ast_typename* node);
@@ -123,7 +123,7 @@ typedef enum {
 
 struct _ast_expr_node;
 
-typedef VEC(struct _ast_expr_node*) vec_expr;
+typedef SLICE(struct _ast_expr_node*) slice_expr;
 
 typedef struct {
     long double value;
@@ -143,9 +143,31 @@ typedef struct {
     bool value;
 } ast_node_bool;
 
+typedef enum {
+    /* Not resolved yet, see resolve.h */
+    AST_BINDING_UNRESOLVED,
+
+    /* A parameter or variable of the function it is used in, or a variable
+     * of an enclosing function that a lambda captures (see closure.h) */
+    AST_BINDING_LOCAL,
+
+    /* A named function */
+    AST_BINDING_FUNCTION,
+} ast_binding_kind;
+
+typedef struct {
+    ast_binding_kind kind;
+
+    /* The variable's slot in its function's frame, or the index of the
+     * function */
+    size_t index;
+} ast_binding;
+
 typedef struct {
     char* start;
     size_t len;
+
+    ast_binding binding;
 } ast_node_identifier;
 
 typedef struct {
@@ -159,15 +181,60 @@ typedef struct {
     struct _ast_expr_node* expr;
 } ast_node_unary;
 
+struct _ast_node_lambda;
+
 typedef struct {
     struct _ast_expr_node* function;
-    vec_expr args;  //  vec of struct _ast_expr_node*
+    slice_expr args;
+
+    /* The lifted lambda it calls, NULL if none. Set by closure_convert(). */
+    struct _ast_node_lambda* lambda;
+
+    /* Whether the call replaces the one it is made in, see tailcall.h. Set
+     * by tailcall_mark(). */
+    bool tail;
 } ast_node_call;
 
+typedef enum {
+    /* Captures nothing, its value is the function itself */
+    AST_CLOSURE_NONE,
+
+    /* Only ever called where it is declared, the captured values are
+     * passed after the arguments and no closure is made */
+    AST_CLOSURE_LIFTED,
+
+    /* Does not outlive the call that makes it, its environment is in the
+     * frame of that call */
+    AST_CLOSURE_STACK,
+
+    /* May outlive the call that makes it, its environment is on the heap */
+    AST_CLOSURE_HEAP,
+} ast_closure_kind;
+
+/* A variable of an enclosing function that a lambda uses */
 typedef struct {
+    const char* name;
+    size_t len;
+} ast_capture;
+
+typedef SLICE(ast_capture) slice_capture;
+
+typedef struct _ast_node_lambda {
     struct _ast_stmt_node* body;
     ast_param* params;
     ast_typename* return_type;
+
+    /* Index among all the functions of the program, set by resolve() */
+    size_t index;
+
+    /* Variables of enclosing functions it uses, in the order they are
+     * first used, and how it gets them. Set by closure_convert(). */
+    slice_capture captures;
+    ast_closure_kind closure;
+
+    /* AST_CLOSURE_STACK: first of the slots its environment takes in the
+     * frame of the function that makes it, set by resolve() */
+    size_t env_slot;
 } ast_node_lambda;
 
 typedef struct _ast_expr_node {
@@ -183,6 +250,10 @@ typedef struct _ast_expr_node {
     };
 
     ast_expr_node_type type;
+
+    /* Type of the value, set by resolve(). Points to type names owned by
+     * the declarations or by the resolver. */
+    ast_typename* value_type;
 } ast_expr_node;
 
 ast_expr_node* make_ast_num(allocator_t* allocator, double long value);
@@ -203,7 +274,7 @@ ast_expr_node* make_ast_unary(
     allocator_t* allocator, token_type op, ast_expr_node* expr
 );
 ast_expr_node* make_ast_call(
-    allocator_t* allocator, ast_expr_node* function, vec_expr args
+    allocator_t* allocator, ast_expr_node* function, slice_expr args
 );
 ast_expr_node* make_ast_lambda(
     allocator_t* allocator,
@@ -274,6 +345,9 @@ typedef struct {
     ast_typename* typename;
     ast_expr_node* value;
     bool mut;
+
+    /* Slot in the frame of the function, set by resolve() */
+    size_t slot;
 } ast_node_var_decl;
 
 typedef struct {
@@ -5,92 +5,94 @@
 #include "ast.h"
 
 typedef struct {
-} empty_ctx;
+    FILE* out;
+} printer_ctx;
 
-AST_TYPENAME_WALKER(ast_typename_printer_t, void, empty_ctx)
+AST_TYPENAME_WALKER(ast_typename_printer_t, void, printer_ctx)
 
-AST_EXPR_WALKER(ast_expr_printer_t, void, empty_ctx)
+AST_EXPR_WALKER(ast_expr_printer_t, void, printer_ctx)
 
-AST_STMT_WALKER(ast_stmt_printer_t, void, empty_ctx)
+AST_STMT_WALKER(ast_stmt_printer_t, void, printer_ctx)
 
-AST_ITEM_WALKER(ast_item_printer_t, void, empty_ctx)
+AST_ITEM_WALKER(ast_item_printer_t, void, printer_ctx)
 
 static void walk_boolean_type(
-    ast_typename_printer_t* _self, ast_typename_boolean* _node
+    ast_typename_printer_t* self, ast_typename_boolean* _node
 ) {
-    printf("boolean");
+    fprintf(self->ctx.out, "boolean");
 }
 
 static void walk_integer_type(
-    ast_typename_printer_t* _self, ast_typename_integer* node
+    ast_typename_printer_t* self, ast_typename_integer* node
 ) {
-    putchar(node->is_signed ? 'i' : 'u');
-    printf("%d", node->size * 8);
+    fputc(node->is_signed ? 'i' : 'u', self->ctx.out);
+    fprintf(self->ctx.out, "%d", node->size * 8);
 };
 
 static void walk_string_type(
-    ast_typename_printer_t* _self, ast_typename_string* _node
+    ast_typename_printer_t* self, ast_typename_string* _node
 ) {
-    printf("string");
+    fprintf(self->ctx.out, "string");
 };
 
 static void walk_tuple_type(
     ast_typename_printer_t* self, ast_typename_tuple* node
 ) {
-    putchar('(');
+    fputc('(', self->ctx.out);
 
     ast_typename** item;
     vec_foreach(&node->items, item) {
         ast_typename_printer_t_walk(self, *item);
 
         if (i != node->items.len - 1) {
-            printf(", ");
+            fprintf(self->ctx.out, ", ");
         }
     }
 
-    putchar(')');
+    fputc(')', self->ctx.out);
 }
 
 static void walk_function_type(
     ast_typename_printer_t* self, ast_typename_function* node
 ) {
-    printf("(fn(");
+    fprintf(self->ctx.out, "(fn(");
 
     ast_typename** param;
     vec_foreach(&node->params, param) {
         ast_typename_printer_t_walk(self, *param);
 
         if (i < node->params.len - 1) {
-            putchar(' ');
+            fputc(' ', self->ctx.out);
         }
     }
 
-    printf(") ");
+    fprintf(self->ctx.out, ") ");
 
     ast_typename_printer_t_walk(self, node->return_type);
 
-    putchar(')');
+    fputc(')', self->ctx.out);
 }
 
-static void print_typename(ast_typename* node) {
+static void print_typename(FILE* out, ast_typename* node) {
     ast_typename_printer_t printer = (ast_typename_printer_t){
         .walk_boolean_type = walk_boolean_type,
         .walk_integer_type = walk_integer_type,
         .walk_string_type = walk_string_type,
         .walk_tuple_type = walk_tuple_type,
         .walk_function_type = walk_function_type,
+        .ctx = {.out = out},
     };
     ast_typename_printer_t_walk(&printer, node);
 }
 
-static void print_stmt(ast_stmt_node* node);
+static void print_stmt(FILE* out, ast_stmt_node* node);
 
-static void walk_num(ast_expr_printer_t* _, ast_node_num* node) {
-    printf("%Le", node->value);
+static void walk_num(ast_expr_printer_t* self, ast_node_num* node) {
+    fprintf(self->ctx.out, "%Le", node->value);
 }
 
-static void walk_iden(ast_expr_printer_t* _, ast_node_identifier* node) {
-    printf("%.*s", (int)node->len, node->start);
+static void walk_iden(ast_expr_printer_t* self, ast_node_identifier* node) {
+    fprintf(self->ctx.out, "%.*s", (int)node->len, node->start);
 }
 
 static char* op2str(token_type tt) {
@@ -176,72 +178,77 @@ static char* op2str(token_type tt) {
 static void walk_binary(ast_expr_printer_t* self, ast_node_binary* node) {
     char* op = op2str(node->op);
 
-    printf("(%s ", op);
+    fprintf(self->ctx.out, "(%s ", op);
     ast_expr_printer_t_walk(self, node->left);
-    printf(" ");
+    fprintf(self->ctx.out, " ");
     ast_expr_printer_t_walk(self, node->right);
-    printf(")");
+    fprintf(self->ctx.out, ")");
 }
 
 static void walk_unary(ast_expr_printer_t* self, ast_node_unary* node) {
     char* op = op2str(node->op);
-    printf("(%s ", op);
+    fprintf(self->ctx.out, "(%s ", op);
     ast_expr_printer_t_walk(self, node->expr);
-    putchar(')');
+    fputc(')', self->ctx.out);
 }
 
 static void walk_call(ast_expr_printer_t* self, ast_node_call* node) {
-    printf("(call ");
+    fprintf(self->ctx.out, "(call ");
     ast_expr_printer_t_walk(self, node->function);
 
     ast_expr_node** arg;
     vec_foreach(&node->args, arg) {
-        putchar(' ');
+        fputc(' ', self->ctx.out);
         ast_expr_printer_t_walk(self, *arg);
     }
 
-    putchar(')');
+    fputc(')', self->ctx.out);
 }
 
-static void walk_str(ast_expr_printer_t* _, ast_node_str* node) {
-    printf("(str '%s')", node->str);
+static void walk_str(ast_expr_printer_t* self, ast_node_str* node) {
+    fprintf(self->ctx.out, "(str '%s')", node->str);
 }
 
-static void walk_bool(ast_expr_printer_t* _, ast_node_bool* node) {
-    printf("%s", node->value ? "true" : "false");
+static void walk_bool(ast_expr_printer_t* self, ast_node_bool* node) {
+    fprintf(self->ctx.out, "%s", node->value ? "true" : "false");
 }
 
-static void walk_lambda(ast_expr_printer_t* _, ast_node_lambda* fn) {
-    printf("(fn ");
+static void walk_lambda(ast_expr_printer_t* self, ast_node_lambda* fn) {
+    fprintf(self->ctx.out, "(fn ");
 
     ast_param* curr = fn->params;
-    putchar('(');
+    fputc('(', self->ctx.out);
     while (curr != NULL) {
-        printf("%.*s ", (int)curr->name.span_size, curr->name.span);
+        fprintf(
+            self->ctx.out,
+            "%.*s ",
+            (int)curr->name.span_size,
+            curr->name.span
+        );
 
-        putchar(':');
-        print_typename(curr->type);
+        fputc(':', self->ctx.out);
+        print_typename(self->ctx.out, curr->type);
 
         curr = curr->next;
 
         if (curr != NULL) {
-            putchar(' ');
+            fputc(' ', self->ctx.out);
         }
     }
-    putchar(')');
+    fputc(')', self->ctx.out);
 
     if (fn->return_type != NULL) {
-        printf(" :");
-        print_typename(fn->return_type);
+        fprintf(self->ctx.out, " :");
+        print_typename(self->ctx.out, fn->return_type);
     }
 
-    if (fn->body != NULL) putchar(' ');
-    print_stmt(fn->body);
+    if (fn->body != NULL) fputc(' ', self->ctx.out);
+    print_stmt(self->ctx.out, fn->body);
 
-    printf(")");
+    fprintf(self->ctx.out, ")");
 }
 
-ast_expr_printer_t expr_printer = (ast_expr_printer_t){
+static const ast_expr_printer_t expr_printer = (ast_expr_printer_t){
     .walk_binary = walk_binary,
     .walk_unary = walk_unary,
     .walk_call = walk_call,
@@ -252,72 +259,81 @@ ast_expr_printer_t expr_printer = (ast_expr_printer_t){
     .walk_lambda = walk_lambda,
 };
 
-static void print_expr(ast_expr_node* node) {
-    ast_expr_printer_t_walk(&expr_printer, node);
+static void print_expr(FILE* out, ast_expr_node* node) {
+    ast_expr_printer_t printer = expr_printer;
+    printer.ctx.out = out;
+
+    ast_expr_printer_t_walk(&printer, node);
 }
 
 static void walk_expr_stmt(ast_stmt_printer_t* self, ast_node_expr_stmt* node) {
-    print_expr(node->expr);
+    print_expr(self->ctx.out, node->expr);
 }
 
 static void walk_var_decl(ast_stmt_printer_t* self, ast_node_var_decl* node) {
     char* op = node->mut ? "let-mut" : "let";
 
-    printf("(%s %.*s ", op, (int)node->name.span_size, node->name.span);
+    fprintf(
+        self->ctx.out,
+        "(%s %.*s ",
+        op,
+        (int)node->name.span_size,
+        node->name.span
+    );
 
     if (node->typename != NULL) {
-        putchar(':');
-        print_typename(node->typename);
-        putchar(' ');
+        fputc(':', self->ctx.out);
+        print_typename(self->ctx.out, node->typename);
+        fputc(' ', self->ctx.out);
     }
 
     if (node->value == NULL) {
-        printf("NULL");
+        fprintf(self->ctx.out, "NULL");
     } else {
-        print_expr(node->value);
+        print_expr(self->ctx.out, node->value);
     }
-    printf(")");
+    fprintf(self->ctx.out, ")");
 }
 
 static void walk_block(ast_stmt_printer_t* self, ast_node_block* node) {
-    printf("(block");
+    fprintf(self->ctx.out, "(block");
 
     ast_stmt_node* curr = node->body;
     while (curr != NULL) {
-        putchar(' ');
+        fputc(' ', self->ctx.out);
         ast_stmt_printer_t_walk(self, curr);
         curr = curr->next;
     }
 
-    printf(")");
+    fprintf(self->ctx.out, ")");
 }
 
 static void walk_if_else(ast_stmt_printer_t* self, ast_node_if_else* node) {
-    printf("(if ");
-    print_expr(node->condition);
+    fprintf(self->ctx.out, "(if ");
+    print_expr(self->ctx.out, node->condition);
 
-    putchar(' ');
+    fputc(' ', self->ctx.out);
     ast_stmt_printer_t_walk(self, node->body);
 
     if (node->else_body != NULL) {
-        putchar(' ');
+        fputc(' ', self->ctx.out);
         ast_stmt_printer_t_walk(self, node->else_body);
     }
 
-    printf(")");
+    fprintf(self->ctx.out, ")");
 }
 
 static void walk_while(ast_stmt_printer_t* self, ast_node_while* node) {
-    printf("(while ");
-    print_expr(node->condition);
+    fprintf(self->ctx.out, "(while ");
+    print_expr(self->ctx.out, node->condition);
 
-    putchar(' ');
+    fputc(' ', self->ctx.out);
     ast_stmt_printer_t_walk(self, node->body);
 
-    putchar(')');
+    fputc(')', self->ctx.out);
 }
 
-ast_stmt_printer_t stmt_printer = (ast_stmt_printer_t){
+static const ast_stmt_printer_t stmt_printer = (ast_stmt_printer_t){
     .walk_expr_stmt = walk_expr_stmt,
     .walk_var_decl = walk_var_decl,
     .walk_block = walk_block,
@@ -325,60 +341,74 @@ ast_stmt_printer_t stmt_printer = (ast_stmt_printer_t){
     .walk_while = walk_while,
 };
 
-static void print_stmt(ast_stmt_node* node) {
+static void print_stmt(FILE* out, ast_stmt_node* node) {
+    ast_stmt_printer_t printer = stmt_printer;
+    printer.ctx.out = out;
+
     ast_stmt_node* curr = node;
 
     while (curr != NULL) {
-        ast_stmt_printer_t_walk(&stmt_printer, curr);
+        ast_stmt_printer_t_walk(&printer, curr);
         curr = curr->next;
 
         // If there is another statement on the list, we want a separator
         // between that and the current one.
         if (curr != NULL) {
-            putchar(' ');
+            fputc(' ', out);
         }
     }
 }
 
 static void walk_function(ast_item_printer_t* self, ast_node_function* fn) {
-    printf("(fn ");
+    fprintf(self->ctx.out, "(fn ");
 
-    printf("%.*s ", (int)fn->name.span_size, fn->name.span);
+    fprintf(self->ctx.out, "%.*s ", (int)fn->name.span_size, fn->name.span);
 
-    putchar('(');
+    fputc('(', self->ctx.out);
     ast_param* curr = fn->params;
     while (curr != NULL) {
-        printf("%.*s ", (int)curr->name.span_size, curr->name.span);
+        fprintf(
+            self->ctx.out,
+            "%.*s ",
+            (int)curr->name.span_size,
+            curr->name.span
+        );
 
-        putchar(':');
-        print_typename(curr->type);
+        fputc(':', self->ctx.out);
+        print_typename(self->ctx.out, curr->type);
 
         curr = curr->next;
         if (curr != NULL) {
-            putchar(' ');
+            fputc(' ', self->ctx.out);
         }
     }
-    putchar(')');
+    fputc(')', self->ctx.out);
 
     if (fn->return_type != NULL) {
-        printf(" :");
-        print_typename(fn->return_type);
+        fprintf(self->ctx.out, " :");
+        print_typename(self->ctx.out, fn->return_type);
     }
 
-    if (fn->body != NULL) putchar(' ');
-    print_stmt(fn->body);
+    if (fn->body != NULL) fputc(' ', self->ctx.out);
+    print_stmt(self->ctx.out, fn->body);
 
-    printf(")\n");
+    fprintf(self->ctx.out, ")\n");
 }
 
-ast_item_printer_t item_printer =
-    (ast_item_printer_t){.walk_function = walk_function};
+void fprint_ast(FILE* out, ast_item_node* node) {
+    ast_item_printer_t printer = (ast_item_printer_t){
+        .walk_function = walk_function,
+        .ctx = {.out = out},
+    };
 
-void print_ast(ast_item_node* node) {
     ast_item_node* curr = node;
 
     while (curr != NULL) {
-        ast_item_printer_t_walk(&item_printer, curr);
+        ast_item_printer_t_walk(&printer, curr);
         curr = curr->next;
     }
 }
+
+void print_ast(ast_item_node* node) {
+    fprint_ast(stdout, node);
+}
@@ -1,8 +1,15 @@
 #ifndef ast_printer
 #define ast_printer
 
+#include <stdio.h>
+
 #include "ast.h"
 
+/**
+ * Prints the AST as S-expressions, one item per line.
+ */
+void fprint_ast(FILE* out, ast_item_node* node);
+
 void print_ast(ast_item_node* node);
 
 #endif  // ast_printer
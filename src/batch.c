@@ -0,0 +1,248 @@
+#include "batch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "ast_printer.h"
+#include "diag.h"
+#include "lex.h"
+#include "mmio_alloc.h"
+#include "parser.h"
+#include "typecheck.h"
+
+/* Programs are expected to be small, most fit in the first block */
+#define BATCH_ARENA_BLOCK_SIZE ((size_t) 256 * 1024)
+
+static const struct {
+    const char* name;
+    batch_stage stage;
+} STAGES[] = {
+    {"tokens", BATCH_TOKENS},
+    {"sexpr", BATCH_SEXPR},
+    {"typecheck", BATCH_TYPECHECK},
+    {"compile", BATCH_COMPILE},
+};
+
+bool batch_stage_from_name(const char* name, batch_stage* out) {
+    for (size_t i = 0; i < sizeof(STAGES) / sizeof(STAGES[0]); i++) {
+        if (strcmp(name, STAGES[i].name) == 0) {
+            *out = STAGES[i].stage;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#ifdef _WIN32
+
+int batch_run(const batch_options* options, FILE* in, FILE* out) {
+    (void) options;
+    (void) in;
+    (void) out;
+
+    /* Needs open_memstream */
+    fprintf(stderr, "Batch mode is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+typedef enum {
+    READ_OK,
+    READ_END,
+    READ_ERROR,
+} read_result;
+
+/* Reads the next program into `buffer`, which is grown with realloc as
+ * needed, and terminates it with a zero byte */
+static read_result read_program(
+    batch_input_format format,
+    FILE* in,
+    char** buffer,
+    size_t* capacity,
+    size_t* length
+) {
+    if (format == BATCH_INPUT_NUL) {
+        ssize_t n = getdelim(buffer, capacity, '\0', in);
+
+        if (n < 0) {
+            return feof(in) ? READ_END : READ_ERROR;
+        }
+
+        /* The last program need not be terminated */
+        *length = (size_t) n;
+        if ((*buffer)[n - 1] == '\0') {
+            (*length)--;
+        }
+
+        return READ_OK;
+    }
+
+    size_t n;
+    int matched = fscanf(in, "%zu", &n);
+
+    if (matched == EOF) {
+        return feof(in) ? READ_END : READ_ERROR;
+    }
+
+    if (matched != 1 || fgetc(in) != '\n') {
+        return READ_ERROR;
+    }
+
+    if (n + 1 > *capacity) {
+        char* grown = realloc(*buffer, n + 1);
+        if (grown == NULL) {
+            return READ_ERROR;
+        }
+
+        *buffer = grown;
+        *capacity = n + 1;
+    }
+
+    if (fread(*buffer, 1, n, in) != n) {
+        return READ_ERROR;
+    }
+
+    (*buffer)[n] = '\0';
+    *length = n;
+
+    return READ_OK;
+}
+
+static int print_tokens(char* src, size_t len, FILE* out) {
+    lexer_t lex = make_lexer(src, len);
+
+    token_result tok;
+    while ((tok = lex_advance(&lex)).ok && tok.t.type != TOK_EOF) {
+        fprintf(
+            out,
+            "%zu:%zu %.*s\n",
+            tok.t.line,
+            tok.t.col,
+            (int)tok.t.span_size,
+            tok.t.span
+        );
+    }
+
+    if (!tok.ok) {
+        lex_error_print(diag_stream(), tok.e);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int run_stage(
+    const batch_options* options,
+    char* src,
+    size_t len,
+    allocator_t* allocator,
+    FILE* out
+) {
+    ast_item_node* ast;
+
+    switch (options->stage) {
+        case BATCH_TOKENS:
+            return print_tokens(src, len, out);
+
+        case BATCH_SEXPR:
+            if (!parse(allocator, src, len, &ast)) {
+                return 1;
+            }
+
+            fprint_ast(out, ast);
+            return 0;
+
+        case BATCH_TYPECHECK:
+            if (!parse(allocator, src, len, &ast)) {
+                return 1;
+            }
+
+            return typecheck(allocator, ast) ? 0 : 1;
+
+        case BATCH_COMPILE:
+            return options->compile(src, len, allocator);
+    }
+
+    return 1;
+}
+
+int batch_run(const batch_options* options, FILE* in, FILE* out) {
+    int ret = 0;
+
+    arena* arena = arena_make(&mmio_alloc, BATCH_ARENA_BLOCK_SIZE);
+    allocator_t allocator = arena_get_alloc(arena);
+
+    /* Both streams are rewound for every program, their buffers only grow
+     * to fit the largest one */
+    char* output = NULL;
+    size_t output_size = 0;
+    FILE* output_stream = open_memstream(&output, &output_size);
+
+    char* diagnostics = NULL;
+    size_t diagnostics_size = 0;
+    FILE* diagnostics_stream = open_memstream(&diagnostics, &diagnostics_size);
+
+    if (output_stream == NULL || diagnostics_stream == NULL) {
+        perror("open_memstream");
+        return 1;
+    }
+
+    diag_redirect(diagnostics_stream);
+
+    char* program = NULL;
+    size_t capacity = 0;
+    size_t length;
+
+    for (;;) {
+        read_result result = read_program(
+            options->input_format, in, &program, &capacity, &length
+        );
+
+        if (result == READ_END) {
+            break;
+        }
+
+        if (result == READ_ERROR) {
+            fprintf(stderr, "Malformed batch input\n");
+            ret = 1;
+            break;
+        }
+
+        rewind(output_stream);
+        rewind(diagnostics_stream);
+
+        arena_checkpoint mark = arena_mark(arena);
+        int status = run_stage(options, program, length, &allocator, output_stream);
+        arena_reset(arena, mark);
+
+        fflush(output_stream);
+        fflush(diagnostics_stream);
+
+        long output_length = ftell(output_stream);
+        long diagnostics_length = ftell(diagnostics_stream);
+
+        fprintf(out, "%d %ld %ld\n", status, output_length, diagnostics_length);
+        fwrite(output, 1, output_length, out);
+        fwrite(diagnostics, 1, diagnostics_length, out);
+
+        /* Whoever feeds us may wait for this answer before sending more */
+        fflush(out);
+    }
+
+    diag_redirect(NULL);
+
+    fclose(output_stream);
+    fclose(diagnostics_stream);
+    free(output);
+    free(diagnostics);
+    free(program);
+
+    arena_destroy(arena);
+
+    return ret;
+}
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * Batch mode
+ *
+ * `onec --batch=<stage>` runs many small programs through one stage of the
+ * compiler in a single process. Programs are read from stdin, either
+ * separated by zero bytes or each preceded by a line with its length in
+ * decimal. Every program is answered on stdout with a frame:
+ *
+ *     <status> <output length> <diagnostics length>\n
+ *     <output><diagnostics>
+ *
+ * where the output is what the stage produces (tokens, S-expressions) and
+ * the diagnostics are the errors that would have gone to stderr. All the
+ * memory a program needs is released in one go before the next one.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "alloc.h"
+
+typedef enum {
+    /* One token per line, as `line:col text` */
+    BATCH_TOKENS,
+
+    /* The AST as S-expressions, one item per line */
+    BATCH_SEXPR,
+
+    BATCH_TYPECHECK,
+    BATCH_COMPILE,
+} batch_stage;
+
+typedef enum {
+    /* Programs are separated by zero bytes */
+    BATCH_INPUT_NUL,
+
+    /* Each program is preceded by `<length>\n` */
+    BATCH_INPUT_LENGTH,
+} batch_input_format;
+
+typedef struct {
+    batch_stage stage;
+    batch_input_format input_format;
+
+    /* Runs BATCH_COMPILE, see server_compile_fn */
+    int (*compile)(char* src, size_t len, allocator_t* allocator);
+} batch_options;
+
+/**
+ * Parses the name of a stage as given on the command line.
+ */
+bool batch_stage_from_name(const char* name, batch_stage* out);
+
+/**
+ * Answers every program in `in` with a frame on `out`, flushed as soon as
+ * it is complete. Returns the exit status: 1 if the input is malformed or
+ * cannot be read, 0 otherwise, whatever the programs' own statuses.
+ */
+int batch_run(const batch_options* options, FILE* in, FILE* out);
+
+#endif  // BATCH_H
@@ -0,0 +1,64 @@
+/**
+ * Arena allocation microbenchmark.
+ *
+ * Makes millions of small (16-64 byte) allocations and reports the average
+ * cost of an allocation as the arena grows. The cost per allocation should
+ * stay flat no matter how many blocks the arena has accumulated.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "arena.h"
+#include "mmio.h"
+#include "mmio_alloc.h"
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main() {
+    /* Number of allocations made in each round, the arena is kept alive
+     * across rounds so that later rounds run on a larger arena. */
+    const size_t round_size = 1000000;
+    const size_t rounds = 8;
+
+    arena* ar = arena_make(&mmio_alloc, mmio_get_page_size());
+    allocator_t alloc = arena_get_alloc(ar);
+
+    /* xorshift, we only need something cheap and deterministic */
+    unsigned int seed = 2463534242;
+    volatile char sink = 0;
+
+    printf("%10s %12s %14s\n", "round", "allocations", "ns/allocation");
+
+    for (size_t round = 0; round < rounds; round++) {
+        double start = now();
+
+        for (size_t i = 0; i < round_size; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+
+            size_t size = 16 + seed % 49;
+            char* ptr = ALLOC_ARRAY(&alloc, char, size);
+            ptr[0] = (char) i;
+            sink += ptr[0];
+        }
+
+        double elapsed = now() - start;
+
+        printf(
+            "%10zu %12zu %14.2f\n",
+            round,
+            (round + 1) * round_size,
+            elapsed * 1e9 / round_size
+        );
+    }
+
+    arena_destroy(ar);
+
+    return 0;
+}
@@ -0,0 +1,228 @@
+/**
+ * Cross-backend benchmark.
+ *
+ * Runs the programs of bench_programs.h on every execution backend and
+ * reports the time each one takes, and its speedup over the tree-walking
+ * interpreter, the baseline. The backends must agree on what main returns.
+ *
+ * A new backend is measured by adding it to the table below.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "bench_programs.h"
+#include "bytecode.h"
+#include "codegen.h"
+#include "interp.h"
+#include "ir.h"
+#include "jit.h"
+#include "mmio.h"
+#include "mmio_alloc.h"
+#include "parser.h"
+#include "resolve.h"
+#include "typecheck.h"
+#include "vm.h"
+#include "x86.h"
+
+#define ROUNDS 3
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    const char* name;
+
+    /* Gets the program ready to run, not timed. Returns NULL on failure. */
+    void* (*prepare)(allocator_t* allocator, ast_item_node* ast);
+
+    /* Runs main, timed */
+    bool (*run)(void* prepared, int64_t* result);
+} backend;
+
+typedef struct {
+    resolved_program program;
+    interp* interp;
+} interp_backend;
+
+static void* interp_prepare(allocator_t* allocator, ast_item_node* ast) {
+    interp_backend* self = ALLOC(allocator, interp_backend);
+
+    if (!resolve(allocator, ast, NULL, &self->program)) {
+        return NULL;
+    }
+
+    self->interp = interp_make(allocator, &self->program);
+    return self;
+}
+
+static bool interp_run(void* prepared, int64_t* result) {
+    interp_backend* self = prepared;
+    return interp_call(self->interp, self->program.main, NULL, 0, result);
+}
+
+typedef struct {
+    bc_module module;
+    vm* vm;
+} vm_backend;
+
+static void* vm_prepare(allocator_t* allocator, ast_item_node* ast) {
+    vm_backend* self = ALLOC(allocator, vm_backend);
+
+    if (!bc_compile(allocator, ast, NULL, &self->module)) {
+        return NULL;
+    }
+
+    self->vm = vm_make(allocator, &self->module);
+    return self;
+}
+
+static bool vm_run(void* prepared, int64_t* result) {
+    vm_backend* self = prepared;
+    return vm_call(self->vm, self->module.main, NULL, 0, result);
+}
+
+typedef struct {
+    jit* jit;
+    int64_t (*main)(void);
+} jit_backend;
+
+static void* jit_prepare(allocator_t* allocator, ast_item_node* ast) {
+    resolved_program resolved;
+    ir_program program;
+
+    if (!resolve(allocator, ast, NULL, &resolved) ||
+        !ir_build(allocator, &resolved, &program)) {
+        return NULL;
+    }
+
+    ir_optimize(allocator, &program);
+    ir_inline(allocator, &program, NULL);
+
+    codegen_options options = {.allocate_registers = true};
+    x86_asm* as = x86_asm_make_binary(allocator);
+    jit* jit = NULL;
+
+    if (codegen(allocator, &program, &options, as)) {
+        x86_object object = x86_asm_object(as);
+        jit = jit_load(allocator, &object);
+    }
+
+    x86_asm_destroy(as);
+
+    if (jit == NULL) {
+        return NULL;
+    }
+
+    jit_backend* self = ALLOC(allocator, jit_backend);
+    self->jit = jit;
+
+    /* The program's main rather than the C entry point, whose result is
+     * truncated to an int */
+    self->main = (int64_t (*)(void))jit_function(jit, "one.main");
+
+    return self;
+}
+
+static bool jit_run(void* prepared, int64_t* result) {
+    jit_backend* self = prepared;
+    *result = self->main();
+    return true;
+}
+
+/* The first one is the baseline */
+static const backend backends[] = {
+    {"interp", interp_prepare, interp_run},
+    {"vm", vm_prepare, vm_run},
+    {"jit", jit_prepare, jit_run},
+};
+
+#define BACKEND_COUNT (sizeof(backends) / sizeof(backends[0]))
+
+int main() {
+    printf("%-16s", "program");
+    for (size_t b = 0; b < BACKEND_COUNT; b++) {
+        printf(" %10s ms", backends[b].name);
+
+        if (b != 0) {
+            printf(" %8s", "speedup");
+        }
+    }
+    printf("\n");
+
+    for (size_t p = 0; p < BENCH_PROGRAM_COUNT; p++) {
+        arena* ar = arena_make(&mmio_alloc, mmio_get_page_size());
+        allocator_t alloc = arena_get_alloc(ar);
+
+        size_t len = strlen(bench_programs[p].code);
+        char* code = ALLOC_ARRAY(&alloc, char, len + 1);
+        memcpy(code, bench_programs[p].code, len + 1);
+
+        ast_item_node* ast;
+        if (!parse(&alloc, code, len, &ast) || !typecheck(&alloc, ast)) {
+            return 1;
+        }
+
+        printf("%-16s", bench_programs[p].name);
+        fflush(stdout);
+
+        double baseline = 0;
+        int64_t expected = 0;
+
+        for (size_t b = 0; b < BACKEND_COUNT; b++) {
+            void* prepared = backends[b].prepare(&alloc, ast);
+            if (prepared == NULL) {
+                return 1;
+            }
+
+            /* Best of a few rounds */
+            double best = 0;
+            int64_t result;
+
+            for (size_t round = 0; round < ROUNDS; round++) {
+                double start = now();
+                if (!backends[b].run(prepared, &result)) {
+                    return 1;
+                }
+                double elapsed = now() - start;
+
+                if (round == 0 || elapsed < best) {
+                    best = elapsed;
+                }
+            }
+
+            if (b == 0) {
+                baseline = best;
+                expected = result;
+            } else if (result != expected) {
+                fprintf(
+                    stderr,
+                    "\n%s returned %lld, %s returned %lld\n",
+                    backends[b].name,
+                    (long long)result,
+                    backends[0].name,
+                    (long long)expected
+                );
+                return 1;
+            }
+
+            printf(" %13.2f", best * 1e3);
+
+            if (b != 0) {
+                printf(" %7.1fx", baseline / best);
+            }
+
+            fflush(stdout);
+        }
+
+        printf("\n");
+        arena_destroy(ar);
+    }
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+/**
+ * Inliner benchmark.
+ *
+ * Lowers the optimized IR of the programs of bench_programs.h with and
+ * without ir_inline, and reports for both how many calls the IR has left,
+ * how many bytes of machine code the native backend makes of it, and how
+ * long main takes to run on the JIT. The two must agree on what main
+ * returns.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "bench_programs.h"
+#include "codegen.h"
+#include "ir.h"
+#include "jit.h"
+#include "mmio.h"
+#include "mmio_alloc.h"
+#include "parser.h"
+#include "resolve.h"
+#include "typecheck.h"
+#include "x86.h"
+
+#define ROUNDS 3
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    size_t calls;
+    size_t code_size;
+    double time;
+    int64_t result;
+} measurement;
+
+static size_t count_calls(const ir_program* program) {
+    size_t count = 0;
+
+    for (size_t f = 0; f < program->functions.len; f++) {
+        const ir_function* fn = &program->functions.items[f];
+
+        for (size_t v = 0; v < fn->values.len; v++) {
+            const ir_instr* instr = &fn->values.items[v];
+
+            if (instr->op == IR_CALL && instr->block != IR_NONE) {
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+static bool measure(
+    allocator_t* allocator, ast_item_node* ast, bool inlining, measurement* out
+) {
+    resolved_program resolved;
+    ir_program program;
+
+    if (!resolve(allocator, ast, NULL, &resolved) ||
+        !ir_build(allocator, &resolved, &program)) {
+        return false;
+    }
+
+    ir_optimize(allocator, &program);
+
+    if (inlining) {
+        ir_inline(allocator, &program, NULL);
+    }
+
+    out->calls = count_calls(&program);
+
+    codegen_options options = {.allocate_registers = true};
+    x86_asm* as = x86_asm_make_binary(allocator);
+    jit* jit = NULL;
+
+    if (codegen(allocator, &program, &options, as)) {
+        x86_object object = x86_asm_object(as);
+
+        out->code_size = object.section_sizes[X86_SECTION_TEXT];
+        jit = jit_load(allocator, &object);
+    }
+
+    x86_asm_destroy(as);
+
+    if (jit == NULL) {
+        return false;
+    }
+
+    int64_t (*main)(void) = (int64_t (*)(void))jit_function(jit, "one.main");
+
+    /* Best of a few rounds */
+    for (size_t round = 0; round < ROUNDS; round++) {
+        double start = now();
+        out->result = main();
+        double elapsed = now() - start;
+
+        if (round == 0 || elapsed < out->time) {
+            out->time = elapsed;
+        }
+    }
+
+    jit_destroy(jit);
+
+    return true;
+}
+
+int main() {
+    printf(
+        "%-16s %15s %17s %21s %8s\n",
+        "program",
+        "IR calls",
+        "code bytes",
+        "run ms",
+        "speedup"
+    );
+
+    for (size_t p = 0; p < BENCH_PROGRAM_COUNT; p++) {
+        arena* ar = arena_make(&mmio_alloc, mmio_get_page_size());
+        allocator_t alloc = arena_get_alloc(ar);
+
+        size_t len = strlen(bench_programs[p].code);
+        char* code = ALLOC_ARRAY(&alloc, char, len + 1);
+        memcpy(code, bench_programs[p].code, len + 1);
+
+        ast_item_node* ast;
+        if (!parse(&alloc, code, len, &ast) || !typecheck(&alloc, ast)) {
+            return 1;
+        }
+
+        measurement plain;
+        measurement inlined;
+
+        if (!measure(&alloc, ast, false, &plain) ||
+            !measure(&alloc, ast, true, &inlined)) {
+            return 1;
+        }
+
+        if (plain.result != inlined.result) {
+            fprintf(
+                stderr,
+                "%s: without inlining returned %lld, with %lld\n",
+                bench_programs[p].name,
+                (long long)plain.result,
+                (long long)inlined.result
+            );
+            return 1;
+        }
+
+        printf(
+            "%-16s %6zu -> %5zu %7zu -> %6zu %9.2f -> %8.2f %7.1fx\n",
+            bench_programs[p].name,
+            plain.calls,
+            inlined.calls,
+            plain.code_size,
+            inlined.code_size,
+            plain.time * 1e3,
+            inlined.time * 1e3,
+            plain.time / inlined.time
+        );
+
+        arena_destroy(ar);
+    }
+
+    return 0;
+}
@@ -0,0 +1,224 @@
+/**
+ * Input throughput benchmark.
+ *
+ * Feeds the same generated source to mmio through a memory mapped file, by
+ * reading the file and through a pipe, and reports how fast the contents
+ * become available to the lexer. Every cache line is touched so that lazily
+ * mapped pages are paid for too.
+ *
+ * Then opens files of increasing size with mmio_open_path, forcing either
+ * the read or the mmap strategy, to find where mmap starts to pay off. This
+ * is what MMIO_DEFAULT_MMAP_THRESHOLD is based on.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mmio.h"
+
+#define INPUT_SIZE ((size_t) 64 * 1024 * 1024)
+#define ROUNDS 5
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char* snippet =
+    "fn f(a: i32, b: i32) -> i32 {\n"
+    "    let x = a + b * 2;\n"
+    "    while x < 10 { x = x + 1; }\n"
+    "}\n";
+
+static unsigned long touch(mmio_mapping* mapping) {
+    unsigned long sum = 0;
+    const char* bytes = mapping->ptr;
+
+    for (size_t i = 0; i < mapping->length; i += 64) {
+        sum += bytes[i];
+    }
+
+    return sum;
+}
+
+static void write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            perror("write");
+            exit(1);
+        }
+
+        data += written;
+        size -= written;
+    }
+}
+
+typedef enum {
+    INPUT_MMAP,
+    INPUT_READ,
+    INPUT_PIPE,
+} input_kind;
+
+static const char* input_names[] = {
+    [INPUT_MMAP] = "mmap",
+    [INPUT_READ] = "read",
+    [INPUT_PIPE] = "pipe",
+};
+
+static bool open_input(
+    input_kind kind, const char* path, const char* data, mmio_mapping* out
+) {
+    switch (kind) {
+        case INPUT_MMAP:
+            return mmio_mm_path((char*) path, out);
+
+        case INPUT_READ: {
+            int fd = open(path, O_RDONLY);
+            bool ret = mmio_read_fd(fd, out);
+            close(fd);
+            return ret;
+        }
+
+        case INPUT_PIPE: {
+            int fds[2];
+            if (pipe(fds) == -1) {
+                perror("pipe");
+                return false;
+            }
+
+            pid_t writer = fork();
+            if (writer == 0) {
+                close(fds[0]);
+                write_all(fds[1], data, INPUT_SIZE);
+                _exit(0);
+            }
+
+            close(fds[1]);
+            bool ret = mmio_read_fd(fds[0], out);
+            close(fds[0]);
+            waitpid(writer, NULL, 0);
+
+            return ret;
+        }
+    }
+
+    return false;
+}
+
+int main() {
+    char* data = malloc(INPUT_SIZE);
+    size_t snippet_len = strlen(snippet);
+    for (size_t i = 0; i < INPUT_SIZE; i++) {
+        data[i] = snippet[i % snippet_len];
+    }
+
+    char path[] = "/tmp/bench_input_XXXXXX";
+    int fd = mkstemp(path);
+    write_all(fd, data, INPUT_SIZE);
+    close(fd);
+
+    printf("%-10s %12s %12s\n", "input", "MiB/s", "read calls");
+
+    for (input_kind kind = INPUT_MMAP; kind <= INPUT_PIPE; kind++) {
+        double best = 0;
+        size_t reads = 0;
+
+        for (size_t round = 0; round < ROUNDS; round++) {
+            size_t reads_before = mmio_get_syscall_stats().read;
+            double start = now();
+
+            mmio_mapping mapping;
+            if (!open_input(kind, path, data, &mapping)) {
+                return 1;
+            }
+
+            volatile unsigned long sum = touch(&mapping);
+            (void) sum;
+
+            mmio_unmap(&mapping);
+
+            double elapsed = now() - start;
+            if (best == 0 || elapsed < best) {
+                best = elapsed;
+            }
+
+            reads = mmio_get_syscall_stats().read - reads_before;
+        }
+
+        printf(
+            "%-10s %12.1f %12zu\n",
+            input_names[kind],
+            INPUT_SIZE / (1024.0 * 1024.0) / best,
+            reads
+        );
+    }
+
+    printf(
+        "\n%-10s %12s %12s %12s\n",
+        "file size",
+        "plain mmap",
+        "read us",
+        "mmap+hint us"
+    );
+
+    for (size_t size = 1024; size <= INPUT_SIZE; size *= 4) {
+        /* Sizes that are a multiple of the page are always read */
+        size_t file_size = size - 100;
+
+        fd = open(path, O_WRONLY | O_TRUNC);
+        write_all(fd, data, file_size);
+        close(fd);
+
+        size_t iterations = INPUT_SIZE / size;
+        if (iterations > 20000) {
+            iterations = 20000;
+        }
+        if (iterations < 3) {
+            iterations = 3;
+        }
+
+        printf("%-10zu", file_size);
+
+        /* plain mapping, then forced read, then forced mapping with hints */
+        for (int strategy = 0; strategy < 3; strategy++) {
+            mmio_input_options options = {
+                .mmap_threshold = strategy == 1 ? SIZE_MAX : 0,
+                .populate = false,
+            };
+
+            double start = now();
+
+            for (size_t i = 0; i < iterations; i++) {
+                mmio_mapping mapping;
+                bool ok = strategy == 0
+                              ? mmio_mm_path(path, &mapping)
+                              : mmio_open_path(path, &options, &mapping);
+                if (!ok) {
+                    return 1;
+                }
+
+                volatile unsigned long sum = touch(&mapping);
+                (void) sum;
+
+                mmio_unmap(&mapping);
+            }
+
+            printf(" %12.1f", (now() - start) * 1e6 / iterations);
+        }
+
+        printf("\n");
+    }
+
+    unlink(path);
+    free(data);
+
+    return 0;
+}
@@ -0,0 +1,199 @@
+/**
+ * IR optimizer benchmark.
+ *
+ * Lowers the programs of bench_programs.h to the IR with and without
+ * ir_optimize, and reports for both how many instructions the IR has, how
+ * many bytes of machine code the native backend makes of it, and how long
+ * main takes to run on the JIT. The two must agree on what main returns.
+ *
+ * Where the optimizer leaves the machine code as it was, the two run the
+ * very same code and only differ by noise, so no speedup is given. The call
+ * heavy programs mostly gain from inlining, which bench_inline measures.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "bench_programs.h"
+#include "codegen.h"
+#include "ir.h"
+#include "jit.h"
+#include "mmio.h"
+#include "mmio_alloc.h"
+#include "parser.h"
+#include "resolve.h"
+#include "typecheck.h"
+#include "x86.h"
+
+#define ROUNDS 10
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    size_t instrs;
+    size_t code_size;
+    uint8_t* code;
+
+    jit* jit;
+    int64_t (*main)(void);
+    double time;
+    int64_t result;
+} measurement;
+
+static size_t count_instrs(const ir_program* program) {
+    size_t count = 0;
+
+    for (size_t f = 0; f < program->functions.len; f++) {
+        const ir_function* fn = &program->functions.items[f];
+
+        for (size_t b = 0; b < fn->blocks.len; b++) {
+            const ir_block_data* block = &fn->blocks.items[b];
+
+            if (block->live) {
+                count += block->phis.len + block->instrs.len;
+            }
+        }
+    }
+
+    return count;
+}
+
+/* Builds `ast`, optimized or not, and loads it for timing */
+static bool build(
+    allocator_t* allocator, ast_item_node* ast, bool optimize, measurement* out
+) {
+    resolved_program resolved;
+    ir_program program;
+
+    if (!resolve(allocator, ast, NULL, &resolved) ||
+        !ir_build(allocator, &resolved, &program)) {
+        return false;
+    }
+
+    if (optimize) {
+        ir_optimize(allocator, &program);
+    }
+
+    out->instrs = count_instrs(&program);
+
+    codegen_options options = {.allocate_registers = true};
+    x86_asm* as = x86_asm_make_binary(allocator);
+
+    out->jit = NULL;
+
+    if (codegen(allocator, &program, &options, as)) {
+        x86_object object = x86_asm_object(as);
+
+        out->code_size = object.section_sizes[X86_SECTION_TEXT];
+        out->code = ALLOC_ARRAY(allocator, uint8_t, out->code_size);
+        memcpy(
+            out->code, object.sections[X86_SECTION_TEXT], out->code_size
+        );
+        out->jit = jit_load(allocator, &object);
+    }
+
+    x86_asm_destroy(as);
+
+    if (out->jit == NULL) {
+        return false;
+    }
+
+    out->main = (int64_t (*)(void))jit_function(out->jit, "one.main");
+
+    return true;
+}
+
+static void run_round(measurement* m, size_t round) {
+    double start = now();
+    m->result = m->main();
+    double elapsed = now() - start;
+
+    if (round == 0 || elapsed < m->time) {
+        m->time = elapsed;
+    }
+}
+
+int main() {
+    printf(
+        "%-16s %15s %17s %21s %8s\n",
+        "program",
+        "IR instrs",
+        "code bytes",
+        "run ms",
+        "speedup"
+    );
+
+    for (size_t p = 0; p < BENCH_PROGRAM_COUNT; p++) {
+        arena* ar = arena_make(&mmio_alloc, mmio_get_page_size());
+        allocator_t alloc = arena_get_alloc(ar);
+
+        size_t len = strlen(bench_programs[p].code);
+        char* code = ALLOC_ARRAY(&alloc, char, len + 1);
+        memcpy(code, bench_programs[p].code, len + 1);
+
+        ast_item_node* ast;
+        if (!parse(&alloc, code, len, &ast) || !typecheck(&alloc, ast)) {
+            return 1;
+        }
+
+        measurement plain;
+        measurement optimized;
+
+        if (!build(&alloc, ast, false, &plain) ||
+            !build(&alloc, ast, true, &optimized)) {
+            return 1;
+        }
+
+        /* Best of a few rounds, taking turns so that both see the machine
+         * in the same state */
+        for (size_t round = 0; round < ROUNDS; round++) {
+            run_round(&plain, round);
+            run_round(&optimized, round);
+        }
+
+        jit_destroy(plain.jit);
+        jit_destroy(optimized.jit);
+
+        if (plain.result != optimized.result) {
+            fprintf(
+                stderr,
+                "%s: unoptimized returned %lld, optimized returned %lld\n",
+                bench_programs[p].name,
+                (long long)plain.result,
+                (long long)optimized.result
+            );
+            return 1;
+        }
+
+        bool same_code = plain.code_size == optimized.code_size &&
+                         memcmp(plain.code, optimized.code, plain.code_size) ==
+                             0;
+
+        printf(
+            "%-16s %6zu -> %5zu %7zu -> %6zu %9.2f -> %8.2f ",
+            bench_programs[p].name,
+            plain.instrs,
+            optimized.instrs,
+            plain.code_size,
+            optimized.code_size,
+            plain.time * 1e3,
+            optimized.time * 1e3
+        );
+
+        if (same_code) {
+            printf("%8s\n", "same");
+        } else {
+            printf("%7.1fx\n", plain.time / optimized.time);
+        }
+
+        arena_destroy(ar);
+    }
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+/**
+ * Counts the system calls made by the mmio based allocators.
+ *
+ * Compares growing a buffer through mmio_alloc, and filling an arena backed
+ * by mmio_alloc (one mapping per block) against one backed by a reserved
+ * region (pages committed on demand).
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "arena.h"
+#include "mmio.h"
+#include "mmio_alloc.h"
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_stats(
+    const char* name, mmio_syscall_stats before, double elapsed
+) {
+    mmio_syscall_stats after = mmio_get_syscall_stats();
+
+    size_t map = after.map - before.map;
+    size_t unmap = after.unmap - before.unmap;
+    size_t remap = after.remap - before.remap;
+    size_t protect = after.protect - before.protect;
+
+    printf(
+        "%-28s %8zu %8zu %8zu %8zu %8zu %10.2f\n",
+        name,
+        map,
+        unmap,
+        remap,
+        protect,
+        map + unmap + remap + protect,
+        elapsed * 1e3
+    );
+}
+
+static void grow_buffer() {
+    mmio_syscall_stats before = mmio_get_syscall_stats();
+    double start = now();
+
+    size_t size = 4096;
+    char* buf = ALLOC_ARRAY(&mmio_alloc, char, size);
+
+    while (size < 64 * 1024 * 1024) {
+        buf = RESIZE_ARRAY(&mmio_alloc, buf, char, size, size * 2);
+        buf[size] = 1;
+        size *= 2;
+    }
+
+    FREE_ARRAY(&mmio_alloc, buf, char, size);
+
+    print_stats("buffer 4K -> 64M", before, now() - start);
+}
+
+static void fill_arena(const char* name, allocator_t* base) {
+    const size_t total = 64 * 1024 * 1024;
+
+    mmio_syscall_stats before = mmio_get_syscall_stats();
+    double start = now();
+
+    arena* ar = arena_make(base, mmio_get_page_size());
+    allocator_t alloc = arena_get_alloc(ar);
+
+    for (size_t i = 0; i < total / 64; i++) {
+        char* ptr = ALLOC_ARRAY(&alloc, char, 64);
+        ptr[0] = 1;
+    }
+
+    arena_destroy(ar);
+
+    print_stats(name, before, now() - start);
+}
+
+int main() {
+    printf(
+        "%-28s %8s %8s %8s %8s %8s %10s\n",
+        "",
+        "mmap",
+        "munmap",
+        "mremap",
+        "mprotect",
+        "total",
+        "ms"
+    );
+
+    grow_buffer();
+
+    fill_arena("arena 64M on mmio_alloc", &mmio_alloc);
+
+    mmio_region_ctx region;
+    if (!mmio_region_ctx_init(&region, (size_t) 1 << 30)) {
+        return 1;
+    }
+
+    allocator_t region_alloc = mmio_region_alloc(&region);
+    fill_arena("arena 64M on a region", &region_alloc);
+
+    mmio_region_ctx_destroy(&region);
+
+    return 0;
+}
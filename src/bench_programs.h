@@ -0,0 +1,132 @@
+/**
+ * Programs shared by the execution benchmarks: loop heavy ones that mostly
+ * run arithmetic and jumps, and call heavy ones. Every program has a main
+ * function that returns a value, for the benchmarks to check.
+ */
+
+#ifndef BENCH_PROGRAMS_H
+#define BENCH_PROGRAMS_H
+
+#include <stddef.h>
+
+typedef struct {
+    const char* name;
+    const char* code;
+} bench_program;
+
+static const bench_program bench_programs[] = {
+    {
+        "sum loop",
+        "fn main() -> i32 {\n"
+        "    let mut s = 0;\n"
+        "    let mut i = 0;\n"
+        "    while i < 10000000 { s = s + i; i = i + 1; }\n"
+        "    s;\n"
+        "}\n",
+    },
+    {
+        "nested loops",
+        "fn main() -> i32 {\n"
+        "    let mut s = 0;\n"
+        "    let mut i = 0;\n"
+        "    while i < 3000 {\n"
+        "        let mut j = 0;\n"
+        "        while j < 1000 {\n"
+        "            if ((i ^ j) & 1) == 0 { s = s + j; } else { s = s - 1; }\n"
+        "            j = j + 1;\n"
+        "        }\n"
+        "        i = i + 1;\n"
+        "    }\n"
+        "    s;\n"
+        "}\n",
+    },
+    {
+        "small integers",
+        "fn main() -> u8 {\n"
+        "    let mut a: u8 = 0;\n"
+        "    let mut b: i16 = 1;\n"
+        "    let mut i = 0;\n"
+        "    while i < 5000000 { a = a * 3 + 7; b = b * 5 - 3; i = i + 1; }\n"
+        "    a;\n"
+        "}\n",
+    },
+    {
+        "redundant math",
+        "fn main() -> i32 {\n"
+        "    let scale = 4 * 8;\n"
+        "    let mut s = 0;\n"
+        "    let mut i = 0;\n"
+        "    while i < 5000000 {\n"
+        "        let a = (i & 255) * scale + 3;\n"
+        "        let b = (i & 255) * scale + 3;\n"
+        "        if scale > 100 { s = s - a; }\n"
+        "        s = s + (a ^ b) + b;\n"
+        "        i = i + 1;\n"
+        "    }\n"
+        "    s;\n"
+        "}\n",
+    },
+    {
+        "recursive fib",
+        "fn fib(n: i32) -> i32 {\n"
+        "    let mut r = n;\n"
+        "    if n > 1 { r = fib(n - 1) + fib(n - 2); }\n"
+        "    r;\n"
+        "}\n"
+        "fn main() -> i32 { fib(27); }\n",
+    },
+    {
+        "lambda calls",
+        "fn apply(f: fn(i32, i32) -> i32, a: i32, b: i32) -> i32 { f(a, b); }\n"
+        "fn main() -> i32 {\n"
+        "    let add = fn(a: i32, b: i32) -> i32 { a + b; };\n"
+        "    let mut s = 0;\n"
+        "    let mut i = 0;\n"
+        "    while i < 2000000 { s = apply(add, s, i); i = i + 1; }\n"
+        "    s;\n"
+        "}\n",
+    },
+    {
+        "closure calls",
+        "fn apply(f: fn(i32) -> i32, a: i32) -> i32 { f(a); }\n"
+        "fn main() -> i32 {\n"
+        "    let mut s = 0;\n"
+        "    let mut i = 0;\n"
+        "    while i < 2000000 {\n"
+        "        let k = i & 7;\n"
+        "        s = apply(fn(a: i32) -> i32 { a + k + i; }, s);\n"
+        "        i = i + 1;\n"
+        "    }\n"
+        "    s;\n"
+        "}\n",
+    },
+    {
+        "small helpers",
+        "fn min(a: i32, b: i32) -> i32 {\n"
+        "    let mut r = a;\n"
+        "    if b < a { r = b; }\n"
+        "    r;\n"
+        "}\n"
+        "fn max(a: i32, b: i32) -> i32 {\n"
+        "    let mut r = a;\n"
+        "    if b > a { r = b; }\n"
+        "    r;\n"
+        "}\n"
+        "fn clamp(x: i32, lo: i32, hi: i32) -> i32 { min(max(x, lo), hi); }\n"
+        "fn square(x: i32) -> i32 { x * x; }\n"
+        "fn step(s: i32, i: i32) -> i32 {\n"
+        "    (s + square(clamp(i % 100 - 50, -20, 20))) & 65535;\n"
+        "}\n"
+        "fn main() -> i32 {\n"
+        "    let mut s = 0;\n"
+        "    let mut i = 0;\n"
+        "    while i < 2000000 { s = step(s, i); i = i + 1; }\n"
+        "    s;\n"
+        "}\n",
+    },
+};
+
+#define BENCH_PROGRAM_COUNT \
+    (sizeof(bench_programs) / sizeof(bench_programs[0]))
+
+#endif  // BENCH_PROGRAMS_H
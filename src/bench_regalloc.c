@@ -0,0 +1,149 @@
+/**
+ * Register allocator benchmark.
+ *
+ * Lowers the optimized IR of the programs of bench_programs.h with every
+ * value in its stack slot and with registers allocated (see regalloc.h),
+ * and reports for both how many machine instructions and bytes the native
+ * backend makes, and how long main takes to run on the JIT. The two must
+ * agree on what main returns.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "bench_programs.h"
+#include "codegen.h"
+#include "ir.h"
+#include "jit.h"
+#include "mmio.h"
+#include "mmio_alloc.h"
+#include "parser.h"
+#include "resolve.h"
+#include "typecheck.h"
+#include "x86.h"
+
+#define ROUNDS 3
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    size_t instructions;
+    size_t code_size;
+    double time;
+    int64_t result;
+} measurement;
+
+static bool measure(
+    allocator_t* allocator,
+    const ir_program* program,
+    bool allocate,
+    measurement* out
+) {
+    codegen_options options = {.allocate_registers = allocate};
+    x86_asm* as = x86_asm_make_binary(allocator);
+    jit* jit = NULL;
+
+    if (codegen(allocator, program, &options, as)) {
+        x86_object object = x86_asm_object(as);
+
+        out->instructions = object.instruction_count;
+        out->code_size = object.section_sizes[X86_SECTION_TEXT];
+        jit = jit_load(allocator, &object);
+    }
+
+    x86_asm_destroy(as);
+
+    if (jit == NULL) {
+        return false;
+    }
+
+    int64_t (*main)(void) = (int64_t (*)(void))jit_function(jit, "one.main");
+
+    /* Best of a few rounds */
+    for (size_t round = 0; round < ROUNDS; round++) {
+        double start = now();
+        out->result = main();
+        double elapsed = now() - start;
+
+        if (round == 0 || elapsed < out->time) {
+            out->time = elapsed;
+        }
+    }
+
+    jit_destroy(jit);
+
+    return true;
+}
+
+int main() {
+    printf(
+        "%-16s %15s %17s %21s %8s\n",
+        "program",
+        "instructions",
+        "code bytes",
+        "run ms",
+        "speedup"
+    );
+
+    for (size_t p = 0; p < BENCH_PROGRAM_COUNT; p++) {
+        arena* ar = arena_make(&mmio_alloc, mmio_get_page_size());
+        allocator_t alloc = arena_get_alloc(ar);
+
+        size_t len = strlen(bench_programs[p].code);
+        char* code = ALLOC_ARRAY(&alloc, char, len + 1);
+        memcpy(code, bench_programs[p].code, len + 1);
+
+        ast_item_node* ast;
+        resolved_program resolved;
+        ir_program program;
+
+        if (!parse(&alloc, code, len, &ast) || !typecheck(&alloc, ast) ||
+            !resolve(&alloc, ast, NULL, &resolved) ||
+            !ir_build(&alloc, &resolved, &program)) {
+            return 1;
+        }
+
+        ir_optimize(&alloc, &program);
+
+        measurement slots;
+        measurement registers;
+
+        if (!measure(&alloc, &program, false, &slots) ||
+            !measure(&alloc, &program, true, &registers)) {
+            return 1;
+        }
+
+        if (slots.result != registers.result) {
+            fprintf(
+                stderr,
+                "%s: without registers returned %lld, with %lld\n",
+                bench_programs[p].name,
+                (long long)slots.result,
+                (long long)registers.result
+            );
+            return 1;
+        }
+
+        printf(
+            "%-16s %6zu -> %5zu %7zu -> %6zu %9.2f -> %8.2f %7.1fx\n",
+            bench_programs[p].name,
+            slots.instructions,
+            registers.instructions,
+            slots.code_size,
+            registers.code_size,
+            slots.time * 1e3,
+            registers.time * 1e3,
+            slots.time / registers.time
+        );
+
+        arena_destroy(ar);
+    }
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+/**
+ * Multi-threaded allocation stress benchmark.
+ *
+ * Every thread runs a series of "units", each making thousands of small
+ * (16-64 byte) allocations and then dropping all of them, roughly what a
+ * worker compiling one file after another would do. The same workload runs
+ * on malloc, on one arena shared behind a lock, and on thread-local arenas
+ * fed by a block pool.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "arena.h"
+#include "mmio.h"
+#include "mmio_alloc.h"
+#include "thread_alloc.h"
+
+#define MAX_THREADS 8
+#define UNITS 64
+#define UNIT_SIZE 20000
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef enum {
+    MODE_MALLOC,
+    MODE_LOCKED_ARENA,
+    MODE_THREAD_ARENA,
+} mode;
+
+static const char* mode_names[] = {
+    [MODE_MALLOC] = "malloc",
+    [MODE_LOCKED_ARENA] = "locked arena",
+    [MODE_THREAD_ARENA] = "thread arena",
+};
+
+/* The arena shared by all threads in MODE_LOCKED_ARENA */
+static arena* shared_arena;
+static allocator_t shared_alloc;
+static atomic_flag shared_lock = ATOMIC_FLAG_INIT;
+
+static void* locked_alloc(
+    void* ctx, void* ptr, size_t old_size, size_t new_size
+) {
+    (void) ctx;
+
+    while (atomic_flag_test_and_set_explicit(&shared_lock, memory_order_acquire)
+    ) {
+    }
+
+    void* ret = shared_alloc.alloc(shared_alloc.ctx, ptr, old_size, new_size);
+
+    atomic_flag_clear_explicit(&shared_lock, memory_order_release);
+
+    return ret;
+}
+
+typedef struct {
+    mode mode;
+    block_pool* pool;
+    unsigned int seed;
+    char sink;
+} worker;
+
+static void* run_worker(void* arg) {
+    worker* w = (worker*) arg;
+
+    allocator_t locked = {.alloc = locked_alloc, .ctx = NULL};
+    allocator_t cached = thread_cache_alloc(w->pool);
+
+    void** ptrs = malloc(sizeof(void*) * UNIT_SIZE);
+
+    for (size_t unit = 0; unit < UNITS; unit++) {
+        for (size_t i = 0; i < UNIT_SIZE; i++) {
+            w->seed ^= w->seed << 13;
+            w->seed ^= w->seed >> 17;
+            w->seed ^= w->seed << 5;
+
+            size_t size = 16 + w->seed % 49;
+            char* ptr;
+
+            switch (w->mode) {
+                case MODE_MALLOC:
+                    ptr = malloc(size);
+                    ptrs[i] = ptr;
+                    break;
+
+                case MODE_LOCKED_ARENA:
+                    ptr = ALLOC_ARRAY(&locked, char, size);
+                    break;
+
+                case MODE_THREAD_ARENA:
+                    ptr = ALLOC_ARRAY(&cached, char, size);
+                    break;
+            }
+
+            ptr[0] = (char) i;
+            w->sink += ptr[0];
+        }
+
+        /* Drop everything the unit allocated. A shared arena cannot do that
+         * while other threads are still using it. */
+        if (w->mode == MODE_MALLOC) {
+            for (size_t i = 0; i < UNIT_SIZE; i++) {
+                free(ptrs[i]);
+            }
+        } else if (w->mode == MODE_THREAD_ARENA) {
+            thread_arena_release();
+        }
+    }
+
+    free(ptrs);
+
+    return NULL;
+}
+
+static double run(mode m, size_t threads, block_pool* pool) {
+    pthread_t handles[MAX_THREADS];
+    worker workers[MAX_THREADS];
+
+    if (m == MODE_LOCKED_ARENA) {
+        shared_arena = arena_make(&mmio_alloc, 64 * 1024);
+        shared_alloc = arena_get_alloc(shared_arena);
+    }
+
+    double start = now();
+
+    for (size_t i = 0; i < threads; i++) {
+        workers[i] = (worker){
+            .mode = m,
+            .pool = pool,
+            .seed = 2463534242u + i,
+        };
+        pthread_create(&handles[i], NULL, run_worker, &workers[i]);
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        pthread_join(handles[i], NULL);
+    }
+
+    double elapsed = now() - start;
+
+    if (m == MODE_LOCKED_ARENA) {
+        arena_destroy(shared_arena);
+    }
+
+    return elapsed * 1e9 / (threads * UNITS * UNIT_SIZE);
+}
+
+int main() {
+    block_pool* pool = block_pool_make(&mmio_alloc, 64 * 1024);
+
+    printf("%-14s", "ns/allocation");
+    for (size_t threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        printf(" %8zu thr", threads);
+    }
+    printf("\n");
+
+    for (mode m = MODE_MALLOC; m <= MODE_THREAD_ARENA; m++) {
+        printf("%-14s", mode_names[m]);
+
+        for (size_t threads = 1; threads <= MAX_THREADS; threads *= 2) {
+            printf(" %12.2f", run(m, threads, pool));
+            fflush(stdout);
+        }
+
+        printf("\n");
+    }
+
+    block_pool_stats stats = block_pool_get_stats(pool);
+    mmio_syscall_stats syscalls = mmio_get_syscall_stats();
+
+    printf(
+        "\npool: %zu blocks created, %zu reused, %zu cached\n",
+        stats.created,
+        stats.reused,
+        stats.cached
+    );
+    printf("mmap calls: %zu, munmap calls: %zu\n", syscalls.map, syscalls.unmap);
+
+    block_pool_destroy(pool);
+
+    return 0;
+}
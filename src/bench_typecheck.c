@@ -0,0 +1,86 @@
+/**
+ * Typecheck benchmark.
+ *
+ * Generates a program with a few thousand functions, parses it once and
+ * typechecks it a few times. Reports the time of a typecheck and the memory
+ * it takes, measured as the size of the arena it allocates from.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "mmio.h"
+#include "mmio_alloc.h"
+#include "parser.h"
+#include "typecheck.h"
+
+#define FUNCTIONS 20000
+#define ROUNDS 5
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char* function_body =
+    "    let x = a + b * 2;\n"
+    "    let mut i = 0;\n"
+    "    while i < 10 { i = i + 1; x = x + i; }\n"
+    "    let g = fn(p: i32, q: i32, r: i32) -> i32 { p + q + r; };\n"
+    "    if x > 3 { let y = x * 3; } else { let z = x - 1; }\n"
+    "    g(1, 2, 3);\n"
+    "    let s: string = \"hello\";\n"
+    "}\n";
+
+int main() {
+    size_t capacity = FUNCTIONS * (strlen(function_body) + 64) + 1;
+    char* code = ALLOC_ARRAY(&mmio_alloc, char, capacity);
+    size_t len = 0;
+
+    for (size_t i = 0; i < FUNCTIONS; i++) {
+        len += sprintf(
+            code + len, "fn f%zu(a: i32, b: i32) -> i32 {\n%s", i, function_body
+        );
+    }
+
+    arena* ast_arena = arena_make(&mmio_alloc, 1024 * 1024);
+    allocator_t ast_alloc = arena_get_alloc(ast_arena);
+
+    ast_item_node* ast;
+    if (!parse(&ast_alloc, code, len, &ast)) {
+        return 1;
+    }
+
+    printf("%10s %12s %12s\n", "round", "ms", "KiB");
+
+    for (size_t round = 0; round < ROUNDS; round++) {
+        arena* tc_arena = arena_make(&mmio_alloc, mmio_get_page_size());
+        allocator_t tc_alloc = arena_get_alloc(tc_arena);
+
+        double start = now();
+        bool passes = typecheck(&tc_alloc, ast);
+        double elapsed = now() - start;
+
+        if (!passes) {
+            fprintf(stderr, "typecheck failed\n");
+            return 1;
+        }
+
+        printf(
+            "%10zu %12.2f %12zu\n",
+            round,
+            elapsed * 1e3,
+            arena_get_stats(tc_arena).bytes / 1024
+        );
+
+        arena_destroy(tc_arena);
+    }
+
+    arena_destroy(ast_arena);
+    FREE_ARRAY(&mmio_alloc, code, char, capacity);
+
+    return 0;
+}
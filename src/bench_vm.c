@@ -0,0 +1,86 @@
+/**
+ * VM benchmark.
+ *
+ * Runs the programs of bench_programs.h through the bytecode VM and
+ * reports how many instructions it executes per second. Build with
+ * CFLAGS=-DVM_NO_COMPUTED_GOTO to measure the switch dispatch instead of
+ * computed gotos.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "bench_programs.h"
+#include "bytecode.h"
+#include "mmio.h"
+#include "mmio_alloc.h"
+#include "parser.h"
+#include "typecheck.h"
+#include "vm.h"
+
+#define ROUNDS 3
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main() {
+    printf(
+        "%-16s %14s %10s %12s\n", "program", "instructions", "ms", "Minstr/s"
+    );
+
+    for (size_t p = 0; p < BENCH_PROGRAM_COUNT; p++) {
+        arena* ar = arena_make(&mmio_alloc, mmio_get_page_size());
+        allocator_t alloc = arena_get_alloc(ar);
+
+        size_t len = strlen(bench_programs[p].code);
+        char* code = ALLOC_ARRAY(&alloc, char, len + 1);
+        memcpy(code, bench_programs[p].code, len + 1);
+
+        ast_item_node* ast;
+        bc_module module;
+
+        if (!parse(&alloc, code, len, &ast) || !typecheck(&alloc, ast) ||
+            !bc_compile(&alloc, ast, NULL, &module)) {
+            return 1;
+        }
+
+        /* Best of a few rounds */
+        double best = 0;
+        uint64_t instructions = 0;
+
+        for (size_t round = 0; round < ROUNDS; round++) {
+            vm* vm = vm_make(&alloc, &module);
+            int64_t result;
+
+            double start = now();
+            if (!vm_call(vm, module.main, NULL, 0, &result)) {
+                return 1;
+            }
+            double elapsed = now() - start;
+
+            if (round == 0 || elapsed < best) {
+                best = elapsed;
+            }
+
+            instructions = vm_instructions(vm);
+            vm_destroy(vm);
+        }
+
+        printf(
+            "%-16s %14llu %10.2f %12.1f\n",
+            bench_programs[p].name,
+            (unsigned long long)instructions,
+            best * 1e3,
+            instructions / best / 1e6
+        );
+
+        arena_destroy(ar);
+    }
+
+    return 0;
+}
@@ -0,0 +1,1355 @@
+#include "bytecode.h"
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "closure.h"
+#include "diag.h"
+#include "tailcall.h"
+
+/* Types the lowering keeps track of. The program has been typechecked, so
+ * this only needs enough to pick instructions and to size literals. */
+typedef enum {
+    VALUE_UNIT,
+    VALUE_INTEGER,
+    VALUE_BOOLEAN,
+    VALUE_STRING,
+    VALUE_FUNCTION,
+
+    /* An integer literal that takes the type of whatever it meets, i32 if
+     * nothing */
+    VALUE_LITERAL,
+} value_kind;
+
+typedef struct {
+    value_kind kind;
+
+    /* VALUE_INTEGER */
+    bc_int_type integer;
+
+    /* VALUE_FUNCTION: the parameters come either from a declaration or
+     * from a function type */
+    ast_param* params;
+    slice_typename* param_types;
+    ast_typename* return_type;
+} value_type;
+
+typedef struct {
+    const char* name;
+    size_t name_len;
+
+    uint8_t reg;
+    value_type type;
+} local;
+
+typedef VEC(local) vec_local;
+typedef VEC(bc_instr) vec_instr;
+
+/* A lifted lambda, and the registers of the values it captures where it
+ * is declared */
+typedef struct {
+    ast_node_lambda* lambda;
+    size_t function;
+    uint8_t* captures;
+} lifted_lambda;
+
+typedef VEC(lifted_lambda) vec_lifted_lambda;
+
+typedef struct _function_builder {
+    /* Function the lambda being built is declared in, NULL for named
+     * functions */
+    struct _function_builder* parent;
+
+    vec_local locals;
+    vec_instr code;
+
+    /* First free register, and the most ever used */
+    unsigned reg_top;
+    unsigned reg_max;
+} function_builder;
+
+typedef struct {
+    allocator_t* allocator;
+    bc_module* module;
+    ast_item_node* ast;
+
+    function_builder* fn;
+    vec_lifted_lambda lifted;
+
+    /* The first error unwinds straight back to bc_compile */
+    jmp_buf on_error;
+} lowering;
+
+static void lowering_error(lowering* self, const char* fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    diag_vprintf(fmt, args);
+    va_end(args);
+
+    longjmp(self->on_error, 1);
+}
+
+static const value_type UNIT_TYPE = {.kind = VALUE_UNIT};
+static const value_type I32_TYPE = {
+    .kind = VALUE_INTEGER,
+    .integer = BC_INT_I32,
+};
+
+static bc_int_type int_type_of(bool is_signed, ast_integer_size size) {
+    switch (size) {
+        case INTEGER_SIZE_8:
+            return is_signed ? BC_INT_I8 : BC_INT_U8;
+        case INTEGER_SIZE_16:
+            return is_signed ? BC_INT_I16 : BC_INT_U16;
+        case INTEGER_SIZE_32:
+            break;
+    }
+
+    return is_signed ? BC_INT_I32 : BC_INT_U32;
+}
+
+static value_type type_from_typename(lowering* self, ast_typename* typename) {
+    if (typename == NULL) {
+        return UNIT_TYPE;
+    }
+
+    switch (typename->type) {
+        case TYPE_NAME_INTEGER:
+            return (value_type){
+                .kind = VALUE_INTEGER,
+                .integer = int_type_of(
+                    typename->as.integer.is_signed, typename->as.integer.size
+                ),
+            };
+
+        case TYPE_NAME_BOOLEAN:
+            return (value_type){.kind = VALUE_BOOLEAN};
+
+        case TYPE_NAME_STRING:
+            return (value_type){.kind = VALUE_STRING};
+
+        case TYPE_NAME_TUPLE:
+            if (typename->as.tuple.items.len != 0) {
+                lowering_error(self, "tuples are not supported by the VM yet");
+            }
+
+            return UNIT_TYPE;
+
+        case TYPE_NAME_FUNCTION:
+            return (value_type){
+                .kind = VALUE_FUNCTION,
+                .param_types = &typename->as.function.params,
+                .return_type = typename->as.function.return_type,
+            };
+    }
+
+    return UNIT_TYPE;
+}
+
+static value_type function_type(ast_param* params, ast_typename* return_type) {
+    return (value_type){
+        .kind = VALUE_FUNCTION,
+        .params = params,
+        .return_type = return_type,
+    };
+}
+
+static value_type param_type(lowering* self, value_type* fn, size_t index) {
+    if (fn->param_types != NULL) {
+        return type_from_typename(self, fn->param_types->items[index]);
+    }
+
+    ast_param* param = fn->params;
+    for (size_t i = 0; i < index; i++) {
+        param = param->next;
+    }
+
+    return type_from_typename(self, param->type);
+}
+
+/* Type of a binary operation's operands: the first one that is not a bare
+ * literal */
+static value_type unify(value_type left, value_type right) {
+    return left.kind == VALUE_LITERAL ? right : left;
+}
+
+// Code emission
+
+static size_t emit(lowering* self, bc_instr instr) {
+    vec_push(&self->fn->code, &instr);
+    return self->fn->code.len - 1;
+}
+
+static size_t code_offset(lowering* self) {
+    return self->fn->code.len;
+}
+
+/* Points the jump at `at` to the next instruction to be emitted */
+static void patch_jump(lowering* self, size_t at) {
+    bc_instr* instr = &self->fn->code.items[at];
+    long offset = (long)code_offset(self) - (long)at - 1;
+
+    if (BC_OP(*instr) == BC_JMP) {
+        if (offset < BC_SJ_MIN || offset > BC_SJ_MAX) {
+            lowering_error(self, "function too large");
+        }
+
+        *instr = BC_MAKE_SJ(BC_JMP, offset);
+        return;
+    }
+
+    if (offset < BC_SBX_MIN || offset > BC_SBX_MAX) {
+        lowering_error(self, "function too large");
+    }
+
+    *instr = BC_MAKE_ABX(BC_OP(*instr), BC_A(*instr), offset);
+}
+
+/* Emits a jump back to `target` */
+static void emit_loop(lowering* self, bc_opcode op, uint8_t reg, size_t target) {
+    long offset = (long)target - (long)code_offset(self) - 1;
+
+    if (offset < BC_SBX_MIN) {
+        lowering_error(self, "function too large");
+    }
+
+    emit(self, BC_MAKE_ABX(op, reg, offset));
+}
+
+/* The first of `count` consecutive free registers */
+static uint8_t alloc_regs(lowering* self, size_t count) {
+    function_builder* fn = self->fn;
+
+    if (fn->reg_top + count > BC_MAX_REGISTERS) {
+        lowering_error(self, "function needs more than %d registers",
+                       BC_MAX_REGISTERS);
+    }
+
+    uint8_t reg = fn->reg_top;
+    fn->reg_top += count;
+
+    if (fn->reg_top > fn->reg_max) {
+        fn->reg_max = fn->reg_top;
+    }
+
+    return reg;
+}
+
+static uint8_t alloc_reg(lowering* self) {
+    return alloc_regs(self, 1);
+}
+
+/* `dst` if one was asked for, a new temporary otherwise */
+static uint8_t target_reg(lowering* self, int dst) {
+    return dst >= 0 ? (uint8_t)dst : alloc_reg(self);
+}
+
+static uint16_t add_constant(lowering* self, int64_t value) {
+    bc_module* module = self->module;
+
+    if (module->constants.len > UINT16_MAX) {
+        lowering_error(self, "too many constants");
+    }
+
+    vec_push(&module->constants, &value);
+    return module->constants.len - 1;
+}
+
+/* Wraps `value` to the width of `type`, the same way the VM does */
+static int64_t wrap_integer(bc_int_type type, int64_t value) {
+    switch (type) {
+        case BC_INT_I8:
+            return (int8_t)value;
+        case BC_INT_I16:
+            return (int16_t)value;
+        case BC_INT_I32:
+            return (int32_t)value;
+        case BC_INT_U8:
+            return (uint8_t)value;
+        case BC_INT_U16:
+            return (uint16_t)value;
+        case BC_INT_U32:
+            return (uint32_t)value;
+    }
+
+    return value;
+}
+
+static void emit_load_integer(lowering* self, uint8_t dst, int64_t value) {
+    if (value >= BC_SBX_MIN && value <= BC_SBX_MAX) {
+        emit(self, BC_MAKE_ABX(BC_LOADI, dst, value));
+    } else {
+        emit(self, BC_MAKE_ABX(BC_LOADK, dst, add_constant(self, value)));
+    }
+}
+
+// Names
+
+static local* lookup_local(function_builder* fn, const char* name, size_t len) {
+    for (size_t i = fn->locals.len; i > 0; i--) {
+        local* l = &fn->locals.items[i - 1];
+
+        if (l->name_len == len && memcmp(l->name, name, len) == 0) {
+            return l;
+        }
+    }
+
+    return NULL;
+}
+
+static void declare_local(
+    lowering* self, token name, uint8_t reg, value_type type
+) {
+    local l = (local){
+        .name = name.span,
+        .name_len = name.span_size,
+        .reg = reg,
+        .type = type,
+    };
+
+    vec_push(&self->fn->locals, &l);
+}
+
+/* Index of the named function `name`, the last one declared wins */
+static ast_node_function* lookup_function(
+    lowering* self, const char* name, size_t len, size_t* index
+) {
+    ast_node_function* found = NULL;
+    size_t i = 0;
+
+    for (ast_item_node* item = self->ast; item != NULL; item = item->next) {
+        if (item->type != AST_FN) {
+            continue;
+        }
+
+        token fn_name = item->function.name;
+        if (fn_name.span_size == len && memcmp(fn_name.span, name, len) == 0) {
+            found = &item->function;
+            *index = i;
+        }
+
+        i++;
+    }
+
+    return found;
+}
+
+// Expressions
+
+static value_type expr_type(lowering* self, ast_expr_node* expr);
+static uint8_t lower_expr(
+    lowering* self, ast_expr_node* expr, const value_type* expected, int dst
+);
+static size_t lower_function(
+    lowering* self,
+    const char* name,
+    size_t name_len,
+    ast_param* params,
+    ast_stmt_node* body,
+    ast_typename* return_type,
+    ast_node_lambda* lambda,
+    size_t index
+);
+
+static value_type identifier_type(lowering* self, ast_node_identifier* iden) {
+    local* l = lookup_local(self->fn, iden->start, iden->len);
+    if (l != NULL) {
+        return l->type;
+    }
+
+    size_t index;
+    ast_node_function* fn = lookup_function(self, iden->start, iden->len, &index);
+    if (fn != NULL) {
+        return function_type(fn->params, fn->return_type);
+    }
+
+    return UNIT_TYPE;
+}
+
+static bool is_comparison(token_type op) {
+    return op == TOK_EQ || op == TOK_NEQ || op == TOK_LT || op == TOK_GT ||
+           op == TOK_LTEQ || op == TOK_GTEQ || op == TOK_AND || op == TOK_OR;
+}
+
+/* Type of `expr` without generating any code for it */
+static value_type expr_type(lowering* self, ast_expr_node* expr) {
+    switch (expr->type) {
+        case AST_NUM:
+            return (value_type){.kind = VALUE_LITERAL};
+
+        case AST_BOOL:
+            return (value_type){.kind = VALUE_BOOLEAN};
+
+        case AST_STR:
+            return (value_type){.kind = VALUE_STRING};
+
+        case AST_IDEN:
+            return identifier_type(self, &expr->identifier);
+
+        case AST_BINARY: {
+            token_type op = expr->binary.op;
+
+            if (is_comparison(op)) {
+                return (value_type){.kind = VALUE_BOOLEAN};
+            }
+
+            if (op == TOK_ASSIGN) {
+                return expr_type(self, expr->binary.left);
+            }
+
+            value_type left = expr_type(self, expr->binary.left);
+            if (left.kind != VALUE_LITERAL) {
+                return left;
+            }
+
+            return expr_type(self, expr->binary.right);
+        }
+
+        case AST_UNARY:
+            if (expr->unary.op == TOK_BANG) {
+                return (value_type){.kind = VALUE_BOOLEAN};
+            }
+
+            return expr_type(self, expr->unary.expr);
+
+        case AST_CALL: {
+            value_type fn = expr_type(self, expr->call.function);
+            return type_from_typename(self, fn.return_type);
+        }
+
+        case AST_LAMBDA:
+            return function_type(expr->lambda.params, expr->lambda.return_type);
+    }
+
+    return UNIT_TYPE;
+}
+
+static uint8_t lower_identifier(
+    lowering* self, ast_node_identifier* iden, int dst
+) {
+    local* l = lookup_local(self->fn, iden->start, iden->len);
+
+    if (l != NULL) {
+        if (dst >= 0 && dst != l->reg) {
+            emit(self, BC_MAKE_ABC(BC_MOV, dst, l->reg, 0));
+            return dst;
+        }
+
+        return l->reg;
+    }
+
+    size_t index;
+    if (lookup_function(self, iden->start, iden->len, &index) == NULL) {
+        lowering_error(
+            self, "undeclared variable '%.*s'", (int)iden->len, iden->start
+        );
+    }
+
+    uint8_t reg = target_reg(self, dst);
+    emit(self, BC_MAKE_ABX(BC_LOADF, reg, index));
+    return reg;
+}
+
+static uint8_t lower_assign(lowering* self, ast_node_binary* expr, int dst) {
+    if (expr->left->type != AST_IDEN) {
+        lowering_error(self, "can only assign to variables");
+    }
+
+    ast_node_identifier* iden = &expr->left->identifier;
+    local* l = lookup_local(self->fn, iden->start, iden->len);
+
+    if (l == NULL) {
+        lowering_error(
+            self,
+            "can only assign to local variables: '%.*s'",
+            (int)iden->len,
+            iden->start
+        );
+    }
+
+    /* `l` may move while the value is lowered, lambdas declare locals */
+    uint8_t reg = l->reg;
+    value_type type = l->type;
+
+    unsigned saved_top = self->fn->reg_top;
+    lower_expr(self, expr->right, &type, reg);
+    self->fn->reg_top = saved_top;
+
+    if (dst >= 0 && dst != reg) {
+        emit(self, BC_MAKE_ABC(BC_MOV, dst, reg, 0));
+        return dst;
+    }
+
+    return reg;
+}
+
+/* && and ||, the right operand is only evaluated if needed */
+static uint8_t lower_logical(lowering* self, ast_node_binary* expr, int dst) {
+    static const value_type boolean = {.kind = VALUE_BOOLEAN};
+    uint8_t reg = target_reg(self, dst);
+
+    unsigned saved_top = self->fn->reg_top;
+    lower_expr(self, expr->left, &boolean, reg);
+
+    size_t jump = emit(
+        self, BC_MAKE_ABX(expr->op == TOK_AND ? BC_JMPF : BC_JMPT, reg, 0)
+    );
+
+    lower_expr(self, expr->right, &boolean, reg);
+    self->fn->reg_top = saved_top;
+
+    patch_jump(self, jump);
+
+    return reg;
+}
+
+static bc_opcode typed_opcode(bc_opcode base, value_type* type) {
+    return (bc_opcode)(base + type->integer);
+}
+
+static uint8_t lower_binary(
+    lowering* self, ast_node_binary* expr, const value_type* expected, int dst
+) {
+    switch (expr->op) {
+        case TOK_ASSIGN:
+            return lower_assign(self, expr, dst);
+
+        case TOK_AND:
+        case TOK_OR:
+            return lower_logical(self, expr, dst);
+
+        default:
+            break;
+    }
+
+    value_type type = unify(
+        expr_type(self, expr->left), expr_type(self, expr->right)
+    );
+
+    if (type.kind == VALUE_LITERAL) {
+        bool arithmetic = !is_comparison(expr->op);
+        type = arithmetic && expected != NULL &&
+                       expected->kind == VALUE_INTEGER
+                   ? *expected
+                   : I32_TYPE;
+    }
+
+    unsigned saved_top = self->fn->reg_top;
+    uint8_t left = lower_expr(self, expr->left, &type, -1);
+    uint8_t right = lower_expr(self, expr->right, &type, -1);
+    self->fn->reg_top = saved_top;
+
+    uint8_t reg = target_reg(self, dst);
+    bool is_string = type.kind == VALUE_STRING;
+    bc_opcode op;
+
+    switch (expr->op) {
+        case TOK_PLUS:
+            op = is_string ? BC_CONCAT : typed_opcode(BC_ADD_I8, &type);
+            break;
+        case TOK_MINUS:
+            op = typed_opcode(BC_SUB_I8, &type);
+            break;
+        case TOK_MUL:
+            op = typed_opcode(BC_MUL_I8, &type);
+            break;
+        case TOK_DIV:
+            op = typed_opcode(BC_DIV_I8, &type);
+            break;
+        case TOK_PERC:
+            op = typed_opcode(BC_MOD_I8, &type);
+            break;
+        case TOK_AMP:
+            op = BC_BAND;
+            break;
+        case TOK_PIPE:
+            op = BC_BOR;
+            break;
+        case TOK_CARET:
+            op = BC_BXOR;
+            break;
+        case TOK_EQ:
+            op = is_string ? BC_STREQ : BC_EQ;
+            break;
+        case TOK_NEQ:
+            op = is_string ? BC_STREQ : BC_EQ;
+            emit(self, BC_MAKE_ABC(op, reg, left, right));
+            emit(self, BC_MAKE_ABC(BC_NOT, reg, reg, 0));
+            return reg;
+        case TOK_LT:
+            op = BC_LT;
+            break;
+        case TOK_GT:
+            op = BC_GT;
+            break;
+        case TOK_LTEQ:
+            emit(self, BC_MAKE_ABC(BC_GT, reg, left, right));
+            emit(self, BC_MAKE_ABC(BC_NOT, reg, reg, 0));
+            return reg;
+        case TOK_GTEQ:
+            emit(self, BC_MAKE_ABC(BC_LT, reg, left, right));
+            emit(self, BC_MAKE_ABC(BC_NOT, reg, reg, 0));
+            return reg;
+        default:
+            lowering_error(self, "BUG: unknown binary operator");
+            return reg;
+    }
+
+    emit(self, BC_MAKE_ABC(op, reg, left, right));
+    return reg;
+}
+
+static uint8_t lower_number(
+    lowering* self, ast_node_num* num, const value_type* expected, int dst
+) {
+    value_type type = expected != NULL && expected->kind == VALUE_INTEGER
+                          ? *expected
+                          : I32_TYPE;
+
+    uint8_t reg = target_reg(self, dst);
+    emit_load_integer(
+        self, reg, wrap_integer(type.integer, (int64_t)num->value)
+    );
+
+    return reg;
+}
+
+static uint8_t lower_unary(
+    lowering* self, ast_node_unary* expr, const value_type* expected, int dst
+) {
+    if (expr->op == TOK_PLUS) {
+        return lower_expr(self, expr->expr, expected, dst);
+    }
+
+    if (expr->op == TOK_BANG) {
+        unsigned saved_top = self->fn->reg_top;
+        uint8_t operand = lower_expr(self, expr->expr, NULL, -1);
+        self->fn->reg_top = saved_top;
+
+        uint8_t reg = target_reg(self, dst);
+        emit(self, BC_MAKE_ABC(BC_NOT, reg, operand, 0));
+        return reg;
+    }
+
+    value_type type = expr_type(self, expr->expr);
+    if (type.kind == VALUE_LITERAL) {
+        type = expected != NULL && expected->kind == VALUE_INTEGER
+                   ? *expected
+                   : I32_TYPE;
+    }
+
+    /* Negative literals are loaded as they are */
+    if (expr->expr->type == AST_NUM) {
+        uint8_t reg = target_reg(self, dst);
+        int64_t value = -(int64_t)expr->expr->num.value;
+
+        emit_load_integer(self, reg, wrap_integer(type.integer, value));
+        return reg;
+    }
+
+    unsigned saved_top = self->fn->reg_top;
+    uint8_t operand = lower_expr(self, expr->expr, &type, -1);
+    self->fn->reg_top = saved_top;
+
+    uint8_t reg = target_reg(self, dst);
+    emit(self, BC_MAKE_ABC(typed_opcode(BC_NEG_I8, &type), reg, operand, 0));
+    return reg;
+}
+
+static lifted_lambda* lookup_lifted(lowering* self, ast_node_lambda* lambda) {
+    for (size_t i = self->lifted.len; i > 0; i--) {
+        if (self->lifted.items[i - 1].lambda == lambda) {
+            return &self->lifted.items[i - 1];
+        }
+    }
+
+    return NULL;
+}
+
+static size_t compile_lambda(lowering* self, ast_node_lambda* lambda);
+static uint8_t lower_lambda(
+    lowering* self, ast_node_lambda* lambda, int env, int dst
+);
+
+/* Whether `expr` is a lambda that keeps its environment in the frame */
+static bool is_stack_closure(ast_expr_node* expr) {
+    return expr->type == AST_LAMBDA &&
+           expr->lambda.closure == AST_CLOSURE_STACK;
+}
+
+static uint8_t lower_call(lowering* self, ast_node_call* call, int dst) {
+    value_type fn_type = expr_type(self, call->function);
+    lifted_lambda lifted = {.lambda = NULL};
+    size_t extra = 0;
+
+    if (call->lambda != NULL) {
+        /* Not lowered yet if it is called right where it is declared */
+        if (lookup_lifted(self, call->lambda) == NULL) {
+            compile_lambda(self, call->lambda);
+        }
+
+        lifted = *lookup_lifted(self, call->lambda);
+        extra = call->lambda->captures.len;
+    }
+
+    if (call->args.len + extra > UINT8_MAX) {
+        lowering_error(self, "too many arguments");
+    }
+
+    /* Environments of the closures passed, which must outlive the call */
+    int* envs = ALLOC_ARRAY(self->allocator, int, (call->args.len + 1));
+
+    for (size_t i = 0; i < call->args.len; i++) {
+        ast_expr_node* arg = call->args.items[i];
+
+        envs[i] = is_stack_closure(arg)
+                      ? alloc_regs(self, arg->lambda.captures.len + 1)
+                      : -1;
+    }
+
+    /* The callee's registers start right after `base`, the arguments are
+     * evaluated straight into its parameters */
+    uint8_t base = alloc_reg(self);
+
+    /* Named functions that are not shadowed by a local are called
+     * directly */
+    size_t index = BC_NO_FUNCTION;
+    if (lifted.lambda != NULL) {
+        index = lifted.function;
+    } else if (call->function->type == AST_IDEN) {
+        ast_node_identifier* iden = &call->function->identifier;
+
+        if (lookup_local(self->fn, iden->start, iden->len) == NULL) {
+            lookup_function(self, iden->start, iden->len, &index);
+        }
+    }
+
+    if (index == BC_NO_FUNCTION) {
+        lower_expr(self, call->function, NULL, base);
+    }
+
+    for (size_t i = 0; i < call->args.len; i++) {
+        ast_expr_node* arg = call->args.items[i];
+        value_type type = param_type(self, &fn_type, i);
+        uint8_t reg = alloc_reg(self);
+
+        if (envs[i] >= 0) {
+            lower_lambda(self, &arg->lambda, envs[i], reg);
+        } else {
+            lower_expr(self, arg, &type, reg);
+        }
+
+        self->fn->reg_top = reg + 1;
+    }
+
+    FREE_ARRAY(self->allocator, envs, int, (call->args.len + 1));
+
+    /* Lifted lambdas get the values they capture after the arguments */
+    for (size_t i = 0; i < extra; i++) {
+        uint8_t reg = alloc_reg(self);
+        emit(self, BC_MAKE_ABC(BC_MOV, reg, lifted.captures[i], 0));
+    }
+
+    /* What follows a tail call is never run, the callee returns to the
+     * caller of this function */
+    if (index != BC_NO_FUNCTION) {
+        bc_opcode op = call->tail ? BC_TAILCALLK : BC_CALLK;
+        emit(self, BC_MAKE_ABX(op, base, index));
+    } else {
+        bc_opcode op = call->tail ? BC_TAILCALL : BC_CALL;
+        emit(self, BC_MAKE_ABC(op, base, 0, call->args.len));
+    }
+
+    self->fn->reg_top = base + 1;
+
+    if (dst >= 0 && dst != base) {
+        emit(self, BC_MAKE_ABC(BC_MOV, dst, base, 0));
+        self->fn->reg_top = base;
+        return dst;
+    }
+
+    return base;
+}
+
+static uint8_t lower_string(lowering* self, ast_node_str* str, int dst) {
+    bc_string* s = ALLOC_ARRAY(
+        self->allocator, char, (sizeof(bc_string) + str->len)
+    );
+
+    s->len = str->len;
+    memcpy(s->chars, str->str, str->len);
+
+    uint8_t reg = target_reg(self, dst);
+    emit(self, BC_MAKE_ABX(BC_LOADK, reg, add_constant(self, (intptr_t)s)));
+    return reg;
+}
+
+/* Register of captured variable `i` of `lambda` where it is declared */
+static uint8_t capture_reg(
+    lowering* self, ast_node_lambda* lambda, size_t i
+) {
+    ast_capture* capture = &lambda->captures.items[i];
+    local* l = lookup_local(self->fn, capture->name, capture->len);
+
+    if (l == NULL) {
+        lowering_error(
+            self,
+            "BUG: captured variable '%.*s' is not in scope",
+            (int)capture->len,
+            capture->name
+        );
+    }
+
+    return l->reg;
+}
+
+/* Lowers the function of `lambda` and returns its index. Lifted lambdas
+ * are remembered with where their captured values are. */
+static size_t compile_lambda(lowering* self, ast_node_lambda* lambda) {
+    bc_module* module = self->module;
+    size_t index = module->functions.len;
+
+    bc_function placeholder = {0};
+    vec_push(&module->functions, &placeholder);
+
+    lower_function(
+        self,
+        "<lambda>",
+        sizeof("<lambda>") - 1,
+        lambda->params,
+        lambda->body,
+        lambda->return_type,
+        lambda,
+        index
+    );
+
+    if (lambda->closure == AST_CLOSURE_LIFTED) {
+        size_t count = lambda->captures.len;
+        lifted_lambda lifted = {
+            .lambda = lambda,
+            .function = index,
+            .captures = ALLOC_ARRAY(self->allocator, uint8_t, (count + 1)),
+        };
+
+        for (size_t i = 0; i < count; i++) {
+            lifted.captures[i] = capture_reg(self, lambda, i);
+        }
+
+        vec_push(&self->lifted, &lifted);
+    }
+
+    return index;
+}
+
+/**
+ * Emits code that makes the value of `lambda` in `dst`. A closure that
+ * keeps its environment in the frame puts it in the registers from `env`
+ * on, which must stay allocated as long as the closure is used.
+ */
+static uint8_t lower_lambda(
+    lowering* self, ast_node_lambda* lambda, int env, int dst
+) {
+    size_t index = compile_lambda(self, lambda);
+    size_t count = lambda->captures.len;
+
+    switch (lambda->closure) {
+        case AST_CLOSURE_STACK:
+            if (env < 0) {
+                lowering_error(self, "BUG: closure without an environment");
+            }
+            break;
+
+        case AST_CLOSURE_HEAP:
+            break;
+
+        /* Lifted lambdas are only called, see lower_call */
+        default: {
+            uint8_t reg = target_reg(self, dst);
+            emit(self, BC_MAKE_ABX(BC_LOADF, reg, index));
+            return reg;
+        }
+    }
+
+    /* The function, then the captured values */
+    unsigned saved_top = self->fn->reg_top;
+    uint8_t start = env >= 0 ? (uint8_t)env : alloc_regs(self, count + 1);
+
+    emit(self, BC_MAKE_ABX(BC_LOADF, start, index));
+
+    for (size_t i = 0; i < count; i++) {
+        uint8_t reg = capture_reg(self, lambda, i);
+        emit(self, BC_MAKE_ABC(BC_MOV, start + 1 + i, reg, 0));
+    }
+
+    self->fn->reg_top = saved_top;
+
+    uint8_t reg = target_reg(self, dst);
+
+    if (env >= 0) {
+        emit(self, BC_MAKE_ABC(BC_LCLOSURE, reg, start, 0));
+    } else {
+        emit(self, BC_MAKE_ABC(BC_CLOSURE, reg, start, count));
+    }
+
+    return reg;
+}
+
+/**
+ * Emits code that computes `expr` into `dst`, or into any register if `dst`
+ * is negative, and returns the register. `expected` is the type the value
+ * is used as, it sizes integer literals. May be NULL.
+ */
+static uint8_t lower_expr(
+    lowering* self, ast_expr_node* expr, const value_type* expected, int dst
+) {
+    switch (expr->type) {
+        case AST_NUM:
+            return lower_number(self, &expr->num, expected, dst);
+
+        case AST_BOOL: {
+            uint8_t reg = target_reg(self, dst);
+            emit(self, BC_MAKE_ABX(BC_LOADI, reg, expr->boolean.value));
+            return reg;
+        }
+
+        case AST_STR:
+            return lower_string(self, &expr->str, dst);
+
+        case AST_IDEN:
+            return lower_identifier(self, &expr->identifier, dst);
+
+        case AST_BINARY:
+            return lower_binary(self, &expr->binary, expected, dst);
+
+        case AST_UNARY:
+            return lower_unary(self, &expr->unary, expected, dst);
+
+        case AST_CALL:
+            return lower_call(self, &expr->call, dst);
+
+        case AST_LAMBDA:
+            return lower_lambda(self, &expr->lambda, -1, dst);
+    }
+
+    lowering_error(self, "BUG: unknown expression");
+    return 0;
+}
+
+// Statements
+
+static void lower_stmt(lowering* self, ast_stmt_node* stmt);
+
+static void lower_stmt_list(lowering* self, ast_stmt_node* stmts) {
+    for (ast_stmt_node* curr = stmts; curr != NULL; curr = curr->next) {
+        lower_stmt(self, curr);
+    }
+}
+
+static void lower_var_decl(lowering* self, ast_node_var_decl* decl) {
+    value_type type;
+
+    if (decl->typename != NULL) {
+        type = type_from_typename(self, decl->typename);
+    } else {
+        type = expr_type(self, decl->value);
+
+        if (type.kind == VALUE_LITERAL) {
+            type = I32_TYPE;
+        }
+    }
+
+    /* The environment of a closure that stays in the frame lives as long
+     * as the variable, below it */
+    int env = -1;
+
+    if (decl->value != NULL && is_stack_closure(decl->value)) {
+        env = alloc_regs(self, decl->value->lambda.captures.len + 1);
+    }
+
+    uint8_t reg = alloc_reg(self);
+
+    if (env >= 0) {
+        lower_lambda(self, &decl->value->lambda, env, reg);
+    } else if (decl->value != NULL) {
+        lower_expr(self, decl->value, &type, reg);
+    } else {
+        emit(self, BC_MAKE_ABX(BC_LOADI, reg, 0));
+    }
+
+    self->fn->reg_top = reg + 1;
+
+    /* Declared after its value, which may refer to a shadowed variable */
+    declare_local(self, decl->name, reg, type);
+}
+
+static uint8_t lower_condition(lowering* self, ast_expr_node* condition) {
+    static const value_type boolean = {.kind = VALUE_BOOLEAN};
+
+    unsigned saved_top = self->fn->reg_top;
+    uint8_t reg = lower_expr(self, condition, &boolean, -1);
+    self->fn->reg_top = saved_top;
+
+    return reg;
+}
+
+static void lower_if_else(lowering* self, ast_node_if_else* stmt) {
+    uint8_t condition = lower_condition(self, stmt->condition);
+    size_t skip_body = emit(self, BC_MAKE_ABX(BC_JMPF, condition, 0));
+
+    lower_stmt(self, stmt->body);
+
+    if (stmt->else_body == NULL) {
+        patch_jump(self, skip_body);
+        return;
+    }
+
+    size_t skip_else = emit(self, BC_MAKE_SJ(BC_JMP, 0));
+    patch_jump(self, skip_body);
+
+    lower_stmt(self, stmt->else_body);
+    patch_jump(self, skip_else);
+}
+
+static void lower_while(lowering* self, ast_node_while* stmt) {
+    /* The condition is tested at the bottom, one jump per iteration */
+    size_t enter = emit(self, BC_MAKE_SJ(BC_JMP, 0));
+    size_t body = code_offset(self);
+
+    lower_stmt(self, stmt->body);
+
+    patch_jump(self, enter);
+    uint8_t condition = lower_condition(self, stmt->condition);
+    emit_loop(self, BC_JMPT, condition, body);
+}
+
+static void lower_stmt(lowering* self, ast_stmt_node* stmt) {
+    function_builder* fn = self->fn;
+
+    switch (stmt->type) {
+        case AST_EXPR_STMT: {
+            unsigned saved_top = fn->reg_top;
+            lower_expr(self, stmt->expr_stmt.expr, NULL, -1);
+            fn->reg_top = saved_top;
+            break;
+        }
+
+        case AST_VAR_DECL:
+            lower_var_decl(self, &stmt->var_decl);
+            break;
+
+        case AST_BLOCK: {
+            size_t saved_locals = fn->locals.len;
+            unsigned saved_top = fn->reg_top;
+
+            lower_stmt_list(self, stmt->block.body);
+
+            fn->locals.len = saved_locals;
+            fn->reg_top = saved_top;
+            break;
+        }
+
+        case AST_IF_ELSE:
+            lower_if_else(self, &stmt->if_else);
+            break;
+
+        case AST_WHILE:
+            lower_while(self, &stmt->while_);
+            break;
+    }
+}
+
+// Functions
+
+/* Lowers a function into module->functions.items[index] */
+static size_t lower_function(
+    lowering* self,
+    const char* name,
+    size_t name_len,
+    ast_param* params,
+    ast_stmt_node* body,
+    ast_typename* return_type,
+    ast_node_lambda* lambda,
+    size_t index
+) {
+    function_builder builder = (function_builder){
+        .parent = self->fn,
+        .locals = vec_make(self->allocator),
+        .code = vec_make(self->allocator),
+        .reg_top = 0,
+        .reg_max = 0,
+    };
+
+    self->fn = &builder;
+
+    size_t param_count = 0;
+    for (ast_param* param = params; param != NULL; param = param->next) {
+        uint8_t reg = alloc_reg(self);
+        declare_local(self, param->name, reg, type_from_typename(self, param->type));
+        param_count++;
+    }
+
+    /* The captured values come after the parameters. Closures get them
+     * from their environment, which arrives in the first of them. */
+    size_t capture_count = lambda != NULL ? lambda->captures.len : 0;
+
+    if (param_count + capture_count > UINT8_MAX) {
+        lowering_error(self, "too many parameters");
+    }
+
+    for (size_t i = 0; i < capture_count; i++) {
+        ast_capture* capture = &lambda->captures.items[i];
+        local* outer = lookup_local(
+            builder.parent, capture->name, capture->len
+        );
+
+        if (outer == NULL) {
+            lowering_error(
+                self,
+                "BUG: captured variable '%.*s' is not in scope",
+                (int)capture->len,
+                capture->name
+            );
+        }
+
+        value_type type = outer->type;
+        local l = {
+            .name = capture->name,
+            .name_len = capture->len,
+            .reg = alloc_reg(self),
+            .type = type,
+        };
+
+        vec_push(&builder.locals, &l);
+    }
+
+    if (lambda != NULL && (lambda->closure == AST_CLOSURE_STACK ||
+                           lambda->closure == AST_CLOSURE_HEAP)) {
+        for (size_t i = capture_count; i-- > 0;) {
+            emit(
+                self,
+                BC_MAKE_ABC(BC_LOADE, param_count + i, param_count, i)
+            );
+        }
+    }
+
+    if (lambda != NULL && lambda->closure == AST_CLOSURE_LIFTED) {
+        param_count += capture_count;
+    }
+
+    value_type result = type_from_typename(self, return_type);
+    ast_stmt_node* last = body;
+
+    for (ast_stmt_node* curr = body; curr != NULL; curr = curr->next) {
+        last = curr;
+
+        if (curr->next == NULL && curr->type == AST_EXPR_STMT &&
+            result.kind != VALUE_UNIT) {
+            break;
+        }
+
+        lower_stmt(self, curr);
+    }
+
+    /* The last expression is the return value */
+    if (last != NULL && last->type == AST_EXPR_STMT &&
+        result.kind != VALUE_UNIT) {
+        uint8_t reg = lower_expr(self, last->expr_stmt.expr, &result, -1);
+        emit(self, BC_MAKE_ABC(BC_RET, reg, 0, 0));
+    } else {
+        emit(self, BC_MAKE_ABC(BC_RET0, 0, 0, 0));
+    }
+
+    vec_free(&builder.locals);
+    vec_shrink_to_fit(&builder.code);
+
+    self->module->functions.items[index] = (bc_function){
+        .name = name,
+        .name_len = name_len,
+        .code = builder.code.items,
+        .code_len = builder.code.len,
+        .param_count = param_count,
+        .register_count = builder.reg_max,
+    };
+
+    self->fn = builder.parent;
+
+    return index;
+}
+
+bool bc_compile(
+    allocator_t* allocator,
+    ast_item_node* ast,
+    FILE* tail_report,
+    bc_module* out
+) {
+    *out = (bc_module){
+        .functions = vec_make(allocator),
+        .constants = vec_make(allocator),
+        .main = BC_NO_FUNCTION,
+    };
+
+    if (!closure_convert(allocator, ast)) {
+        return false;
+    }
+
+    tailcall_mark(allocator, ast, tail_report);
+
+    lowering self = (lowering){
+        .allocator = allocator,
+        .module = out,
+        .ast = ast,
+        .fn = NULL,
+        .lifted = vec_make(allocator),
+    };
+
+    if (setjmp(self.on_error) != 0) {
+        return false;
+    }
+
+    /* Named functions get the first indices, so that calls can refer to
+     * functions that have not been lowered yet */
+    size_t count = 0;
+    for (ast_item_node* item = ast; item != NULL; item = item->next) {
+        if (item->type == AST_FN) {
+            count++;
+        }
+    }
+
+    vec_reserve(&out->functions, count);
+    out->functions.len = count;
+
+    size_t index = 0;
+    for (ast_item_node* item = ast; item != NULL; item = item->next) {
+        if (item->type != AST_FN) {
+            continue;
+        }
+
+        ast_node_function* fn = &item->function;
+        lower_function(
+            &self,
+            fn->name.span,
+            fn->name.span_size,
+            fn->params,
+            fn->body,
+            fn->return_type,
+            NULL,
+            index
+        );
+
+        if (fn->name.span_size == 4 && memcmp(fn->name.span, "main", 4) == 0) {
+            out->main = index;
+        }
+
+        index++;
+    }
+
+    for (size_t i = 0; i < self.lifted.len; i++) {
+        lifted_lambda* lifted = &self.lifted.items[i];
+        size_t count = lifted->lambda->captures.len;
+
+        FREE_ARRAY(allocator, lifted->captures, uint8_t, (count + 1));
+    }
+
+    vec_free(&self.lifted);
+
+    return true;
+}
+
+// Disassembler
+
+static const char* const OPCODE_NAMES[] = {
+#define BC_OPCODE_NAME(name, format) #name,
+    BC_OPCODES(BC_OPCODE_NAME)
+#undef BC_OPCODE_NAME
+};
+
+typedef enum {
+    FORMAT_KIND_ABC,
+    FORMAT_KIND_AB,
+    FORMAT_KIND_ABx,
+    FORMAT_KIND_AsBx,
+    FORMAT_KIND_sJ,
+    FORMAT_KIND_A,
+    FORMAT_KIND_NONE,
+} format_kind;
+
+static const format_kind OPCODE_FORMATS[] = {
+#define BC_OPCODE_FORMAT(name, format) FORMAT_KIND_##format,
+    BC_OPCODES(BC_OPCODE_FORMAT)
+#undef BC_OPCODE_FORMAT
+};
+
+const char* bc_opcode_name(bc_opcode op) {
+    return op < BC_OPCODE_COUNT ? OPCODE_NAMES[op] : "?";
+}
+
+void bc_disassemble(FILE* out, const bc_module* module) {
+    for (size_t f = 0; f < module->functions.len; f++) {
+        bc_function* fn = &module->functions.items[f];
+
+        fprintf(
+            out,
+            "function %zu %.*s (%u params, %u registers)\n",
+            f,
+            (int)fn->name_len,
+            fn->name,
+            fn->param_count,
+            fn->register_count
+        );
+
+        for (size_t i = 0; i < fn->code_len; i++) {
+            bc_instr instr = fn->code[i];
+            bc_opcode op = BC_OP(instr);
+
+            fprintf(out, "%6zu  %-8s", i, bc_opcode_name(op));
+
+            switch (OPCODE_FORMATS[op]) {
+                case FORMAT_KIND_ABC:
+                    fprintf(
+                        out,
+                        " r%u, r%u, r%u",
+                        BC_A(instr),
+                        BC_B(instr),
+                        BC_C(instr)
+                    );
+                    break;
+
+                case FORMAT_KIND_AB:
+                    fprintf(out, " r%u, r%u", BC_A(instr), BC_B(instr));
+                    break;
+
+                case FORMAT_KIND_ABx:
+                    fprintf(out, " r%u, %u", BC_A(instr), BC_BX(instr));
+                    break;
+
+                case FORMAT_KIND_AsBx:
+                    if (op == BC_LOADI) {
+                        fprintf(out, " r%u, %d", BC_A(instr), BC_SBX(instr));
+                    } else {
+                        fprintf(
+                            out,
+                            " r%u, -> %zu",
+                            BC_A(instr),
+                            i + 1 + BC_SBX(instr)
+                        );
+                    }
+                    break;
+
+                case FORMAT_KIND_sJ:
+                    fprintf(out, " -> %zu", i + 1 + BC_SJ(instr));
+                    break;
+
+                case FORMAT_KIND_A:
+                    fprintf(out, " r%u", BC_A(instr));
+                    break;
+
+                case FORMAT_KIND_NONE:
+                    break;
+            }
+
+            fputc('\n', out);
+        }
+    }
+}
@@ -0,0 +1,216 @@
+/**
+ * Register based bytecode
+ *
+ * The typechecked AST is lowered to bytecode that the VM (vm.h) runs. Every
+ * function has up to 256 registers, the first ones hold its parameters and
+ * locals, the rest temporaries. An instruction is a 32 bit word, the opcode
+ * in the low byte followed by the operands in one of these layouts:
+ *
+ *     ABC    op | A:8 | B:8 | C:8     three registers
+ *     ABx    op | A:8 | Bx:16         register and unsigned index
+ *     AsBx   op | A:8 | sBx:16        register and signed immediate or jump
+ *     sJ     op | sJ:24               jump
+ *
+ * Jumps are relative to the instruction after the jump.
+ *
+ * Integer arithmetic comes in one opcode per integer type. Registers are 64
+ * bits wide, and integer values are kept sign or zero extended from their
+ * type's width, so only operations that can leave the range of the type
+ * (+, -, *, /, %, negation) need to know it. Comparisons and bitwise
+ * operations work on the whole register.
+ *
+ * A function returns the value of its last statement if that is an
+ * expression and the function has a return type, 0 otherwise. The language
+ * has no return statement yet. A tail call hands the frame of the function
+ * over to the callee, which returns to the function's caller.
+ *
+ * A function value is the function's index times two, and closures are
+ * represented as closure.h describes. The environment of a closure that
+ * does not escape is in registers of the function that makes it.
+ */
+
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "alloc.h"
+#include "ast.h"
+#include "vec.h"
+
+/* X(name) for every integer type */
+#define BC_INT_TYPES(X) X(I8) X(I16) X(I32) X(U8) X(U16) X(U32)
+
+#define BC_TYPED_OP(X, op, format)         \
+    X(op##_I8, format) X(op##_I16, format) \
+    X(op##_I32, format) X(op##_U8, format) \
+    X(op##_U16, format) X(op##_U32, format)
+
+/* X(name, operand layout) for every opcode */
+#define BC_OPCODES(X)                     \
+    /* A = B */                           \
+    X(MOV, AB)                            \
+    /* A = sBx */                         \
+    X(LOADI, AsBx)                        \
+    /* A = constant Bx */                 \
+    X(LOADK, ABx)                         \
+    /* A = function Bx */                 \
+    X(LOADF, ABx)                         \
+                                          \
+    /* A = closure with the function and  \
+     * C values from B on, copied to the  \
+     * heap */                            \
+    X(CLOSURE, ABC)                       \
+    /* A = closure with its environment   \
+     * in B.. */                          \
+    X(LCLOSURE, AB)                       \
+    /* A = captured value C of the        \
+     * environment in B */                \
+    X(LOADE, ABC)                         \
+                                          \
+    /* A = B op C, wrapped to the type */ \
+    BC_TYPED_OP(X, ADD, ABC)              \
+    BC_TYPED_OP(X, SUB, ABC)              \
+    BC_TYPED_OP(X, MUL, ABC)              \
+    BC_TYPED_OP(X, DIV, ABC)              \
+    BC_TYPED_OP(X, MOD, ABC)              \
+    /* A = -B */                          \
+    BC_TYPED_OP(X, NEG, AB)               \
+                                          \
+    /* A = B op C */                      \
+    X(BAND, ABC)                          \
+    X(BOR, ABC)                           \
+    X(BXOR, ABC)                          \
+    X(EQ, ABC)                            \
+    X(LT, ABC)                            \
+    X(GT, ABC)                            \
+    /* A = !B */                          \
+    X(NOT, AB)                            \
+                                          \
+    /* A = B + C, strings */              \
+    X(CONCAT, ABC)                        \
+    /* A = B == C, strings */             \
+    X(STREQ, ABC)                         \
+                                          \
+    X(JMP, sJ)                            \
+    /* jump if A is false */              \
+    X(JMPF, AsBx)                         \
+    /* jump if A is true */               \
+    X(JMPT, AsBx)                         \
+                                          \
+    /* Call the function or closure in A  \
+     * with C arguments in A+1.., result  \
+     * in A */                            \
+    X(CALL, ABC)                          \
+    /* Same, calls function Bx */         \
+    X(CALLK, ABx)                         \
+    /* CALL and CALLK in place of the     \
+     * current call, see tailcall.h */    \
+    X(TAILCALL, ABC)                      \
+    X(TAILCALLK, ABx)                     \
+    /* return A */                        \
+    X(RET, A)                             \
+    /* return 0 */                        \
+    X(RET0, NONE)
+
+#define BC_OPCODE_ENUM(name, format) BC_##name,
+
+typedef enum { BC_OPCODES(BC_OPCODE_ENUM) BC_OPCODE_COUNT } bc_opcode;
+
+#undef BC_OPCODE_ENUM
+
+typedef enum {
+#define BC_INT_TYPE_ENUM(name) BC_INT_##name,
+    BC_INT_TYPES(BC_INT_TYPE_ENUM)
+#undef BC_INT_TYPE_ENUM
+} bc_int_type;
+
+typedef uint32_t bc_instr;
+
+#define BC_OP(i) ((bc_opcode)((i) & 0xff))
+#define BC_A(i) (((i) >> 8) & 0xff)
+#define BC_B(i) (((i) >> 16) & 0xff)
+#define BC_C(i) (((i) >> 24) & 0xff)
+#define BC_BX(i) ((i) >> 16)
+#define BC_SBX(i) ((int32_t)(int16_t)((i) >> 16))
+#define BC_SJ(i) ((int32_t)(i) >> 8)
+
+#define BC_MAKE_ABC(op, a, b, c)           \
+    ((bc_instr)(op) | (bc_instr)(a) << 8 | \
+     (bc_instr)(b) << 16 | (bc_instr)(c) << 24)
+#define BC_MAKE_ABX(op, a, bx) \
+    ((bc_instr)(op) | (bc_instr)(a) << 8 | (bc_instr)(uint16_t)(bx) << 16)
+#define BC_MAKE_SJ(op, sj) ((bc_instr)(op) | (bc_instr)(sj) << 8)
+
+#define BC_MAX_REGISTERS 256
+#define BC_SBX_MIN INT16_MIN
+#define BC_SBX_MAX INT16_MAX
+#define BC_SJ_MIN (-(1 << 23))
+#define BC_SJ_MAX ((1 << 23) - 1)
+
+/* A string value is a pointer to one of these */
+typedef struct {
+    size_t len;
+    char chars[];
+} bc_string;
+
+typedef struct {
+    /* Not zero terminated, points into the source for named functions */
+    const char* name;
+    size_t name_len;
+
+    bc_instr* code;
+    size_t code_len;
+
+    uint8_t param_count;
+
+    /* Registers the function needs, including its parameters */
+    uint16_t register_count;
+} bc_function;
+
+typedef VEC(bc_function) vec_bc_function;
+typedef VEC(int64_t) vec_bc_constant;
+
+/* Value of bc_module.main when there is no main function */
+#define BC_NO_FUNCTION ((size_t) -1)
+
+typedef struct {
+    /* Named functions first, in the order they are declared, then lambdas */
+    vec_bc_function functions;
+
+    /* Integers too large for LOADI and pointers to bc_string */
+    vec_bc_constant constants;
+
+    size_t main;
+} bc_module;
+
+/**
+ * Lowers a typechecked AST to bytecode. All the memory of the module comes
+ * from `allocator` and may point into the AST and the source. The calls
+ * that are not tail calls are reported to `tail_report`, unless it is NULL
+ * (see tailcall.h).
+ *
+ * Returns false after printing to diag_stream() if the program uses
+ * something the bytecode cannot express yet, or closure_convert() fails.
+ */
+bool bc_compile(
+    allocator_t* allocator,
+    ast_item_node* ast,
+    FILE* tail_report,
+    bc_module* out
+);
+
+/**
+ * Name of an opcode, as printed by the disassembler.
+ */
+const char* bc_opcode_name(bc_opcode op);
+
+/**
+ * Prints every function of the module in a readable form.
+ */
+void bc_disassemble(FILE* out, const bc_module* module);
+
+#endif  // BYTECODE_H
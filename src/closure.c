@@ -0,0 +1,724 @@
+#include "closure.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "diag.h"
+#include "vec.h"
+
+#define NO_VARIABLE ((size_t) -1)
+
+/* Most arguments a lifted lambda is called with, parameters and captures
+ * together: as many as the native backend passes in registers */
+#define MAX_LIFTED_ARGS 6
+
+/* How a value is used, which decides whether it escapes */
+typedef enum {
+    /* Computed with, or tested */
+    USE_VALUE,
+
+    /* Called, by `call` */
+    USE_CALLEE,
+
+    /* Passed to parameter `param` of named function `function` */
+    USE_ARGUMENT,
+
+    /* Given to `variable`, by its `let` if `binds` */
+    USE_STORE,
+
+    /* Returned, or passed to a function that is not known */
+    USE_ESCAPE,
+} use_kind;
+
+typedef struct {
+    use_kind kind;
+
+    ast_node_call* call;
+    size_t function;
+    size_t param;
+    size_t variable;
+    bool binds;
+} use;
+
+/* A parameter passed on to another function */
+typedef struct {
+    size_t function;
+    size_t param;
+} argument;
+
+typedef VEC(argument) vec_argument;
+typedef VEC(ast_node_call*) vec_call;
+typedef VEC(size_t) vec_size;
+
+typedef struct {
+    /* Frame of the function that declares it */
+    size_t frame;
+
+    bool assigned;
+    bool captured;
+
+    /* Used as anything but a callee */
+    bool used;
+
+    /* Stored or returned, or captured: escapes whatever else it does */
+    bool stored;
+
+    /* The named function parameters it is passed to, and the calls that
+     * call it */
+    vec_argument arguments;
+    vec_call calls;
+
+    bool escapes;
+} variable;
+
+typedef VEC(variable) vec_variable;
+
+typedef struct {
+    const char* name;
+    size_t len;
+    size_t variable;
+} scope_entry;
+
+typedef VEC(scope_entry) vec_scope_entry;
+
+/* A function being walked */
+typedef struct {
+    /* NULL for named functions */
+    ast_node_lambda* lambda;
+
+    /* Its first entry in the scope */
+    size_t scope_start;
+
+    /* What it captures so far, in the order they are first used */
+    VEC(ast_capture) captures;
+    vec_size captured;
+
+    /* Last statement, if its value is returned */
+    ast_stmt_node* result;
+} frame;
+
+typedef VEC(frame) vec_frame;
+
+/* A lambda, where it is made */
+typedef struct {
+    ast_node_lambda* lambda;
+    use context;
+
+    /* The variables it captures */
+    vec_size captured;
+} site;
+
+typedef VEC(site) vec_site;
+
+typedef struct {
+    /* The parameters of the named function, and how many */
+    size_t first_param;
+    size_t param_count;
+
+    const char* name;
+    size_t name_len;
+} named_function;
+
+typedef VEC(named_function) vec_named_function;
+
+typedef struct {
+    allocator_t* allocator;
+    bool ok;
+
+    vec_variable variables;
+    vec_scope_entry scope;
+    vec_frame frames;
+    vec_site sites;
+    vec_named_function functions;
+} converter;
+
+static void convert_error(converter* self, const char* fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    diag_vprintf(fmt, args);
+    va_end(args);
+
+    self->ok = false;
+}
+
+static const use VALUE = {.kind = USE_VALUE};
+static const use ESCAPE = {.kind = USE_ESCAPE};
+
+static bool is_unit(ast_typename* type) {
+    return type == NULL ||
+           (type->type == TYPE_NAME_TUPLE && type->as.tuple.items.len == 0);
+}
+
+static variable* variable_at(converter* self, size_t index) {
+    return &self->variables.items[index];
+}
+
+static frame* current_frame(converter* self) {
+    return &self->frames.items[self->frames.len - 1];
+}
+
+// Names
+
+static size_t declare(converter* self) {
+    variable v = {
+        .frame = self->frames.len - 1,
+        .arguments = vec_make(self->allocator),
+        .calls = vec_make(self->allocator),
+    };
+
+    vec_push(&self->variables, &v);
+    return self->variables.len - 1;
+}
+
+static void bind(converter* self, const char* name, size_t len, size_t var) {
+    scope_entry entry = {.name = name, .len = len, .variable = var};
+    vec_push(&self->scope, &entry);
+}
+
+/* Marks `var` as captured by every lambda between its function and the
+ * current one */
+static void capture(converter* self, const char* name, size_t len, size_t var) {
+    variable_at(self, var)->captured = true;
+
+    for (size_t f = variable_at(self, var)->frame + 1; f < self->frames.len;
+         f++) {
+        frame* fn = &self->frames.items[f];
+        bool known = false;
+
+        for (size_t i = 0; i < fn->captured.len && !known; i++) {
+            known = fn->captured.items[i] == var;
+        }
+
+        if (!known) {
+            ast_capture c = {.name = name, .len = len};
+
+            vec_push(&fn->captures, &c);
+            vec_push(&fn->captured, &var);
+        }
+    }
+}
+
+/* The variable `name` refers to, NO_VARIABLE for named functions */
+static size_t lookup(converter* self, const char* name, size_t len) {
+    for (size_t i = self->scope.len; i > 0; i--) {
+        scope_entry* entry = &self->scope.items[i - 1];
+
+        if (entry->len != len || memcmp(entry->name, name, len) != 0) {
+            continue;
+        }
+
+        if (variable_at(self, entry->variable)->frame + 1 <
+            self->frames.len) {
+            capture(self, name, len, entry->variable);
+        }
+
+        return entry->variable;
+    }
+
+    return NO_VARIABLE;
+}
+
+/* Named functions, the last one declared wins */
+static size_t lookup_function(converter* self, const char* name, size_t len) {
+    for (size_t i = self->functions.len; i > 0; i--) {
+        named_function* fn = &self->functions.items[i - 1];
+
+        if (fn->name_len == len && memcmp(fn->name, name, len) == 0) {
+            return i - 1;
+        }
+    }
+
+    return NO_VARIABLE;
+}
+
+// Walking
+
+static void walk_expr(converter* self, ast_expr_node* expr, use context);
+static frame walk_function(
+    converter* self,
+    ast_node_lambda* lambda,
+    ast_param* params,
+    ast_stmt_node* body,
+    ast_typename* return_type
+);
+
+static void use_variable(converter* self, size_t var, use context) {
+    variable* v = variable_at(self, var);
+
+    switch (context.kind) {
+        case USE_CALLEE:
+            vec_push(&v->calls, &context.call);
+            return;
+
+        case USE_ARGUMENT: {
+            argument arg = {
+                .function = context.function,
+                .param = context.param,
+            };
+
+            vec_push(&v->arguments, &arg);
+            v->used = true;
+            return;
+        }
+
+        case USE_VALUE:
+            v->used = true;
+            return;
+
+        case USE_STORE:
+        case USE_ESCAPE:
+            v->used = true;
+            v->stored = true;
+            return;
+    }
+}
+
+static void walk_assign(converter* self, ast_node_binary* expr, use context) {
+    if (expr->left->type != AST_IDEN) {
+        walk_expr(self, expr->right, ESCAPE);
+        return;
+    }
+
+    ast_node_identifier* iden = &expr->left->identifier;
+    size_t var = lookup(self, iden->start, iden->len);
+
+    if (var == NO_VARIABLE) {
+        walk_expr(self, expr->right, ESCAPE);
+        return;
+    }
+
+    if (variable_at(self, var)->frame + 1 < self->frames.len) {
+        convert_error(
+            self,
+            "lambdas cannot assign captured variables: '%.*s'",
+            (int)iden->len,
+            iden->start
+        );
+    }
+
+    variable_at(self, var)->assigned = true;
+
+    /* The value of the assignment goes on to be used as well */
+    use store = {.kind = USE_STORE, .variable = var};
+    walk_expr(self, expr->right, context.kind == USE_VALUE ? store : ESCAPE);
+}
+
+static void walk_call(converter* self, ast_node_call* call) {
+    ast_expr_node* callee = call->function;
+    size_t function = NO_VARIABLE;
+
+    call->lambda = NULL;
+
+    if (callee->type == AST_IDEN) {
+        ast_node_identifier* iden = &callee->identifier;
+        size_t var = lookup(self, iden->start, iden->len);
+
+        if (var != NO_VARIABLE) {
+            use_variable(
+                self, var, (use){.kind = USE_CALLEE, .call = call}
+            );
+        } else {
+            function = lookup_function(self, iden->start, iden->len);
+        }
+    } else {
+        walk_expr(self, callee, (use){.kind = USE_CALLEE, .call = call});
+    }
+
+    for (size_t i = 0; i < call->args.len; i++) {
+        use context = ESCAPE;
+
+        if (function != NO_VARIABLE &&
+            i < self->functions.items[function].param_count) {
+            context = (use){
+                .kind = USE_ARGUMENT,
+                .function = function,
+                .param = i,
+            };
+        }
+
+        walk_expr(self, call->args.items[i], context);
+    }
+}
+
+static void walk_lambda(converter* self, ast_node_lambda* lambda, use context) {
+    frame fn = walk_function(
+        self, lambda, lambda->params, lambda->body, lambda->return_type
+    );
+
+    if (lambda->captures.len != 0) {
+        slice_free(self->allocator, &lambda->captures);
+    }
+
+    lambda->captures.len = fn.captures.len;
+
+    if (fn.captures.len != 0) {
+        lambda->captures.items = ALLOC_ARRAY(
+            self->allocator, ast_capture, fn.captures.len
+        );
+        memcpy(
+            lambda->captures.items,
+            fn.captures.items,
+            fn.captures.len * sizeof(ast_capture)
+        );
+    }
+
+    site s = {
+        .lambda = lambda,
+        .context = context,
+        .captured = fn.captured,
+    };
+
+    vec_push(&self->sites, &s);
+    vec_free(&fn.captures);
+}
+
+static void walk_expr(converter* self, ast_expr_node* expr, use context) {
+    switch (expr->type) {
+        case AST_NUM:
+        case AST_BOOL:
+        case AST_STR:
+            return;
+
+        case AST_IDEN: {
+            ast_node_identifier* iden = &expr->identifier;
+            size_t var = lookup(self, iden->start, iden->len);
+
+            if (var != NO_VARIABLE) {
+                use_variable(self, var, context);
+            }
+
+            return;
+        }
+
+        case AST_BINARY:
+            if (expr->binary.op == TOK_ASSIGN) {
+                walk_assign(self, &expr->binary, context);
+                return;
+            }
+
+            walk_expr(self, expr->binary.left, VALUE);
+            walk_expr(self, expr->binary.right, VALUE);
+            return;
+
+        case AST_UNARY:
+            walk_expr(self, expr->unary.expr, VALUE);
+            return;
+
+        case AST_CALL:
+            walk_call(self, &expr->call);
+            return;
+
+        case AST_LAMBDA:
+            walk_lambda(self, &expr->lambda, context);
+            return;
+    }
+}
+
+static void walk_stmt(converter* self, ast_stmt_node* stmt) {
+    switch (stmt->type) {
+        case AST_EXPR_STMT: {
+            bool is_result = current_frame(self)->result == stmt;
+            walk_expr(self, stmt->expr_stmt.expr, is_result ? ESCAPE : VALUE);
+            return;
+        }
+
+        case AST_VAR_DECL: {
+            ast_node_var_decl* decl = &stmt->var_decl;
+            size_t var = declare(self);
+
+            if (decl->value != NULL) {
+                use store = {.kind = USE_STORE, .variable = var, .binds = true};
+                walk_expr(self, decl->value, store);
+            }
+
+            /* Declared after its value, which may refer to a shadowed
+             * variable */
+            bind(self, decl->name.span, decl->name.span_size, var);
+            return;
+        }
+
+        case AST_BLOCK: {
+            size_t saved = self->scope.len;
+
+            for (ast_stmt_node* curr = stmt->block.body; curr != NULL;
+                 curr = curr->next) {
+                walk_stmt(self, curr);
+            }
+
+            self->scope.len = saved;
+            return;
+        }
+
+        case AST_IF_ELSE:
+            walk_expr(self, stmt->if_else.condition, VALUE);
+            walk_stmt(self, stmt->if_else.body);
+
+            if (stmt->if_else.else_body != NULL) {
+                walk_stmt(self, stmt->if_else.else_body);
+            }
+
+            return;
+
+        case AST_WHILE:
+            walk_expr(self, stmt->while_.condition, VALUE);
+            walk_stmt(self, stmt->while_.body);
+            return;
+    }
+}
+
+/* Walks a function with its parameters declared, and returns its frame */
+static frame walk_function(
+    converter* self,
+    ast_node_lambda* lambda,
+    ast_param* params,
+    ast_stmt_node* body,
+    ast_typename* return_type
+) {
+    frame fn = {
+        .lambda = lambda,
+        .scope_start = self->scope.len,
+        .captures = vec_make(self->allocator),
+        .captured = vec_make(self->allocator),
+        .result = NULL,
+    };
+
+    if (!is_unit(return_type)) {
+        for (ast_stmt_node* curr = body; curr != NULL; curr = curr->next) {
+            fn.result = curr->type == AST_EXPR_STMT ? curr : NULL;
+        }
+    }
+
+    vec_push(&self->frames, &fn);
+
+    for (ast_param* param = params; param != NULL; param = param->next) {
+        size_t var = declare(self);
+        bind(self, param->name.span, param->name.span_size, var);
+    }
+
+    for (ast_stmt_node* curr = body; curr != NULL; curr = curr->next) {
+        walk_stmt(self, curr);
+    }
+
+    self->scope.len = fn.scope_start;
+    return self->frames.items[--self->frames.len];
+}
+
+// Deciding
+
+/* Whether parameters escape, until nothing changes */
+static void solve_escapes(converter* self) {
+    for (size_t i = 0; i < self->variables.len; i++) {
+        variable* v = variable_at(self, i);
+        v->escapes = v->stored || v->captured;
+    }
+
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (size_t i = 0; i < self->variables.len; i++) {
+            variable* v = variable_at(self, i);
+
+            for (size_t k = 0; k < v->arguments.len && !v->escapes; k++) {
+                argument* arg = &v->arguments.items[k];
+                named_function* fn = &self->functions.items[arg->function];
+
+                if (variable_at(self, fn->first_param + arg->param)->escapes) {
+                    v->escapes = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+/* Whether the captures of the lambda made at `s` fit in the arguments of
+ * its calls */
+static bool fits_lifted(const site* s) {
+    size_t count = s->captured.len;
+
+    for (ast_param* p = s->lambda->params; p != NULL; p = p->next) {
+        count++;
+    }
+
+    return count <= MAX_LIFTED_ARGS;
+}
+
+/* Whether the lambda made at `s` can be called with the values of its
+ * captures wherever the variable it is bound to is called */
+static bool can_lift(converter* self, const site* s, variable* bound) {
+    if (bound->used || bound->assigned || bound->captured || !fits_lifted(s)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < s->captured.len; i++) {
+        if (variable_at(self, s->captured.items[i])->assigned) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static ast_closure_kind decide(converter* self, const site* s) {
+    const use* context = &s->context;
+
+    if (s->captured.len == 0) {
+        return AST_CLOSURE_NONE;
+    }
+
+    switch (context->kind) {
+        case USE_CALLEE:
+            /* Only a `let` or an argument keeps an environment in the
+             * frame */
+            if (!fits_lifted(s)) {
+                return AST_CLOSURE_HEAP;
+            }
+
+            context->call->lambda = s->lambda;
+            return AST_CLOSURE_LIFTED;
+
+        case USE_STORE: {
+            variable* bound = variable_at(self, context->variable);
+
+            if (!context->binds) {
+                return AST_CLOSURE_HEAP;
+            }
+
+            if (can_lift(self, s, bound)) {
+                for (size_t i = 0; i < bound->calls.len; i++) {
+                    bound->calls.items[i]->lambda = s->lambda;
+                }
+
+                return AST_CLOSURE_LIFTED;
+            }
+
+            return bound->escapes ? AST_CLOSURE_HEAP : AST_CLOSURE_STACK;
+        }
+
+        case USE_ARGUMENT: {
+            named_function* fn = &self->functions.items[context->function];
+            variable* param = variable_at(
+                self, fn->first_param + context->param
+            );
+
+            return param->escapes ? AST_CLOSURE_HEAP : AST_CLOSURE_STACK;
+        }
+
+        default:
+            return AST_CLOSURE_HEAP;
+    }
+}
+
+bool closure_convert(allocator_t* allocator, ast_item_node* ast) {
+    converter self = {
+        .allocator = allocator,
+        .ok = true,
+        .variables = vec_make(allocator),
+        .scope = vec_make(allocator),
+        .frames = vec_make(allocator),
+        .sites = vec_make(allocator),
+        .functions = vec_make(allocator),
+    };
+
+    /* The parameters of named functions first, for the calls that come
+     * before their function */
+    vec_push(&self.frames, &(frame){.lambda = NULL});
+
+    for (ast_item_node* item = ast; item != NULL; item = item->next) {
+        if (item->type != AST_FN) {
+            continue;
+        }
+
+        named_function fn = {
+            .first_param = self.variables.len,
+            .param_count = 0,
+            .name = item->function.name.span,
+            .name_len = item->function.name.span_size,
+        };
+
+        for (ast_param* param = item->function.params; param != NULL;
+             param = param->next) {
+            declare(&self);
+            fn.param_count++;
+        }
+
+        vec_push(&self.functions, &fn);
+    }
+
+    self.frames.len = 0;
+
+    size_t index = 0;
+    for (ast_item_node* item = ast; item != NULL; item = item->next) {
+        if (item->type != AST_FN) {
+            continue;
+        }
+
+        ast_node_function* fn = &item->function;
+        named_function* named = &self.functions.items[index++];
+        frame outer = {
+            .lambda = NULL,
+            .scope_start = 0,
+            .captures = vec_make(allocator),
+            .captured = vec_make(allocator),
+            .result = NULL,
+        };
+
+        if (!is_unit(fn->return_type)) {
+            for (ast_stmt_node* curr = fn->body; curr != NULL;
+                 curr = curr->next) {
+                outer.result = curr->type == AST_EXPR_STMT ? curr : NULL;
+            }
+        }
+
+        vec_push(&self.frames, &outer);
+
+        size_t p = 0;
+        for (ast_param* param = fn->params; param != NULL;
+             param = param->next) {
+            bind(
+                &self,
+                param->name.span,
+                param->name.span_size,
+                named->first_param + p++
+            );
+        }
+
+        for (ast_stmt_node* curr = fn->body; curr != NULL; curr = curr->next) {
+            walk_stmt(&self, curr);
+        }
+
+        self.scope.len = 0;
+        self.frames.len = 0;
+        vec_free(&outer.captures);
+        vec_free(&outer.captured);
+    }
+
+    solve_escapes(&self);
+
+    for (size_t i = 0; i < self.sites.len; i++) {
+        site* s = &self.sites.items[i];
+        s->lambda->closure = decide(&self, s);
+    }
+
+    for (size_t i = 0; i < self.sites.len; i++) {
+        site* s = &self.sites.items[i];
+        vec_free(&s->captured);
+    }
+
+    for (size_t i = 0; i < self.variables.len; i++) {
+        vec_free(&self.variables.items[i].arguments);
+        vec_free(&self.variables.items[i].calls);
+    }
+
+    vec_free(&self.variables);
+    vec_free(&self.scope);
+    vec_free(&self.frames);
+    vec_free(&self.sites);
+    vec_free(&self.functions);
+
+    return self.ok;
+}
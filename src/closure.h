@@ -0,0 +1,54 @@
+/**
+ * Closure conversion
+ *
+ * Lambdas can use the variables of the functions they are declared in.
+ * This finds the variables every lambda captures and decides how it gets
+ * them (see ast_closure_kind), the cheapest way that is safe:
+ *
+ * - a lambda that captures nothing is a plain function value,
+ * - a lambda that is only called, right where it is written or through a
+ *   `let` that is never assigned, captured or used any other way, is
+ *   lifted: its calls pass the captured values as extra arguments, as long
+ *   as they and its parameters fit in the native argument registers,
+ * - a lambda that cannot outlive the call that makes it, because it is
+ *   bound by such a `let` or passed to a parameter of a named function,
+ *   and neither escapes, keeps its environment in the frame of that call,
+ * - any other lambda gets its environment on the heap.
+ *
+ * Captures are by value, taken when the closure is made. A lambda cannot
+ * assign a variable it captures, and a lambda is only lifted through a
+ * `let` if none of the variables it captures are ever assigned, so that
+ * the values its calls pass are the ones it was made with.
+ *
+ * A variable escapes if it is stored in another variable, returned,
+ * captured, or passed to a lambda or to a parameter that escapes. Whether
+ * parameters escape is a fixed point over all the named functions,
+ * starting from none escaping.
+ *
+ * The backends share how closures are represented. A lambda's captured
+ * values follow its parameters, and a closure made with an environment is
+ * called with the environment as an extra argument after the others. The
+ * environment holds the function followed by the captured values, and the
+ * value of the closure is its address with the lowest bit set, which is
+ * always clear for plain functions.
+ */
+
+#ifndef CLOSURE_H
+#define CLOSURE_H
+
+#include <stdbool.h>
+
+#include "alloc.h"
+#include "ast.h"
+
+/**
+ * Annotates the lambdas of a typechecked AST, and the calls of the lifted
+ * ones, in place. Running it again on the same AST gives the same result.
+ * The lists of captures come from `allocator`.
+ *
+ * Returns false after printing to diag_stream() if a lambda assigns a
+ * variable it captures.
+ */
+bool closure_convert(allocator_t* allocator, ast_item_node* ast);
+
+#endif  // CLOSURE_H
@@ -0,0 +1,1469 @@
+#include "codegen.h"
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "diag.h"
+#include "regalloc.h"
+
+#define SYMBOL_PREFIX "one."
+
+/* System V integer argument registers */
+static const x86_reg ARG_REGS[] = {
+    X86_RDI, X86_RSI, X86_RDX, X86_RCX, X86_R8, X86_R9,
+};
+
+#define REG_ARG_COUNT (sizeof(ARG_REGS) / sizeof(ARG_REGS[0]))
+
+/* Where the callee finds its stack arguments, past rbp and the return
+ * address */
+#define STACK_ARGS_DISP 16
+
+/* Functions the generated code calls into, made when first needed */
+typedef enum {
+    RUNTIME_CONCAT,
+    RUNTIME_STREQ,
+    RUNTIME_DIV_ZERO,
+    RUNTIME_CLOSURE,
+
+    RUNTIME_COUNT,
+} runtime_function;
+
+static const char* const RUNTIME_NAMES[] = {
+    [RUNTIME_CONCAT] = SYMBOL_PREFIX "rt.concat",
+    [RUNTIME_STREQ] = SYMBOL_PREFIX "rt.streq",
+    [RUNTIME_DIV_ZERO] = SYMBOL_PREFIX "rt.div_zero",
+    [RUNTIME_CLOSURE] = SYMBOL_PREFIX "rt.closure",
+};
+
+/* A branch to a block that needs moves on the way, for its phi nodes or
+ * for values that go back to their registers there, goes through a stub
+ * that makes them */
+typedef struct {
+    x86_label label;
+    ir_block from;
+    ir_block to;
+} edge_stub;
+
+typedef VEC(edge_stub) vec_edge_stub;
+
+/* One of a set of moves made at once */
+typedef struct {
+    /* A register or memory */
+    x86_operand dst;
+
+    /* Anything, unless `remat` is a value to put back instead */
+    x86_operand src;
+    ir_value remat;
+} move;
+
+typedef VEC(move) vec_move;
+
+/* Where divisions by zero go that are reported in `function`, which
+ * differs from the one being lowered once it is inlined */
+typedef struct {
+    size_t function;
+    x86_label label;
+} div_zero_stub;
+
+typedef VEC(div_zero_stub) vec_div_zero_stub;
+
+typedef struct {
+    allocator_t* allocator;
+    const ir_program* program;
+    x86_asm* as;
+    codegen_options options;
+
+    /* Symbol of every function of the program, by index */
+    x86_symbol* functions;
+
+    /* Label of every string literal of the program, made when first
+     * needed */
+    x86_label* strings;
+    bool* has_string;
+
+    x86_symbol runtime[RUNTIME_COUNT];
+    bool runtime_used[RUNTIME_COUNT];
+
+    /* Function being lowered, where its values are, and how many times
+     * every value is used */
+    const ir_function* fn;
+    regalloc_result ra;
+    size_t* uses;
+
+    /* Where the environment of every closure it makes is built, in words
+     * past the slots, and how many words they take */
+    size_t* envs;
+    size_t env_words;
+
+    /* Label of every block, and the stubs to emit after them */
+    x86_label* blocks;
+    vec_edge_stub stubs;
+
+    /* Position of the instruction being lowered, see regalloc.h */
+    size_t position;
+
+    /* Block that comes next in the output, IR_NONE for none */
+    ir_block next;
+
+    vec_move moves;
+
+    /* Where divisions by zero in it go, made when first needed */
+    vec_div_zero_stub div_zero;
+
+    /* The first error unwinds straight back to codegen */
+    jmp_buf on_error;
+} codegen_state;
+
+static void codegen_error(codegen_state* self, const char* fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    diag_vprintf(fmt, args);
+    va_end(args);
+
+    longjmp(self->on_error, 1);
+}
+
+static x86_symbol use_runtime(codegen_state* self, runtime_function f) {
+    self->runtime_used[f] = true;
+    return self->runtime[f];
+}
+
+static const ir_instr* instr_of(codegen_state* self, ir_value value) {
+    return &self->fn->values.items[value];
+}
+
+static x86_width width_of(ir_type type) {
+    return (x86_width)ir_type_size(type);
+}
+
+/* Brings `reg` back into the range of `type` */
+static void wrap(codegen_state* self, x86_reg reg, ir_type type) {
+    x86_extend(self->as, reg, width_of(type), ir_type_is_signed(type));
+}
+
+// Values
+
+/* Slots are below the saved registers */
+static x86_operand slot(codegen_state* self, ir_value value) {
+    size_t index = self->ra.saved_count + self->ra.values[value].slot;
+    return X86_MEM(X86_RBP, -8 * (int32_t)(index + 1));
+}
+
+/* Environments are below the slots, word 0 first */
+static int32_t env_disp(codegen_state* self, ir_value value) {
+    size_t words = instr_of(self, value)->args.len;
+    size_t index = self->ra.saved_count + self->ra.slot_count +
+                   self->envs[value] + words;
+    return -8 * (int32_t)index;
+}
+
+static bool in_reg(codegen_state* self, ir_value value, size_t position) {
+    return regalloc_in_reg(&self->ra, value, position);
+}
+
+/* Where an instruction at `position` can read `value` from as it is: its
+ * register, its slot, or the constant itself if it fits. False for the
+ * values that are put back into a register instead. */
+static bool place(
+    codegen_state* self, ir_value value, size_t position, x86_operand* out
+) {
+    const ir_instr* instr = instr_of(self, value);
+
+    if (instr->op == IR_CONST) {
+        if (instr->imm < INT32_MIN || instr->imm > INT32_MAX) {
+            return false;
+        }
+
+        *out = X86_IMM((int32_t)instr->imm);
+        return true;
+    }
+
+    if (instr->op == IR_FUNCTION || instr->op == IR_STRING) {
+        return false;
+    }
+
+    if (in_reg(self, value, position)) {
+        *out = X86_REG(self->ra.values[value].reg);
+        return true;
+    }
+
+    if (!self->ra.values[value].has_slot) {
+        codegen_error(self, "BUG: value v%u has no place", value);
+    }
+
+    *out = slot(self, value);
+    return true;
+}
+
+static x86_label string_label(codegen_state* self, size_t index) {
+    if (!self->has_string[index]) {
+        const ir_string* str = &self->program->strings.items[index];
+
+        self->strings[index] = x86_string(self->as, str->str, str->len);
+        self->has_string[index] = true;
+    }
+
+    return self->strings[index];
+}
+
+/* Sets `reg` to `value`, a constant, function or string */
+static void rematerialize(codegen_state* self, x86_reg reg, ir_value value) {
+    const ir_instr* instr = instr_of(self, value);
+
+    switch (instr->op) {
+        case IR_CONST:
+            x86_mov_imm(self->as, reg, instr->imm);
+            return;
+
+        case IR_FUNCTION:
+            x86_lea_symbol(self->as, reg, self->functions[instr->imm]);
+            return;
+
+        default:
+            x86_lea_label(self->as, reg, string_label(self, instr->imm));
+            return;
+    }
+}
+
+static void load(codegen_state* self, x86_reg reg, ir_value value) {
+    x86_operand src;
+
+    if (!place(self, value, self->position, &src)) {
+        rematerialize(self, reg, value);
+    } else if (src.kind != X86_OPERAND_REG || src.reg != reg) {
+        x86_mov(self->as, reg, src);
+    }
+}
+
+/* Where an instruction can read `value`, put in `scratch` if it has to */
+static x86_operand operand(
+    codegen_state* self, ir_value value, x86_reg scratch
+) {
+    x86_operand src;
+
+    if (!place(self, value, self->position, &src)) {
+        rematerialize(self, scratch, value);
+        return X86_REG(scratch);
+    }
+
+    return src;
+}
+
+/* Register to compute `value` in: its own, or rax */
+static x86_reg target(codegen_state* self, ir_value value) {
+    if (in_reg(self, value, self->position)) {
+        return self->ra.values[value].reg;
+    }
+
+    return X86_RAX;
+}
+
+/* `value` was computed in `reg`, puts it where it lives */
+static void define(codegen_state* self, ir_value value, x86_reg reg) {
+    const regalloc_location* location = &self->ra.values[value];
+
+    if (in_reg(self, value, self->position) && location->reg != reg) {
+        x86_mov(self->as, location->reg, X86_REG(reg));
+    }
+
+    if (location->has_slot) {
+        x86_operand dst = slot(self, value);
+        x86_store(self->as, dst.reg, dst.value, reg);
+    }
+}
+
+// Parallel moves
+
+static void add_move(
+    codegen_state* self, x86_operand dst, x86_operand src, ir_value remat
+) {
+    move m = {.dst = dst, .src = src, .remat = remat};
+    vec_push(&self->moves, &m);
+}
+
+/* Moves `value` as it is at `position` to `dst` */
+static void add_value_move(
+    codegen_state* self, x86_operand dst, ir_value value, size_t position
+) {
+    x86_operand src;
+
+    if (place(self, value, position, &src)) {
+        add_move(self, dst, src, IR_NONE);
+    } else {
+        add_move(self, dst, X86_IMM(0), value);
+    }
+}
+
+static bool same_place(x86_operand a, x86_operand b) {
+    return a.kind == b.kind && a.kind != X86_OPERAND_IMM && a.reg == b.reg &&
+           (a.kind == X86_OPERAND_REG || a.value == b.value);
+}
+
+static void emit_move(codegen_state* self, const move* m) {
+    x86_reg reg = m->dst.kind == X86_OPERAND_REG ? m->dst.reg : X86_RAX;
+
+    if (m->remat != IR_NONE) {
+        rematerialize(self, reg, m->remat);
+    } else if (m->dst.kind == X86_OPERAND_MEM &&
+               m->src.kind == X86_OPERAND_REG) {
+        reg = m->src.reg;
+    } else {
+        x86_mov(self->as, reg, m->src);
+    }
+
+    if (m->dst.kind == X86_OPERAND_MEM) {
+        x86_store(self->as, m->dst.reg, m->dst.value, reg);
+    }
+}
+
+/* Makes the moves as if at once: a move waits for the ones that read its
+ * destination, and cycles are broken through r11 */
+static void emit_moves(codegen_state* self) {
+    vec_move* moves = &self->moves;
+    size_t pending = 0;
+
+    for (size_t i = 0; i < moves->len; i++) {
+        if (moves->items[i].remat != IR_NONE ||
+            !same_place(moves->items[i].dst, moves->items[i].src)) {
+            moves->items[pending++] = moves->items[i];
+        }
+    }
+
+    while (pending != 0) {
+        size_t ready = pending;
+
+        for (size_t i = 0; i < pending && ready == pending; i++) {
+            bool read = false;
+
+            for (size_t j = 0; j < pending && !read; j++) {
+                read = j != i && moves->items[j].remat == IR_NONE &&
+                       same_place(moves->items[j].src, moves->items[i].dst);
+            }
+
+            if (!read) {
+                ready = i;
+            }
+        }
+
+        if (ready == pending) {
+            x86_operand dst = moves->items[0].dst;
+
+            x86_mov(self->as, X86_R11, dst);
+
+            for (size_t j = 0; j < pending; j++) {
+                if (same_place(moves->items[j].src, dst)) {
+                    moves->items[j].src = X86_REG(X86_R11);
+                }
+            }
+
+            ready = 0;
+        }
+
+        emit_move(self, &moves->items[ready]);
+        moves->items[ready] = moves->items[--pending];
+    }
+
+    moves->len = 0;
+}
+
+// Instructions
+
+static bool is_comparison(ir_opcode op) {
+    return op == IR_EQ || op == IR_NE || op == IR_LT || op == IR_LE ||
+           op == IR_GT || op == IR_GE;
+}
+
+static x86_cond comparison_cond(ir_opcode op, ir_type type) {
+    bool unsigned_order = !ir_type_is_signed(type);
+
+    switch (op) {
+        case IR_EQ:
+            return X86_CC_E;
+        case IR_NE:
+            return X86_CC_NE;
+        case IR_LT:
+            return unsigned_order ? X86_CC_B : X86_CC_L;
+        case IR_GT:
+            return unsigned_order ? X86_CC_A : X86_CC_G;
+        case IR_LE:
+            return unsigned_order ? X86_CC_BE : X86_CC_LE;
+        default:
+            break;
+    }
+
+    return unsigned_order ? X86_CC_AE : X86_CC_GE;
+}
+
+/* Condition codes come in pairs that differ in the lowest bit */
+static x86_cond negate(x86_cond cond) {
+    return cond ^ 1;
+}
+
+/* Whether comparison `value` only decides the branch right after it, which
+ * then tests the flags rather than a boolean */
+static bool is_fused(codegen_state* self, ir_value value) {
+    const ir_instr* instr = instr_of(self, value);
+
+    if (!is_comparison(instr->op) || self->uses[value] != 1) {
+        return false;
+    }
+
+    const vec_ir_value* instrs = &self->fn->blocks.items[instr->block].instrs;
+    const ir_instr* terminator = instr_of(self, instrs->items[instrs->len - 1]);
+
+    return instrs->len >= 2 && instrs->items[instrs->len - 2] == value &&
+           terminator->op == IR_BRANCH && terminator->args.items[0] == value;
+}
+
+/* Sets the flags for comparison `value` */
+static void lower_compare(codegen_state* self, ir_value value) {
+    const ir_instr* instr = instr_of(self, value);
+    x86_operand left = operand(self, instr->args.items[0], X86_RAX);
+
+    if (left.kind != X86_OPERAND_REG) {
+        x86_mov(self->as, X86_RAX, left);
+        left = X86_REG(X86_RAX);
+    }
+
+    x86_alu(
+        self->as,
+        X86_CMP,
+        X86_QWORD,
+        left.reg,
+        operand(self, instr->args.items[1], X86_RCX)
+    );
+}
+
+static x86_label div_zero_label(codegen_state* self, size_t function) {
+    for (size_t i = 0; i < self->div_zero.len; i++) {
+        if (self->div_zero.items[i].function == function) {
+            return self->div_zero.items[i].label;
+        }
+    }
+
+    div_zero_stub stub = {
+        .function = function,
+        .label = x86_label_make(self->as),
+    };
+
+    vec_push(&self->div_zero, &stub);
+    return stub.label;
+}
+
+static void lower_division(codegen_state* self, ir_value value) {
+    const ir_instr* instr = instr_of(self, value);
+
+    load(self, X86_RAX, instr->args.items[0]);
+    load(self, X86_RCX, instr->args.items[1]);
+
+    x86_test(self->as, X86_RCX, X86_RCX);
+    x86_jcc(self->as, X86_CC_E, div_zero_label(self, instr->imm));
+
+    /* Operands are in the range of their type, 64 bit division cannot
+     * overflow */
+    if (ir_type_is_signed(instr->type)) {
+        x86_cqo(self->as);
+        x86_idiv(self->as, X86_RCX);
+    } else {
+        x86_alu(self->as, X86_XOR, X86_DWORD, X86_RDX, X86_REG(X86_RDX));
+        x86_div(self->as, X86_RCX);
+    }
+
+    x86_reg result = instr->op == IR_MOD ? X86_RDX : X86_RAX;
+
+    wrap(self, result, instr->type);
+    define(self, value, result);
+}
+
+/* a op b, computed in the register of the result unless b is there */
+static void lower_arithmetic(codegen_state* self, ir_value value) {
+    const ir_instr* instr = instr_of(self, value);
+    x86_operand right = operand(self, instr->args.items[1], X86_RCX);
+    x86_reg work = target(self, value);
+
+    if (right.kind == X86_OPERAND_REG && right.reg == work) {
+        work = X86_RAX;
+    }
+
+    load(self, work, instr->args.items[0]);
+
+    /* Extended operands give an extended result */
+    switch (instr->op) {
+        case IR_ADD:
+            x86_alu(self->as, X86_ADD, width_of(instr->type), work, right);
+            wrap(self, work, instr->type);
+            break;
+
+        case IR_SUB:
+            x86_alu(self->as, X86_SUB, width_of(instr->type), work, right);
+            wrap(self, work, instr->type);
+            break;
+
+        case IR_MUL:
+            x86_imul(self->as, width_of(instr->type), work, right);
+            wrap(self, work, instr->type);
+            break;
+
+        case IR_AND:
+            x86_alu(self->as, X86_AND, X86_QWORD, work, right);
+            break;
+
+        case IR_OR:
+            x86_alu(self->as, X86_OR, X86_QWORD, work, right);
+            break;
+
+        default:
+            x86_alu(self->as, X86_XOR, X86_QWORD, work, right);
+            break;
+    }
+
+    define(self, value, work);
+}
+
+static void leave_frame(codegen_state* self);
+static void lower_epilogue(codegen_state* self);
+
+/* Words of arguments a call passes on the stack. A closure's environment
+ * goes there too when the registers are taken, whether the callee takes
+ * one or not. */
+static size_t stack_arg_words(size_t arg_count, ir_value indirect) {
+    size_t words = arg_count > REG_ARG_COUNT ? arg_count - REG_ARG_COUNT : 0;
+
+    return words + (indirect != IR_NONE && arg_count >= REG_ARG_COUNT);
+}
+
+/* Words of stack arguments, padding included, that every caller of the
+ * function being lowered pushes, which are free once the prologue moved
+ * the parameters where they live */
+static size_t incoming_arg_words(codegen_state* self) {
+    size_t params = self->fn->param_count;
+    size_t words = params > REG_ARG_COUNT ? params - REG_ARG_COUNT : 0;
+
+    return (words + 1) & ~(size_t)1;
+}
+
+/* Puts the arguments past the registers where the callee finds them, the
+ * environment of a closure after them if it goes there. A call pushes
+ * them, the last one first, with a word of padding past them if that keeps
+ * the stack aligned, and returns how many bytes it pushed. A tail call
+ * writes them over the stack arguments of the caller instead. */
+static int32_t lower_stack_args(
+    codegen_state* self,
+    const ir_value* args,
+    size_t arg_count,
+    ir_value indirect,
+    bool tail
+) {
+    x86_asm* as = self->as;
+    bool stack_env = indirect != IR_NONE && arg_count >= REG_ARG_COUNT;
+    size_t words = stack_arg_words(arg_count, indirect);
+
+    if (words == 0) {
+        return 0;
+    }
+
+    if (tail) {
+        for (size_t i = REG_ARG_COUNT; i < words + REG_ARG_COUNT; i++) {
+            int32_t disp = STACK_ARGS_DISP + 8 * (int32_t)(i - REG_ARG_COUNT);
+
+            if (i < arg_count) {
+                load(self, X86_RAX, args[i]);
+            } else {
+                load(self, X86_RAX, indirect);
+                x86_lea(as, X86_RAX, X86_RAX, -1);
+            }
+
+            x86_store(as, X86_RBP, disp, X86_RAX);
+        }
+
+        return 0;
+    }
+
+    if (words % 2 != 0) {
+        x86_alu(as, X86_SUB, X86_QWORD, X86_RSP, X86_IMM(8));
+        words++;
+    }
+
+    if (stack_env) {
+        load(self, X86_RAX, indirect);
+        x86_lea(as, X86_RAX, X86_RAX, -1);
+        x86_push(as, X86_RAX);
+    }
+
+    for (size_t i = arg_count; i-- > REG_ARG_COUNT;) {
+        load(self, X86_RAX, args[i]);
+        x86_push(as, X86_RAX);
+    }
+
+    return 8 * (int32_t)words;
+}
+
+/* Calls `callee` with the arguments in `args` and defines `value` as its
+ * result. Every value live after the call is in a callee-saved register
+ * or in its slot. A tail call leaves the frame and jumps to the callee
+ * instead, which returns to the caller; its stack arguments, if any, must
+ * fit in those of the caller. */
+static void lower_call_to(
+    codegen_state* self,
+    ir_value value,
+    x86_symbol callee,
+    const ir_value* args,
+    size_t arg_count,
+    ir_value indirect,
+    bool tail
+) {
+    int32_t pushed = lower_stack_args(self, args, arg_count, indirect, tail);
+
+    for (size_t i = 0; i < arg_count && i < REG_ARG_COUNT; i++) {
+        add_value_move(self, X86_REG(ARG_REGS[i]), args[i], self->position);
+    }
+
+    if (indirect != IR_NONE) {
+        add_value_move(self, X86_REG(X86_R10), indirect, self->position);
+    }
+
+    emit_moves(self);
+
+    /* The frame keeps the stack aligned. A closure is called with its
+     * environment after the arguments, already on the stack if it goes
+     * there. */
+    if (indirect != IR_NONE) {
+        x86_label plain = x86_label_make(self->as);
+
+        x86_mov(self->as, X86_R11, X86_REG(X86_R10));
+        x86_alu(self->as, X86_AND, X86_DWORD, X86_R11, X86_IMM(1));
+        x86_jcc(self->as, X86_CC_E, plain);
+
+        if (arg_count < REG_ARG_COUNT) {
+            x86_reg env = ARG_REGS[arg_count];
+
+            x86_lea(self->as, env, X86_R10, -1);
+            x86_mov(self->as, X86_R10, X86_MEM(env, 0));
+        } else {
+            x86_mov(self->as, X86_R10, X86_MEM(X86_R10, -1));
+        }
+
+        x86_bind(self->as, plain);
+    }
+
+    /* Neither the arguments nor r10 are callee-saved */
+    if (tail) {
+        leave_frame(self);
+
+        if (indirect != IR_NONE) {
+            x86_jmp_reg(self->as, X86_R10);
+        } else {
+            x86_jmp_symbol(self->as, callee);
+        }
+
+        return;
+    }
+
+    if (indirect != IR_NONE) {
+        x86_call_reg(self->as, X86_R10);
+    } else {
+        x86_call(self->as, callee);
+    }
+
+    if (pushed != 0) {
+        x86_alu(self->as, X86_ADD, X86_QWORD, X86_RSP, X86_IMM(pushed));
+    }
+
+    define(self, value, X86_RAX);
+}
+
+/* Reports a tail call that is made as a plain call, since its stack
+ * arguments do not fit in those of the caller */
+static void report_kept_tail_call(codegen_state* self, ir_value callee) {
+    FILE* out = self->options.tail_report;
+    const ir_instr* instr = instr_of(self, callee);
+
+    if (out == NULL) {
+        return;
+    }
+
+    fprintf(out, "%.*s -> ", (int)self->fn->name_len, self->fn->name);
+
+    if (instr->op == IR_FUNCTION) {
+        const ir_function* fn = &self->program->functions.items[instr->imm];
+        fprintf(out, "%.*s", (int)fn->name_len, fn->name);
+    } else {
+        fprintf(out, "?");
+    }
+
+    fprintf(out, ": the callee takes more stack arguments than the caller\n");
+}
+
+/* IR_CALL, or IR_TAIL_CALL if `tail` */
+static void lower_call(codegen_state* self, ir_value value, bool tail) {
+    const ir_instr* instr = instr_of(self, value);
+    size_t arg_count = instr->args.len - 1;
+    ir_value callee = instr->args.items[0];
+    bool direct = instr_of(self, callee)->op == IR_FUNCTION;
+
+    size_t words = stack_arg_words(arg_count, direct ? IR_NONE : callee);
+
+    /* Made as a call followed by a return otherwise */
+    bool jump = tail && words <= incoming_arg_words(self);
+
+    if (tail && !jump) {
+        report_kept_tail_call(self, callee);
+    }
+
+    if (direct) {
+        x86_symbol symbol = self->functions[instr_of(self, callee)->imm];
+        lower_call_to(
+            self,
+            value,
+            symbol,
+            instr->args.items + 1,
+            arg_count,
+            IR_NONE,
+            jump
+        );
+    } else {
+        lower_call_to(
+            self, value, 0, instr->args.items + 1, arg_count, callee, jump
+        );
+    }
+
+    if (tail && !jump) {
+        lower_epilogue(self);
+    }
+}
+
+/* Fills in the environment of closure `value` in its frame area */
+static void build_env(codegen_state* self, ir_value value) {
+    const ir_instr* instr = instr_of(self, value);
+    int32_t disp = env_disp(self, value);
+
+    for (size_t i = 0; i < instr->args.len; i++) {
+        x86_operand src = operand(self, instr->args.items[i], X86_RAX);
+
+        if (src.kind != X86_OPERAND_REG) {
+            x86_mov(self->as, X86_RAX, src);
+            src = X86_REG(X86_RAX);
+        }
+
+        x86_store(self->as, X86_RBP, disp + 8 * (int32_t)i, src.reg);
+    }
+}
+
+static void lower_closure(codegen_state* self, ir_value value) {
+    const ir_instr* instr = instr_of(self, value);
+    int32_t disp = env_disp(self, value);
+
+    build_env(self, value);
+
+    /* Made for the call, as is */
+    if (instr->op == IR_STACK_CLOSURE) {
+        x86_reg work = target(self, value);
+
+        x86_lea(self->as, work, X86_RBP, disp + 1);
+        define(self, value, work);
+        return;
+    }
+
+    x86_lea(self->as, X86_RDI, X86_RBP, disp);
+    x86_mov_imm(self->as, X86_RSI, 8 * (int64_t)instr->args.len);
+    x86_call(self->as, use_runtime(self, RUNTIME_CLOSURE));
+    define(self, value, X86_RAX);
+}
+
+static void lower_value(codegen_state* self, ir_value value) {
+    const ir_instr* instr = instr_of(self, value);
+    x86_asm* as = self->as;
+
+    switch (instr->op) {
+        /* Put back where they are used */
+        case IR_CONST:
+        case IR_FUNCTION:
+        case IR_STRING:
+
+        /* Set by the prologue and the predecessors */
+        case IR_PARAM:
+        case IR_PHI:
+            return;
+
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_AND:
+        case IR_OR:
+        case IR_XOR:
+            lower_arithmetic(self, value);
+            return;
+
+        case IR_DIV:
+        case IR_MOD:
+            lower_division(self, value);
+            return;
+
+        case IR_NEG:
+        case IR_NOT: {
+            x86_reg work = target(self, value);
+
+            load(self, work, instr->args.items[0]);
+
+            if (instr->op == IR_NEG) {
+                x86_neg(as, work);
+                wrap(self, work, instr->type);
+            } else {
+                x86_alu(as, X86_XOR, X86_DWORD, work, X86_IMM(1));
+            }
+
+            define(self, value, work);
+            return;
+        }
+
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_LE:
+        case IR_GT:
+        case IR_GE: {
+            if (is_fused(self, value)) {
+                return;
+            }
+
+            x86_reg work = target(self, value);
+
+            lower_compare(self, value);
+            x86_set(as, comparison_cond(instr->op, instr->type), work);
+            define(self, value, work);
+            return;
+        }
+
+        case IR_CONCAT:
+        case IR_STREQ: {
+            runtime_function f = instr->op == IR_CONCAT ? RUNTIME_CONCAT
+                                                        : RUNTIME_STREQ;
+
+            lower_call_to(
+                self,
+                value,
+                use_runtime(self, f),
+                instr->args.items,
+                2,
+                IR_NONE,
+                false
+            );
+            return;
+        }
+
+        case IR_CALL:
+            lower_call(self, value, false);
+            return;
+
+        case IR_STACK_CLOSURE:
+        case IR_CLOSURE:
+            lower_closure(self, value);
+            return;
+
+        case IR_CAPTURE: {
+            x86_reg work = target(self, value);
+            x86_operand env = operand(self, instr->args.items[0], X86_RAX);
+
+            if (env.kind != X86_OPERAND_REG) {
+                x86_mov(as, X86_RAX, env);
+                env = X86_REG(X86_RAX);
+            }
+
+            x86_mov(as, work, X86_MEM(env.reg, 8 * (int32_t)(instr->imm + 1)));
+            define(self, value, work);
+            return;
+        }
+
+        default:
+            codegen_error(self, "BUG: unexpected IR instruction");
+            return;
+    }
+}
+
+// Control flow
+
+/* Collects the moves of the edge from `from` to `to`: the phi nodes of
+ * `to`, and the values that are back in their registers there */
+static void collect_edge_moves(
+    codegen_state* self, ir_block from, ir_block to
+) {
+    const ir_function* fn = self->fn;
+    const ir_block_data* target = &fn->blocks.items[to];
+    const vec_ir_value* instrs = &fn->blocks.items[from].instrs;
+    size_t out = self->ra.positions[instrs->items[instrs->len - 1]];
+    size_t in = self->ra.block_starts[to];
+    size_t index = 0;
+
+    while (target->preds.items[index] != from) {
+        index++;
+    }
+
+    for (size_t i = 0; i < target->phis.len; i++) {
+        ir_value phi = target->phis.items[i];
+        ir_value arg = instr_of(self, phi)->args.items[index];
+
+        if (in_reg(self, phi, in)) {
+            x86_reg reg = self->ra.values[phi].reg;
+            add_value_move(self, X86_REG(reg), arg, out);
+        }
+
+        if (self->ra.values[phi].has_slot) {
+            add_value_move(self, slot(self, phi), arg, out);
+        }
+    }
+
+    for (size_t v = 0; v < fn->values.len; v++) {
+        if (regalloc_is_live_in(&self->ra, to, v) && in_reg(self, v, in) &&
+            !in_reg(self, v, out)) {
+            add_move(
+                self, X86_REG(self->ra.values[v].reg), slot(self, v), IR_NONE
+            );
+        }
+    }
+}
+
+static void lower_jump(codegen_state* self, ir_block from, ir_block to) {
+    collect_edge_moves(self, from, to);
+    emit_moves(self);
+
+    if (to != self->next) {
+        x86_jmp(self->as, self->blocks[to]);
+    }
+}
+
+/* Label a branch from `from` jumps to for `to` */
+static x86_label branch_target(
+    codegen_state* self, ir_block from, ir_block to
+) {
+    collect_edge_moves(self, from, to);
+
+    bool direct = self->moves.len == 0;
+    self->moves.len = 0;
+
+    if (direct) {
+        return self->blocks[to];
+    }
+
+    edge_stub stub = {
+        .label = x86_label_make(self->as),
+        .from = from,
+        .to = to,
+    };
+
+    vec_push(&self->stubs, &stub);
+    return stub.label;
+}
+
+static void lower_branch(codegen_state* self, ir_block block, ir_value value) {
+    const ir_instr* instr = instr_of(self, value);
+    ir_value condition = instr->args.items[0];
+    x86_cond cond;
+
+    if (is_fused(self, condition)) {
+        const ir_instr* cmp = instr_of(self, condition);
+
+        lower_compare(self, condition);
+        cond = comparison_cond(cmp->op, cmp->type);
+    } else {
+        x86_operand test = operand(self, condition, X86_RAX);
+
+        if (test.kind != X86_OPERAND_REG) {
+            x86_mov(self->as, X86_RAX, test);
+            test = X86_REG(X86_RAX);
+        }
+
+        x86_test(self->as, test.reg, test.reg);
+        cond = X86_CC_NE;
+    }
+
+    x86_label then = branch_target(self, block, instr->targets[0]);
+    x86_label otherwise = branch_target(self, block, instr->targets[1]);
+    bool has_next = self->next != IR_NONE;
+
+    if (has_next && then == self->blocks[self->next]) {
+        x86_jcc(self->as, negate(cond), otherwise);
+        return;
+    }
+
+    x86_jcc(self->as, cond, then);
+
+    if (!has_next || otherwise != self->blocks[self->next]) {
+        x86_jmp(self->as, otherwise);
+    }
+}
+
+/* Restores the callee-saved registers and rbp, the return address on top
+ * of the stack */
+static void leave_frame(codegen_state* self) {
+    x86_asm* as = self->as;
+    size_t saved = self->ra.saved_count;
+
+    /* Past the slots, down to the saved registers */
+    if (saved != 0) {
+        x86_lea(as, X86_RSP, X86_RBP, -8 * (int32_t)saved);
+
+        for (size_t i = saved; i-- > 0;) {
+            x86_pop(as, self->ra.saved[i]);
+        }
+    }
+
+    x86_leave(as);
+}
+
+static void lower_epilogue(codegen_state* self) {
+    leave_frame(self);
+    x86_ret(self->as);
+}
+
+static void lower_block(codegen_state* self, ir_block block) {
+    const ir_block_data* data = &self->fn->blocks.items[block];
+    x86_asm* as = self->as;
+
+    x86_bind(as, self->blocks[block]);
+
+    for (size_t i = 0; i < data->instrs.len; i++) {
+        ir_value value = data->instrs.items[i];
+        const ir_instr* instr = instr_of(self, value);
+
+        self->position = self->ra.positions[value];
+
+        switch (instr->op) {
+            case IR_JUMP:
+                lower_jump(self, block, instr->targets[0]);
+                break;
+
+            case IR_BRANCH:
+                lower_branch(self, block, value);
+                break;
+
+            case IR_RET:
+                if (instr->args.len != 0) {
+                    load(self, X86_RAX, instr->args.items[0]);
+                } else {
+                    x86_alu(as, X86_XOR, X86_DWORD, X86_RAX, X86_REG(X86_RAX));
+                }
+
+                lower_epilogue(self);
+                break;
+
+            case IR_TAIL_CALL:
+                lower_call(self, value, true);
+                break;
+
+            default:
+                lower_value(self, value);
+                break;
+        }
+    }
+}
+
+// Functions
+
+/* Gives every closure made by the function its own area */
+static void place_envs(codegen_state* self) {
+    const ir_function* fn = self->fn;
+
+    self->env_words = 0;
+
+    for (size_t v = 0; v < fn->values.len; v++) {
+        const ir_instr* instr = &fn->values.items[v];
+
+        if (instr->block != IR_NONE && (instr->op == IR_STACK_CLOSURE ||
+                                        instr->op == IR_CLOSURE)) {
+            self->envs[v] = self->env_words;
+            self->env_words += instr->args.len;
+        }
+    }
+}
+
+static void count_uses(codegen_state* self) {
+    const ir_function* fn = self->fn;
+
+    for (size_t v = 0; v < fn->values.len; v++) {
+        self->uses[v] = 0;
+    }
+
+    for (size_t v = 0; v < fn->values.len; v++) {
+        const ir_instr* instr = &fn->values.items[v];
+
+        if (instr->block == IR_NONE) {
+            continue;
+        }
+
+        for (size_t i = 0; i < instr->args.len; i++) {
+            self->uses[instr->args.items[i]]++;
+        }
+    }
+}
+
+/* Pushes rbp and the callee-saved registers, makes room for the slots, and
+ * moves the parameters where they live */
+static void lower_prologue(codegen_state* self) {
+    x86_asm* as = self->as;
+    size_t saved = self->ra.saved_count;
+
+    x86_push(as, X86_RBP);
+    x86_mov(as, X86_RBP, X86_REG(X86_RSP));
+
+    for (size_t i = 0; i < saved; i++) {
+        x86_push(as, self->ra.saved[i]);
+    }
+
+    /* The return address and rbp leave the stack aligned, the rest keeps
+     * it so */
+    size_t words = saved + self->ra.slot_count + self->env_words;
+    size_t size = (words * 8 + 15) & ~(size_t)15;
+    int32_t frame = (int32_t)(size - saved * 8);
+
+    if (frame != 0) {
+        x86_alu(as, X86_SUB, X86_QWORD, X86_RSP, X86_IMM(frame));
+    }
+
+    const vec_ir_value* entry = &self->fn->blocks.items[0].instrs;
+
+    for (size_t i = 0; i < entry->len; i++) {
+        ir_value value = entry->items[i];
+        const ir_instr* instr = instr_of(self, value);
+
+        if (instr->op != IR_PARAM) {
+            continue;
+        }
+
+        size_t index = (size_t)instr->imm;
+        x86_operand src = index < REG_ARG_COUNT
+                              ? X86_REG(ARG_REGS[index])
+                              : X86_MEM(
+                                    X86_RBP,
+                                    STACK_ARGS_DISP +
+                                        8 * (int32_t)(index - REG_ARG_COUNT)
+                                );
+
+        if (in_reg(self, value, 0)) {
+            add_move(
+                self, X86_REG(self->ra.values[value].reg), src, IR_NONE
+            );
+        }
+
+        if (self->ra.values[value].has_slot) {
+            add_move(self, slot(self, value), src, IR_NONE);
+        }
+    }
+
+    emit_moves(self);
+}
+
+static void lower_function(codegen_state* self, size_t index) {
+    const ir_function* fn = &self->program->functions.items[index];
+    x86_asm* as = self->as;
+    size_t block_count = fn->blocks.len;
+    size_t value_count = fn->values.len;
+
+    self->fn = fn;
+    self->div_zero = (vec_div_zero_stub)vec_make(self->allocator);
+    self->blocks = ALLOC_ARRAY(self->allocator, x86_label, block_count);
+    self->uses = ALLOC_ARRAY(self->allocator, size_t, value_count);
+    self->envs = ALLOC_ARRAY(self->allocator, size_t, value_count);
+    self->stubs = (vec_edge_stub)vec_make(self->allocator);
+
+    regalloc_function(
+        self->allocator, fn, self->options.allocate_registers, &self->ra
+    );
+
+    for (size_t b = 0; b < block_count; b++) {
+        self->blocks[b] = x86_label_make(as);
+    }
+
+    count_uses(self);
+    place_envs(self);
+
+    x86_function(as, self->functions[index]);
+    lower_prologue(self);
+
+    for (size_t i = 0; i < self->ra.block_count; i++) {
+        bool last = i + 1 == self->ra.block_count;
+
+        self->next = last ? IR_NONE : self->ra.order[i + 1];
+        lower_block(self, self->ra.order[i]);
+    }
+
+    /* Stubs come after every block, so none of them falls through */
+    self->next = IR_NONE;
+
+    for (size_t i = 0; i < self->stubs.len; i++) {
+        edge_stub stub = self->stubs.items[i];
+
+        x86_bind(as, stub.label);
+        lower_jump(self, stub.from, stub.to);
+    }
+
+    for (size_t i = 0; i < self->div_zero.len; i++) {
+        const ir_function* reported =
+            &self->program->functions.items[self->div_zero.items[i].function];
+
+        x86_bind(as, self->div_zero.items[i].label);
+        x86_lea_label(
+            as,
+            X86_RDI,
+            x86_string(as, reported->name, reported->name_len)
+        );
+        x86_call(as, use_runtime(self, RUNTIME_DIV_ZERO));
+    }
+
+    regalloc_free(self->allocator, fn, &self->ra);
+    vec_free(&self->div_zero);
+    vec_free(&self->stubs);
+    FREE_ARRAY(self->allocator, self->envs, size_t, value_count);
+    FREE_ARRAY(self->allocator, self->uses, size_t, value_count);
+    FREE_ARRAY(self->allocator, self->blocks, x86_label, block_count);
+}
+
+/* The C entry point, returning the value of the program's main */
+static void lower_entry(codegen_state* self) {
+    x86_asm* as = self->as;
+    const ir_program* program = self->program;
+
+    x86_function(as, x86_symbol_make(as, "main", 4, X86_SYMBOL_GLOBAL));
+    x86_push(as, X86_RBP);
+    x86_mov(as, X86_RBP, X86_REG(X86_RSP));
+
+    if (program->main != RESOLVED_NO_FUNCTION) {
+        x86_call(as, self->functions[program->main]);
+    }
+
+    if (program->main == RESOLVED_NO_FUNCTION ||
+        program->functions.items[program->main].return_type == IR_TYPE_UNIT) {
+        x86_alu(as, X86_XOR, X86_DWORD, X86_RAX, X86_REG(X86_RAX));
+    }
+
+    x86_pop(as, X86_RBP);
+    x86_ret(as);
+}
+
+// Runtime
+
+static x86_symbol libc(codegen_state* self, const char* name) {
+    return x86_symbol_make(self->as, name, strlen(name), X86_SYMBOL_EXTERN);
+}
+
+/* rdi = rdi + rsi, in a new string */
+static void lower_concat(codegen_state* self) {
+    x86_asm* as = self->as;
+    x86_symbol malloc_symbol = libc(self, "malloc");
+    x86_symbol memcpy_symbol = libc(self, "memcpy");
+
+    x86_function(as, self->runtime[RUNTIME_CONCAT]);
+    x86_push(as, X86_RBX);
+    x86_push(as, X86_R12);
+    x86_push(as, X86_R13);
+    x86_mov(as, X86_RBX, X86_REG(X86_RDI));
+    x86_mov(as, X86_R12, X86_REG(X86_RSI));
+
+    x86_mov(as, X86_RDI, X86_MEM(X86_RBX, 0));
+    x86_alu(as, X86_ADD, X86_QWORD, X86_RDI, X86_MEM(X86_R12, 0));
+    x86_alu(as, X86_ADD, X86_QWORD, X86_RDI, X86_IMM(8));
+    x86_call(as, malloc_symbol);
+    x86_mov(as, X86_R13, X86_REG(X86_RAX));
+
+    x86_mov(as, X86_RCX, X86_MEM(X86_RBX, 0));
+    x86_alu(as, X86_ADD, X86_QWORD, X86_RCX, X86_MEM(X86_R12, 0));
+    x86_store(as, X86_R13, 0, X86_RCX);
+
+    x86_lea(as, X86_RDI, X86_R13, 8);
+    x86_lea(as, X86_RSI, X86_RBX, 8);
+    x86_mov(as, X86_RDX, X86_MEM(X86_RBX, 0));
+    x86_call(as, memcpy_symbol);
+
+    x86_lea(as, X86_RDI, X86_R13, 8);
+    x86_alu(as, X86_ADD, X86_QWORD, X86_RDI, X86_MEM(X86_RBX, 0));
+    x86_lea(as, X86_RSI, X86_R12, 8);
+    x86_mov(as, X86_RDX, X86_MEM(X86_R12, 0));
+    x86_call(as, memcpy_symbol);
+
+    x86_mov(as, X86_RAX, X86_REG(X86_R13));
+    x86_pop(as, X86_R13);
+    x86_pop(as, X86_R12);
+    x86_pop(as, X86_RBX);
+    x86_ret(as);
+}
+
+/* rax = a copy of the rsi bytes at rdi on the heap, with the lowest bit
+ * set */
+static void lower_closure_runtime(codegen_state* self) {
+    x86_asm* as = self->as;
+
+    x86_function(as, self->runtime[RUNTIME_CLOSURE]);
+    x86_push(as, X86_RBX);
+    x86_push(as, X86_R12);
+    x86_push(as, X86_R13);
+    x86_mov(as, X86_RBX, X86_REG(X86_RDI));
+    x86_mov(as, X86_R12, X86_REG(X86_RSI));
+
+    x86_mov(as, X86_RDI, X86_REG(X86_RSI));
+    x86_call(as, libc(self, "malloc"));
+    x86_mov(as, X86_R13, X86_REG(X86_RAX));
+
+    x86_mov(as, X86_RDI, X86_REG(X86_RAX));
+    x86_mov(as, X86_RSI, X86_REG(X86_RBX));
+    x86_mov(as, X86_RDX, X86_REG(X86_R12));
+    x86_call(as, libc(self, "memcpy"));
+
+    x86_lea(as, X86_RAX, X86_R13, 1);
+    x86_pop(as, X86_R13);
+    x86_pop(as, X86_R12);
+    x86_pop(as, X86_RBX);
+    x86_ret(as);
+}
+
+/* rax = rdi == rsi, as strings */
+static void lower_streq(codegen_state* self) {
+    x86_asm* as = self->as;
+    x86_label different = x86_label_make(as);
+
+    x86_function(as, self->runtime[RUNTIME_STREQ]);
+    x86_mov(as, X86_RDX, X86_MEM(X86_RDI, 0));
+    x86_alu(as, X86_CMP, X86_QWORD, X86_RDX, X86_MEM(X86_RSI, 0));
+    x86_jcc(as, X86_CC_NE, different);
+
+    x86_push(as, X86_RBX);
+    x86_alu(as, X86_ADD, X86_QWORD, X86_RDI, X86_IMM(8));
+    x86_alu(as, X86_ADD, X86_QWORD, X86_RSI, X86_IMM(8));
+    x86_call(as, libc(self, "memcmp"));
+    x86_pop(as, X86_RBX);
+    x86_alu(as, X86_CMP, X86_DWORD, X86_RAX, X86_IMM(0));
+    x86_set(as, X86_CC_E, X86_RAX);
+    x86_ret(as);
+
+    x86_bind(as, different);
+    x86_alu(as, X86_XOR, X86_DWORD, X86_RAX, X86_REG(X86_RAX));
+    x86_ret(as);
+}
+
+/* Writes `str` to stderr, or the string at rbx if it is NULL */
+static void lower_write(
+    codegen_state* self, x86_symbol write, const char* str
+) {
+    x86_asm* as = self->as;
+
+    if (str != NULL) {
+        x86_lea_label(as, X86_RBX, x86_string(as, str, strlen(str)));
+    }
+
+    x86_mov_imm(as, X86_RDI, 2);
+    x86_lea(as, X86_RSI, X86_RBX, 8);
+    x86_mov(as, X86_RDX, X86_MEM(X86_RBX, 0));
+    x86_call(as, write);
+}
+
+/* Reports a division by zero in the function named by the string at rdi,
+ * and exits */
+static void lower_div_zero(codegen_state* self) {
+    x86_asm* as = self->as;
+    x86_symbol write = libc(self, "write");
+
+    x86_function(as, self->runtime[RUNTIME_DIV_ZERO]);
+    x86_push(as, X86_RBX);
+    x86_push(as, X86_R12);
+    x86_push(as, X86_R13);
+    x86_mov(as, X86_R12, X86_REG(X86_RDI));
+
+    lower_write(self, write, "Runtime error in ");
+    x86_mov(as, X86_RBX, X86_REG(X86_R12));
+    lower_write(self, write, NULL);
+    lower_write(self, write, ": division by zero\n");
+
+    x86_mov_imm(as, X86_RDI, 1);
+    x86_call(as, libc(self, "exit"));
+}
+
+bool codegen(
+    allocator_t* allocator,
+    const ir_program* program,
+    const codegen_options* options,
+    x86_asm* out
+) {
+    size_t count = program->functions.len;
+    size_t string_count = program->strings.len;
+    codegen_state self = {
+        .allocator = allocator,
+        .program = program,
+        .as = out,
+        .options = *options,
+        .functions = ALLOC_ARRAY(allocator, x86_symbol, count),
+        .strings = ALLOC_ARRAY(allocator, x86_label, string_count),
+        .has_string = ALLOC_ARRAY(allocator, bool, string_count),
+        .moves = (vec_move)vec_make(allocator),
+    };
+
+    for (size_t i = 0; i < RUNTIME_COUNT; i++) {
+        self.runtime[i] = x86_symbol_make(
+            out, RUNTIME_NAMES[i], strlen(RUNTIME_NAMES[i]), X86_SYMBOL_LOCAL
+        );
+        self.runtime_used[i] = false;
+    }
+
+    for (size_t i = 0; i < string_count; i++) {
+        self.has_string[i] = false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const ir_function* fn = &program->functions.items[i];
+        char lambda[32];
+        const char* name = fn->name;
+        size_t len = fn->name_len;
+
+        if (fn->is_lambda) {
+            len = snprintf(lambda, sizeof(lambda), "lambda.%zu", i);
+            name = lambda;
+        }
+
+        size_t prefix_len = sizeof(SYMBOL_PREFIX) - 1;
+        char* symbol = ALLOC_ARRAY(allocator, char, (prefix_len + len));
+
+        memcpy(symbol, SYMBOL_PREFIX, prefix_len);
+        memcpy(symbol + prefix_len, name, len);
+
+        self.functions[i] = x86_symbol_make(
+            out, symbol, prefix_len + len, X86_SYMBOL_LOCAL
+        );
+        FREE_ARRAY(allocator, symbol, char, (prefix_len + len));
+    }
+
+    bool ok = setjmp(self.on_error) == 0;
+
+    if (ok) {
+        for (size_t i = 0; i < count; i++) {
+            lower_function(&self, i);
+        }
+
+        lower_entry(&self);
+
+        if (self.runtime_used[RUNTIME_CONCAT]) {
+            lower_concat(&self);
+        }
+
+        if (self.runtime_used[RUNTIME_STREQ]) {
+            lower_streq(&self);
+        }
+
+        if (self.runtime_used[RUNTIME_DIV_ZERO]) {
+            lower_div_zero(&self);
+        }
+
+        if (self.runtime_used[RUNTIME_CLOSURE]) {
+            lower_closure_runtime(&self);
+        }
+
+        x86_end(out);
+    }
+
+    vec_free(&self.moves);
+    FREE_ARRAY(allocator, self.has_string, bool, string_count);
+    FREE_ARRAY(allocator, self.strings, x86_label, string_count);
+    FREE_ARRAY(allocator, self.functions, x86_symbol, count);
+
+    return ok;
+}
@@ -0,0 +1,61 @@
+/**
+ * x86-64 backend
+ *
+ * Lowers a program in the IR (see ir.h) to x86-64 code for the System V
+ * ABI, one function at a time through the instruction emitter of x86.h.
+ *
+ * Values live in registers or stack slots, as regalloc.h decides: an
+ * instruction reads its operands where they are, computes at the width of
+ * its type in the register of its result, using the sub-register of that
+ * width, and extends the result back to 64 bits. Blocks are laid out in
+ * reverse postorder, and the moves an edge needs, for the phi nodes of the
+ * block it enters and the values that go back to their registers there,
+ * are made on the way. Comparisons deciding a branch jump on their flags
+ * rather than making a boolean first.
+ *
+ * Arguments past the six System V argument registers go on the stack, as
+ * does a closure's environment when it comes after them. A tail call
+ * writes them over the stack arguments of the caller, which every caller
+ * pushes for as many parameters as it has. When they do not fit, the tail
+ * call is made as a plain call followed by a return, and reported.
+ *
+ * Functions of the program are local symbols named `one.<name>`, lambdas
+ * `one.lambda.<index>`, and a function value is the address of its code.
+ * The output also has a global `main` that calls the program's main and
+ * returns its value, so that it links into an executable with the C
+ * library, which string operations and runtime errors use.
+ */
+
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "alloc.h"
+#include "ir.h"
+#include "x86.h"
+
+typedef struct {
+    /* Keeps values in registers, rather than every one in its slot */
+    bool allocate_registers;
+
+    /* Where the tail calls made as plain calls are reported, NULL for
+     * none */
+    FILE* tail_report;
+} codegen_options;
+
+/**
+ * Lowers every function of `program` to `out`.
+ *
+ * Returns false after printing to diag_stream() if `program` is not valid
+ * IR, which is a bug in the passes that made it.
+ */
+bool codegen(
+    allocator_t* allocator,
+    const ir_program* program,
+    const codegen_options* options,
+    x86_asm* out
+);
+
+#endif  // CODEGEN_H
@@ -0,0 +1,44 @@
+#include "diag.h"
+
+static _Thread_local FILE* stream = NULL;
+
+FILE* diag_stream() {
+    return stream != NULL ? stream : stderr;
+}
+
+void diag_redirect(FILE* new_stream) {
+    stream = new_stream;
+}
+
+void diag_printf(const char* fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    diag_vprintf(fmt, args);
+    va_end(args);
+}
+
+void diag_vprintf(const char* fmt, va_list args) {
+    FILE* out = diag_stream();
+
+    diag_lock(out);
+    vfprintf(out, fmt, args);
+    fputc('\n', out);
+    diag_unlock(out);
+}
+
+void diag_lock(FILE* out) {
+#ifdef _WIN32
+    _lock_file(out);
+#else
+    flockfile(out);
+#endif
+}
+
+void diag_unlock(FILE* out) {
+#ifdef _WIN32
+    _unlock_file(out);
+#else
+    funlockfile(out);
+#endif
+}
@@ -0,0 +1,40 @@
+/**
+ * Where compiler diagnostics go.
+ *
+ * Syntax and type errors are written to the calling thread's diagnostic
+ * stream, stderr by default. The compile server redirects it to collect the
+ * diagnostics of each request and send them back to the client.
+ */
+
+#ifndef DIAG_H
+#define DIAG_H
+
+#include <stdarg.h>
+#include <stdio.h>
+
+/**
+ * Returns the calling thread's diagnostic stream.
+ */
+FILE* diag_stream();
+
+/**
+ * Sends the calling thread's diagnostics to `stream`, NULL for stderr.
+ */
+void diag_redirect(FILE* stream);
+
+/**
+ * Writes `fmt`, formatted with the arguments, and a newline to the calling
+ * thread's diagnostic stream. Reports written from several threads at once
+ * do not interleave.
+ */
+void diag_printf(const char* fmt, ...);
+void diag_vprintf(const char* fmt, va_list args);
+
+/**
+ * Keeps other threads from writing to `out` until diag_unlock(), for
+ * reports written in several pieces.
+ */
+void diag_lock(FILE* out);
+void diag_unlock(FILE* out);
+
+#endif  // DIAG_H
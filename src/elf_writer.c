@@ -0,0 +1,263 @@
+#include "elf_writer.h"
+
+#include <elf.h>
+#include <string.h>
+
+#include "mmio.h"
+
+/* Section header indices */
+enum {
+    SECTION_NULL,
+    SECTION_TEXT,
+    SECTION_RODATA,
+    SECTION_RELA_TEXT,
+    SECTION_SYMTAB,
+    SECTION_STRTAB,
+    SECTION_SHSTRTAB,
+    SECTION_NOTE_STACK,
+
+    SECTION_COUNT,
+};
+
+static const char* const SECTION_NAMES[] = {
+    [SECTION_NULL] = "",
+    [SECTION_TEXT] = ".text",
+    [SECTION_RODATA] = ".rodata",
+    [SECTION_RELA_TEXT] = ".rela.text",
+    [SECTION_SYMTAB] = ".symtab",
+    [SECTION_STRTAB] = ".strtab",
+    [SECTION_SHSTRTAB] = ".shstrtab",
+    [SECTION_NOTE_STACK] = ".note.GNU-stack",
+};
+
+/* The symbol table starts with the null symbol and one for each section
+ * with contents, which relocations into .rodata refer to */
+enum {
+    SYMBOL_TEXT = 1,
+    SYMBOL_RODATA = 2,
+    FIRST_SYMBOL = 3,
+};
+
+static size_t align_up(size_t offset, size_t alignment) {
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+static bool is_local(const x86_symbol_info* symbol) {
+    return symbol->kind == X86_SYMBOL_LOCAL;
+}
+
+/* Runtime helpers the program turned out not to need are made but never
+ * defined, they are left out */
+static bool is_listed(const x86_symbol_info* symbol) {
+    return symbol->defined || symbol->kind == X86_SYMBOL_EXTERN;
+}
+
+bool elf_write_object(
+    allocator_t* allocator, const x86_object* object, char* path
+) {
+    /* Index of every symbol of the object in the table, locals come
+     * first */
+    Elf64_Word* indices = ALLOC_ARRAY(
+        allocator, Elf64_Word, (object->symbol_count + 1)
+    );
+    Elf64_Word next = FIRST_SYMBOL;
+    size_t strtab_size = 1;
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < object->symbol_count; i++) {
+            const x86_symbol_info* symbol = &object->symbols[i];
+
+            if (is_listed(symbol) && is_local(symbol) == (pass == 0)) {
+                indices[i] = next++;
+                strtab_size += symbol->len + 1;
+            }
+        }
+    }
+
+    size_t symbol_count = next;
+    Elf64_Word first_global = FIRST_SYMBOL;
+
+    for (size_t i = 0; i < object->symbol_count; i++) {
+        const x86_symbol_info* symbol = &object->symbols[i];
+        first_global += is_listed(symbol) && is_local(symbol);
+    }
+
+    size_t shstrtab_size = 0;
+    Elf64_Word section_names[SECTION_COUNT];
+
+    for (size_t i = 0; i < SECTION_COUNT; i++) {
+        section_names[i] = shstrtab_size;
+        shstrtab_size += strlen(SECTION_NAMES[i]) + 1;
+    }
+
+    /* Layout: the header, the contents of the sections, and the section
+     * headers */
+    Elf64_Shdr sections[SECTION_COUNT] = {0};
+
+    sections[SECTION_TEXT] = (Elf64_Shdr){
+        .sh_type = SHT_PROGBITS,
+        .sh_flags = SHF_ALLOC | SHF_EXECINSTR,
+        .sh_size = object->section_sizes[X86_SECTION_TEXT],
+        .sh_addralign = 16,
+    };
+    sections[SECTION_RODATA] = (Elf64_Shdr){
+        .sh_type = SHT_PROGBITS,
+        .sh_flags = SHF_ALLOC,
+        .sh_size = object->section_sizes[X86_SECTION_RODATA],
+        .sh_addralign = 8,
+    };
+    sections[SECTION_RELA_TEXT] = (Elf64_Shdr){
+        .sh_type = SHT_RELA,
+        .sh_flags = SHF_INFO_LINK,
+        .sh_size = object->reloc_count * sizeof(Elf64_Rela),
+        .sh_link = SECTION_SYMTAB,
+        .sh_info = SECTION_TEXT,
+        .sh_addralign = 8,
+        .sh_entsize = sizeof(Elf64_Rela),
+    };
+    sections[SECTION_SYMTAB] = (Elf64_Shdr){
+        .sh_type = SHT_SYMTAB,
+        .sh_size = symbol_count * sizeof(Elf64_Sym),
+        .sh_link = SECTION_STRTAB,
+        .sh_info = first_global,
+        .sh_addralign = 8,
+        .sh_entsize = sizeof(Elf64_Sym),
+    };
+    sections[SECTION_STRTAB] = (Elf64_Shdr){
+        .sh_type = SHT_STRTAB,
+        .sh_size = strtab_size,
+        .sh_addralign = 1,
+    };
+    sections[SECTION_SHSTRTAB] = (Elf64_Shdr){
+        .sh_type = SHT_STRTAB,
+        .sh_size = shstrtab_size,
+        .sh_addralign = 1,
+    };
+    sections[SECTION_NOTE_STACK] = (Elf64_Shdr){
+        .sh_type = SHT_PROGBITS,
+        .sh_addralign = 1,
+    };
+
+    size_t offset = sizeof(Elf64_Ehdr);
+
+    for (size_t i = 1; i < SECTION_COUNT; i++) {
+        offset = align_up(offset, sections[i].sh_addralign);
+
+        sections[i].sh_name = section_names[i];
+        sections[i].sh_offset = offset;
+        offset += sections[i].sh_size;
+    }
+
+    size_t headers = align_up(offset, 8);
+    size_t size = headers + sizeof(sections);
+
+    mmio_mapping mapping;
+
+    if (!mmio_create_path(path, size, &mapping)) {
+        FREE_ARRAY(allocator, indices, Elf64_Word, (object->symbol_count + 1));
+        return false;
+    }
+
+    /* A new file reads as zeros, only the contents need writing */
+    uint8_t* out = mapping.ptr;
+
+    *(Elf64_Ehdr*)out = (Elf64_Ehdr){
+        .e_ident =
+            {
+                ELFMAG0,
+                ELFMAG1,
+                ELFMAG2,
+                ELFMAG3,
+                ELFCLASS64,
+                ELFDATA2LSB,
+                EV_CURRENT,
+                ELFOSABI_SYSV,
+            },
+        .e_type = ET_REL,
+        .e_machine = EM_X86_64,
+        .e_version = EV_CURRENT,
+        .e_shoff = headers,
+        .e_ehsize = sizeof(Elf64_Ehdr),
+        .e_shentsize = sizeof(Elf64_Shdr),
+        .e_shnum = SECTION_COUNT,
+        .e_shstrndx = SECTION_SHSTRTAB,
+    };
+
+    memcpy(out + headers, sections, sizeof(sections));
+
+    for (size_t i = 0; i < X86_SECTION_COUNT; i++) {
+        size_t at = sections[i == X86_SECTION_TEXT ? SECTION_TEXT
+                                                   : SECTION_RODATA]
+                        .sh_offset;
+
+        if (object->section_sizes[i] != 0) {
+            memcpy(out + at, object->sections[i], object->section_sizes[i]);
+        }
+    }
+
+    char* shstrtab = (char*)out + sections[SECTION_SHSTRTAB].sh_offset;
+
+    for (size_t i = 0; i < SECTION_COUNT; i++) {
+        strcpy(shstrtab + section_names[i], SECTION_NAMES[i]);
+    }
+
+    Elf64_Sym* symtab = (Elf64_Sym*)(out + sections[SECTION_SYMTAB].sh_offset);
+    char* strtab = (char*)out + sections[SECTION_STRTAB].sh_offset;
+
+    symtab[SYMBOL_TEXT] = (Elf64_Sym){
+        .st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION),
+        .st_shndx = SECTION_TEXT,
+    };
+    symtab[SYMBOL_RODATA] = (Elf64_Sym){
+        .st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION),
+        .st_shndx = SECTION_RODATA,
+    };
+
+    size_t name = 1;
+
+    for (size_t i = 0; i < object->symbol_count; i++) {
+        const x86_symbol_info* symbol = &object->symbols[i];
+        bool defined = symbol->kind != X86_SYMBOL_EXTERN;
+
+        if (!is_listed(symbol)) {
+            continue;
+        }
+
+        symtab[indices[i]] = (Elf64_Sym){
+            .st_name = name,
+            .st_info = ELF64_ST_INFO(
+                is_local(symbol) ? STB_LOCAL : STB_GLOBAL,
+                defined ? STT_FUNC : STT_NOTYPE
+            ),
+            .st_shndx = defined ? SECTION_TEXT : SHN_UNDEF,
+            .st_value = defined ? symbol->offset : 0,
+            .st_size = symbol->size,
+        };
+
+        memcpy(strtab + name, symbol->name, symbol->len);
+        name += symbol->len + 1;
+    }
+
+    Elf64_Rela* rela =
+        (Elf64_Rela*)(out + sections[SECTION_RELA_TEXT].sh_offset);
+
+    for (size_t i = 0; i < object->reloc_count; i++) {
+        const x86_reloc* reloc = &object->relocs[i];
+        Elf64_Word symbol = reloc->symbol == X86_NO_SYMBOL
+                                ? SYMBOL_RODATA
+                                : indices[reloc->symbol];
+        Elf64_Word type = reloc->kind == X86_RELOC_PLT32 ? R_X86_64_PLT32
+                                                         : R_X86_64_PC32;
+
+        rela[i] = (Elf64_Rela){
+            .r_offset = reloc->offset,
+            .r_info = ELF64_R_INFO(symbol, type),
+            .r_addend = reloc->addend,
+        };
+    }
+
+    mmio_unmap(&mapping);
+    FREE_ARRAY(allocator, indices, Elf64_Word, (object->symbol_count + 1));
+
+    return true;
+}
@@ -0,0 +1,28 @@
+/**
+ * ELF64 object files
+ *
+ * Writes the machine code of a binary x86 emitter (see x86.h) as a
+ * relocatable object for x86-64 Linux, which the system linker takes like
+ * any other: a .text and a .rodata section, a symbol table with the
+ * functions defined and the C library functions used, and the relocations
+ * of .text against them.
+ */
+
+#ifndef ELF_WRITER_H
+#define ELF_WRITER_H
+
+#include <stdbool.h>
+
+#include "alloc.h"
+#include "x86.h"
+
+/**
+ * Writes `object` to the file at `path`, through a writable mapping of it.
+ *
+ * Returns false after printing to stderr if the file cannot be written.
+ */
+bool elf_write_object(
+    allocator_t* allocator, const x86_object* object, char* path
+);
+
+#endif  // ELF_WRITER_H
@@ -0,0 +1,516 @@
+#include "interp.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "diag.h"
+
+/* A string value is a pointer to one of these */
+typedef struct {
+    size_t len;
+    char chars[];
+} interp_string;
+
+AST_EXPR_WALKER(interp_expr_walker, int64_t, interp*)
+AST_STMT_WALKER(interp_stmt_walker, int, interp*)
+
+struct _interp {
+    allocator_t* allocator;
+    const resolved_program* program;
+
+    int64_t* stack;
+    int64_t* stack_end;
+
+    /* Frame of the running function, and the first slot after it */
+    int64_t* base;
+    int64_t* top;
+
+    const resolved_function* fn;
+    size_t depth;
+
+    interp_expr_walker expr;
+    interp_stmt_walker stmt;
+
+    /* Runtime errors unwind straight back to interp_call */
+    jmp_buf on_error;
+};
+
+static interp_expr_walker make_expr_walker(interp* ctx);
+static interp_stmt_walker make_stmt_walker(interp* ctx);
+
+interp* interp_make(allocator_t* allocator, const resolved_program* program) {
+    interp* self = ALLOC(allocator, interp);
+
+    *self = (interp){
+        .allocator = allocator,
+        .program = program,
+        .stack = ALLOC_ARRAY(allocator, int64_t, INTERP_STACK_SIZE),
+        .fn = NULL,
+        .depth = 0,
+    };
+
+    self->stack_end = self->stack + INTERP_STACK_SIZE;
+    self->base = self->stack;
+    self->top = self->stack;
+    self->expr = make_expr_walker(self);
+    self->stmt = make_stmt_walker(self);
+
+    return self;
+}
+
+void interp_destroy(interp* self) {
+    allocator_t* allocator = self->allocator;
+
+    FREE_ARRAY(allocator, self->stack, int64_t, INTERP_STACK_SIZE);
+    FREE(allocator, self, interp);
+}
+
+static void runtime_error(interp* self, const char* message) {
+    diag_printf(
+        "Runtime error in %.*s: %s",
+        (int)self->fn->name_len,
+        self->fn->name,
+        message
+    );
+
+    longjmp(self->on_error, 1);
+}
+
+static int64_t eval(interp* self, ast_expr_node* expr) {
+    return interp_expr_walker_walk(&self->expr, expr);
+}
+
+/* Brings a 64 bit result back into the range of `type` */
+static int64_t wrap(ast_typename* type, uint64_t value) {
+    ast_typename_integer* integer = &type->as.integer;
+
+    switch (integer->size) {
+        case INTEGER_SIZE_8:
+            return integer->is_signed ? (int64_t)(int8_t)value
+                                      : (int64_t)(uint8_t)value;
+        case INTEGER_SIZE_16:
+            return integer->is_signed ? (int64_t)(int16_t)value
+                                      : (int64_t)(uint16_t)value;
+        case INTEGER_SIZE_32:
+            break;
+    }
+
+    return integer->is_signed ? (int64_t)(int32_t)value
+                              : (int64_t)(uint32_t)value;
+}
+
+static interp_string* concat(
+    allocator_t* allocator, interp_string* a, interp_string* b
+) {
+    interp_string* s = ALLOC_ARRAY(
+        allocator, char, (sizeof(interp_string) + a->len + b->len)
+    );
+
+    s->len = a->len + b->len;
+    memcpy(s->chars, a->chars, a->len);
+    memcpy(s->chars + a->len, b->chars, b->len);
+
+    return s;
+}
+
+static bool string_equal(int64_t a, int64_t b) {
+    interp_string* left = (interp_string*)(intptr_t)a;
+    interp_string* right = (interp_string*)(intptr_t)b;
+
+    return left->len == right->len &&
+           memcmp(left->chars, right->chars, left->len) == 0;
+}
+
+// Calls
+
+static int64_t run_body(interp* self, const resolved_function* fn) {
+    for (ast_stmt_node* curr = fn->body; curr != NULL; curr = curr->next) {
+        if (curr->next == NULL && curr->type == AST_EXPR_STMT &&
+            fn->returns_value) {
+            return eval(self, curr->expr_stmt.expr);
+        }
+
+        interp_stmt_walker_walk(&self->stmt, curr);
+    }
+
+    return 0;
+}
+
+/* Runs `fn` with its arguments already at `frame` */
+static int64_t call_function(
+    interp* self, const resolved_function* fn, int64_t* frame
+) {
+    if (self->depth == INTERP_MAX_DEPTH ||
+        fn->frame_size > (size_t)(self->stack_end - frame)) {
+        self->fn = fn;
+        runtime_error(self, "stack overflow");
+    }
+
+    /* The environment of a closure comes after the arguments, where its
+     * captured values go */
+    ast_node_lambda* lambda = fn->lambda;
+
+    if (lambda != NULL && (lambda->closure == AST_CLOSURE_STACK ||
+                           lambda->closure == AST_CLOSURE_HEAP)) {
+        int64_t* env = (int64_t*)(intptr_t)frame[fn->param_count];
+        memcpy(
+            frame + fn->param_count,
+            env + 1,
+            fn->capture_count * sizeof(int64_t)
+        );
+    }
+
+    const resolved_function* caller = self->fn;
+    int64_t* caller_base = self->base;
+
+    self->fn = fn;
+    self->base = frame;
+    self->top = frame + fn->frame_size;
+    self->depth++;
+
+    int64_t result = run_body(self, fn);
+
+    self->depth--;
+    self->fn = caller;
+    self->base = caller_base;
+    self->top = frame;
+
+    return result;
+}
+
+bool interp_call(
+    interp* self,
+    size_t function,
+    const int64_t* args,
+    size_t arg_count,
+    int64_t* result
+) {
+    const resolved_function* fn = &self->program->functions.items[function];
+
+    self->fn = fn;
+    self->base = self->stack;
+    self->top = self->stack;
+    self->depth = 0;
+
+    if (setjmp(self->on_error) != 0) {
+        return false;
+    }
+
+    memcpy(self->stack, args, arg_count * sizeof(int64_t));
+    *result = call_function(self, fn, self->stack);
+
+    return true;
+}
+
+// Expression walker
+
+static int64_t walk_num(interp_expr_walker* self, ast_node_num* expr) {
+    /* The resolver already wrapped it to its type */
+    return (int64_t)expr->value;
+}
+
+static int64_t walk_bool(interp_expr_walker* self, ast_node_bool* expr) {
+    return expr->value;
+}
+
+static int64_t walk_str(interp_expr_walker* self, ast_node_str* expr) {
+    interp* ctx = self->ctx;
+
+    /* The AST has no room to keep the value of a literal, it is made
+     * again on every evaluation */
+    interp_string* s = ALLOC_ARRAY(
+        ctx->allocator, char, (sizeof(interp_string) + expr->len)
+    );
+
+    s->len = expr->len;
+    memcpy(s->chars, expr->str, expr->len);
+
+    return (intptr_t)s;
+}
+
+static int64_t walk_iden(interp_expr_walker* self, ast_node_identifier* expr) {
+    switch (expr->binding.kind) {
+        case AST_BINDING_LOCAL:
+            return self->ctx->base[expr->binding.index];
+
+        case AST_BINDING_FUNCTION:
+            return (int64_t)expr->binding.index << 1;
+
+        case AST_BINDING_UNRESOLVED:
+            break;
+    }
+
+    runtime_error(self->ctx, "BUG: unresolved identifier");
+    return 0;
+}
+
+static int64_t assign(interp_expr_walker* self, ast_node_binary* expr) {
+    if (expr->left->type != AST_IDEN ||
+        expr->left->identifier.binding.kind != AST_BINDING_LOCAL) {
+        runtime_error(self->ctx, "can only assign to local variables");
+    }
+
+    ast_node_identifier* variable = &expr->left->identifier;
+
+    int64_t value = interp_expr_walker_walk(self, expr->right);
+    self->ctx->base[variable->binding.index] = value;
+
+    return value;
+}
+
+static int64_t walk_binary(interp_expr_walker* self, ast_node_binary* expr) {
+    switch (expr->op) {
+        case TOK_ASSIGN:
+            return assign(self, expr);
+
+        case TOK_AND:
+            return interp_expr_walker_walk(self, expr->left) &&
+                   interp_expr_walker_walk(self, expr->right);
+
+        case TOK_OR:
+            return interp_expr_walker_walk(self, expr->left) ||
+                   interp_expr_walker_walk(self, expr->right);
+
+        default:
+            break;
+    }
+
+    ast_typename* type = expr->left->value_type;
+    int64_t left = interp_expr_walker_walk(self, expr->left);
+    int64_t right = interp_expr_walker_walk(self, expr->right);
+
+    bool is_string = type->type == TYPE_NAME_STRING;
+
+    switch (expr->op) {
+        case TOK_PLUS:
+            if (is_string) {
+                return (intptr_t)concat(
+                    self->ctx->allocator,
+                    (interp_string*)(intptr_t)left,
+                    (interp_string*)(intptr_t)right
+                );
+            }
+
+            return wrap(type, (uint64_t)left + (uint64_t)right);
+
+        case TOK_MINUS:
+            return wrap(type, (uint64_t)left - (uint64_t)right);
+
+        case TOK_MUL:
+            return wrap(type, (uint64_t)left * (uint64_t)right);
+
+        case TOK_DIV:
+        case TOK_PERC:
+            if (right == 0) {
+                runtime_error(self->ctx, "division by zero");
+            }
+
+            /* Operands are in the range of their type, 64 bit division
+             * cannot overflow */
+            return wrap(
+                type, expr->op == TOK_DIV ? left / right : left % right
+            );
+
+        case TOK_AMP:
+            return left & right;
+
+        case TOK_PIPE:
+            return left | right;
+
+        case TOK_CARET:
+            return left ^ right;
+
+        case TOK_EQ:
+            return is_string ? string_equal(left, right) : left == right;
+
+        case TOK_NEQ:
+            return is_string ? !string_equal(left, right) : left != right;
+
+        case TOK_LT:
+            return left < right;
+
+        case TOK_GT:
+            return left > right;
+
+        case TOK_LTEQ:
+            return left <= right;
+
+        case TOK_GTEQ:
+            return left >= right;
+
+        default:
+            break;
+    }
+
+    runtime_error(self->ctx, "BUG: unknown binary operator");
+    return 0;
+}
+
+static int64_t walk_unary(interp_expr_walker* self, ast_node_unary* expr) {
+    int64_t value = interp_expr_walker_walk(self, expr->expr);
+
+    switch (expr->op) {
+        case TOK_BANG:
+            return !value;
+
+        case TOK_MINUS:
+            return wrap(expr->expr->value_type, -(uint64_t)value);
+
+        default:
+            return value;
+    }
+}
+
+static int64_t walk_call(interp_expr_walker* self, ast_node_call* expr) {
+    interp* ctx = self->ctx;
+    ast_expr_node* function = expr->function;
+    size_t index;
+    int64_t env = 0;
+
+    if (expr->lambda != NULL) {
+        index = expr->lambda->index;
+    } else if (function->type == AST_IDEN &&
+               function->identifier.binding.kind == AST_BINDING_FUNCTION) {
+        index = function->identifier.binding.index;
+    } else {
+        int64_t value = interp_expr_walker_walk(self, function);
+
+        if (value & 1) {
+            env = value - 1;
+            value = ((int64_t*)(intptr_t)env)[0];
+        }
+
+        index = value >> 1;
+    }
+
+    const resolved_function* fn = &ctx->program->functions.items[index];
+
+    /* Lifted lambdas get their captured values after the arguments, other
+     * closures their environment */
+    size_t extra = expr->lambda != NULL ? fn->capture_count : env != 0;
+
+    /* The arguments go straight into the callee's frame. Calls made while
+     * evaluating them start after the ones already there. */
+    int64_t* frame = ctx->top;
+    size_t count = expr->args.len;
+
+    if (count + extra > (size_t)(ctx->stack_end - frame)) {
+        runtime_error(ctx, "stack overflow");
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        int64_t value = interp_expr_walker_walk(self, expr->args.items[i]);
+
+        frame[i] = value;
+        ctx->top = frame + i + 1;
+    }
+
+    if (expr->lambda != NULL) {
+        for (size_t i = 0; i < extra; i++) {
+            frame[count + i] = ctx->base[fn->captures[i].slot];
+        }
+    } else if (env != 0) {
+        frame[count] = env;
+    }
+
+    int64_t result = call_function(ctx, fn, frame);
+
+    ctx->top = frame;
+
+    return result;
+}
+
+static int64_t walk_lambda(interp_expr_walker* self, ast_node_lambda* expr) {
+    interp* ctx = self->ctx;
+    const resolved_function* fn = &ctx->program->functions.items[expr->index];
+    int64_t* env;
+
+    switch (expr->closure) {
+        case AST_CLOSURE_STACK:
+            env = &ctx->base[expr->env_slot];
+            break;
+
+        case AST_CLOSURE_HEAP:
+            env = ALLOC_ARRAY(ctx->allocator, int64_t, (fn->capture_count + 1));
+            break;
+
+        /* Lifted lambdas are only called, see walk_call */
+        default:
+            return (int64_t)expr->index << 1;
+    }
+
+    env[0] = (int64_t)expr->index << 1;
+
+    for (size_t i = 0; i < fn->capture_count; i++) {
+        env[i + 1] = ctx->base[fn->captures[i].slot];
+    }
+
+    return (intptr_t)env | 1;
+}
+
+static interp_expr_walker make_expr_walker(interp* ctx) {
+    return (interp_expr_walker){
+        .walk_binary = walk_binary,
+        .walk_unary = walk_unary,
+        .walk_call = walk_call,
+        .walk_num = walk_num,
+        .walk_iden = walk_iden,
+        .walk_str = walk_str,
+        .walk_bool = walk_bool,
+        .walk_lambda = walk_lambda,
+        .ctx = ctx,
+    };
+}
+
+// Statement walker
+
+static int walk_expr_stmt(interp_stmt_walker* self, ast_node_expr_stmt* stmt) {
+    eval(self->ctx, stmt->expr);
+    return 0;
+}
+
+static int walk_var_decl(interp_stmt_walker* self, ast_node_var_decl* stmt) {
+    interp* ctx = self->ctx;
+    int64_t value = stmt->value != NULL ? eval(ctx, stmt->value) : 0;
+
+    ctx->base[stmt->slot] = value;
+    return 0;
+}
+
+static int walk_block(interp_stmt_walker* self, ast_node_block* stmt) {
+    for (ast_stmt_node* curr = stmt->body; curr != NULL; curr = curr->next) {
+        interp_stmt_walker_walk(self, curr);
+    }
+
+    return 0;
+}
+
+static int walk_if_else(interp_stmt_walker* self, ast_node_if_else* stmt) {
+    if (eval(self->ctx, stmt->condition)) {
+        interp_stmt_walker_walk(self, stmt->body);
+    } else if (stmt->else_body != NULL) {
+        interp_stmt_walker_walk(self, stmt->else_body);
+    }
+
+    return 0;
+}
+
+static int walk_while(interp_stmt_walker* self, ast_node_while* stmt) {
+    while (eval(self->ctx, stmt->condition)) {
+        interp_stmt_walker_walk(self, stmt->body);
+    }
+
+    return 0;
+}
+
+static interp_stmt_walker make_stmt_walker(interp* ctx) {
+    return (interp_stmt_walker){
+        .walk_expr_stmt = walk_expr_stmt,
+        .walk_var_decl = walk_var_decl,
+        .walk_block = walk_block,
+        .walk_if_else = walk_if_else,
+        .walk_while = walk_while,
+        .ctx = ctx,
+    };
+}
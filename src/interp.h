@@ -0,0 +1,59 @@
+/**
+ * Tree-walking interpreter
+ *
+ * Runs a resolved AST (see resolve.h) directly, with the AST walkers. It is
+ * the simplest way to execute a program and the reference the other
+ * backends are checked and measured against.
+ *
+ * Values live on one flat stack of 64 bit slots. A call's frame starts with
+ * its arguments, followed by its variables at the slots the resolver gave
+ * them, so variables are never looked up by name. Functions are their
+ * index in the function table times two, closures are represented as
+ * closure.h describes, with the environments of the ones that do not
+ * escape in slots of the frame that makes them.
+ */
+
+#ifndef INTERP_H
+#define INTERP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "alloc.h"
+#include "resolve.h"
+
+/* Slots on the stack, shared by all the active calls */
+#define INTERP_STACK_SIZE (1 << 20)
+
+/* Calls that can be active at the same time. Every call takes a few
+ * frames of the C stack, this keeps them well within the default 8 MiB. */
+#define INTERP_MAX_DEPTH 10000
+
+typedef struct _interp interp;
+
+/**
+ * Makes an interpreter for `program`, which must outlive it together with
+ * its AST. Strings made while running come from `allocator` and are only
+ * released with it.
+ */
+interp* interp_make(allocator_t* allocator, const resolved_program* program);
+
+void interp_destroy(interp* self);
+
+/**
+ * Calls function `function` of the program with `arg_count` arguments and
+ * stores what it returns in `result`.
+ *
+ * Returns false after printing to diag_stream() on a runtime error:
+ * division by zero or running out of stack.
+ */
+bool interp_call(
+    interp* self,
+    size_t function,
+    const int64_t* args,
+    size_t arg_count,
+    int64_t* result
+);
+
+#endif  // INTERP_H
@@ -0,0 +1,1135 @@
+#include "ir.h"
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "diag.h"
+
+/* Phi node of a block that did not have all its predecessors yet, waiting
+ * for their values of `slot` */
+typedef struct {
+    size_t slot;
+    ir_value phi;
+} incomplete_phi;
+
+typedef VEC(incomplete_phi) vec_incomplete_phi;
+
+typedef struct {
+    /* Value of every slot at the end of the block so far, IR_NONE if the
+     * block does not set it */
+    ir_value* defs;
+
+    /* Whether all the predecessors of the block are known */
+    bool sealed;
+    vec_incomplete_phi incomplete;
+} block_state;
+
+typedef VEC(block_state) vec_block_state;
+
+/* Variables are the slots the resolver gave them. Reading one looks for
+ * its value back through the predecessors of the block, making phi nodes
+ * where they meet: the construction of Braun et al., "Simple and Efficient
+ * Construction of Static Single Assignment Form". */
+typedef struct {
+    allocator_t* allocator;
+    const resolved_program* program;
+    ir_program* out;
+
+    const resolved_function* source;
+    ir_function* fn;
+    vec_block_state states;
+
+    /* Type of the variable in every slot, while it is in scope */
+    ir_type* slot_types;
+
+    /* Where instructions go */
+    ir_block current;
+
+    /* The first error unwinds straight back to ir_build */
+    jmp_buf on_error;
+} builder;
+
+static void build_error(builder* self, const char* fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    diag_vprintf(fmt, args);
+    va_end(args);
+
+    longjmp(self->on_error, 1);
+}
+
+static ir_type type_of(ast_typename* type) {
+    if (type == NULL) {
+        return IR_TYPE_UNIT;
+    }
+
+    switch (type->type) {
+        case TYPE_NAME_INTEGER: {
+            bool is_signed = type->as.integer.is_signed;
+
+            switch (type->as.integer.size) {
+                case INTEGER_SIZE_8:
+                    return is_signed ? IR_TYPE_I8 : IR_TYPE_U8;
+                case INTEGER_SIZE_16:
+                    return is_signed ? IR_TYPE_I16 : IR_TYPE_U16;
+                case INTEGER_SIZE_32:
+                    break;
+            }
+
+            return is_signed ? IR_TYPE_I32 : IR_TYPE_U32;
+        }
+
+        case TYPE_NAME_BOOLEAN:
+            return IR_TYPE_BOOLEAN;
+
+        case TYPE_NAME_STRING:
+            return IR_TYPE_STRING;
+
+        case TYPE_NAME_FUNCTION:
+            return IR_TYPE_FUNCTION;
+
+        case TYPE_NAME_TUPLE:
+            break;
+    }
+
+    return IR_TYPE_UNIT;
+}
+
+// Blocks and values
+
+static ir_block new_block(builder* self) {
+    ir_block_data block = {
+        .phis = vec_make(self->allocator),
+        .instrs = vec_make(self->allocator),
+        .preds = vec_make(self->allocator),
+        .live = true,
+    };
+    block_state state = {
+        .defs = ALLOC_ARRAY(
+            self->allocator, ir_value, (self->source->frame_size + 1)
+        ),
+        .sealed = false,
+        .incomplete = vec_make(self->allocator),
+    };
+
+    for (size_t i = 0; i < self->source->frame_size; i++) {
+        state.defs[i] = IR_NONE;
+    }
+
+    vec_push(&self->fn->blocks, &block);
+    vec_push(&self->states, &state);
+
+    return self->fn->blocks.len - 1;
+}
+
+static ir_value new_value(builder* self, ir_opcode op, ir_type type) {
+    ir_instr instr = {
+        .op = op,
+        .type = type,
+        .block = self->current,
+        .imm = 0,
+        .args = vec_make(self->allocator),
+        .targets = {IR_NONE, IR_NONE},
+    };
+
+    vec_push(&self->fn->values, &instr);
+
+    return self->fn->values.len - 1;
+}
+
+static ir_instr* instr_of(builder* self, ir_value value) {
+    return &self->fn->values.items[value];
+}
+
+static void add_arg(builder* self, ir_value value, ir_value arg) {
+    vec_push(&instr_of(self, value)->args, &arg);
+}
+
+/* Appends an instruction to the current block */
+static ir_value emit(
+    builder* self, ir_opcode op, ir_type type, size_t arg_count, ...
+) {
+    ir_value value = new_value(self, op, type);
+    va_list args;
+
+    va_start(args, arg_count);
+    for (size_t i = 0; i < arg_count; i++) {
+        add_arg(self, value, va_arg(args, ir_value));
+    }
+    va_end(args);
+
+    vec_push(&self->fn->blocks.items[self->current].instrs, &value);
+
+    return value;
+}
+
+static ir_value emit_const(builder* self, ir_type type, int64_t imm) {
+    ir_value value = emit(self, IR_CONST, type, 0);
+    instr_of(self, value)->imm = imm;
+    return value;
+}
+
+static ir_value emit_function(builder* self, size_t index) {
+    ir_value value = emit(self, IR_FUNCTION, IR_TYPE_FUNCTION, 0);
+    instr_of(self, value)->imm = index;
+    return value;
+}
+
+static void add_edge(builder* self, ir_block from, ir_block to) {
+    vec_push(&self->fn->blocks.items[to].preds, &from);
+}
+
+static void emit_jump(builder* self, ir_block target) {
+    ir_value jump = emit(self, IR_JUMP, IR_TYPE_UNIT, 0);
+
+    instr_of(self, jump)->targets[0] = target;
+    add_edge(self, self->current, target);
+}
+
+static void emit_branch(
+    builder* self, ir_value condition, ir_block then, ir_block otherwise
+) {
+    ir_value branch = emit(self, IR_BRANCH, IR_TYPE_UNIT, 1, condition);
+
+    instr_of(self, branch)->targets[0] = then;
+    instr_of(self, branch)->targets[1] = otherwise;
+    add_edge(self, self->current, then);
+    add_edge(self, self->current, otherwise);
+}
+
+static ir_value new_phi(builder* self, ir_block block, ir_type type) {
+    ir_value phi = new_value(self, IR_PHI, type);
+
+    instr_of(self, phi)->block = block;
+    vec_push(&self->fn->blocks.items[block].phis, &phi);
+
+    return phi;
+}
+
+// Variables
+
+static ir_value read_slot(builder* self, ir_block block, size_t slot);
+
+static void write_slot(
+    builder* self, ir_block block, size_t slot, ir_value value
+) {
+    self->states.items[block].defs[slot] = value;
+}
+
+static void add_phi_operands(builder* self, ir_value phi, size_t slot) {
+    ir_block block = instr_of(self, phi)->block;
+    vec_ir_block* preds = &self->fn->blocks.items[block].preds;
+
+    for (size_t i = 0; i < preds->len; i++) {
+        add_arg(self, phi, read_slot(self, preds->items[i], slot));
+    }
+}
+
+static ir_value read_slot(builder* self, ir_block block, size_t slot) {
+    block_state* state = &self->states.items[block];
+
+    if (state->defs[slot] != IR_NONE) {
+        return state->defs[slot];
+    }
+
+    vec_ir_block* preds = &self->fn->blocks.items[block].preds;
+    ir_value value;
+
+    if (!state->sealed) {
+        value = new_phi(self, block, self->slot_types[slot]);
+
+        incomplete_phi incomplete = {.slot = slot, .phi = value};
+        vec_push(&self->states.items[block].incomplete, &incomplete);
+    } else if (preds->len == 1) {
+        value = read_slot(self, preds->items[0], slot);
+    } else if (preds->len == 0) {
+        /* Every variable is set where it is declared */
+        build_error(self, "BUG: slot %zu read before it is set", slot);
+    } else {
+        /* Set first, so that loops back to the block find the phi */
+        value = new_phi(self, block, self->slot_types[slot]);
+        write_slot(self, block, slot, value);
+        add_phi_operands(self, value, slot);
+    }
+
+    write_slot(self, block, slot, value);
+
+    return value;
+}
+
+/* The predecessors of `block` are all known */
+static void seal(builder* self, ir_block block) {
+    block_state* state = &self->states.items[block];
+
+    for (size_t i = 0; i < state->incomplete.len; i++) {
+        incomplete_phi incomplete = state->incomplete.items[i];
+        add_phi_operands(self, incomplete.phi, incomplete.slot);
+    }
+
+    state->sealed = true;
+}
+
+// Expressions
+
+static ir_value lower_expr(builder* self, ast_expr_node* expr);
+
+static ir_value lower_identifier(builder* self, ast_node_identifier* iden) {
+    switch (iden->binding.kind) {
+        case AST_BINDING_LOCAL:
+            return read_slot(self, self->current, iden->binding.index);
+
+        case AST_BINDING_FUNCTION:
+            return emit_function(self, iden->binding.index);
+
+        case AST_BINDING_UNRESOLVED:
+            break;
+    }
+
+    build_error(
+        self, "BUG: unresolved identifier '%.*s'", (int)iden->len, iden->start
+    );
+    return IR_NONE;
+}
+
+static ir_value lower_assign(builder* self, ast_node_binary* expr) {
+    if (expr->left->type != AST_IDEN ||
+        expr->left->identifier.binding.kind != AST_BINDING_LOCAL) {
+        build_error(self, "can only assign to local variables");
+    }
+
+    ir_value value = lower_expr(self, expr->right);
+    write_slot(
+        self, self->current, expr->left->identifier.binding.index, value
+    );
+
+    return value;
+}
+
+/* a && b is a ? b : a, and a || b is a ? a : b */
+static ir_value lower_logical(builder* self, ast_node_binary* expr) {
+    ir_value left = lower_expr(self, expr->left);
+    ir_block right_block = new_block(self);
+    ir_block end = new_block(self);
+
+    if (expr->op == TOK_AND) {
+        emit_branch(self, left, right_block, end);
+    } else {
+        emit_branch(self, left, end, right_block);
+    }
+
+    ir_block left_end = self->current;
+
+    seal(self, right_block);
+    self->current = right_block;
+
+    ir_value right = lower_expr(self, expr->right);
+    emit_jump(self, end);
+    seal(self, end);
+    self->current = end;
+
+    /* In the order the edges were added */
+    ir_value phi = new_phi(self, end, IR_TYPE_BOOLEAN);
+    vec_ir_block* preds = &self->fn->blocks.items[end].preds;
+
+    for (size_t i = 0; i < preds->len; i++) {
+        add_arg(self, phi, preds->items[i] == left_end ? left : right);
+    }
+
+    return phi;
+}
+
+static ir_opcode binary_opcode(token_type op, bool is_string) {
+    switch (op) {
+        case TOK_PLUS:
+            return is_string ? IR_CONCAT : IR_ADD;
+        case TOK_MINUS:
+            return IR_SUB;
+        case TOK_MUL:
+            return IR_MUL;
+        case TOK_DIV:
+            return IR_DIV;
+        case TOK_PERC:
+            return IR_MOD;
+        case TOK_AMP:
+            return IR_AND;
+        case TOK_PIPE:
+            return IR_OR;
+        case TOK_CARET:
+            return IR_XOR;
+        case TOK_EQ:
+            return is_string ? IR_STREQ : IR_EQ;
+        case TOK_NEQ:
+            return is_string ? IR_STREQ : IR_NE;
+        case TOK_LT:
+            return IR_LT;
+        case TOK_GT:
+            return IR_GT;
+        case TOK_LTEQ:
+            return IR_LE;
+        case TOK_GTEQ:
+            return IR_GE;
+        default:
+            break;
+    }
+
+    return IR_OPCODE_COUNT;
+}
+
+static ir_value lower_binary(builder* self, ast_node_binary* expr) {
+    switch (expr->op) {
+        case TOK_ASSIGN:
+            return lower_assign(self, expr);
+
+        case TOK_AND:
+        case TOK_OR:
+            return lower_logical(self, expr);
+
+        default:
+            break;
+    }
+
+    ir_type type = type_of(expr->left->value_type);
+    bool is_string = type == IR_TYPE_STRING;
+    ir_opcode op = binary_opcode(expr->op, is_string);
+
+    if (op == IR_OPCODE_COUNT) {
+        build_error(self, "BUG: unknown binary operator");
+    }
+
+    ir_value left = lower_expr(self, expr->left);
+    ir_value right = lower_expr(self, expr->right);
+
+    if (op == IR_CONCAT) {
+        return emit(self, op, IR_TYPE_STRING, 2, left, right);
+    }
+
+    if (op == IR_STREQ) {
+        ir_value equal = emit(self, op, IR_TYPE_BOOLEAN, 2, left, right);
+
+        return expr->op == TOK_NEQ
+                   ? emit(self, IR_NOT, IR_TYPE_BOOLEAN, 1, equal)
+                   : equal;
+    }
+
+    /* Comparisons keep the type of their operands */
+    ir_value value = emit(self, op, type, 2, left, right);
+
+    /* A division by zero is reported in the function it is written in,
+     * wherever it ends up */
+    if (op == IR_DIV || op == IR_MOD) {
+        instr_of(self, value)->imm = self->fn - self->out->functions.items;
+    }
+
+    return value;
+}
+
+static ir_value lower_unary(builder* self, ast_node_unary* expr) {
+    ir_value value = lower_expr(self, expr->expr);
+
+    switch (expr->op) {
+        case TOK_BANG:
+            return emit(self, IR_NOT, IR_TYPE_BOOLEAN, 1, value);
+
+        case TOK_MINUS:
+            return emit(
+                self, IR_NEG, type_of(expr->expr->value_type), 1, value
+            );
+
+        default:
+            return value;
+    }
+}
+
+/* Emits `op`, IR_CALL or IR_TAIL_CALL, for `call` */
+static ir_value lower_call(
+    builder* self, ast_node_call* call, ir_opcode op, ir_type type
+) {
+    ast_node_lambda* lifted = call->lambda;
+    ir_value callee = lifted != NULL
+                          ? emit_function(self, lifted->index)
+                          : lower_expr(self, call->function);
+    ir_value* args = ALLOC_ARRAY(
+        self->allocator, ir_value, (call->args.len + 1)
+    );
+
+    for (size_t i = 0; i < call->args.len; i++) {
+        args[i] = lower_expr(self, call->args.items[i]);
+    }
+
+    ir_value value = emit(self, op, type, 1, callee);
+
+    for (size_t i = 0; i < call->args.len; i++) {
+        add_arg(self, value, args[i]);
+    }
+
+    FREE_ARRAY(self->allocator, args, ir_value, (call->args.len + 1));
+
+    /* Lifted lambdas get the values they capture after the arguments */
+    if (lifted != NULL) {
+        const resolved_function* fn =
+            &self->program->functions.items[lifted->index];
+
+        for (size_t i = 0; i < fn->capture_count; i++) {
+            ir_value capture = read_slot(
+                self, self->current, fn->captures[i].slot
+            );
+
+            add_arg(self, value, capture);
+        }
+    }
+
+    return value;
+}
+
+static ir_value lower_lambda(builder* self, ast_node_lambda* lambda) {
+    const resolved_function* fn =
+        &self->program->functions.items[lambda->index];
+    ir_opcode op;
+
+    switch (lambda->closure) {
+        case AST_CLOSURE_STACK:
+            op = IR_STACK_CLOSURE;
+            break;
+
+        case AST_CLOSURE_HEAP:
+            op = IR_CLOSURE;
+            break;
+
+        /* Lifted lambdas are only called, see lower_call */
+        default:
+            return emit_function(self, lambda->index);
+    }
+
+    ir_value function = emit_function(self, lambda->index);
+    ir_value* captures = ALLOC_ARRAY(
+        self->allocator, ir_value, fn->capture_count
+    );
+
+    for (size_t i = 0; i < fn->capture_count; i++) {
+        captures[i] = read_slot(self, self->current, fn->captures[i].slot);
+    }
+
+    ir_value value = emit(self, op, IR_TYPE_FUNCTION, 1, function);
+
+    for (size_t i = 0; i < fn->capture_count; i++) {
+        add_arg(self, value, captures[i]);
+    }
+
+    FREE_ARRAY(self->allocator, captures, ir_value, fn->capture_count);
+
+    return value;
+}
+
+static ir_value lower_expr(builder* self, ast_expr_node* expr) {
+    switch (expr->type) {
+        case AST_NUM:
+            /* The resolver already wrapped it to its type */
+            return emit_const(
+                self, type_of(expr->value_type), (int64_t)expr->num.value
+            );
+
+        case AST_BOOL:
+            return emit_const(self, IR_TYPE_BOOLEAN, expr->boolean.value);
+
+        case AST_STR: {
+            ir_string str = {.str = expr->str.str, .len = expr->str.len};
+            vec_push(&self->out->strings, &str);
+
+            ir_value value = emit(self, IR_STRING, IR_TYPE_STRING, 0);
+            instr_of(self, value)->imm = self->out->strings.len - 1;
+            return value;
+        }
+
+        case AST_IDEN:
+            return lower_identifier(self, &expr->identifier);
+
+        case AST_BINARY:
+            return lower_binary(self, &expr->binary);
+
+        case AST_UNARY:
+            return lower_unary(self, &expr->unary);
+
+        case AST_CALL:
+            return lower_call(
+                self, &expr->call, IR_CALL, type_of(expr->value_type)
+            );
+
+        case AST_LAMBDA:
+            return lower_lambda(self, &expr->lambda);
+    }
+
+    return IR_NONE;
+}
+
+// Statements
+
+static void lower_stmt(builder* self, ast_stmt_node* stmt);
+
+static void lower_var_decl(builder* self, ast_node_var_decl* decl) {
+    ir_type type = type_of(decl->typename);
+    ir_value value;
+
+    if (decl->value != NULL) {
+        type = type_of(decl->value->value_type);
+        value = lower_expr(self, decl->value);
+    } else {
+        value = emit_const(self, type, 0);
+    }
+
+    self->slot_types[decl->slot] = type;
+    write_slot(self, self->current, decl->slot, value);
+}
+
+static bool lower_tail_stmt(builder* self, ast_stmt_node* stmt);
+
+/* Lowers `stmt`, as the last statement of its function if `tail`, and
+ * returns whether it ended the current block */
+static bool lower_branch(builder* self, ast_stmt_node* stmt, bool tail) {
+    if (tail) {
+        return lower_tail_stmt(self, stmt);
+    }
+
+    lower_stmt(self, stmt);
+    return false;
+}
+
+static bool lower_if_else(builder* self, ast_node_if_else* stmt, bool tail) {
+    ir_value condition = lower_expr(self, stmt->condition);
+    ir_block then = new_block(self);
+    ir_block end = new_block(self);
+    ir_block otherwise = stmt->else_body != NULL ? new_block(self) : end;
+
+    emit_branch(self, condition, then, otherwise);
+    seal(self, then);
+
+    self->current = then;
+    if (!lower_branch(self, stmt->body, tail)) {
+        emit_jump(self, end);
+    }
+
+    if (stmt->else_body != NULL) {
+        seal(self, otherwise);
+        self->current = otherwise;
+
+        if (!lower_branch(self, stmt->else_body, tail)) {
+            emit_jump(self, end);
+        }
+    }
+
+    seal(self, end);
+    self->current = end;
+
+    /* Both branches made tail calls */
+    if (self->fn->blocks.items[end].preds.len == 0) {
+        self->fn->blocks.items[end].live = false;
+        return true;
+    }
+
+    return false;
+}
+
+static void lower_while(builder* self, ast_node_while* stmt) {
+    ir_block header = new_block(self);
+    ir_block body = new_block(self);
+    ir_block end = new_block(self);
+
+    emit_jump(self, header);
+
+    /* The back edge is not known until the body is lowered */
+    self->current = header;
+    ir_value condition = lower_expr(self, stmt->condition);
+    emit_branch(self, condition, body, end);
+    seal(self, body);
+
+    self->current = body;
+    lower_stmt(self, stmt->body);
+    emit_jump(self, header);
+    seal(self, header);
+
+    seal(self, end);
+    self->current = end;
+}
+
+static void lower_stmt(builder* self, ast_stmt_node* stmt) {
+    switch (stmt->type) {
+        case AST_EXPR_STMT:
+            lower_expr(self, stmt->expr_stmt.expr);
+            return;
+
+        case AST_VAR_DECL:
+            lower_var_decl(self, &stmt->var_decl);
+            return;
+
+        case AST_BLOCK:
+            for (ast_stmt_node* curr = stmt->block.body; curr != NULL;
+                 curr = curr->next) {
+                lower_stmt(self, curr);
+            }
+            return;
+
+        case AST_IF_ELSE:
+            lower_if_else(self, &stmt->if_else, false);
+            return;
+
+        case AST_WHILE:
+            lower_while(self, &stmt->while_);
+            return;
+    }
+}
+
+// Tail calls
+
+static void lower_tail_call(builder* self, ast_node_call* call) {
+    lower_call(self, call, IR_TAIL_CALL, IR_TYPE_UNIT);
+}
+
+/* Whether `expr` ends with a tail call */
+static bool has_tail_call(ast_expr_node* expr) {
+    if (expr->type == AST_CALL) {
+        return expr->call.tail;
+    }
+
+    return expr->type == AST_BINARY &&
+           (expr->binary.op == TOK_AND || expr->binary.op == TOK_OR) &&
+           has_tail_call(expr->binary.right);
+}
+
+/* Lowers the last statement of a function without a result and returns
+ * whether it ended the current block with a tail call */
+static bool lower_tail_stmt(builder* self, ast_stmt_node* stmt) {
+    switch (stmt->type) {
+        case AST_EXPR_STMT: {
+            ast_expr_node* expr = stmt->expr_stmt.expr;
+
+            if (expr->type == AST_CALL && expr->call.tail) {
+                lower_tail_call(self, &expr->call);
+                return true;
+            }
+            break;
+        }
+
+        case AST_BLOCK: {
+            ast_stmt_node* curr = stmt->block.body;
+
+            for (; curr != NULL && curr->next != NULL; curr = curr->next) {
+                lower_stmt(self, curr);
+            }
+
+            return curr != NULL && lower_tail_stmt(self, curr);
+        }
+
+        case AST_IF_ELSE:
+            return lower_if_else(self, &stmt->if_else, true);
+
+        default:
+            break;
+    }
+
+    lower_stmt(self, stmt);
+    return false;
+}
+
+/* Returns the result of a function, the left operand of a logical
+ * expression by itself when the right one ends with a tail call */
+static void lower_return(builder* self, ast_expr_node* expr) {
+    if (expr->type == AST_CALL && expr->call.tail) {
+        lower_tail_call(self, &expr->call);
+        return;
+    }
+
+    if (expr->type != AST_BINARY || !has_tail_call(expr)) {
+        emit(self, IR_RET, IR_TYPE_UNIT, 1, lower_expr(self, expr));
+        return;
+    }
+
+    ast_node_binary* logical = &expr->binary;
+    ir_value left = lower_expr(self, logical->left);
+    ir_block right = new_block(self);
+    ir_block done = new_block(self);
+
+    if (logical->op == TOK_AND) {
+        emit_branch(self, left, right, done);
+    } else {
+        emit_branch(self, left, done, right);
+    }
+
+    seal(self, right);
+    seal(self, done);
+
+    self->current = done;
+    emit(self, IR_RET, IR_TYPE_UNIT, 1, left);
+
+    self->current = right;
+    lower_return(self, logical->right);
+}
+
+// Functions
+
+static void build_function(builder* self, size_t index) {
+    const resolved_function* source = &self->program->functions.items[index];
+    ir_function* fn = &self->out->functions.items[index];
+
+    *fn = (ir_function){
+        .name = source->name,
+        .name_len = source->name_len,
+        .is_lambda = source->parent != RESOLVED_NO_FUNCTION,
+        .param_count = source->param_count,
+        .return_type = type_of(source->type->as.function.return_type),
+        .values = vec_make(self->allocator),
+        .blocks = vec_make(self->allocator),
+    };
+
+    self->source = source;
+    self->fn = fn;
+    self->states = (vec_block_state)vec_make(self->allocator);
+    self->slot_types = ALLOC_ARRAY(
+        self->allocator, ir_type, (source->frame_size + 1)
+    );
+
+    self->current = new_block(self);
+    seal(self, self->current);
+
+    size_t i = 0;
+    for (ast_param* param = source->params; param != NULL;
+         param = param->next, i++) {
+        ir_type type = type_of(param->type);
+        ir_value value = emit(self, IR_PARAM, type, 0);
+
+        instr_of(self, value)->imm = i;
+        self->slot_types[i] = type;
+        write_slot(self, self->current, i, value);
+    }
+
+    /* The captured values come after the parameters, in arguments of
+     * their own for lifted lambdas, in the environment that arrives in
+     * the first of them for closures */
+    ast_node_lambda* lambda = source->lambda;
+    ir_value env = IR_NONE;
+
+    if (lambda != NULL && (lambda->closure == AST_CLOSURE_STACK ||
+                           lambda->closure == AST_CLOSURE_HEAP)) {
+        env = emit(self, IR_PARAM, IR_TYPE_FUNCTION, 0);
+        instr_of(self, env)->imm = i;
+        fn->param_count++;
+    }
+
+    for (size_t k = 0; k < source->capture_count; k++) {
+        ir_type type = type_of(source->captures[k].type);
+        ir_value value;
+
+        if (env != IR_NONE) {
+            value = emit(self, IR_CAPTURE, type, 1, env);
+            instr_of(self, value)->imm = k;
+        } else {
+            value = emit(self, IR_PARAM, type, 0);
+            instr_of(self, value)->imm = i + k;
+            fn->param_count++;
+        }
+
+        self->slot_types[i + k] = type;
+        write_slot(self, self->current, i + k, value);
+    }
+
+    for (ast_stmt_node* curr = source->body; curr != NULL; curr = curr->next) {
+        if (curr->next != NULL) {
+            lower_stmt(self, curr);
+        } else if (curr->type == AST_EXPR_STMT && source->returns_value) {
+            lower_return(self, curr->expr_stmt.expr);
+            return;
+        } else if (lower_tail_stmt(self, curr)) {
+            return;
+        }
+    }
+
+    emit(self, IR_RET, IR_TYPE_UNIT, 0);
+}
+
+bool ir_build(
+    allocator_t* allocator, const resolved_program* program, ir_program* out
+) {
+    size_t count = program->functions.len;
+
+    *out = (ir_program){
+        .functions = vec_make(allocator),
+        .strings = vec_make(allocator),
+        .main = program->main,
+    };
+
+    vec_reserve(&out->functions, count);
+    out->functions.len = count;
+
+    builder self = {
+        .allocator = allocator,
+        .program = program,
+        .out = out,
+    };
+
+    if (setjmp(self.on_error) != 0) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        build_function(&self, i);
+    }
+
+    return true;
+}
+
+// Queries
+
+size_t ir_type_size(ir_type type) {
+    switch (type) {
+        case IR_TYPE_I8:
+        case IR_TYPE_U8:
+            return 1;
+        case IR_TYPE_I16:
+        case IR_TYPE_U16:
+            return 2;
+        case IR_TYPE_I32:
+        case IR_TYPE_U32:
+            return 4;
+        default:
+            return 8;
+    }
+}
+
+bool ir_type_is_signed(ir_type type) {
+    return type == IR_TYPE_I8 || type == IR_TYPE_I16 || type == IR_TYPE_I32;
+}
+
+bool ir_is_terminator(ir_opcode op) {
+    return op == IR_JUMP || op == IR_BRANCH || op == IR_RET ||
+           op == IR_TAIL_CALL;
+}
+
+bool ir_has_side_effects(const ir_function* fn, const ir_instr* instr) {
+    switch (instr->op) {
+        case IR_CALL:
+        case IR_JUMP:
+        case IR_BRANCH:
+        case IR_RET:
+        case IR_TAIL_CALL:
+            return true;
+
+        /* Unless the divisor is known not to be 0 */
+        case IR_DIV:
+        case IR_MOD: {
+            const ir_instr* divisor = &fn->values.items[instr->args.items[1]];
+            return divisor->op != IR_CONST || divisor->imm == 0;
+        }
+
+        default:
+            return false;
+    }
+}
+
+size_t ir_successors(const ir_function* fn, ir_block block, ir_block out[2]) {
+    const vec_ir_value* instrs = &fn->blocks.items[block].instrs;
+
+    if (instrs->len == 0) {
+        return 0;
+    }
+
+    const ir_instr* last = &fn->values.items[instrs->items[instrs->len - 1]];
+
+    switch (last->op) {
+        case IR_JUMP:
+            out[0] = last->targets[0];
+            return 1;
+
+        case IR_BRANCH:
+            out[0] = last->targets[0];
+            out[1] = last->targets[1];
+            return 2;
+
+        default:
+            return 0;
+    }
+}
+
+size_t ir_reverse_postorder(
+    allocator_t* allocator, const ir_function* fn, ir_block* out
+) {
+    size_t count = fn->blocks.len;
+
+    /* Depth first, with an explicit stack of blocks and how many of their
+     * successors were visited */
+    bool* visited = ALLOC_ARRAY(allocator, bool, count);
+    ir_block* stack = ALLOC_ARRAY(allocator, ir_block, count);
+    size_t* next = ALLOC_ARRAY(allocator, size_t, count);
+    size_t depth = 0;
+    size_t done = 0;
+
+    memset(visited, 0, count * sizeof(bool));
+
+    stack[depth] = 0;
+    next[depth++] = 0;
+    visited[0] = true;
+
+    while (depth != 0) {
+        ir_block block = stack[depth - 1];
+        ir_block succs[2];
+        size_t succ_count = ir_successors(fn, block, succs);
+
+        if (next[depth - 1] < succ_count) {
+            ir_block succ = succs[next[depth - 1]++];
+
+            if (!visited[succ]) {
+                visited[succ] = true;
+                stack[depth] = succ;
+                next[depth++] = 0;
+            }
+
+            continue;
+        }
+
+        /* Postorder, filled in from the end */
+        out[count - 1 - done++] = block;
+        depth--;
+    }
+
+    memmove(out, out + count - done, done * sizeof(ir_block));
+
+    FREE_ARRAY(allocator, next, size_t, count);
+    FREE_ARRAY(allocator, stack, ir_block, count);
+    FREE_ARRAY(allocator, visited, bool, count);
+
+    return done;
+}
+
+// Printing
+
+static const char* const OPCODE_NAMES[] = {
+#define IR_OPCODE_NAME(name, printed) [IR_##name] = printed,
+    IR_OPCODES(IR_OPCODE_NAME)
+#undef IR_OPCODE_NAME
+};
+
+static const char* const TYPE_NAMES[] = {
+    [IR_TYPE_I8] = "i8",
+    [IR_TYPE_I16] = "i16",
+    [IR_TYPE_I32] = "i32",
+    [IR_TYPE_U8] = "u8",
+    [IR_TYPE_U16] = "u16",
+    [IR_TYPE_U32] = "u32",
+    [IR_TYPE_BOOLEAN] = "boolean",
+    [IR_TYPE_STRING] = "string",
+    [IR_TYPE_FUNCTION] = "fn",
+    [IR_TYPE_UNIT] = "unit",
+};
+
+static void print_instr(
+    FILE* out, const ir_program* program, const ir_function* fn, ir_value v
+) {
+    const ir_instr* instr = &fn->values.items[v];
+
+    fprintf(out, "    ");
+
+    if (!ir_is_terminator(instr->op)) {
+        fprintf(out, "v%u = ", v);
+    }
+
+    fprintf(out, "%s", OPCODE_NAMES[instr->op]);
+
+    if (!ir_is_terminator(instr->op)) {
+        fprintf(out, " %s", TYPE_NAMES[instr->type]);
+    }
+
+    switch (instr->op) {
+        case IR_CONST:
+        case IR_PARAM:
+        case IR_FUNCTION:
+            fprintf(out, " %lld\n", (long long)instr->imm);
+            return;
+
+        case IR_CAPTURE:
+            fprintf(
+                out,
+                " v%u, %lld\n",
+                instr->args.items[0],
+                (long long)instr->imm
+            );
+            return;
+
+        case IR_STRING: {
+            const ir_string* str = &program->strings.items[instr->imm];
+            fprintf(out, " \"%.*s\"\n", (int)str->len, str->str);
+            return;
+        }
+
+        case IR_PHI: {
+            const vec_ir_block* preds = &fn->blocks.items[instr->block].preds;
+
+            for (size_t i = 0; i < instr->args.len; i++) {
+                fprintf(
+                    out,
+                    "%s [b%u: v%u]",
+                    i == 0 ? "" : ",",
+                    preds->items[i],
+                    instr->args.items[i]
+                );
+            }
+
+            fprintf(out, "\n");
+            return;
+        }
+
+        default:
+            break;
+    }
+
+    for (size_t i = 0; i < instr->args.len; i++) {
+        fprintf(out, "%s v%u", i == 0 ? "" : ",", instr->args.items[i]);
+    }
+
+    if (instr->op == IR_JUMP) {
+        fprintf(out, " b%u", instr->targets[0]);
+    } else if (instr->op == IR_BRANCH) {
+        fprintf(out, ", b%u, b%u", instr->targets[0], instr->targets[1]);
+    }
+
+    fprintf(out, "\n");
+}
+
+void ir_print(FILE* out, const ir_program* program) {
+    for (size_t f = 0; f < program->functions.len; f++) {
+        const ir_function* fn = &program->functions.items[f];
+
+        fprintf(
+            out,
+            "function %zu %.*s (%zu params) -> %s\n",
+            f,
+            (int)fn->name_len,
+            fn->name,
+            fn->param_count,
+            TYPE_NAMES[fn->return_type]
+        );
+
+        for (size_t b = 0; b < fn->blocks.len; b++) {
+            const ir_block_data* block = &fn->blocks.items[b];
+
+            if (!block->live) {
+                continue;
+            }
+
+            fprintf(out, "  b%zu:", b);
+
+            for (size_t i = 0; i < block->preds.len; i++) {
+                const char* sep = i == 0 ? " preds" : ",";
+                fprintf(out, "%s b%u", sep, block->preds.items[i]);
+            }
+
+            fprintf(out, "\n");
+
+            for (size_t i = 0; i < block->phis.len; i++) {
+                print_instr(out, program, fn, block->phis.items[i]);
+            }
+
+            for (size_t i = 0; i < block->instrs.len; i++) {
+                print_instr(out, program, fn, block->instrs.items[i]);
+            }
+        }
+    }
+}
@@ -0,0 +1,266 @@
+/**
+ * SSA intermediate representation
+ *
+ * The native backend (see codegen.h) works from this rather than from the
+ * AST, so that the program can be optimized first (see ir_optimize).
+ *
+ * A function is a graph of basic blocks, the first one its entry. A block
+ * is a list of phi nodes, a list of instructions, and a terminator that ends
+ * it: a jump, a branch, a return, or a tail call. Every instruction and phi
+ * node defines one value, numbered within its function, and reads values
+ * defined before it, which in SSA form means in a block that dominates it
+ * or earlier in its own block. A phi node picks one value per predecessor
+ * of its block, in the order of the predecessors.
+ *
+ * Values are 64 bits wide like the registers of the bytecode VM (see
+ * bytecode.h): integers are kept sign or zero extended from their type's
+ * width, so only the instructions that can leave the range of the type
+ * (+, -, *, /, %, negation) need to know it. Booleans are 0 or 1, strings
+ * are pointers to their length followed by their bytes, and unit is 0.
+ * How a backend represents functions is up to it, as long as the lowest
+ * bit is clear: closures are represented as closure.h describes.
+ */
+
+#ifndef IR_H
+#define IR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "alloc.h"
+#include "ast.h"
+#include "resolve.h"
+#include "vec.h"
+
+typedef enum {
+    IR_TYPE_I8,
+    IR_TYPE_I16,
+    IR_TYPE_I32,
+    IR_TYPE_U8,
+    IR_TYPE_U16,
+    IR_TYPE_U32,
+    IR_TYPE_BOOLEAN,
+    IR_TYPE_STRING,
+    IR_TYPE_FUNCTION,
+    IR_TYPE_UNIT,
+} ir_type;
+
+/* X(name, printed name) for every opcode */
+#define IR_OPCODES(X)                       \
+    /* `imm`, already in range of `type` */ \
+    X(CONST, "const")                       \
+    /* Parameter `imm` */                   \
+    X(PARAM, "param")                       \
+    /* Function `imm` */                    \
+    X(FUNCTION, "function")                 \
+    /* String literal `imm` */              \
+    X(STRING, "string")                     \
+                                            \
+    /* a op b, wrapped to `type` */         \
+    X(ADD, "add")                           \
+    X(SUB, "sub")                           \
+    X(MUL, "mul")                           \
+    /* Stop the program if b is 0, as in    \
+     * function `imm` */                    \
+    X(DIV, "div")                           \
+    X(MOD, "mod")                           \
+    X(NEG, "neg")                           \
+                                            \
+    /* a op b */                            \
+    X(AND, "and")                           \
+    X(OR, "or")                             \
+    X(XOR, "xor")                           \
+    X(NOT, "not")                           \
+                                            \
+    /* a op b, `type` is the operands' */   \
+    X(EQ, "eq")                             \
+    X(NE, "ne")                             \
+    X(LT, "lt")                             \
+    X(LE, "le")                             \
+    X(GT, "gt")                             \
+    X(GE, "ge")                             \
+                                            \
+    /* a + b and a == b, strings */         \
+    X(CONCAT, "concat")                     \
+    X(STREQ, "streq")                       \
+                                            \
+    /* Closure over function a with the     \
+     * captured values in the rest, its     \
+     * environment in the frame */          \
+    X(STACK_CLOSURE, "stack_closure")       \
+    /* Same, its environment on the heap */ \
+    X(CLOSURE, "closure")                   \
+    /* Captured value `imm` of the          \
+     * environment a */                     \
+    X(CAPTURE, "capture")                   \
+                                            \
+    /* Calls function or closure a with     \
+     * the rest */                          \
+    X(CALL, "call")                         \
+    X(PHI, "phi")                           \
+                                            \
+    /* Terminators */                       \
+    X(JUMP, "jump")                         \
+    X(BRANCH, "branch")                     \
+    /* Returns a, 0 without it */           \
+    X(RET, "ret")                           \
+    /* Calls function or closure a with     \
+     * the rest in place of the function,  \
+     * see tailcall.h */                    \
+    X(TAIL_CALL, "tail_call")               \
+                                            \
+    /* Stands for a while the optimizer     \
+     * replaces every use of this value */  \
+    X(COPY, "copy")
+
+#define IR_OPCODE_ENUM(name, printed) IR_##name,
+
+typedef enum { IR_OPCODES(IR_OPCODE_ENUM) IR_OPCODE_COUNT } ir_opcode;
+
+#undef IR_OPCODE_ENUM
+
+typedef uint32_t ir_value;
+typedef uint32_t ir_block;
+
+#define IR_NONE ((uint32_t) -1)
+
+typedef VEC(ir_value) vec_ir_value;
+typedef VEC(ir_block) vec_ir_block;
+
+typedef struct {
+    ir_opcode op;
+
+    /* Type of the result, or of the operands of comparisons */
+    ir_type type;
+
+    /* Block the instruction is in, IR_NONE once it is removed */
+    ir_block block;
+
+    int64_t imm;
+
+    /* Operands, one per predecessor for phi nodes */
+    vec_ir_value args;
+
+    /* IR_JUMP: targets[0], IR_BRANCH: targets[0] if args[0] is true,
+     * targets[1] if not */
+    ir_block targets[2];
+} ir_instr;
+
+typedef VEC(ir_instr) vec_ir_instr;
+
+typedef struct {
+    vec_ir_value phis;
+
+    /* Ends with the terminator */
+    vec_ir_value instrs;
+
+    vec_ir_block preds;
+
+    /* Whether the block is still part of the function */
+    bool live;
+} ir_block_data;
+
+typedef VEC(ir_block_data) vec_ir_block_data;
+
+typedef struct {
+    /* Not zero terminated, "<lambda>" for lambdas */
+    const char* name;
+    size_t name_len;
+    bool is_lambda;
+
+    size_t param_count;
+    ir_type return_type;
+
+    /* Indexed by ir_value */
+    vec_ir_instr values;
+
+    /* Indexed by ir_block, the entry first */
+    vec_ir_block_data blocks;
+} ir_function;
+
+typedef VEC(ir_function) vec_ir_function;
+
+typedef struct {
+    /* Not zero terminated, points into the AST */
+    const char* str;
+    size_t len;
+} ir_string;
+
+typedef VEC(ir_string) vec_ir_string;
+
+typedef struct {
+    /* Indexed like the functions of the resolved program */
+    vec_ir_function functions;
+    vec_ir_string strings;
+
+    /* RESOLVED_NO_FUNCTION when there is none */
+    size_t main;
+} ir_program;
+
+/**
+ * Builds the IR of every function of `program`. All the memory of the
+ * result comes from `allocator` and may point into the AST.
+ *
+ * Returns false after printing to diag_stream() if the program uses what
+ * the IR cannot express yet.
+ */
+bool ir_build(
+    allocator_t* allocator, const resolved_program* program, ir_program* out
+);
+
+/**
+ * Optimizes every function of `program` in place: constant folding and
+ * propagation, global value numbering, dead code elimination and control
+ * flow graph simplification. Afterwards the blocks are numbered in reverse
+ * postorder and no IR_COPY is left.
+ */
+void ir_optimize(allocator_t* allocator, ir_program* program);
+
+/**
+ * Same as ir_optimize, for one function.
+ */
+void ir_optimize_function(allocator_t* allocator, ir_function* fn);
+
+/**
+ * Inlines calls to known functions and closures where the cost model finds
+ * it worth it (see ir_inline.c), working bottom-up over the call graph, and
+ * optimizes again the functions that changed. Runs after ir_optimize.
+ *
+ * Every call considered is described on a line of `report`, unless it is
+ * NULL.
+ */
+void ir_inline(allocator_t* allocator, ir_program* program, FILE* report);
+
+/**
+ * Prints every function of `program` in a readable form.
+ */
+void ir_print(FILE* out, const ir_program* program);
+
+/* Size of an integer type in bytes, 8 for the others */
+size_t ir_type_size(ir_type type);
+
+bool ir_type_is_signed(ir_type type);
+
+bool ir_is_terminator(ir_opcode op);
+
+/**
+ * Whether the instruction must be kept even if its value is not used.
+ */
+bool ir_has_side_effects(const ir_function* fn, const ir_instr* instr);
+
+/**
+ * Fills `out` with the successors of `block`.
+ */
+size_t ir_successors(const ir_function* fn, ir_block block, ir_block out[2]);
+
+/**
+ * Fills `out` with the live blocks of `fn` in reverse postorder, entry
+ * first, and returns how many there are. `out` has room for every block.
+ */
+size_t ir_reverse_postorder(
+    allocator_t* allocator, const ir_function* fn, ir_block* out
+);
+
+#endif  // IR_H
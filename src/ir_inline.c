@@ -0,0 +1,680 @@
+/**
+ * Inlining
+ *
+ * The call graph has an edge from every function to every function it
+ * refers to: the ones it calls and the ones it makes values of, which it
+ * may call later or pass on. Its strongly connected components (Tarjan)
+ * come out callees first, and the functions are worked on in that order,
+ * so that a callee is as small as inlining and optimizing made it by the
+ * time its callers look at it.
+ *
+ * A call is inlined when its callee is known and not recursive, that is
+ * alone in its component and not referring to itself, and the cost model
+ * agrees:
+ *
+ * - small callees always are, their body is about the size of the call,
+ * - callees called from a single place are up to a larger size,
+ * - no caller grows past a limit.
+ *
+ * The callee is known for calls to a function, and to a closure made in
+ * the caller, whose captured values then replace the reads of its
+ * environment. Inlining a function that takes a callback makes its calls
+ * to the callback known, so a function is inlined into in rounds,
+ * optimized after each.
+ */
+
+#include <string.h>
+
+#include "ir.h"
+
+/* Instructions, about the cost of a call */
+#define SMALL_FUNCTION 12
+#define SINGLE_CALL_FUNCTION 200
+#define MAX_CALLER 2000
+
+#define MAX_ROUNDS 4
+
+typedef enum {
+    INLINE_SMALL,
+    INLINE_SINGLE_CALL,
+
+    KEEP_UNKNOWN,
+    KEEP_RECURSIVE,
+    KEEP_LARGE,
+    KEEP_CALLER_LARGE,
+    KEEP_ENVIRONMENT,
+    KEEP_ROUNDS,
+} decision;
+
+static const char* const DECISIONS[] = {
+    [INLINE_SMALL] = "inlined, small",
+    [INLINE_SINGLE_CALL] = "inlined, single call site",
+    [KEEP_UNKNOWN] = "not inlined, unknown callee",
+    [KEEP_RECURSIVE] = "not inlined, recursive",
+    [KEEP_LARGE] = "not inlined, too large",
+    [KEEP_CALLER_LARGE] = "not inlined, caller too large",
+    [KEEP_ENVIRONMENT] = "not inlined, uses its environment",
+    [KEEP_ROUNDS] = "not inlined, out of rounds",
+};
+
+typedef VEC(size_t) vec_size;
+
+/* Function a call calls, and the closure it calls it through */
+typedef struct {
+    size_t function;
+    ir_value closure;
+} target;
+
+typedef struct {
+    allocator_t* allocator;
+    ir_program* program;
+    FILE* report;
+
+    /* Functions every function refers to */
+    vec_size* refs;
+
+    /* Whether every function is part of a cycle in the call graph */
+    bool* recursive;
+
+    /* Known call sites of every function */
+    size_t* call_sites;
+
+    /* Tarjan's state */
+    size_t* order;
+    size_t* low;
+    bool* on_stack;
+    vec_size stack;
+    size_t visited;
+
+    /* The functions in the order to work on them */
+    vec_size bottom_up;
+} inliner;
+
+static ir_function* function_at(inliner* self, size_t index) {
+    return &self->program->functions.items[index];
+}
+
+/* Follows the copies left by inlined calls */
+static ir_value forward(const ir_function* fn, ir_value value) {
+    while (fn->values.items[value].op == IR_COPY) {
+        value = fn->values.items[value].args.items[0];
+    }
+
+    return value;
+}
+
+static void print_function(inliner* self, size_t index) {
+    const ir_function* fn = function_at(self, index);
+
+    if (fn->is_lambda) {
+        fprintf(self->report, "lambda.%zu", index);
+    } else {
+        fprintf(self->report, "%.*s", (int)fn->name_len, fn->name);
+    }
+}
+
+// Call graph
+
+static bool find_target(const ir_function* fn, ir_value call, target* out) {
+    ir_value callee = forward(fn, fn->values.items[call].args.items[0]);
+    const ir_instr* instr = &fn->values.items[callee];
+
+    out->closure = IR_NONE;
+
+    if (instr->op == IR_STACK_CLOSURE || instr->op == IR_CLOSURE) {
+        out->closure = callee;
+        callee = forward(fn, instr->args.items[0]);
+        instr = &fn->values.items[callee];
+    }
+
+    if (instr->op != IR_FUNCTION) {
+        return false;
+    }
+
+    out->function = instr->imm;
+    return true;
+}
+
+static void find_refs(inliner* self, size_t index) {
+    const ir_function* fn = function_at(self, index);
+
+    self->refs[index] = (vec_size)vec_make(self->allocator);
+
+    for (size_t b = 0; b < fn->blocks.len; b++) {
+        const vec_ir_value* instrs = &fn->blocks.items[b].instrs;
+
+        for (size_t i = 0; i < instrs->len; i++) {
+            const ir_instr* instr = &fn->values.items[instrs->items[i]];
+            target t;
+
+            if (instr->op == IR_FUNCTION) {
+                size_t callee = instr->imm;
+                vec_push(&self->refs[index], &callee);
+            }
+
+            if ((instr->op == IR_CALL || instr->op == IR_TAIL_CALL) &&
+                find_target(fn, instrs->items[i], &t)) {
+                self->call_sites[t.function]++;
+            }
+        }
+    }
+}
+
+/* Recursive, as deep as the longest chain of calls */
+static void visit(inliner* self, size_t index) {
+    self->order[index] = self->low[index] = self->visited++;
+    self->on_stack[index] = true;
+    vec_push(&self->stack, &index);
+
+    for (size_t i = 0; i < self->refs[index].len; i++) {
+        size_t callee = self->refs[index].items[i];
+
+        if (callee == index) {
+            self->recursive[index] = true;
+        }
+
+        if (self->order[callee] == IR_NONE) {
+            visit(self, callee);
+
+            if (self->low[callee] < self->low[index]) {
+                self->low[index] = self->low[callee];
+            }
+        } else if (self->on_stack[callee] &&
+                   self->order[callee] < self->low[index]) {
+            self->low[index] = self->order[callee];
+        }
+    }
+
+    if (self->low[index] != self->order[index]) {
+        return;
+    }
+
+    size_t first = self->bottom_up.len;
+    size_t member;
+
+    do {
+        member = self->stack.items[--self->stack.len];
+        self->on_stack[member] = false;
+        vec_push(&self->bottom_up, &member);
+    } while (member != index);
+
+    if (self->bottom_up.len - first > 1) {
+        for (size_t i = first; i < self->bottom_up.len; i++) {
+            self->recursive[self->bottom_up.items[i]] = true;
+        }
+    }
+}
+
+// Cost model
+
+static bool is_free(ir_opcode op) {
+    return op == IR_PARAM || op == IR_CONST || op == IR_FUNCTION ||
+           op == IR_STRING || op == IR_CAPTURE;
+}
+
+static size_t cost_of(const ir_function* fn) {
+    size_t cost = 0;
+
+    for (size_t b = 0; b < fn->blocks.len; b++) {
+        const vec_ir_value* instrs = &fn->blocks.items[b].instrs;
+
+        for (size_t i = 0; i < instrs->len; i++) {
+            cost += !is_free(fn->values.items[instrs->items[i]].op);
+        }
+    }
+
+    return cost;
+}
+
+/* Whether the environment, parameter `env`, is used other than to read
+ * captured values from */
+static bool uses_environment(const ir_function* fn, size_t env) {
+    for (size_t b = 0; b < fn->blocks.len; b++) {
+        const ir_block_data* block = &fn->blocks.items[b];
+        const vec_ir_value* lists[] = {&block->phis, &block->instrs};
+
+        for (size_t l = 0; l < 2; l++) {
+            for (size_t i = 0; i < lists[l]->len; i++) {
+                const ir_instr* instr = &fn->values.items[lists[l]->items[i]];
+
+                for (size_t a = 0; a < instr->args.len; a++) {
+                    const ir_instr* used =
+                        &fn->values.items[instr->args.items[a]];
+
+                    if (used->op == IR_PARAM && (size_t)used->imm == env &&
+                        instr->op != IR_CAPTURE) {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+static decision decide(
+    inliner* self, size_t caller, ir_value call, target* out
+) {
+    const ir_function* fn = function_at(self, caller);
+
+    if (!find_target(fn, call, out)) {
+        return KEEP_UNKNOWN;
+    }
+
+    const ir_function* callee = function_at(self, out->function);
+    size_t arg_count = fn->values.items[call].args.len - 1;
+    size_t param_count = arg_count + (out->closure != IR_NONE);
+
+    if (callee->param_count != param_count) {
+        return KEEP_UNKNOWN;
+    }
+
+    if (self->recursive[out->function]) {
+        return KEEP_RECURSIVE;
+    }
+
+    if (out->closure != IR_NONE && uses_environment(callee, arg_count)) {
+        return KEEP_ENVIRONMENT;
+    }
+
+    size_t cost = cost_of(callee);
+    decision d;
+
+    if (cost <= SMALL_FUNCTION) {
+        d = INLINE_SMALL;
+    } else if (self->call_sites[out->function] == 1 &&
+               cost <= SINGLE_CALL_FUNCTION) {
+        d = INLINE_SINGLE_CALL;
+    } else {
+        return KEEP_LARGE;
+    }
+
+    if (cost_of(fn) + cost > MAX_CALLER) {
+        return KEEP_CALLER_LARGE;
+    }
+
+    return d;
+}
+
+// Inlining
+
+static ir_value add_value(
+    inliner* self, ir_function* fn, ir_opcode op, ir_type type, ir_block block
+) {
+    ir_instr instr = {
+        .op = op,
+        .type = type,
+        .block = block,
+        .imm = 0,
+        .args = vec_make(self->allocator),
+        .targets = {IR_NONE, IR_NONE},
+    };
+
+    vec_push(&fn->values, &instr);
+    return fn->values.len - 1;
+}
+
+/* Constants go first in the entry block, which dominates every use */
+static ir_value add_const(
+    inliner* self, ir_function* fn, ir_type type, int64_t imm
+) {
+    ir_value value = add_value(self, fn, IR_CONST, type, 0);
+    vec_ir_value* entry = &fn->blocks.items[0].instrs;
+
+    fn->values.items[value].imm = imm;
+    vec_push(entry, &value);
+    memmove(
+        entry->items + 1, entry->items, (entry->len - 1) * sizeof(ir_value)
+    );
+    entry->items[0] = value;
+
+    return value;
+}
+
+static ir_block add_block(inliner* self, ir_function* fn) {
+    ir_block_data block = {
+        .phis = vec_make(self->allocator),
+        .instrs = vec_make(self->allocator),
+        .preds = vec_make(self->allocator),
+        .live = true,
+    };
+
+    vec_push(&fn->blocks, &block);
+    return fn->blocks.len - 1;
+}
+
+/* Moves what comes after `call` in its block to a new block, which the
+ * successors of the block come from from now on, and returns it */
+static ir_block split_after(inliner* self, ir_function* fn, ir_value call) {
+    ir_block block = fn->values.items[call].block;
+    ir_block after = add_block(self, fn);
+    vec_ir_value* instrs = &fn->blocks.items[block].instrs;
+    size_t at = 0;
+
+    while (instrs->items[at] != call) {
+        at++;
+    }
+
+    for (size_t i = at + 1; i < instrs->len; i++) {
+        ir_value value = instrs->items[i];
+
+        fn->values.items[value].block = after;
+        vec_push(&fn->blocks.items[after].instrs, &value);
+    }
+
+    instrs->len = at;
+
+    ir_block succs[2];
+    size_t count = ir_successors(fn, after, succs);
+
+    for (size_t s = 0; s < count; s++) {
+        vec_ir_block* preds = &fn->blocks.items[succs[s]].preds;
+
+        for (size_t p = 0; p < preds->len; p++) {
+            if (preds->items[p] == block) {
+                preds->items[p] = after;
+            }
+        }
+    }
+
+    return after;
+}
+
+/* Replaces `call` in `fn` by a copy of the body of `t.function`. Its
+ * parameters are the arguments of the call, its returns jump to what
+ * came after the call, with the value returned in a phi node there, and
+ * so do its tail calls once they are calls. Inlined in place of a tail
+ * call, the callee returns and makes tail calls for the caller instead. */
+static void inline_call(
+    inliner* self, ir_function* fn, ir_value call, target t
+) {
+    const ir_function* callee = function_at(self, t.function);
+    ir_block block = fn->values.items[call].block;
+    bool tail = fn->values.items[call].op == IR_TAIL_CALL;
+    ir_block after = IR_NONE;
+
+    /* A tail call ends its block */
+    if (tail) {
+        fn->blocks.items[block].instrs.len--;
+    } else {
+        after = split_after(self, fn, call);
+    }
+    ir_block base = fn->blocks.len;
+    size_t arg_count = fn->values.items[call].args.len - 1;
+    ir_value* map = ALLOC_ARRAY(
+        self->allocator, ir_value, callee->values.len
+    );
+
+    for (size_t b = 0; b < callee->blocks.len; b++) {
+        add_block(self, fn);
+    }
+
+    /* Parameters and captured values are there already, the rest is
+     * copied */
+    for (size_t v = 0; v < callee->values.len; v++) {
+        const ir_instr* instr = &callee->values.items[v];
+
+        map[v] = IR_NONE;
+
+        if (instr->block == IR_NONE) {
+            continue;
+        }
+
+        if (instr->op == IR_PARAM) {
+            if ((size_t)instr->imm < arg_count) {
+                map[v] = forward(
+                    fn, fn->values.items[call].args.items[instr->imm + 1]
+                );
+            }
+        } else if (instr->op == IR_CAPTURE) {
+            const ir_instr* closure = &fn->values.items[t.closure];
+            map[v] = forward(fn, closure->args.items[instr->imm + 1]);
+        } else {
+            map[v] = add_value(
+                self, fn, instr->op, instr->type, base + instr->block
+            );
+        }
+    }
+
+    /* What returns without a value, or never does, gives */
+    ir_value zero = add_const(self, fn, callee->return_type, 0);
+    vec_ir_block returns = vec_make(self->allocator);
+    vec_ir_value results = vec_make(self->allocator);
+
+    for (size_t b = 0; b < callee->blocks.len; b++) {
+        const ir_block_data* from = &callee->blocks.items[b];
+        const vec_ir_value* lists[] = {&from->phis, &from->instrs};
+        vec_ir_value* to_lists[] = {
+            &fn->blocks.items[base + b].phis,
+            &fn->blocks.items[base + b].instrs,
+        };
+
+        for (size_t p = 0; p < from->preds.len; p++) {
+            ir_block pred = base + from->preds.items[p];
+            vec_push(&fn->blocks.items[base + b].preds, &pred);
+        }
+
+        for (size_t l = 0; l < 2; l++) {
+            for (size_t i = 0; i < lists[l]->len; i++) {
+                ir_value v = lists[l]->items[i];
+                const ir_instr* instr = &callee->values.items[v];
+
+                if (instr->op == IR_PARAM || instr->op == IR_CAPTURE) {
+                    continue;
+                }
+
+                ir_instr* copy = &fn->values.items[map[v]];
+
+                copy->imm = instr->imm;
+
+                for (size_t a = 0; a < instr->args.len; a++) {
+                    vec_push(&copy->args, &map[instr->args.items[a]]);
+                }
+
+                for (size_t k = 0; k < 2; k++) {
+                    if (instr->targets[k] != IR_NONE) {
+                        copy->targets[k] = base + instr->targets[k];
+                    }
+                }
+
+                /* Returns go on after the call */
+                if (instr->op == IR_RET && !tail) {
+                    ir_block at = base + b;
+                    ir_value result =
+                        copy->args.len != 0 ? copy->args.items[0] : zero;
+
+                    copy->op = IR_JUMP;
+                    copy->args.len = 0;
+                    copy->targets[0] = after;
+                    vec_push(&returns, &at);
+                    vec_push(&results, &result);
+                }
+
+                vec_push(to_lists[l], &map[v]);
+
+                if (instr->op == IR_TAIL_CALL && !tail) {
+                    ir_block at = base + b;
+                    ir_value jump = add_value(
+                        self, fn, IR_JUMP, IR_TYPE_UNIT, at
+                    );
+
+                    copy = &fn->values.items[map[v]];
+                    copy->op = IR_CALL;
+                    copy->type = callee->return_type;
+                    fn->values.items[jump].targets[0] = after;
+                    vec_push(to_lists[l], &jump);
+                    vec_push(&returns, &at);
+                    vec_push(&results, &map[v]);
+                }
+            }
+        }
+    }
+
+    ir_value jump = add_value(self, fn, IR_JUMP, IR_TYPE_UNIT, block);
+    fn->values.items[jump].targets[0] = base;
+    vec_push(&fn->blocks.items[block].instrs, &jump);
+    vec_push(&fn->blocks.items[base].preds, &block);
+
+    if (!tail) {
+        vec_extend_from(&fn->blocks.items[after].preds, &returns);
+    }
+
+    ir_value result = results.len == 1 ? results.items[0] : zero;
+
+    if (results.len > 1) {
+        result = add_value(self, fn, IR_PHI, callee->return_type, after);
+        vec_push(&fn->blocks.items[after].phis, &result);
+        vec_extend_from(&fn->values.items[result].args, &results);
+    }
+
+    /* Uses of the call read the result through a copy */
+    ir_instr* instr = &fn->values.items[call];
+
+    instr->op = IR_COPY;
+    instr->block = IR_NONE;
+    instr->args.len = 0;
+    vec_push(&instr->args, &result);
+
+    vec_free(&results);
+    vec_free(&returns);
+    FREE_ARRAY(self->allocator, map, ir_value, callee->values.len);
+}
+
+static void collect_calls(const ir_function* fn, vec_ir_value* out) {
+    out->len = 0;
+
+    for (size_t b = 0; b < fn->blocks.len; b++) {
+        const vec_ir_value* instrs = &fn->blocks.items[b].instrs;
+
+        for (size_t i = 0; i < instrs->len; i++) {
+            ir_opcode op = fn->values.items[instrs->items[i]].op;
+
+            if (op == IR_CALL || op == IR_TAIL_CALL) {
+                vec_push(out, &instrs->items[i]);
+            }
+        }
+    }
+}
+
+static void report(
+    inliner* self, size_t caller, const target* t, decision d
+) {
+    if (self->report == NULL) {
+        return;
+    }
+
+    print_function(self, caller);
+    fprintf(self->report, " -> ");
+
+    if (d == KEEP_UNKNOWN) {
+        fprintf(self->report, "?");
+    } else {
+        print_function(self, t->function);
+    }
+
+    fprintf(self->report, ": %s", DECISIONS[d]);
+
+    if (d != KEEP_UNKNOWN && d != KEEP_RECURSIVE) {
+        size_t cost = cost_of(function_at(self, t->function));
+        fprintf(self->report, " (%zu instructions)", cost);
+    }
+
+    fprintf(self->report, "\n");
+}
+
+static void inline_into(inliner* self, size_t index) {
+    ir_function* fn = function_at(self, index);
+    vec_ir_value calls = vec_make(self->allocator);
+    bool changed = true;
+
+    for (size_t round = 0; round < MAX_ROUNDS && changed; round++) {
+        changed = false;
+        collect_calls(fn, &calls);
+
+        for (size_t i = 0; i < calls.len; i++) {
+            target t;
+            decision d = decide(self, index, calls.items[i], &t);
+
+            if (d != INLINE_SMALL && d != INLINE_SINGLE_CALL) {
+                continue;
+            }
+
+            report(self, index, &t, d);
+            inline_call(self, fn, calls.items[i], t);
+            changed = true;
+        }
+
+        if (changed) {
+            ir_optimize_function(self->allocator, fn);
+        }
+    }
+
+    /* What is left, and why */
+    collect_calls(fn, &calls);
+
+    for (size_t i = 0; i < calls.len; i++) {
+        target t;
+        decision d = decide(self, index, calls.items[i], &t);
+
+        if (d == INLINE_SMALL || d == INLINE_SINGLE_CALL) {
+            d = KEEP_ROUNDS;
+        }
+
+        report(self, index, &t, d);
+    }
+
+    vec_free(&calls);
+}
+
+void ir_inline(allocator_t* allocator, ir_program* program, FILE* report) {
+    size_t count = program->functions.len;
+    inliner self = {
+        .allocator = allocator,
+        .program = program,
+        .report = report,
+        .refs = ALLOC_ARRAY(allocator, vec_size, count),
+        .recursive = ALLOC_ARRAY(allocator, bool, count),
+        .call_sites = ALLOC_ARRAY(allocator, size_t, count),
+        .order = ALLOC_ARRAY(allocator, size_t, count),
+        .low = ALLOC_ARRAY(allocator, size_t, count),
+        .on_stack = ALLOC_ARRAY(allocator, bool, count),
+        .stack = vec_make(allocator),
+        .visited = 0,
+        .bottom_up = vec_make(allocator),
+    };
+
+    for (size_t f = 0; f < count; f++) {
+        self.call_sites[f] = 0;
+        self.order[f] = IR_NONE;
+        self.on_stack[f] = false;
+        self.recursive[f] = false;
+    }
+
+    for (size_t f = 0; f < count; f++) {
+        find_refs(&self, f);
+    }
+
+    for (size_t f = 0; f < count; f++) {
+        if (self.order[f] == IR_NONE) {
+            visit(&self, f);
+        }
+    }
+
+    for (size_t i = 0; i < self.bottom_up.len; i++) {
+        inline_into(&self, self.bottom_up.items[i]);
+    }
+
+    for (size_t f = 0; f < count; f++) {
+        vec_free(&self.refs[f]);
+    }
+
+    vec_free(&self.bottom_up);
+    vec_free(&self.stack);
+    FREE_ARRAY(allocator, self.on_stack, bool, count);
+    FREE_ARRAY(allocator, self.low, size_t, count);
+    FREE_ARRAY(allocator, self.order, size_t, count);
+    FREE_ARRAY(allocator, self.call_sites, size_t, count);
+    FREE_ARRAY(allocator, self.recursive, bool, count);
+    FREE_ARRAY(allocator, self.refs, vec_size, count);
+}
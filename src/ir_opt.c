@@ -0,0 +1,1140 @@
+/**
+ * Optimization passes over the IR
+ *
+ * Every pass works on one function. Instructions are never moved: values
+ * only get replaced by others that are available where they are used,
+ * which the passes do by turning the replaced instruction into an IR_COPY
+ * of its replacement and taking it out of its block. Operands are read
+ * through the copies, and the copies are dropped for good at the end.
+ *
+ * The passes run in rounds until none of them finds anything to change:
+ *
+ * - constants and the other instructions without operands move to the
+ *   entry block, out of loops and where value numbering finds duplicates,
+ * - folding evaluates instructions whose operands are constants, and the
+ *   branches on them, simplifies phi nodes that pick a single value and
+ *   applies a few algebraic identities,
+ * - CFG simplification drops unreachable blocks, merges blocks into their
+ *   single predecessor and skips blocks that only jump,
+ * - global value numbering replaces instructions that compute what a
+ *   dominating instruction already did,
+ * - dead code elimination removes what nothing with side effects uses.
+ */
+
+#include <string.h>
+
+#include "ir.h"
+
+/* Rounds are cheap, but a bug should not spin forever */
+#define MAX_ROUNDS 16
+
+typedef struct {
+    allocator_t* allocator;
+    ir_function* fn;
+
+    /* Whether the last pass changed the function */
+    bool changed;
+} optimizer;
+
+static ir_instr* instr_of(optimizer* self, ir_value value) {
+    return &self->fn->values.items[value];
+}
+
+static ir_block_data* block_of(optimizer* self, ir_block block) {
+    return &self->fn->blocks.items[block];
+}
+
+/* Follows the copies left by replaced instructions */
+static ir_value forward(optimizer* self, ir_value value) {
+    while (instr_of(self, value)->op == IR_COPY) {
+        value = instr_of(self, value)->args.items[0];
+    }
+
+    return value;
+}
+
+static ir_value arg(optimizer* self, ir_value value, size_t i) {
+    return forward(self, instr_of(self, value)->args.items[i]);
+}
+
+static bool is_removed(optimizer* self, ir_value value) {
+    return instr_of(self, value)->block == IR_NONE;
+}
+
+static void remove_instr(optimizer* self, ir_value value) {
+    instr_of(self, value)->block = IR_NONE;
+    self->changed = true;
+}
+
+/* Uses of `value` now read `with`, which must be available wherever
+ * `value` was */
+static void replace(optimizer* self, ir_value value, ir_value with) {
+    ir_instr* instr = instr_of(self, value);
+
+    instr->op = IR_COPY;
+    instr->args.len = 0;
+    vec_push(&instr->args, &with);
+    remove_instr(self, value);
+}
+
+/* Drops the removed instructions from the lists of the blocks */
+static void compact(optimizer* self) {
+    for (size_t b = 0; b < self->fn->blocks.len; b++) {
+        ir_block_data* block = block_of(self, b);
+        vec_ir_value* lists[] = {&block->phis, &block->instrs};
+
+        for (size_t l = 0; l < 2; l++) {
+            vec_ir_value* list = lists[l];
+            size_t kept = 0;
+
+            for (size_t i = 0; i < list->len; i++) {
+                if (block->live && !is_removed(self, list->items[i])) {
+                    list->items[kept++] = list->items[i];
+                }
+            }
+
+            list->len = kept;
+        }
+    }
+}
+
+static void push_front(optimizer* self, ir_block block, ir_value value) {
+    vec_ir_value* instrs = &block_of(self, block)->instrs;
+
+    vec_push(instrs, &value);
+    memmove(
+        instrs->items + 1, instrs->items, (instrs->len - 1) * sizeof(ir_value)
+    );
+    instrs->items[0] = value;
+}
+
+/* Constants go to the entry block, which dominates every use */
+static ir_value new_const(optimizer* self, ir_type type, int64_t imm) {
+    ir_instr instr = {
+        .op = IR_CONST,
+        .type = type,
+        .block = 0,
+        .imm = imm,
+        .args = vec_make(self->allocator),
+        .targets = {IR_NONE, IR_NONE},
+    };
+
+    vec_push(&self->fn->values, &instr);
+    ir_value value = self->fn->values.len - 1;
+
+    push_front(self, 0, value);
+
+    return value;
+}
+
+static ir_value terminator_of(optimizer* self, ir_block block) {
+    vec_ir_value* instrs = &block_of(self, block)->instrs;
+    return instrs->items[instrs->len - 1];
+}
+
+/* Removes the `index`th edge into `block`, and what its phi nodes pick for
+ * it */
+static void remove_pred_at(optimizer* self, ir_block block, size_t index) {
+    ir_block_data* data = block_of(self, block);
+
+    for (size_t i = 0; i < data->phis.len; i++) {
+        ir_value phi = data->phis.items[i];
+
+        if (is_removed(self, phi)) {
+            continue;
+        }
+
+        vec_ir_value* args = &instr_of(self, phi)->args;
+        memmove(
+            args->items + index,
+            args->items + index + 1,
+            (args->len - index - 1) * sizeof(ir_value)
+        );
+        args->len--;
+    }
+
+    memmove(
+        data->preds.items + index,
+        data->preds.items + index + 1,
+        (data->preds.len - index - 1) * sizeof(ir_block)
+    );
+    data->preds.len--;
+    self->changed = true;
+}
+
+static size_t pred_index(optimizer* self, ir_block block, ir_block pred) {
+    vec_ir_block* preds = &block_of(self, block)->preds;
+
+    for (size_t i = 0; i < preds->len; i++) {
+        if (preds->items[i] == pred) {
+            return i;
+        }
+    }
+
+    return IR_NONE;
+}
+
+static void remove_pred(optimizer* self, ir_block block, ir_block pred) {
+    remove_pred_at(self, block, pred_index(self, block, pred));
+}
+
+static void remove_block(optimizer* self, ir_block block) {
+    ir_block_data* data = block_of(self, block);
+    ir_block succs[2];
+    size_t count = ir_successors(self->fn, block, succs);
+
+    for (size_t i = 0; i < count; i++) {
+        if (block_of(self, succs[i])->live) {
+            remove_pred(self, succs[i], block);
+        }
+    }
+
+    for (size_t i = 0; i < data->phis.len; i++) {
+        instr_of(self, data->phis.items[i])->block = IR_NONE;
+    }
+
+    for (size_t i = 0; i < data->instrs.len; i++) {
+        instr_of(self, data->instrs.items[i])->block = IR_NONE;
+    }
+
+    data->live = false;
+    self->changed = true;
+}
+
+// Constants
+
+static void hoist_constants(optimizer* self) {
+    ir_function* fn = self->fn;
+
+    for (size_t b = 1; b < fn->blocks.len; b++) {
+        vec_ir_value* instrs = &block_of(self, b)->instrs;
+        size_t kept = 0;
+
+        for (size_t i = 0; i < instrs->len; i++) {
+            ir_value value = instrs->items[i];
+            ir_opcode op = instr_of(self, value)->op;
+
+            if (op != IR_CONST && op != IR_FUNCTION && op != IR_STRING) {
+                instrs->items[kept++] = value;
+                continue;
+            }
+
+            instr_of(self, value)->block = 0;
+            push_front(self, 0, value);
+            self->changed = true;
+        }
+
+        instrs->len = kept;
+    }
+}
+
+// Folding
+
+/* Brings a 64 bit result back into the range of `type` */
+static int64_t wrap(ir_type type, uint64_t value) {
+    switch (type) {
+        case IR_TYPE_I8:
+            return (int8_t)value;
+        case IR_TYPE_I16:
+            return (int16_t)value;
+        case IR_TYPE_I32:
+            return (int32_t)value;
+        case IR_TYPE_U8:
+            return (uint8_t)value;
+        case IR_TYPE_U16:
+            return (uint16_t)value;
+        case IR_TYPE_U32:
+            return (uint32_t)value;
+        default:
+            return value;
+    }
+}
+
+/* Evaluates an instruction on constants, false if it cannot be */
+static bool evaluate(
+    ir_opcode op, ir_type type, int64_t a, int64_t b, int64_t* out
+) {
+    switch (op) {
+        case IR_ADD:
+            *out = wrap(type, (uint64_t)a + (uint64_t)b);
+            return true;
+        case IR_SUB:
+            *out = wrap(type, (uint64_t)a - (uint64_t)b);
+            return true;
+        case IR_MUL:
+            *out = wrap(type, (uint64_t)a * (uint64_t)b);
+            return true;
+
+        /* Operands are in the range of their type, 64 bit division cannot
+         * overflow */
+        case IR_DIV:
+        case IR_MOD:
+            if (b == 0) {
+                return false;
+            }
+
+            *out = wrap(type, op == IR_DIV ? a / b : a % b);
+            return true;
+
+        case IR_NEG:
+            *out = wrap(type, -(uint64_t)a);
+            return true;
+        case IR_AND:
+            *out = a & b;
+            return true;
+        case IR_OR:
+            *out = a | b;
+            return true;
+        case IR_XOR:
+            *out = a ^ b;
+            return true;
+        case IR_NOT:
+            *out = !a;
+            return true;
+        case IR_EQ:
+            *out = a == b;
+            return true;
+        case IR_NE:
+            *out = a != b;
+            return true;
+        case IR_LT:
+            *out = a < b;
+            return true;
+        case IR_LE:
+            *out = a <= b;
+            return true;
+        case IR_GT:
+            *out = a > b;
+            return true;
+        case IR_GE:
+            *out = a >= b;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_comparison(ir_opcode op) {
+    return op == IR_EQ || op == IR_NE || op == IR_LT || op == IR_LE ||
+           op == IR_GT || op == IR_GE || op == IR_STREQ;
+}
+
+static bool is_const(optimizer* self, ir_value value, int64_t imm) {
+    ir_instr* instr = instr_of(self, value);
+    return instr->op == IR_CONST && instr->imm == imm;
+}
+
+/* Turns `value` into a constant where it is */
+static void make_const(optimizer* self, ir_value value, int64_t imm) {
+    ir_instr* instr = instr_of(self, value);
+
+    if (is_comparison(instr->op)) {
+        instr->type = IR_TYPE_BOOLEAN;
+    }
+
+    instr->op = IR_CONST;
+    instr->imm = imm;
+    instr->args.len = 0;
+    self->changed = true;
+}
+
+/* x + 0, x * 1 and the like. Returns the value `value` is the same as, or
+ * IR_NONE. */
+static ir_value simplify(optimizer* self, ir_value value) {
+    ir_instr* instr = instr_of(self, value);
+
+    if (instr->args.len != 2) {
+        if (instr->op == IR_NOT) {
+            ir_value a = arg(self, value, 0);
+
+            /* !!x is x */
+            if (instr_of(self, a)->op == IR_NOT) {
+                return arg(self, a, 0);
+            }
+        }
+
+        return IR_NONE;
+    }
+
+    ir_value a = arg(self, value, 0);
+    ir_value b = arg(self, value, 1);
+
+    switch (instr->op) {
+        case IR_ADD:
+        case IR_OR:
+        case IR_XOR:
+            if (is_const(self, a, 0)) {
+                return b;
+            }
+            /* fall through */
+        case IR_SUB:
+            return is_const(self, b, 0) ? a : IR_NONE;
+
+        case IR_MUL:
+            if (is_const(self, a, 1)) {
+                return b;
+            }
+            /* fall through */
+        case IR_DIV:
+            return is_const(self, b, 1) ? a : IR_NONE;
+
+        case IR_AND:
+            return a == b ? a : IR_NONE;
+
+        default:
+            return IR_NONE;
+    }
+}
+
+static void fold_phi(optimizer* self, ir_value phi) {
+    ir_instr* instr = instr_of(self, phi);
+    ir_value same = IR_NONE;
+    bool all_const = true;
+
+    for (size_t i = 0; i < instr->args.len; i++) {
+        ir_value a = arg(self, phi, i);
+
+        if (a == phi || a == same) {
+            continue;
+        }
+
+        if (same == IR_NONE) {
+            same = a;
+        } else if (!is_const(self, a, instr_of(self, same)->imm)) {
+            all_const = false;
+        }
+
+        all_const = all_const && instr_of(self, a)->op == IR_CONST;
+    }
+
+    if (same == IR_NONE) {
+        return;
+    }
+
+    if (all_const && instr_of(self, same)->op == IR_CONST) {
+        /* The constants are defined in the predecessors, which do not
+         * dominate the uses of the phi node */
+        ir_value constant = new_const(
+            self, instr->type, instr_of(self, same)->imm
+        );
+        replace(self, phi, constant);
+        return;
+    }
+
+    /* A single value other than the phi node itself dominates it */
+    bool single = true;
+
+    for (size_t i = 0; i < instr->args.len; i++) {
+        ir_value a = arg(self, phi, i);
+        single = single && (a == phi || a == same);
+    }
+
+    if (single) {
+        replace(self, phi, same);
+    }
+}
+
+static void fold_branch(optimizer* self, ir_value branch, ir_block block) {
+    ir_instr* instr = instr_of(self, branch);
+    ir_value condition = arg(self, branch, 0);
+    ir_block then = instr->targets[0];
+    ir_block otherwise = instr->targets[1];
+    ir_block dropped;
+
+    if (then == otherwise) {
+        dropped = then;
+    } else if (instr_of(self, condition)->op == IR_CONST) {
+        bool taken = instr_of(self, condition)->imm != 0;
+
+        dropped = taken ? otherwise : then;
+        instr->targets[0] = taken ? then : otherwise;
+    } else {
+        return;
+    }
+
+    instr->op = IR_JUMP;
+    instr->args.len = 0;
+    instr->targets[1] = IR_NONE;
+    remove_pred(self, dropped, block);
+}
+
+static void fold_instr(optimizer* self, ir_value value) {
+    ir_instr* instr = instr_of(self, value);
+
+    if (instr->op == IR_BRANCH) {
+        fold_branch(self, value, instr->block);
+        return;
+    }
+
+    if (instr->args.len == 0 || instr->args.len > 2 || instr->op == IR_CALL ||
+        instr->op == IR_TAIL_CALL) {
+        return;
+    }
+
+    int64_t operands[2] = {0, 0};
+    bool constant = true;
+
+    for (size_t i = 0; i < instr->args.len; i++) {
+        ir_instr* a = instr_of(self, arg(self, value, i));
+
+        constant = constant && a->op == IR_CONST;
+        operands[i] = a->imm;
+    }
+
+    int64_t result;
+
+    if (constant &&
+        evaluate(instr->op, instr->type, operands[0], operands[1], &result)) {
+        make_const(self, value, result);
+        return;
+    }
+
+    /* Comparing a value with itself */
+    if (instr->args.len == 2 && arg(self, value, 0) == arg(self, value, 1)) {
+        switch (instr->op) {
+            case IR_EQ:
+            case IR_LE:
+            case IR_GE:
+            case IR_STREQ:
+                make_const(self, value, 1);
+                return;
+
+            case IR_NE:
+            case IR_LT:
+            case IR_GT:
+                make_const(self, value, 0);
+                return;
+
+            case IR_SUB:
+            case IR_XOR:
+                make_const(self, value, 0);
+                return;
+
+            default:
+                break;
+        }
+    }
+
+    if (instr->op == IR_MUL && (is_const(self, arg(self, value, 0), 0) ||
+                                is_const(self, arg(self, value, 1), 0))) {
+        make_const(self, value, 0);
+        return;
+    }
+
+    ir_value same = simplify(self, value);
+
+    if (same != IR_NONE) {
+        replace(self, value, same);
+    }
+}
+
+/* In reverse postorder, so that constants reach their uses in one go
+ * except around loops */
+static void fold(optimizer* self) {
+    ir_function* fn = self->fn;
+    ir_block* order = ALLOC_ARRAY(self->allocator, ir_block, fn->blocks.len);
+    size_t count = ir_reverse_postorder(self->allocator, fn, order);
+
+    for (size_t b = 0; b < count; b++) {
+        ir_block_data* block = block_of(self, order[b]);
+
+        for (size_t i = 0; i < block->phis.len; i++) {
+            if (!is_removed(self, block->phis.items[i])) {
+                fold_phi(self, block->phis.items[i]);
+            }
+        }
+
+        /* Folding a phi node may add a constant to the entry block */
+        block = block_of(self, order[b]);
+
+        for (size_t i = 0; i < block->instrs.len; i++) {
+            if (!is_removed(self, block->instrs.items[i])) {
+                fold_instr(self, block->instrs.items[i]);
+            }
+        }
+    }
+
+    FREE_ARRAY(self->allocator, order, ir_block, fn->blocks.len);
+    compact(self);
+}
+
+// CFG simplification
+
+static void remove_unreachable(optimizer* self) {
+    ir_function* fn = self->fn;
+    size_t total = fn->blocks.len;
+    ir_block* order = ALLOC_ARRAY(self->allocator, ir_block, total);
+    bool* reachable = ALLOC_ARRAY(self->allocator, bool, total);
+    size_t count = ir_reverse_postorder(self->allocator, fn, order);
+
+    memset(reachable, 0, total * sizeof(bool));
+
+    for (size_t i = 0; i < count; i++) {
+        reachable[order[i]] = true;
+    }
+
+    for (size_t b = 0; b < total; b++) {
+        if (block_of(self, b)->live && !reachable[b]) {
+            remove_block(self, b);
+        }
+    }
+
+    FREE_ARRAY(self->allocator, reachable, bool, total);
+    FREE_ARRAY(self->allocator, order, ir_block, total);
+}
+
+static void retarget(
+    optimizer* self, ir_block block, ir_block from, ir_block to
+) {
+    ir_instr* terminator = instr_of(self, terminator_of(self, block));
+
+    for (size_t i = 0; i < 2; i++) {
+        if (terminator->targets[i] == from) {
+            terminator->targets[i] = to;
+        }
+    }
+}
+
+/* Appends `succ` to `block`, its single predecessor, which jumps to it */
+static void merge(optimizer* self, ir_block block, ir_block succ) {
+    ir_block_data* data = block_of(self, succ);
+
+    for (size_t i = 0; i < data->phis.len; i++) {
+        ir_value phi = data->phis.items[i];
+
+        if (!is_removed(self, phi)) {
+            replace(self, phi, arg(self, phi, 0));
+        }
+    }
+
+    /* Its successors come from `block` now */
+    ir_block succs[2];
+    size_t count = ir_successors(self->fn, succ, succs);
+
+    for (size_t i = 0; i < count; i++) {
+        vec_ir_block* preds = &block_of(self, succs[i])->preds;
+
+        for (size_t j = 0; j < preds->len; j++) {
+            if (preds->items[j] == succ) {
+                preds->items[j] = block;
+            }
+        }
+    }
+
+    vec_ir_value* instrs = &block_of(self, block)->instrs;
+    remove_instr(self, instrs->items[--instrs->len]);
+
+    for (size_t i = 0; i < data->instrs.len; i++) {
+        ir_value value = data->instrs.items[i];
+
+        instr_of(self, value)->block = block;
+        vec_push(instrs, &value);
+    }
+
+    data->instrs.len = 0;
+    data->phis.len = 0;
+    data->preds.len = 0;
+    data->live = false;
+}
+
+/* `block` only jumps to `succ`, its predecessors can jump there
+ * themselves, unless they already do */
+static bool skip(optimizer* self, ir_block block, ir_block succ) {
+    ir_block_data* data = block_of(self, block);
+
+    for (size_t i = 0; i < data->preds.len; i++) {
+        ir_block pred = data->preds.items[i];
+
+        if (pred == block || pred_index(self, succ, pred) != IR_NONE) {
+            return false;
+        }
+    }
+
+    /* What the phi nodes of `succ` pick for `block` dominates `block`, and
+     * so its predecessors */
+    size_t index = pred_index(self, succ, block);
+    ir_block_data* target = block_of(self, succ);
+
+    for (size_t i = 0; i < data->preds.len; i++) {
+        ir_block pred = data->preds.items[i];
+
+        retarget(self, pred, block, succ);
+
+        if (i == 0) {
+            target->preds.items[index] = pred;
+            continue;
+        }
+
+        vec_push(&target->preds, &pred);
+
+        for (size_t p = 0; p < target->phis.len; p++) {
+            ir_value phi = target->phis.items[p];
+
+            if (!is_removed(self, phi)) {
+                vec_ir_value* args = &instr_of(self, phi)->args;
+                ir_value picked = args->items[index];
+                vec_push(args, &picked);
+            }
+        }
+    }
+
+    remove_instr(self, terminator_of(self, block));
+    data->instrs.len = 0;
+    data->preds.len = 0;
+    data->live = false;
+
+    return true;
+}
+
+static void simplify_cfg(optimizer* self) {
+    remove_unreachable(self);
+    compact(self);
+
+    ir_function* fn = self->fn;
+
+    for (size_t b = 0; b < fn->blocks.len; b++) {
+        ir_block_data* block = block_of(self, b);
+
+        if (!block->live) {
+            continue;
+        }
+
+        ir_instr* terminator = instr_of(self, terminator_of(self, b));
+
+        if (terminator->op != IR_JUMP) {
+            continue;
+        }
+
+        ir_block succ = terminator->targets[0];
+        ir_block_data* target = block_of(self, succ);
+
+        if (succ != b && succ != 0 && target->preds.len == 1) {
+            merge(self, b, succ);
+
+            /* The merged block may jump somewhere that can be merged too */
+            b--;
+            continue;
+        }
+
+        if (b != 0 && succ != b && block->phis.len == 0 &&
+            block->instrs.len == 1 && block->preds.len != 0) {
+            skip(self, b, succ);
+        }
+    }
+
+    compact(self);
+}
+
+// Global value numbering
+
+typedef struct {
+    ir_block* idom;
+
+    /* Order of the blocks in a walk of the dominator tree, when they are
+     * entered and left */
+    size_t* enter;
+    size_t* leave;
+} dominators;
+
+/* Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm" */
+static dominators find_dominators(
+    optimizer* self, const ir_block* order, size_t count
+) {
+    ir_function* fn = self->fn;
+    size_t total = fn->blocks.len;
+    size_t* rank = ALLOC_ARRAY(self->allocator, size_t, total);
+    dominators dom = {
+        .idom = ALLOC_ARRAY(self->allocator, ir_block, total),
+        .enter = ALLOC_ARRAY(self->allocator, size_t, total),
+        .leave = ALLOC_ARRAY(self->allocator, size_t, total),
+    };
+
+    for (size_t b = 0; b < total; b++) {
+        rank[b] = IR_NONE;
+        dom.idom[b] = IR_NONE;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        rank[order[i]] = i;
+    }
+
+    dom.idom[0] = 0;
+
+    for (bool changed = true; changed;) {
+        changed = false;
+
+        for (size_t i = 1; i < count; i++) {
+            ir_block b = order[i];
+            vec_ir_block* preds = &block_of(self, b)->preds;
+            ir_block idom = IR_NONE;
+
+            for (size_t p = 0; p < preds->len; p++) {
+                ir_block pred = preds->items[p];
+
+                if (dom.idom[pred] == IR_NONE) {
+                    continue;
+                }
+
+                if (idom == IR_NONE) {
+                    idom = pred;
+                    continue;
+                }
+
+                /* Walk both up to where they meet */
+                ir_block x = pred;
+                ir_block y = idom;
+
+                while (x != y) {
+                    while (rank[x] > rank[y]) {
+                        x = dom.idom[x];
+                    }
+                    while (rank[y] > rank[x]) {
+                        y = dom.idom[y];
+                    }
+                }
+
+                idom = x;
+            }
+
+            if (dom.idom[b] != idom) {
+                dom.idom[b] = idom;
+                changed = true;
+            }
+        }
+    }
+
+    /* Number the tree: children are found by scanning for them, the
+     * functions are small */
+    ir_block* stack = ALLOC_ARRAY(self->allocator, ir_block, total);
+    size_t* next = ALLOC_ARRAY(self->allocator, size_t, total);
+    size_t depth = 0;
+    size_t clock = 0;
+
+    stack[depth] = 0;
+    next[depth++] = 0;
+    dom.enter[0] = clock++;
+
+    while (depth != 0) {
+        ir_block b = stack[depth - 1];
+        size_t* child = &next[depth - 1];
+
+        while (*child < count &&
+               (order[*child] == b || dom.idom[order[*child]] != b)) {
+            (*child)++;
+        }
+
+        if (*child == count) {
+            dom.leave[b] = clock++;
+            depth--;
+            continue;
+        }
+
+        ir_block c = order[(*child)++];
+        dom.enter[c] = clock++;
+        stack[depth] = c;
+        next[depth++] = 0;
+    }
+
+    FREE_ARRAY(self->allocator, next, size_t, total);
+    FREE_ARRAY(self->allocator, stack, ir_block, total);
+    FREE_ARRAY(self->allocator, rank, size_t, total);
+
+    return dom;
+}
+
+static void free_dominators(optimizer* self, dominators* dom) {
+    size_t total = self->fn->blocks.len;
+
+    FREE_ARRAY(self->allocator, dom->leave, size_t, total);
+    FREE_ARRAY(self->allocator, dom->enter, size_t, total);
+    FREE_ARRAY(self->allocator, dom->idom, ir_block, total);
+}
+
+static bool dominates(const dominators* dom, ir_block a, ir_block b) {
+    return dom->enter[a] <= dom->enter[b] && dom->leave[b] <= dom->leave[a];
+}
+
+static bool is_commutative(ir_opcode op) {
+    return op == IR_ADD || op == IR_MUL || op == IR_AND || op == IR_OR ||
+           op == IR_XOR || op == IR_EQ || op == IR_NE || op == IR_STREQ;
+}
+
+static bool is_numbered(ir_opcode op) {
+    return op != IR_CALL && op != IR_COPY && !ir_is_terminator(op);
+}
+
+/* Operand `i` of `value`, with the operands of commutative instructions in
+ * a fixed order */
+static ir_value key_arg(optimizer* self, ir_value value, size_t i) {
+    ir_instr* instr = instr_of(self, value);
+
+    if (is_commutative(instr->op) && instr->args.len == 2) {
+        ir_value a = arg(self, value, 0);
+        ir_value b = arg(self, value, 1);
+
+        if (a > b) {
+            return i == 0 ? b : a;
+        }
+    }
+
+    return arg(self, value, i);
+}
+
+static size_t hash_value(optimizer* self, ir_value value) {
+    ir_instr* instr = instr_of(self, value);
+    uint64_t hash = instr->op * 31 + instr->type;
+
+    hash = hash * 31 + (uint64_t)instr->imm;
+
+    /* Phi nodes are only the same in the same block */
+    if (instr->op == IR_PHI) {
+        hash = hash * 31 + instr->block;
+    }
+
+    for (size_t i = 0; i < instr->args.len; i++) {
+        hash = hash * 31 + key_arg(self, value, i);
+    }
+
+    return hash ^ (hash >> 29);
+}
+
+static bool same_value(optimizer* self, ir_value a, ir_value b) {
+    ir_instr* x = instr_of(self, a);
+    ir_instr* y = instr_of(self, b);
+
+    if (x->op != y->op || x->type != y->type || x->imm != y->imm ||
+        x->args.len != y->args.len) {
+        return false;
+    }
+
+    if (x->op == IR_PHI && x->block != y->block) {
+        return false;
+    }
+
+    for (size_t i = 0; i < x->args.len; i++) {
+        if (key_arg(self, a, i) != key_arg(self, b, i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Values are looked up in a hash table chaining every value with the same
+ * hash. One that dominates the lookup is available there: blocks are
+ * visited in reverse postorder, so dominators come first. */
+static void gvn(optimizer* self) {
+    ir_function* fn = self->fn;
+    size_t total = fn->blocks.len;
+    ir_block* order = ALLOC_ARRAY(self->allocator, ir_block, total);
+    size_t count = ir_reverse_postorder(self->allocator, fn, order);
+    dominators dom = find_dominators(self, order, count);
+
+    size_t bucket_count = 16;
+    while (bucket_count < fn->values.len * 2) {
+        bucket_count *= 2;
+    }
+
+    size_t value_count = fn->values.len;
+    ir_value* buckets = ALLOC_ARRAY(self->allocator, ir_value, bucket_count);
+    ir_value* chain = ALLOC_ARRAY(self->allocator, ir_value, value_count);
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        buckets[i] = IR_NONE;
+    }
+
+    for (size_t b = 0; b < count; b++) {
+        ir_block_data* block = block_of(self, order[b]);
+        vec_ir_value* lists[] = {&block->phis, &block->instrs};
+
+        for (size_t l = 0; l < 2; l++) {
+            for (size_t i = 0; i < lists[l]->len; i++) {
+                ir_value value = lists[l]->items[i];
+
+                if (is_removed(self, value) ||
+                    !is_numbered(instr_of(self, value)->op)) {
+                    continue;
+                }
+
+                size_t bucket = hash_value(self, value) & (bucket_count - 1);
+                ir_value found = IR_NONE;
+
+                for (ir_value other = buckets[bucket]; other != IR_NONE;
+                     other = chain[other]) {
+                    if (!is_removed(self, other) &&
+                        same_value(self, value, other) &&
+                        dominates(
+                            &dom, instr_of(self, other)->block, order[b]
+                        )) {
+                        found = other;
+                        break;
+                    }
+                }
+
+                if (found != IR_NONE) {
+                    replace(self, value, found);
+                    continue;
+                }
+
+                chain[value] = buckets[bucket];
+                buckets[bucket] = value;
+            }
+        }
+    }
+
+    FREE_ARRAY(self->allocator, chain, ir_value, value_count);
+    FREE_ARRAY(self->allocator, buckets, ir_value, bucket_count);
+    free_dominators(self, &dom);
+    FREE_ARRAY(self->allocator, order, ir_block, total);
+    compact(self);
+}
+
+// Dead code elimination
+
+static void dce(optimizer* self) {
+    ir_function* fn = self->fn;
+    size_t value_count = fn->values.len;
+    bool* used = ALLOC_ARRAY(self->allocator, bool, value_count);
+    ir_value* work = ALLOC_ARRAY(self->allocator, ir_value, value_count);
+    size_t pending = 0;
+
+    memset(used, 0, value_count * sizeof(bool));
+
+    for (size_t b = 0; b < fn->blocks.len; b++) {
+        ir_block_data* block = block_of(self, b);
+
+        for (size_t i = 0; i < block->instrs.len; i++) {
+            ir_value value = block->instrs.items[i];
+
+            if (ir_has_side_effects(fn, instr_of(self, value))) {
+                used[value] = true;
+                work[pending++] = value;
+            }
+        }
+    }
+
+    while (pending != 0) {
+        ir_value value = work[--pending];
+        ir_instr* instr = instr_of(self, value);
+
+        for (size_t i = 0; i < instr->args.len; i++) {
+            ir_value a = arg(self, value, i);
+
+            if (!used[a]) {
+                used[a] = true;
+                work[pending++] = a;
+            }
+        }
+    }
+
+    for (size_t b = 0; b < fn->blocks.len; b++) {
+        ir_block_data* block = block_of(self, b);
+        vec_ir_value* lists[] = {&block->phis, &block->instrs};
+
+        for (size_t l = 0; l < 2; l++) {
+            for (size_t i = 0; i < lists[l]->len; i++) {
+                ir_value value = lists[l]->items[i];
+
+                if (!used[value] && !is_removed(self, value)) {
+                    remove_instr(self, value);
+                }
+            }
+        }
+    }
+
+    FREE_ARRAY(self->allocator, work, ir_value, value_count);
+    FREE_ARRAY(self->allocator, used, bool, value_count);
+    compact(self);
+}
+
+// Cleanup
+
+/* Points every operand at what it resolves to, and numbers the blocks in
+ * reverse postorder, which is also the order the backend lays them out */
+static void finish(optimizer* self) {
+    ir_function* fn = self->fn;
+    size_t total = fn->blocks.len;
+    ir_block* order = ALLOC_ARRAY(self->allocator, ir_block, total);
+    ir_block* renumber = ALLOC_ARRAY(self->allocator, ir_block, total);
+    size_t count = ir_reverse_postorder(self->allocator, fn, order);
+
+    for (size_t b = 0; b < total; b++) {
+        renumber[b] = IR_NONE;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        renumber[order[i]] = i;
+    }
+
+    for (size_t v = 0; v < fn->values.len; v++) {
+        ir_instr* instr = instr_of(self, v);
+
+        if (instr->block == IR_NONE) {
+            continue;
+        }
+
+        for (size_t i = 0; i < instr->args.len; i++) {
+            instr->args.items[i] = arg(self, v, i);
+        }
+
+        instr->block = renumber[instr->block];
+
+        for (size_t i = 0; i < 2; i++) {
+            if (instr->targets[i] != IR_NONE) {
+                instr->targets[i] = renumber[instr->targets[i]];
+            }
+        }
+    }
+
+    vec_ir_block_data blocks = vec_make(self->allocator);
+    vec_reserve(&blocks, count);
+
+    for (size_t i = 0; i < count; i++) {
+        ir_block_data block = *block_of(self, order[i]);
+
+        for (size_t p = 0; p < block.preds.len; p++) {
+            block.preds.items[p] = renumber[block.preds.items[p]];
+        }
+
+        vec_push(&blocks, &block);
+    }
+
+    vec_free(&fn->blocks);
+    fn->blocks = blocks;
+
+    FREE_ARRAY(self->allocator, renumber, ir_block, total);
+    FREE_ARRAY(self->allocator, order, ir_block, total);
+}
+
+void ir_optimize_function(allocator_t* allocator, ir_function* fn) {
+    optimizer self = {
+        .allocator = allocator,
+        .fn = fn,
+    };
+
+    for (size_t round = 0; round < MAX_ROUNDS; round++) {
+        bool changed = false;
+
+        void (*const passes[])(optimizer*) = {
+            hoist_constants, fold, simplify_cfg, gvn, dce,
+        };
+
+        for (size_t p = 0; p < sizeof(passes) / sizeof(passes[0]); p++) {
+            self.changed = false;
+            passes[p](&self);
+            changed = changed || self.changed;
+        }
+
+        if (!changed) {
+            break;
+        }
+    }
+
+    finish(&self);
+}
+
+void ir_optimize(allocator_t* allocator, ir_program* program) {
+    for (size_t f = 0; f < program->functions.len; f++) {
+        ir_optimize_function(allocator, &program->functions.items[f]);
+    }
+}
@@ -0,0 +1,251 @@
+/* for RTLD_DEFAULT */
+#define _GNU_SOURCE
+
+#include "jit.h"
+
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmio.h"
+
+/* movabs $address, %r11; jmp *%r11, padded */
+#define STUB_SIZE 16
+
+typedef struct {
+    /* Zero terminated */
+    char* name;
+    size_t len;
+    uint8_t* address;
+    size_t size;
+} jit_function_info;
+
+struct _jit {
+    allocator_t* allocator;
+
+    /* .text and the stubs, then .rodata on pages of its own */
+    uint8_t* memory;
+    size_t size;
+
+    jit_function_info* functions;
+    size_t function_count;
+};
+
+static size_t align_up(size_t offset, size_t alignment) {
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+static void put_le32(uint8_t* at, uint32_t value) {
+    for (size_t i = 0; i < 4; i++) {
+        at[i] = value >> (8 * i);
+    }
+}
+
+static void put_le64(uint8_t* at, uint64_t value) {
+    for (size_t i = 0; i < 8; i++) {
+        at[i] = value >> (8 * i);
+    }
+}
+
+static void write_stub(uint8_t* at, void* target) {
+    at[0] = 0x49;
+    at[1] = 0xbb;
+    put_le64(at + 2, (uintptr_t)target);
+    at[10] = 0x41;
+    at[11] = 0xff;
+    at[12] = 0xe3;
+    memset(at + 13, 0xcc, STUB_SIZE - 13);
+}
+
+/* Address of the C library function `symbol` */
+static void* find_extern(
+    allocator_t* allocator, const x86_symbol_info* symbol
+) {
+    char* name = ALLOC_ARRAY(allocator, char, (symbol->len + 1));
+    memcpy(name, symbol->name, symbol->len);
+    name[symbol->len] = '\0';
+
+    void* address = dlsym(RTLD_DEFAULT, name);
+
+    if (address == NULL) {
+        fprintf(stderr, "jit: undefined function '%s'\n", name);
+    }
+
+    FREE_ARRAY(allocator, name, char, (symbol->len + 1));
+
+    return address;
+}
+
+static void copy_functions(jit* self, const x86_object* object) {
+    size_t count = 0;
+
+    for (size_t i = 0; i < object->symbol_count; i++) {
+        count += object->symbols[i].defined;
+    }
+
+    self->functions = ALLOC_ARRAY(self->allocator, jit_function_info, count);
+    self->function_count = count;
+
+    jit_function_info* f = self->functions;
+
+    for (size_t i = 0; i < object->symbol_count; i++) {
+        const x86_symbol_info* symbol = &object->symbols[i];
+
+        if (!symbol->defined) {
+            continue;
+        }
+
+        f->name = ALLOC_ARRAY(self->allocator, char, (symbol->len + 1));
+        memcpy(f->name, symbol->name, symbol->len);
+        f->name[symbol->len] = '\0';
+        f->len = symbol->len;
+        f->address = self->memory + symbol->offset;
+        f->size = symbol->size;
+        f++;
+    }
+}
+
+jit* jit_load(allocator_t* allocator, const x86_object* object) {
+    size_t page = mmio_get_page_size();
+    size_t text_size = object->section_sizes[X86_SECTION_TEXT];
+    size_t rodata_size = object->section_sizes[X86_SECTION_RODATA];
+
+    size_t stubs = align_up(text_size, STUB_SIZE);
+    size_t stub_count = 0;
+
+    for (size_t i = 0; i < object->symbol_count; i++) {
+        stub_count += object->symbols[i].kind == X86_SYMBOL_EXTERN;
+    }
+
+    size_t code_size = align_up(stubs + stub_count * STUB_SIZE, page);
+    size_t size = code_size + align_up(rodata_size, page);
+
+    uint8_t* memory = mmio_virtual_alloc(size);
+
+    if (memory == NULL) {
+        return NULL;
+    }
+
+    uint8_t* rodata = memory + code_size;
+
+    memcpy(memory, object->sections[X86_SECTION_TEXT], text_size);
+    memset(memory + text_size, 0xcc, code_size - text_size);
+    memcpy(rodata, object->sections[X86_SECTION_RODATA], rodata_size);
+
+    /* Where every symbol is, externs at their stub */
+    uint8_t** addresses = ALLOC_ARRAY(
+        allocator, uint8_t*, (object->symbol_count + 1)
+    );
+    uint8_t* stub = memory + stubs;
+    bool ok = true;
+
+    for (size_t i = 0; i < object->symbol_count; i++) {
+        const x86_symbol_info* symbol = &object->symbols[i];
+
+        if (symbol->kind != X86_SYMBOL_EXTERN) {
+            addresses[i] = memory + symbol->offset;
+            continue;
+        }
+
+        void* target = find_extern(allocator, symbol);
+
+        if (target == NULL) {
+            ok = false;
+            break;
+        }
+
+        write_stub(stub, target);
+        addresses[i] = stub;
+        stub += STUB_SIZE;
+    }
+
+    /* Both kinds are relative to the end of the field, S + A - P */
+    for (size_t i = 0; ok && i < object->reloc_count; i++) {
+        const x86_reloc* reloc = &object->relocs[i];
+        uint8_t* target = reloc->symbol == X86_NO_SYMBOL
+                              ? rodata
+                              : addresses[reloc->symbol];
+        uint8_t* field = memory + reloc->offset;
+
+        put_le32(field, (uint32_t)(target + reloc->addend - field));
+    }
+
+    FREE_ARRAY(allocator, addresses, uint8_t*, (object->symbol_count + 1));
+
+    ok = ok && mmio_virtual_protect(memory, code_size, MMIO_PROTECT_READ_EXEC);
+    ok = ok && (size == code_size ||
+                mmio_virtual_protect(
+                    rodata, size - code_size, MMIO_PROTECT_READ
+                ));
+
+    if (!ok) {
+        mmio_virtual_free(memory, size);
+        return NULL;
+    }
+
+    jit* self = ALLOC(allocator, jit);
+    *self = (jit){
+        .allocator = allocator,
+        .memory = memory,
+        .size = size,
+    };
+
+    copy_functions(self, object);
+
+    return self;
+}
+
+void jit_destroy(jit* self) {
+    for (size_t i = 0; i < self->function_count; i++) {
+        jit_function_info* f = &self->functions[i];
+        FREE_ARRAY(self->allocator, f->name, char, (f->len + 1));
+    }
+
+    FREE_ARRAY(
+        self->allocator, self->functions, jit_function_info,
+        self->function_count
+    );
+    mmio_virtual_free(self->memory, self->size);
+    FREE(self->allocator, self, jit);
+}
+
+void* jit_function(const jit* self, const char* name) {
+    for (size_t i = 0; i < self->function_count; i++) {
+        if (strcmp(self->functions[i].name, name) == 0) {
+            return self->functions[i].address;
+        }
+    }
+
+    return NULL;
+}
+
+bool jit_write_perf_map(const jit* self) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%ld.map", (long)getpid());
+
+    /* Appended to, a process may load more than one program */
+    FILE* out = fopen(path, "a");
+
+    if (out == NULL) {
+        perror(path);
+        return false;
+    }
+
+    for (size_t i = 0; i < self->function_count; i++) {
+        const jit_function_info* f = &self->functions[i];
+
+        fprintf(
+            out, "%lx %zx %s\n", (unsigned long)(uintptr_t)f->address,
+            f->size, f->name
+        );
+    }
+
+    if (fclose(out) != 0) {
+        perror(path);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,51 @@
+/**
+ * In-process loader for machine code
+ *
+ * Takes the machine code of a binary x86 emitter (see x86.h), which would
+ * otherwise go to an object file, and loads it into memory of this process
+ * so that its functions can be called directly: the sections are copied to
+ * fresh pages, relocations are applied against their addresses and against
+ * the C library functions of this process, and the pages are then made
+ * executable. Pages are never writable and executable at once.
+ *
+ * Calls to the C library go through a small stub next to the code, which
+ * jumps to the absolute address of the function, since the library may be
+ * mapped further away than a 32 bit displacement reaches.
+ */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "alloc.h"
+#include "x86.h"
+
+typedef struct _jit jit;
+
+/**
+ * Loads `object`, which does not need to outlive the result.
+ *
+ * Returns NULL after printing to stderr if memory cannot be had, or a C
+ * library function the code uses is not found.
+ */
+jit* jit_load(allocator_t* allocator, const x86_object* object);
+
+void jit_destroy(jit* self);
+
+/**
+ * Address of the function named `name`, or NULL if there is none.
+ */
+void* jit_function(const jit* self, const char* name);
+
+/**
+ * Appends the address, size and name of every function to
+ * /tmp/perf-<pid>.map, where Linux perf looks for symbols of code it finds
+ * no binary for.
+ *
+ * Returns false after printing to stderr if the file cannot be written.
+ */
+bool jit_write_perf_map(const jit* self);
+
+#endif  // JIT_H
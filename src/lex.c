@@ -314,3 +314,24 @@ token_result lex_advance(lexer_t* lex) {
 
     return ret;
 }
+
+void lex_error_print(FILE* out, lex_error e) {
+    switch (e.type) {
+        case LEX_ERR_UNEXPECTED_CHAR: {
+            fprintf(out, "Unexpected character: '%c'", *e.span);
+            break;
+        }
+
+        case LEX_ERR_UNTERMINATED_STRING: {
+            fprintf(
+                out,
+                "Unterminated string: %.*s",
+                (int)e.span_size,
+                e.span
+            );
+            break;
+        }
+    }
+
+    fputc('\n', out);
+}
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 
 typedef enum {
     TOK_IDEN,
@@ -132,4 +133,9 @@ typedef struct {
 lexer_t make_lexer(char* src, size_t size);
 token_result lex_advance(lexer_t* lex);
 
+/**
+ * Describes a lexical error on one line of `out`.
+ */
+void lex_error_print(FILE* out, lex_error e);
+
 #endif  // LEX_H
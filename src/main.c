@@ -6,25 +6,159 @@
 /* for putting stdout to binary mode on Windows */
 #ifdef _WIN32
 #include <fcntl.h>
+#else
+#include <pthread.h>
 #endif
 
+#include "alloc_profile.h"
 #include "arena.h"
 #include "ast.h"
+#include "batch.h"
+#include "bytecode.h"
+#include "codegen.h"
+#include "elf_writer.h"
+#include "interp.h"
+#include "ir.h"
+#include "jit.h"
 #include "mmio.h"
 #include "mmio_alloc.h"
 #include "parser.h"
+#include "resolve.h"
+#include "server.h"
+#include "thread_alloc.h"
+#include "toolchain.h"
 #include "typecheck.h"
+#include "vm.h"
+#include "x86.h"
+
+/* Arena blocks start at a page and double up to this size */
+#define ARENA_MAX_BLOCK_SIZE (4 * MMIO_HUGE_PAGE_SIZE)
+
+/* With several input files, each file gets an arena of blocks this size,
+ * recycled from file to file through a shared block pool */
+#define FILE_ARENA_BLOCK_SIZE ((size_t) 256 * 1024)
 
 struct compiler_args {
-    char* path;
+    /* Points into argv */
+    char** paths;
+    size_t path_count;
+
+    /* Worker threads compiling files, 0 for one per CPU */
+    size_t jobs;
+
+    /* Socket to serve compile requests on (--server), or of the server to
+     * send the files to (--client) */
+    char* server_socket;
+    char* client_socket;
+
+    /* Run many programs from stdin through one stage (--batch) */
+    bool batch;
+    batch_stage batch_stage;
+    batch_input_format batch_input;
+
+    /* Print the bytecode to stdout instead of running main */
+    bool emit_bytecode;
+
+    /* Print the IR the native backend works from to stdout instead of
+     * running main */
+    bool emit_ir;
+
+    /* Optimize the IR (cleared by -O0) */
+    bool optimize;
+
+    /* Describe on stderr which calls the optimizer inlines, and why the
+     * others are not */
+    bool print_inlining;
+
+    /* Describe on stderr which calls are not tail calls, and why */
+    bool print_non_tail_calls;
+
+    /* How the native backends lower the IR, registers allocated unless
+     * --no-regalloc was passed */
+    codegen_options codegen;
+
+    /* Run main with the tree-walking interpreter instead of the VM */
+    bool interp;
+
+    /* Compile main to x86-64 machine code in memory and run it */
+    bool jit;
+
+    /* Describe the code compiled by --jit in /tmp/perf-<pid>.map for Linux
+     * perf */
+    bool perf_map;
+
+    /* Compile to x86-64 assembly (-S), written to `output` or stdout */
+    bool emit_asm;
+
+    /* Compile to an x86-64 object file (-c) at `output` instead of linking
+     * an executable */
+    bool emit_object;
+
+    /* Executable to compile to (-o), or file the assembly or object goes
+     * to */
+    char* output;
+
+    /* Print arena statistics to stderr after compiling */
+    bool arena_stats;
+
+    /* Profile the compiler's allocations and print a summary to stderr at
+     * exit */
+    bool alloc_stats;
+    alloc_profile_format alloc_stats_format;
+
+    /* How the source file is brought into memory */
+    mmio_input_options input;
 };
 
 const struct compiler_args DEFAULT_ARGS = (struct compiler_args){
-    .path = NULL,
+    .paths = NULL,
+    .path_count = 0,
+    .jobs = 0,
+    .server_socket = NULL,
+    .client_socket = NULL,
+    .batch = false,
+    .batch_stage = BATCH_COMPILE,
+    .batch_input = BATCH_INPUT_NUL,
+    .emit_bytecode = false,
+    .emit_ir = false,
+    .optimize = true,
+    .print_inlining = false,
+    .print_non_tail_calls = false,
+    .codegen = {.allocate_registers = true},
+    .interp = false,
+    .jit = false,
+    .perf_map = false,
+    .emit_asm = false,
+    .emit_object = false,
+    .output = NULL,
+    .arena_stats = false,
+    .alloc_stats = false,
+    .alloc_stats_format = ALLOC_PROFILE_TABLE,
+    .input =
+        {
+            .mmap_threshold = MMIO_DEFAULT_MMAP_THRESHOLD,
+            .populate = false,
+        },
 };
 
 void print_usage_and_die(char* program) {
-    fprintf(stderr, "Usage: %s [path]\n", program);
+    fprintf(
+        stderr,
+        "Usage: %s [path|-]... [--arena-stats] [--alloc-stats[=table|json]]\n"
+        "          [--mmap-threshold=<bytes>] [--mmap-populate] [--jobs=<n>]\n"
+        "          [--emit-bytecode] [--emit-ir] [--interp]\n"
+        "          [--jit [--perf-map]] [-S | -c] [-o <output>] [-O0]\n"
+        "          [--no-regalloc] [--print-inlining]\n"
+        "          [--print-non-tail-calls]\n"
+        "       %s --server <socket> [--jobs=<n>] [--mmap-threshold=<bytes>]\n"
+        "       %s --client <socket> [path|-]...\n"
+        "       %s --batch=<tokens|sexpr|typecheck|compile>\n"
+        "          [--batch-input=nul|length]\n",
+        program,
+        program,
+        program,
+        program
+    );
     exit(1);
 }
 
@@ -34,65 +168,875 @@ struct compiler_args parse_args(int argc, char** argv) {
 
     argc--;
 
+    /* There cannot be more paths than arguments */
+    ret.paths = ALLOC_ARRAY(gpa(), char*, (size_t) argc + 1);
+
     while (argc--) {
         char* arg = *(argv++);
 
-        if (memcmp(arg, "--", sizeof("--")) == 0 || arg[0] == '-') {
+        /* A lone '-' is a path, standing for stdin */
+        bool is_flag = memcmp(arg, "--", sizeof("--")) == 0 ||
+                       (arg[0] == '-' && arg[1] != '\0');
 
-            /* Flags must appear after path */
-            if (ret.path == NULL) {
+        /* The socket follows these two, they may come first */
+        if (strcmp(arg, "--server") == 0 || strcmp(arg, "--client") == 0) {
+            if (argc-- == 0) {
+                fprintf(stderr, "Expected a socket path after '%s'\n", arg);
+                print_usage_and_die(exec);
+            }
+
+            if (arg[2] == 's') {
+                ret.server_socket = *(argv++);
+            } else {
+                ret.client_socket = *(argv++);
+            }
+
+            continue;
+        }
+
+        if (strncmp(arg, "--batch=", 8) == 0) {
+            if (!batch_stage_from_name(arg + 8, &ret.batch_stage)) {
+                fprintf(stderr, "Invalid batch stage: '%s'\n", arg + 8);
+                print_usage_and_die(exec);
+            }
+
+            ret.batch = true;
+            continue;
+        }
+
+        if (is_flag) {
+
+            /* Other flags must appear after the first path or mode */
+            if (ret.path_count == 0 && ret.server_socket == NULL &&
+                ret.client_socket == NULL && !ret.batch) {
                 fprintf(stderr, "Expected filename before flag '%s'\n", arg);
                 print_usage_and_die(exec);
             }
 
+            if (strcmp(arg, "--emit-bytecode") == 0) {
+                ret.emit_bytecode = true;
+                continue;
+            }
+
+            if (strcmp(arg, "--emit-ir") == 0) {
+                ret.emit_ir = true;
+                continue;
+            }
+
+            if (strcmp(arg, "-O0") == 0) {
+                ret.optimize = false;
+                continue;
+            }
+
+            if (strcmp(arg, "--print-inlining") == 0) {
+                ret.print_inlining = true;
+                continue;
+            }
+
+            if (strcmp(arg, "--print-non-tail-calls") == 0) {
+                ret.print_non_tail_calls = true;
+                ret.codegen.tail_report = stderr;
+                continue;
+            }
+
+            if (strcmp(arg, "--no-regalloc") == 0) {
+                ret.codegen.allocate_registers = false;
+                continue;
+            }
+
+            if (strcmp(arg, "--interp") == 0) {
+                ret.interp = true;
+                continue;
+            }
+
+            if (strcmp(arg, "--jit") == 0) {
+                ret.jit = true;
+                continue;
+            }
+
+            if (strcmp(arg, "--perf-map") == 0) {
+                ret.perf_map = true;
+                continue;
+            }
+
+            if (strcmp(arg, "-S") == 0) {
+                ret.emit_asm = true;
+                continue;
+            }
+
+            if (strcmp(arg, "-c") == 0) {
+                ret.emit_object = true;
+                continue;
+            }
+
+            if (strcmp(arg, "-o") == 0) {
+                if (argc-- == 0) {
+                    fprintf(stderr, "Expected an output path after '-o'\n");
+                    print_usage_and_die(exec);
+                }
+
+                ret.output = *(argv++);
+                continue;
+            }
+
+            if (strcmp(arg, "--arena-stats") == 0) {
+                ret.arena_stats = true;
+                continue;
+            }
+
+            if (strcmp(arg, "--alloc-stats") == 0 ||
+                strcmp(arg, "--alloc-stats=table") == 0) {
+                ret.alloc_stats = true;
+                ret.alloc_stats_format = ALLOC_PROFILE_TABLE;
+                continue;
+            }
+
+            if (strcmp(arg, "--alloc-stats=json") == 0) {
+                ret.alloc_stats = true;
+                ret.alloc_stats_format = ALLOC_PROFILE_JSON;
+                continue;
+            }
+
+            if (strncmp(arg, "--mmap-threshold=", 17) == 0) {
+                char* end;
+                ret.input.mmap_threshold = strtoull(arg + 17, &end, 10);
+
+                if (end == arg + 17 || *end != '\0') {
+                    fprintf(stderr, "Invalid threshold: '%s'\n", arg + 17);
+                    print_usage_and_die(exec);
+                }
+
+                continue;
+            }
+
+            if (strcmp(arg, "--mmap-populate") == 0) {
+                ret.input.populate = true;
+                continue;
+            }
+
+            if (strcmp(arg, "--batch-input=nul") == 0) {
+                ret.batch_input = BATCH_INPUT_NUL;
+                continue;
+            }
+
+            if (strcmp(arg, "--batch-input=length") == 0) {
+                ret.batch_input = BATCH_INPUT_LENGTH;
+                continue;
+            }
+
+            if (strncmp(arg, "--jobs=", 7) == 0) {
+                char* end;
+                ret.jobs = strtoull(arg + 7, &end, 10);
+
+                if (end == arg + 7 || *end != '\0' || ret.jobs == 0) {
+                    fprintf(stderr, "Invalid number of jobs: '%s'\n", arg + 7);
+                    print_usage_and_die(exec);
+                }
+
+                continue;
+            }
+
             fprintf(stderr, "Invalid flag: '%s'\n", arg);
             print_usage_and_die(exec);
         } else {
-            ret.path = arg;
+            ret.paths[ret.path_count++] = arg;
         }
     }
 
-    if (ret.path == NULL) {
+    int modes = (ret.server_socket != NULL) + (ret.client_socket != NULL) +
+                ret.batch;
+
+    if (modes > 1) {
+        fprintf(stderr, "Only one of --server, --client and --batch is allowed\n");
+        print_usage_and_die(exec);
+    }
+
+    if ((ret.server_socket != NULL || ret.batch) && ret.path_count != 0) {
+        fprintf(stderr, "Programs are not read from files in this mode\n");
+        print_usage_and_die(exec);
+    }
+
+    if (ret.path_count == 0 && ret.server_socket == NULL && !ret.batch) {
         fprintf(stderr, "Expected path to a source file.\n");
         print_usage_and_die(exec);
     }
 
+    if ((ret.emit_asm || ret.emit_object || ret.output != NULL) &&
+        ret.path_count != 1) {
+        fprintf(stderr, "-S, -c and -o take a single source file\n");
+        print_usage_and_die(exec);
+    }
+
+    /* Several files are only checked, never run or printed */
+    bool single_file_mode = ret.emit_bytecode || ret.emit_ir || ret.interp ||
+                            ret.jit || ret.perf_map || !ret.optimize ||
+                            !ret.codegen.allocate_registers ||
+                            ret.print_inlining || ret.print_non_tail_calls;
+
+    if (single_file_mode && ret.path_count > 1) {
+        fprintf(
+            stderr,
+            "--emit-bytecode, --emit-ir, --interp, --jit, --perf-map, -O0, "
+            "--no-regalloc, --print-inlining and --print-non-tail-calls take "
+            "a single source file\n"
+        );
+        print_usage_and_die(exec);
+    }
+
+    if (ret.emit_object && (ret.emit_asm || ret.output == NULL)) {
+        fprintf(stderr, "-c takes an output path and no -S\n");
+        print_usage_and_die(exec);
+    }
+
+    if (ret.emit_ir && (ret.emit_asm || ret.output != NULL)) {
+        fprintf(stderr, "--emit-ir takes no -S, -c or -o\n");
+        print_usage_and_die(exec);
+    }
+
+    if (ret.print_inlining && !ret.emit_ir && !ret.jit && !ret.emit_asm &&
+        !ret.emit_object && ret.output == NULL) {
+        fprintf(stderr, "--print-inlining is only for the native backend\n");
+        print_usage_and_die(exec);
+    }
+
+    if (ret.print_non_tail_calls && ret.interp) {
+        fprintf(stderr, "--print-non-tail-calls is not for --interp\n");
+        print_usage_and_die(exec);
+    }
+
+    if (ret.perf_map && !ret.jit) {
+        fprintf(stderr, "--perf-map is only for --jit\n");
+        print_usage_and_die(exec);
+    }
+
     return ret;
 }
 
-int compile_file(struct compiler_args* args, mmio_mapping* mapping) {
-    (void) args;
+/* `path` is NULL when there is a single input file */
+void print_arena_stats(char* path, arena* arena) {
+    arena_stats stats = arena_get_stats(arena);
 
-    int ret = 0;
+    fprintf(
+        stderr,
+        "%s%sarena: %zu blocks (%zu dedicated), %zu KiB total, "
+        "largest block %zu KiB\n",
+        path != NULL ? path : "",
+        path != NULL ? ": " : "",
+        stats.blocks,
+        stats.dedicated_blocks,
+        stats.bytes / 1024,
+        stats.largest_block / 1024
+    );
+}
+
+/* Set when --alloc-stats is passed. The summary is printed at exit, so that
+ * it is printed even if compilation exits early on an error. */
+static alloc_profiler* profiler = NULL;
+static alloc_profile_format profiler_format;
+
+void print_alloc_stats() {
+    alloc_profiler_print(profiler, stderr, profiler_format);
+    alloc_profiler_destroy(profiler);
+}
+
+/* Returns `inner`, wrapped in the profiler if --alloc-stats was passed */
+allocator_t profile_allocations(struct compiler_args* args, allocator_t* inner) {
+    if (!args->alloc_stats) {
+        return *inner;
+    }
+
+    profiler = alloc_profiler_make(inner);
+    profiler_format = args->alloc_stats_format;
+    atexit(print_alloc_stats);
+
+    return alloc_profiler_get_alloc(profiler);
+}
+
+/* Parses and typechecks a source file */
+bool compile_to_ast(
+    char* src, size_t len, allocator_t* allocator, ast_item_node** out
+) {
+    if (!parse(allocator, src, len, out)) {
+        return false;
+    }
+
+    return typecheck(allocator, *out);
+}
 
-    arena* arena = arena_make(&mmio_alloc, mmio_get_page_size());
-    allocator_t allocator = arena_get_alloc(arena);
+/* Same, and lowers it to bytecode, reporting the calls that are not tail
+ * calls to `tail_report` unless it is NULL */
+bool compile_to_module(
+    char* src,
+    size_t len,
+    allocator_t* allocator,
+    FILE* tail_report,
+    bc_module* out
+) {
+    ast_item_node* ast;
 
-    ast_item_node* ast = parse(&allocator, (char*) mapping->ptr, mapping->length);
+    if (!compile_to_ast(src, len, allocator, &ast)) {
+        return false;
+    }
+
+    return bc_compile(allocator, ast, tail_report, out);
+}
+
+/* Same, and lowers it to the IR, optimized unless -O0 was passed */
+bool compile_to_ir(
+    struct compiler_args* args,
+    char* src,
+    size_t len,
+    allocator_t* allocator,
+    ir_program* out
+) {
+    ast_item_node* ast;
+    resolved_program program;
+    FILE* tail_report = args->print_non_tail_calls ? stderr : NULL;
+
+    if (!compile_to_ast(src, len, allocator, &ast) ||
+        !resolve(allocator, ast, tail_report, &program) ||
+        !ir_build(allocator, &program, out)) {
+        return false;
+    }
 
-    if (!typecheck(&allocator, ast)) {
-        ret = 1;
-        goto cleanup;
+    if (args->optimize) {
+        ir_optimize(allocator, out);
+        ir_inline(allocator, out, args->print_inlining ? stderr : NULL);
     }
 
-    fprintf(stderr, "NOT IMPLEMENTED: Code execution is WIP.\n");
+    return true;
+}
+
+/* Compiles a source file without running it. Returns the exit status. */
+int compile_source(char* src, size_t len, allocator_t* allocator) {
+    bc_module module;
+
+    return compile_to_module(src, len, allocator, NULL, &module) ? 0 : 1;
+}
+
+/* Runs the main function of the module, if it has one. Returns the exit
+ * status: what main returns, or 1 on a runtime error. */
+int run_main(bc_module* module, allocator_t* allocator) {
+    if (module->main == BC_NO_FUNCTION) {
+        return 0;
+    }
+
+    vm* vm = vm_make(allocator, module);
+    int64_t result;
+
+    bool ok = vm_call(vm, module->main, NULL, 0, &result);
+    vm_destroy(vm);
+
+    return ok ? (int)result : 1;
+}
+
+/* Same as run_main, with the tree-walking interpreter */
+int interpret_main(ast_item_node* ast, allocator_t* allocator) {
+    resolved_program program;
+
+    if (!resolve(allocator, ast, NULL, &program)) {
+        return 1;
+    }
+
+    if (program.main == RESOLVED_NO_FUNCTION) {
+        return 0;
+    }
+
+    interp* interp = interp_make(allocator, &program);
+    int64_t result;
+
+    bool ok = interp_call(interp, program.main, NULL, 0, &result);
+    interp_destroy(interp);
+
+    return ok ? (int)result : 1;
+}
+
+/* Lowers the program to x86-64 assembly at `out` */
+bool write_assembly(
+    ir_program* program,
+    const codegen_options* options,
+    allocator_t* allocator,
+    FILE* out
+) {
+    x86_asm* as = x86_asm_make(allocator, out);
+    bool ok = codegen(allocator, program, options, as);
+    x86_asm_destroy(as);
+
+    return ok;
+}
+
+/* Encodes the program to an ELF object file at `path` */
+bool write_object(
+    ir_program* program,
+    const codegen_options* options,
+    allocator_t* allocator,
+    char* path
+) {
+    x86_asm* as = x86_asm_make_binary(allocator);
+    bool ok = codegen(allocator, program, options, as);
+
+    if (ok) {
+        x86_object object = x86_asm_object(as);
+        ok = elf_write_object(allocator, &object, path);
+    }
+
+    x86_asm_destroy(as);
+
+    return ok;
+}
+
+/* Compiles the source file to assembly with -S, to an object file with -c,
+ * or to an executable with -o. Returns the exit status. */
+int compile_native(
+    struct compiler_args* args, char* src, size_t len, allocator_t* allocator
+) {
+    ir_program program;
+
+    if (!compile_to_ir(args, src, len, allocator, &program)) {
+        return 1;
+    }
+
+    if (args->emit_asm) {
+        FILE* out = args->output != NULL ? fopen(args->output, "w") : stdout;
+
+        if (out == NULL) {
+            perror(args->output);
+            return 1;
+        }
+
+        bool ok = write_assembly(&program, &args->codegen, allocator, out);
+
+        if (out != stdout && fclose(out) != 0) {
+            perror(args->output);
+            ok = false;
+        }
+
+        return ok ? 0 : 1;
+    }
+
+    if (args->emit_object) {
+        bool ok = write_object(
+            &program, &args->codegen, allocator, args->output
+        );
+
+        return ok ? 0 : 1;
+    }
+
+    /* The object only lives until the toolchain has linked it */
+    char path[] = "/tmp/onec-XXXXXX.o";
+    int fd = mkstemps(path, 2);
+
+    if (fd < 0) {
+        perror("Could not create a temporary file");
+        return 1;
+    }
+
+    close(fd);
+
+    bool ok = write_object(&program, &args->codegen, allocator, path);
+
+    const char* inputs[] = {path};
+    ok = ok && toolchain_link(inputs, 1, args->output);
+
+    unlink(path);
+
+    return ok ? 0 : 1;
+}
+
+/* Compiles the program to machine code in memory and runs its main */
+int jit_main(
+    ir_program* program,
+    const codegen_options* options,
+    allocator_t* allocator,
+    bool perf_map
+) {
+    x86_asm* as = x86_asm_make_binary(allocator);
+    jit* jit = NULL;
+
+    if (codegen(allocator, program, options, as)) {
+        x86_object object = x86_asm_object(as);
+        jit = jit_load(allocator, &object);
+    }
+
+    x86_asm_destroy(as);
+
+    if (jit == NULL) {
+        return 1;
+    }
+
+    if (perf_map && !jit_write_perf_map(jit)) {
+        jit_destroy(jit);
+        return 1;
+    }
+
+    /* The C entry point codegen adds, which calls the program's main */
+    int (*entry)(void) = (int (*)(void))jit_function(jit, "main");
+    int ret = entry();
+
+    jit_destroy(jit);
+
+    return ret;
+}
+
+/* Runs the source file's main function. Returns the exit status. */
+int run_source(
+    struct compiler_args* args, char* src, size_t len, allocator_t* allocator
+) {
+    if (args->emit_asm || args->emit_object || args->output != NULL) {
+        return compile_native(args, src, len, allocator);
+    }
+    if (args->emit_ir || args->jit) {
+        ir_program program;
+
+        if (!compile_to_ir(args, src, len, allocator, &program)) {
+            return 1;
+        }
+
+        if (args->emit_ir) {
+            ir_print(stdout, &program);
+            return 0;
+        }
+
+        return jit_main(
+            &program, &args->codegen, allocator, args->perf_map
+        );
+    }
+    if (args->interp) {
+        ast_item_node* ast;
+
+        if (!compile_to_ast(src, len, allocator, &ast)) {
+            return 1;
+        }
+
+        return interpret_main(ast, allocator);
+    }
+
+    bc_module module;
+    FILE* tail_report = args->print_non_tail_calls ? stderr : NULL;
+
+    if (!compile_to_module(src, len, allocator, tail_report, &module)) {
+        return 1;
+    }
+
+    if (args->emit_bytecode) {
+        bc_disassemble(stdout, &module);
+        return 0;
+    }
+
+    return run_main(&module, allocator);
+}
+
+int compile_file(struct compiler_args* args, mmio_mapping* mapping) {
+    arena* arena = arena_make_with_options(
+        &mmio_alloc,
+        &(arena_options){
+            .block_size = mmio_get_page_size(),
+            .max_block_size = ARENA_MAX_BLOCK_SIZE,
+            .huge_pages = true,
+        }
+    );
+    allocator_t arena_alloc = arena_get_alloc(arena);
+    allocator_t allocator = profile_allocations(args, &arena_alloc);
+
+    int ret = run_source(
+        args, (char*) mapping->ptr, mapping->length, &allocator
+    );
+
+    if (args->arena_stats) {
+        print_arena_stats(NULL, arena);
+    }
 
-cleanup:
     arena_destroy(arena);
 
     return ret;
 }
 
-mmio_mapping open_file_or_die(char* path) {
-    mmio_mapping ret = { 0 };
-    if (!mmio_mm_path(path, &ret)) {
+bool open_file(char* path, mmio_input_options* options, mmio_mapping* out) {
+    if (strcmp(path, "-") == 0) {
+#ifdef _WIN32
+        file_des in = GetStdHandle(STD_INPUT_HANDLE);
+#else
+        file_des in = STDIN_FILENO;
+#endif
+
+        if (!mmio_open_fd(in, options, out)) {
+            fprintf(stderr, "Unable to read stdin\n");
+            return false;
+        }
+
+        return true;
+    }
+
+    if (!mmio_open_path(path, options, out)) {
         fprintf(stderr, "Unable to open file '%s'\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+mmio_mapping open_file_or_die(char* path, mmio_input_options* options) {
+    mmio_mapping ret = { 0 };
+
+    if (!open_file(path, options, &ret)) {
         exit(1);
     }
 
     return ret;
 }
 
+/* Files still to be compiled, shared by the workers */
+typedef struct {
+    struct compiler_args* args;
+    block_pool* pool;
+
+    /* Allocates from the arena of the calling worker */
+    allocator_t* allocator;
+
+    /* Index of the next file to compile */
+    size_t next;
+
+    /* Exit status of each file */
+    int* status;
+} compile_queue;
+
+void compile_queued_file(compile_queue* queue, size_t i) {
+    char* path = queue->args->paths[i];
+    mmio_mapping mapping;
+
+    if (!open_file(path, &queue->args->input, &mapping)) {
+        queue->status[i] = 1;
+        return;
+    }
+
+    /* Each file gets a fresh arena. Once the file is done, its blocks go
+     * back to the pool for the next file, on whichever worker. */
+    arena* arena = thread_arena(queue->pool);
+
+    queue->status[i] = compile_source(
+        (char*) mapping.ptr, mapping.length, queue->allocator
+    );
+
+    if (queue->args->arena_stats) {
+        print_arena_stats(path, arena);
+    }
+
+    thread_arena_release();
+    mmio_unmap(&mapping);
+}
+
+void* compile_worker(void* ctx) {
+    compile_queue* queue = ctx;
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) <
+           queue->args->path_count) {
+        compile_queued_file(queue, i);
+    }
+
+    return NULL;
+}
+
+size_t cpu_count() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t) count : 1;
+#endif
+}
+
+#ifdef _WIN32
+DWORD WINAPI compile_worker_thread(LPVOID ctx) {
+    compile_worker(ctx);
+    return 0;
+}
+#endif
+
+/* Runs `jobs` workers on the queue, the calling thread being one of them */
+void run_workers(compile_queue* queue, size_t jobs) {
+#ifdef _WIN32
+    HANDLE* threads = ALLOC_ARRAY(gpa(), HANDLE, jobs);
+    size_t started = 0;
+
+    /* If a thread cannot be started, the others pick up its share */
+    while (started + 1 < jobs &&
+           (threads[started] = CreateThread(
+                NULL, 0, compile_worker_thread, queue, 0, NULL
+            )) != NULL) {
+        started++;
+    }
+
+    compile_worker(queue);
+
+    /* One wait takes at most MAXIMUM_WAIT_OBJECTS handles */
+    for (size_t i = 0; i < started; i += MAXIMUM_WAIT_OBJECTS) {
+        size_t count = started - i < MAXIMUM_WAIT_OBJECTS
+                           ? started - i
+                           : MAXIMUM_WAIT_OBJECTS;
+
+        WaitForMultipleObjects((DWORD) count, &threads[i], TRUE, INFINITE);
+    }
+
+    for (size_t i = 0; i < started; i++) {
+        CloseHandle(threads[i]);
+    }
+
+    FREE_ARRAY(gpa(), threads, HANDLE, jobs);
+#else
+    pthread_t* threads = ALLOC_ARRAY(gpa(), pthread_t, jobs);
+    size_t started = 0;
+
+    /* If a thread cannot be started, the others pick up its share */
+    while (started + 1 < jobs &&
+           pthread_create(&threads[started], NULL, compile_worker, queue) == 0) {
+        started++;
+    }
+
+    compile_worker(queue);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    FREE_ARRAY(gpa(), threads, pthread_t, jobs);
+#endif
+}
+
+int compile_files(struct compiler_args* args) {
+    int ret = 0;
+
+    /* Have the OS read every file in the background, the first ones are
+     * compiled while the rest are still coming in. Files that cannot be
+     * opened are reported when their turn comes. */
+    for (size_t i = 0; i < args->path_count; i++) {
+        if (strcmp(args->paths[i], "-") != 0) {
+            mmio_prefetch_path(args->paths[i]);
+        }
+    }
+
+    block_pool* pool = block_pool_make(&mmio_alloc, FILE_ARENA_BLOCK_SIZE);
+    allocator_t cache_alloc = thread_cache_alloc(pool);
+    allocator_t allocator = profile_allocations(args, &cache_alloc);
+
+    compile_queue queue = (compile_queue){
+        .args = args,
+        .pool = pool,
+        .allocator = &allocator,
+        .next = 0,
+        .status = ALLOC_ARRAY(gpa(), int, args->path_count),
+    };
+
+    size_t jobs = args->jobs != 0 ? args->jobs : cpu_count();
+    if (jobs > args->path_count) {
+        jobs = args->path_count;
+    }
+
+    run_workers(&queue, jobs);
+
+    for (size_t i = 0; i < args->path_count; i++) {
+        fprintf(
+            stderr, "%s: %s\n", args->paths[i], queue.status[i] ? "failed" : "ok"
+        );
+
+        if (queue.status[i] != 0) {
+            ret = 1;
+        }
+    }
+
+    if (args->arena_stats) {
+        block_pool_stats stats = block_pool_get_stats(pool);
+
+        fprintf(
+            stderr,
+            "block pool: %zu blocks created, %zu reused, %zu cached\n",
+            stats.created,
+            stats.reused,
+            stats.cached
+        );
+    }
+
+    FREE_ARRAY(gpa(), queue.status, int, args->path_count);
+    block_pool_destroy(pool);
+
+    return ret;
+}
+
+/* Sends every file to the server, which reads them itself unless they come
+ * from stdin */
+int compile_on_server(struct compiler_args* args) {
+    int ret = 0;
+    int connection = server_connect(args->client_socket);
+
+    if (connection < 0) {
+        fprintf(
+            stderr, "Unable to connect to the server at '%s'\n",
+            args->client_socket
+        );
+        return 1;
+    }
+
+    for (size_t i = 0; i < args->path_count; i++) {
+        char* path = args->paths[i];
+        int status = 1;
+        bool sent = true;
+
+        if (strcmp(path, "-") == 0) {
+            mmio_mapping mapping = open_file_or_die(path, &args->input);
+            sent = server_request(
+                connection,
+                SERVER_REQUEST_SOURCE,
+                (char*) mapping.ptr,
+                mapping.length,
+                stderr,
+                &status
+            );
+            mmio_unmap(&mapping);
+        } else {
+            /* The server may run in another directory */
+#ifdef _WIN32
+            char* full_path = _fullpath(NULL, path, 0);
+#else
+            char* full_path = realpath(path, NULL);
+#endif
+
+            if (full_path == NULL) {
+                fprintf(stderr, "Unable to open file '%s'\n", path);
+            } else {
+                sent = server_request(
+                    connection,
+                    SERVER_REQUEST_PATH,
+                    full_path,
+                    strlen(full_path),
+                    stderr,
+                    &status
+                );
+                free(full_path);
+            }
+        }
+
+        if (!sent) {
+            fprintf(stderr, "Lost connection to the server\n");
+            ret = 1;
+            break;
+        }
+
+        if (args->path_count > 1) {
+            fprintf(stderr, "%s: %s\n", path, status ? "failed" : "ok");
+        }
+
+        if (status != 0) {
+            ret = 1;
+        }
+    }
+
+    server_disconnect(connection);
+
+    return ret;
+}
+
 int main(int argc, char** argv) {
     int ret;
 
@@ -102,9 +1046,38 @@ int main(int argc, char** argv) {
 
     struct compiler_args args = parse_args(argc, argv);
 
-    mmio_mapping mapping = open_file_or_die(args.path);
-    ret = compile_file(&args, &mapping);
-    mmio_unmap(&mapping);
+    if (args.server_socket != NULL) {
+        size_t jobs = args.jobs != 0 ? args.jobs : cpu_count();
+
+        ret = server_run(
+            args.server_socket,
+            &(server_options){
+                .jobs = jobs,
+                .input = args.input,
+                .compile = compile_source,
+            }
+        );
+    } else if (args.batch) {
+        ret = batch_run(
+            &(batch_options){
+                .stage = args.batch_stage,
+                .input_format = args.batch_input,
+                .compile = compile_source,
+            },
+            stdin,
+            stdout
+        );
+    } else if (args.client_socket != NULL) {
+        ret = compile_on_server(&args);
+    } else if (args.path_count > 1) {
+        ret = compile_files(&args);
+    } else {
+        mmio_mapping mapping = open_file_or_die(args.paths[0], &args.input);
+        ret = compile_file(&args, &mapping);
+        mmio_unmap(&mapping);
+    }
+
+    FREE_ARRAY(gpa(), args.paths, char*, (size_t) argc);
 
     return ret;
 }
@@ -3,15 +3,22 @@
  * Conditionally compiles to use mmap (POSIX) or VirutalAlloc (WIN32).
  */
 
+#ifdef __linux__
+/* for mremap */
+#define _GNU_SOURCE
+#endif
+
 #include "mmio.h"
 
 #include <stdio.h>
+#include <string.h>
 
 #ifdef _WIN32
 #include <windows.h>
 #else
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #endif
@@ -19,11 +26,18 @@
 static const mmio_mapping MMIO_MAPPING_INIT = {
     .ptr = NULL,
     .length = 0,
+    .buffer_size = 0,
 #ifdef _WIN32
     .mapping = NULL,
 #endif
 };
 
+static mmio_syscall_stats syscall_stats = {0};
+
+/* Mappings are made from any thread */
+#define COUNT_SYSCALL(kind) \
+    __atomic_fetch_add(&syscall_stats.kind, 1, __ATOMIC_RELAXED)
+
 static int64_t filesize(file_des fd) {
 #ifdef _WIN32
     LARGE_INTEGER length;
@@ -66,6 +80,8 @@ void* mmio_virtual_alloc(size_t size) {
         MAP_ANONYMOUS | MAP_PRIVATE,
         -1, 0);
 
+    COUNT_SYSCALL(map);
+
     if (ret == MAP_FAILED) {
         perror("mmap");
         return NULL;
@@ -75,6 +91,45 @@ void* mmio_virtual_alloc(size_t size) {
     return ret;
 }
 
+void* mmio_virtual_alloc_huge(size_t size) {
+#ifdef _WIN32
+    /* Large pages on Windows need special privileges, use regular pages */
+    return mmio_virtual_alloc(size);
+#else
+    /* Over-allocate so that an aligned range of `size` bytes fits, then
+     * unmap the excess on both sides. */
+    size_t mapped = size + MMIO_HUGE_PAGE_SIZE;
+
+    char* raw = mmio_virtual_alloc(mapped);
+    if (raw == NULL) {
+        return NULL;
+    }
+
+    uintptr_t aligned = ((uintptr_t) raw + MMIO_HUGE_PAGE_SIZE - 1) &
+                        ~(uintptr_t)(MMIO_HUGE_PAGE_SIZE - 1);
+    char* ret = (char*) aligned;
+
+    size_t head = ret - raw;
+    size_t tail = mapped - head - size;
+
+    if (head > 0) {
+        mmio_virtual_free(raw, head);
+    }
+    if (tail > 0) {
+        mmio_virtual_free(ret + size, tail);
+    }
+
+#ifdef MADV_HUGEPAGE
+    COUNT_SYSCALL(advise);
+
+    /* Only a hint, failing is harmless (e.g. THP disabled) */
+    madvise(ret, size, MADV_HUGEPAGE);
+#endif
+
+    return ret;
+#endif
+}
+
 void mmio_virtual_free(void* ptr, size_t size) {
 #ifdef _WIN32
     (void) size;
@@ -83,13 +138,166 @@ void mmio_virtual_free(void* ptr, size_t size) {
         fprintf(stderr, "VirtualFree: unable to free\n");
     }
 #else
+    COUNT_SYSCALL(unmap);
+
     if (munmap(ptr, size) == -1) {
         perror("munmap");
     }
 #endif
 }
 
-bool mmio_mm_fd(file_des fd, mmio_mapping *out) {
+bool mmio_virtual_protect(void* ptr, size_t size, mmio_protection protection) {
+#ifdef _WIN32
+    static const DWORD FLAGS[] = {
+        [MMIO_PROTECT_READ] = PAGE_READONLY,
+        [MMIO_PROTECT_READ_WRITE] = PAGE_READWRITE,
+        [MMIO_PROTECT_READ_EXEC] = PAGE_EXECUTE_READ,
+    };
+    DWORD old;
+
+    if (!VirtualProtect(ptr, size, FLAGS[protection], &old)) {
+        fprintf(stderr, "VirtualProtect: unable to change protection\n");
+        return false;
+    }
+#else
+    static const int FLAGS[] = {
+        [MMIO_PROTECT_READ] = PROT_READ,
+        [MMIO_PROTECT_READ_WRITE] = PROT_READ | PROT_WRITE,
+        [MMIO_PROTECT_READ_EXEC] = PROT_READ | PROT_EXEC,
+    };
+
+    COUNT_SYSCALL(protect);
+
+    if (mprotect(ptr, size, FLAGS[protection]) == -1) {
+        perror("mprotect");
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+void* mmio_virtual_realloc(void* ptr, size_t old_size, size_t new_size) {
+#ifdef __linux__
+    COUNT_SYSCALL(remap);
+
+    void* ret = mremap(ptr, old_size, new_size, MREMAP_MAYMOVE);
+    if (ret == MAP_FAILED) {
+        perror("mremap");
+        return NULL;
+    }
+
+    return ret;
+#else
+    void* ret = mmio_virtual_alloc(new_size);
+    if (ret == NULL) {
+        return NULL;
+    }
+
+    memcpy(ret, ptr, old_size < new_size ? old_size : new_size);
+    mmio_virtual_free(ptr, old_size);
+
+    return ret;
+#endif
+}
+
+static size_t page_align_up(size_t size) {
+    size_t page = mmio_get_page_size();
+    return (size + page - 1) & ~(page - 1);
+}
+
+bool mmio_reserve(size_t size, mmio_region* out) {
+    size = page_align_up(size);
+
+#ifdef _WIN32
+    void* ptr = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+    if (ptr == NULL) {
+        fprintf(stderr, "VirtualAlloc: unable to reserve\n");
+        return false;
+    }
+#else
+    void* ptr = mmap(NULL, size,
+        PROT_NONE,
+        MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE,
+        -1, 0);
+
+    COUNT_SYSCALL(map);
+
+    if (ptr == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+#endif
+
+    *out = (mmio_region){
+        .ptr = ptr,
+        .reserved = size,
+        .committed = 0,
+    };
+
+    return true;
+}
+
+bool mmio_commit(mmio_region* region, size_t size) {
+    if (size <= region->committed) {
+        return true;
+    }
+
+    size = page_align_up(size);
+    if (size > region->reserved) {
+        fprintf(stderr, "mmio: commit exceeds the reserved region\n");
+        return false;
+    }
+
+    char* start = (char*) region->ptr + region->committed;
+    size_t length = size - region->committed;
+
+#ifdef _WIN32
+    if (VirtualAlloc(start, length, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+        fprintf(stderr, "VirtualAlloc: unable to commit\n");
+        return false;
+    }
+#else
+    COUNT_SYSCALL(protect);
+
+    if (mprotect(start, length, PROT_READ | PROT_WRITE) == -1) {
+        perror("mprotect");
+        return false;
+    }
+#endif
+
+    region->committed = size;
+    return true;
+}
+
+void mmio_release(mmio_region* region) {
+    if (region->ptr == NULL) {
+        return;
+    }
+
+    mmio_virtual_free(region->ptr, region->reserved);
+
+    region->ptr = NULL;
+    region->reserved = 0;
+    region->committed = 0;
+}
+
+mmio_syscall_stats mmio_get_syscall_stats() {
+    return (mmio_syscall_stats){
+        .map = __atomic_load_n(&syscall_stats.map, __ATOMIC_RELAXED),
+        .unmap = __atomic_load_n(&syscall_stats.unmap, __ATOMIC_RELAXED),
+        .remap = __atomic_load_n(&syscall_stats.remap, __ATOMIC_RELAXED),
+        .protect = __atomic_load_n(&syscall_stats.protect, __ATOMIC_RELAXED),
+        .advise = __atomic_load_n(&syscall_stats.advise, __ATOMIC_RELAXED),
+        .read = __atomic_load_n(&syscall_stats.read, __ATOMIC_RELAXED),
+    };
+}
+
+/* Maps `fd` like mmio_mm_fd. On POSIX, `flags` are added to the mmap flags
+ * and `sequential` asks for aggressive readahead. */
+static bool map_fd(
+    file_des fd, int flags, bool sequential, mmio_mapping *out
+) {
     bool ret = true;
 
     *out = MMIO_MAPPING_INIT;
@@ -115,6 +323,9 @@ bool mmio_mm_fd(file_des fd, mmio_mapping *out) {
     }
 
 #ifdef _WIN32
+    (void) flags;
+    (void) sequential;
+
     out->mapping = CreateFileMapping(fd, NULL, PAGE_READONLY, 0, 0, NULL);
     if (out->mapping == NULL) {
         ret = false;
@@ -130,7 +341,7 @@ bool mmio_mm_fd(file_des fd, mmio_mapping *out) {
 
     out->ptr = ptr;
 #else
-    void* ptr = mmap(NULL, out->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    void* ptr = mmap(NULL, out->length, PROT_READ, MAP_PRIVATE | flags, fd, 0);
     if (ptr == MAP_FAILED) {
         ret = false;
         perror("mmap");
@@ -138,6 +349,16 @@ bool mmio_mm_fd(file_des fd, mmio_mapping *out) {
     }
 
     out->ptr = ptr;
+
+    if (sequential) {
+        /* Only hints. The lexer makes a single pass from the start: read
+         * ahead aggressively, pages behind us can be dropped early. */
+        COUNT_SYSCALL(advise);
+        madvise(ptr, out->length, MADV_SEQUENTIAL);
+
+        COUNT_SYSCALL(advise);
+        madvise(ptr, out->length, MADV_WILLNEED);
+    }
 #endif
 
 out:
@@ -149,6 +370,10 @@ err:
     goto out;
 }
 
+bool mmio_mm_fd(file_des fd, mmio_mapping *out) {
+    return map_fd(fd, 0, false, out);
+}
+
 bool mmio_mm_path(char* path, mmio_mapping *out) {
     bool ret;
 
@@ -185,7 +410,358 @@ bool mmio_mm_path(char* path, mmio_mapping *out) {
 #endif
 }
 
+bool mmio_create_path(char* path, uint64_t size, mmio_mapping *out) {
+    *out = MMIO_MAPPING_INIT;
+    out->length = size;
+
+#ifdef _WIN32
+    HANDLE hFile = CreateFile(
+            path,
+            GENERIC_READ | GENERIC_WRITE,
+            0,
+            NULL,
+            CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL,
+            NULL
+    );
+
+    if (hFile == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "CreateFile: unable to create file '%s'\n", path);
+        return false;
+    }
+
+    /* Mapping the file sizes it */
+    out->mapping = CreateFileMapping(
+        hFile, NULL, PAGE_READWRITE, (DWORD) (size >> 32), (DWORD) size, NULL
+    );
+    CloseHandle(hFile);
+
+    if (out->mapping == NULL) {
+        fprintf(stderr, "mmio: failed to create file mapping\n");
+        return false;
+    }
+
+    out->ptr = MapViewOfFile(out->mapping, FILE_MAP_WRITE, 0, 0, 0);
+
+    if (out->ptr == NULL) {
+        fprintf(stderr, "mmio: failed to create file mapping\n");
+        mmio_unmap(out);
+        return false;
+    }
+
+    return true;
+#else
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        perror("open");
+        return false;
+    }
+
+    if (ftruncate(fd, (off_t) size) != 0) {
+        perror("ftruncate");
+        close(fd);
+        return false;
+    }
+
+    COUNT_SYSCALL(map);
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (ptr == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+
+    out->ptr = ptr;
+    return true;
+#endif
+}
+
+/* First size of the buffer mmio_read_fd reads into, doubled when full */
+#define READ_BUFFER_INITIAL_SIZE ((size_t) 256 * 1024)
+
+/* Pipe capacity asked for before reading, so that a fast writer is not
+ * stalled by the default 64 KiB pipe buffer */
+#define READ_PIPE_SIZE (1024 * 1024)
+
+bool mmio_read_fd(file_des fd, mmio_mapping *out) {
+    *out = MMIO_MAPPING_INIT;
+
+    size_t size = READ_BUFFER_INITIAL_SIZE;
+    char* buffer = mmio_virtual_alloc(size);
+    if (buffer == NULL) {
+        return false;
+    }
+
+#ifdef F_SETPIPE_SZ
+    /* Fails harmlessly if fd is not a pipe or the size is above the limit */
+    fcntl(fd, F_SETPIPE_SZ, READ_PIPE_SIZE);
+#endif
+
+    size_t length = 0;
+
+    while (true) {
+        /* Keep room for the zero byte after the contents */
+        if (length == size - 1) {
+            char* grown = mmio_virtual_realloc(buffer, size, size * 2);
+            if (grown == NULL) {
+                mmio_virtual_free(buffer, size);
+                return false;
+            }
+
+            buffer = grown;
+            size *= 2;
+        }
+
+        size_t want = size - 1 - length;
+
+        COUNT_SYSCALL(read);
+
+#ifdef _WIN32
+        DWORD got;
+        if (!ReadFile(fd, buffer + length, (DWORD) want, &got, NULL)) {
+            /* The write end of a pipe was closed */
+            if (GetLastError() == ERROR_BROKEN_PIPE) {
+                break;
+            }
+
+            fprintf(stderr, "ReadFile: unable to read\n");
+            mmio_virtual_free(buffer, size);
+            return false;
+        }
+#else
+        ssize_t got = read(fd, buffer + length, want);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("read");
+            mmio_virtual_free(buffer, size);
+            return false;
+        }
+#endif
+
+        if (got == 0) {
+            break;
+        }
+
+        length += (size_t) got;
+    }
+
+    buffer[length] = '\0';
+
+    out->ptr = buffer;
+    out->length = length;
+    out->buffer_size = size;
+
+    return true;
+}
+
+/* Buffers of small files are kept for the next small file read on the same
+ * thread, up to this size */
+#define READ_POOL_MAX_SIZE ((size_t) 4 * 1024 * 1024)
+
+static _Thread_local void* pooled_buffer = NULL;
+static _Thread_local size_t pooled_size = 0;
+
+/* Returns a buffer of at least `size` bytes, its actual size in `out_size` */
+static char* take_buffer(size_t size, size_t* out_size) {
+    if (pooled_buffer != NULL && pooled_size >= size) {
+        char* ret = pooled_buffer;
+        *out_size = pooled_size;
+
+        pooled_buffer = NULL;
+        pooled_size = 0;
+
+        return ret;
+    }
+
+    /* Too small, make room for the larger buffer to be pooled instead */
+    if (pooled_buffer != NULL) {
+        mmio_virtual_free(pooled_buffer, pooled_size);
+        pooled_buffer = NULL;
+        pooled_size = 0;
+    }
+
+    *out_size = page_align_up(size);
+    return mmio_virtual_alloc(*out_size);
+}
+
+static void release_buffer(void* buffer, size_t size) {
+    if (pooled_buffer == NULL && size <= READ_POOL_MAX_SIZE) {
+        pooled_buffer = buffer;
+        pooled_size = size;
+        return;
+    }
+
+    mmio_virtual_free(buffer, size);
+}
+
+/* Reads a regular file of `length` bytes with positioned reads */
+static bool read_small(file_des fd, size_t length, mmio_mapping *out) {
+    *out = MMIO_MAPPING_INIT;
+
+    size_t size;
+    char* buffer = take_buffer(length + 1, &size);
+    if (buffer == NULL) {
+        return false;
+    }
+
+    size_t done = 0;
+    while (done < length) {
+        COUNT_SYSCALL(read);
+
+#ifdef _WIN32
+        DWORD got;
+        if (!ReadFile(fd, buffer + done, (DWORD) (length - done), &got, NULL)) {
+            fprintf(stderr, "ReadFile: unable to read\n");
+            release_buffer(buffer, size);
+            return false;
+        }
+#else
+        ssize_t got = pread(fd, buffer + done, length - done, (off_t) done);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("pread");
+            release_buffer(buffer, size);
+            return false;
+        }
+#endif
+
+        /* The file shrank under us */
+        if (got == 0) {
+            break;
+        }
+
+        done += (size_t) got;
+    }
+
+    buffer[done] = '\0';
+
+    out->ptr = buffer;
+    out->length = done;
+    out->buffer_size = size;
+
+    return true;
+}
+
+bool mmio_open_fd(
+    file_des fd, const mmio_input_options* options, mmio_mapping *out
+) {
+    mmio_input_options defaults = {
+        .mmap_threshold = MMIO_DEFAULT_MMAP_THRESHOLD,
+        .populate = false,
+    };
+
+    if (options == NULL) {
+        options = &defaults;
+    }
+
+#ifdef _WIN32
+    bool regular = GetFileType(fd) == FILE_TYPE_DISK;
+#else
+    struct stat st;
+    bool regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+#endif
+
+    if (!regular) {
+        return mmio_read_fd(fd, out);
+    }
+
+    int64_t length = filesize(fd);
+    if (length < 0) {
+        return false;
+    }
+
+    /* A mapping that ends exactly on a page boundary has no zero byte after
+     * the contents, those files are read too */
+    bool page_multiple = length % mmio_get_page_size() == 0;
+
+    if ((uint64_t) length < options->mmap_threshold || page_multiple) {
+        return read_small(fd, (size_t) length, out);
+    }
+
+#ifdef _WIN32
+    return map_fd(fd, 0, true, out);
+#else
+    int flags = 0;
+#ifdef MAP_POPULATE
+    if (options->populate) {
+        flags |= MAP_POPULATE;
+    }
+#endif
+
+    return map_fd(fd, flags, true, out);
+#endif
+}
+
+bool mmio_open_path(
+    char* path, const mmio_input_options* options, mmio_mapping *out
+) {
+    bool ret;
+
+#ifdef _WIN32
+    HANDLE hFile = CreateFile(
+            path,
+            GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            NULL,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL,
+            NULL
+    );
+
+    if (hFile == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "CreateFile: unable to open file '%s'\n", path);
+        return false;
+    }
+
+    ret = mmio_open_fd(hFile, options, out);
+
+    CloseHandle(hFile);
+    return ret;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        return false;
+    }
+
+    ret = mmio_open_fd(fd, options, out);
+    close(fd);
+    return ret;
+#endif
+}
+
+bool mmio_prefetch_path(char* path) {
+#ifdef _WIN32
+    /* Nothing cheap to do short of mapping the file */
+    (void) path;
+    return true;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    /* Starts readahead of the whole file without waiting for it */
+    COUNT_SYSCALL(advise);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+
+    close(fd);
+    return true;
+#endif
+}
+
 void mmio_unmap(mmio_mapping *mapping) {
+    if (mapping->buffer_size != 0) {
+        release_buffer(mapping->ptr, mapping->buffer_size);
+        return;
+    }
 
 #ifdef _WIN32
     if (mapping->ptr != NULL) {
@@ -21,6 +21,10 @@ typedef struct mmio_mapping {
     /* Length of file contents mapped at ptr */
     uint64_t length;
 
+    /* Size of the anonymous buffer at ptr when the contents were read
+     * rather than mapped, 0 for file mappings */
+    size_t buffer_size;
+
 #ifdef _WIN32
     HANDLE mapping;
 #endif
@@ -32,15 +36,88 @@ typedef struct mmio_mapping {
 void* mmio_virtual_alloc(size_t size);
 
 /**
- * Frees memory allocated with mmio_virtual_alloc
+ * Size of a transparent huge page
+ */
+#define MMIO_HUGE_PAGE_SIZE ((size_t) 2 * 1024 * 1024)
+
+/**
+ * Like mmio_virtual_alloc, but the memory is aligned to MMIO_HUGE_PAGE_SIZE
+ * and, where supported, the kernel is asked to back it with huge pages.
+ * `size` should be a multiple of MMIO_HUGE_PAGE_SIZE.
+ */
+void* mmio_virtual_alloc_huge(size_t size);
+
+/**
+ * Frees memory allocated with mmio_virtual_alloc or mmio_virtual_alloc_huge
  */
 void mmio_virtual_free(void* ptr, size_t size);
 
+/* What the pages of memory from mmio_virtual_alloc may be used for */
+typedef enum {
+    MMIO_PROTECT_READ,
+    MMIO_PROTECT_READ_WRITE,
+    MMIO_PROTECT_READ_EXEC,
+} mmio_protection;
+
+/**
+ * Changes the protection of the pages in [ptr, ptr + size), which must be
+ * page aligned. Pages are never both writable and executable.
+ */
+bool mmio_virtual_protect(void* ptr, size_t size, mmio_protection protection);
+
+/**
+ * Resizes memory allocated with mmio_virtual_alloc. The contents are
+ * preserved up to the lesser of the two sizes. The memory may move.
+ *
+ * On Linux, this remaps the existing pages rather than copying them.
+ */
+void* mmio_virtual_realloc(void* ptr, size_t old_size, size_t new_size);
+
 /**
  * Returns the page size (minimum sizes mmio_virtual_alloc can allocate)
  */
 size_t mmio_get_page_size();
 
+/**
+ * A range of reserved virtual address space. Only the first `committed`
+ * bytes are backed by memory and accessible.
+ */
+typedef struct mmio_region {
+    void* ptr;
+    size_t reserved;
+    size_t committed;
+} mmio_region;
+
+/**
+ * Reserves `size` bytes of address space without committing any memory.
+ */
+bool mmio_reserve(size_t size, mmio_region* out);
+
+/**
+ * Makes sure at least `size` bytes from the start of the region are
+ * committed. Rounded up to the page size.
+ */
+bool mmio_commit(mmio_region* region, size_t size);
+
+/**
+ * Releases the entire region, committed or not.
+ */
+void mmio_release(mmio_region* region);
+
+/**
+ * Number of system calls made by mmio so far, for diagnostics.
+ */
+typedef struct {
+    size_t map;
+    size_t unmap;
+    size_t remap;
+    size_t protect;
+    size_t advise;
+    size_t read;
+} mmio_syscall_stats;
+
+mmio_syscall_stats mmio_get_syscall_stats();
+
 /**
  * Maps a file descriptor to virtual memory.
  */
@@ -52,7 +129,63 @@ bool mmio_mm_fd(file_des fd, mmio_mapping *out);
 bool mmio_mm_path(char* path, mmio_mapping *out);
 
 /**
- * Unmaps a memory mapping
+ * Creates the file at `path`, truncating it if it exists, with `size` bytes
+ * and maps it writable. What is written to the mapping ends up in the file
+ * once it is unmapped with mmio_unmap. `size` must not be 0.
+ */
+bool mmio_create_path(char* path, uint64_t size, mmio_mapping *out);
+
+/**
+ * Reads everything from a file descriptor that cannot be mapped, such as a
+ * pipe, into an anonymous page-aligned buffer. The buffer grows as needed
+ * and the contents are always followed by at least one zero byte.
+ */
+bool mmio_read_fd(file_des fd, mmio_mapping *out);
+
+/**
+ * Default for mmio_input_options.mmap_threshold, see bench_input
+ */
+#define MMIO_DEFAULT_MMAP_THRESHOLD ((size_t) 256 * 1024)
+
+/**
+ * How mmio_open_fd and mmio_open_path bring a file into memory.
+ */
+typedef struct {
+    /* Regular files smaller than this are read into a pooled buffer, larger
+     * ones are mapped with sequential access hints */
+    size_t mmap_threshold;
+
+    /* Prefault mapped files in one go (MAP_POPULATE) */
+    bool populate;
+} mmio_input_options;
+
+/**
+ * Makes the contents of a file descriptor available in memory, followed by
+ * at least one zero byte. Small regular files are read, large ones mapped,
+ * anything else (pipes, terminals) is read with mmio_read_fd.
+ *
+ * @param options NULL for the defaults
+ */
+bool mmio_open_fd(
+    file_des fd, const mmio_input_options* options, mmio_mapping *out
+);
+
+/**
+ * Opens the file at `path` with mmio_open_fd.
+ */
+bool mmio_open_path(
+    char* path, const mmio_input_options* options, mmio_mapping *out
+);
+
+/**
+ * Asks the OS to start reading the file at `path` into the page cache and
+ * returns without waiting. Opening it later with mmio_open_path then finds
+ * the contents in memory. Returns false if the file cannot be opened.
+ */
+bool mmio_prefetch_path(char* path);
+
+/**
+ * Unmaps a memory mapping, or releases the buffer of one that was read
  */
 void mmio_unmap(mmio_mapping *mapping);
 
@@ -7,6 +7,7 @@
 
 #include "mmio.h"
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,14 +20,20 @@ static void* mmio_allocate(void* _ctx, void* ptr, size_t old_size, size_t new_si
         return NULL;
     }
 
-    void* ret = mmio_virtual_alloc(new_size);
-    if (ret == NULL) {
-        exit(1);
-    }
+    void* ret;
 
     if (ptr != NULL) {
-        memcpy(ret, ptr, old_size < new_size ? old_size : new_size);
-        mmio_virtual_free(ptr, old_size);
+        ret = mmio_virtual_realloc(ptr, old_size, new_size);
+    } else if (new_size % MMIO_HUGE_PAGE_SIZE == 0) {
+        /* Sizes in whole huge pages are asked for deliberately, give them
+         * huge page aligned memory. */
+        ret = mmio_virtual_alloc_huge(new_size);
+    } else {
+        ret = mmio_virtual_alloc(new_size);
+    }
+
+    if (ret == NULL) {
+        exit(1);
     }
 
     return ret;
@@ -37,3 +44,95 @@ allocator_t mmio_alloc = {
     .ctx = NULL,
 };
 
+/* Smallest amount of memory committed at once by the region allocator */
+#define REGION_MIN_COMMIT (64 * 1024)
+
+static inline size_t region_align_up(size_t size) {
+    return (size + (_Alignof(max_align_t) - 1)) &
+           ~(size_t)(_Alignof(max_align_t) - 1);
+}
+
+bool mmio_region_ctx_init(mmio_region_ctx* ctx, size_t reserve) {
+    ctx->used = 0;
+    return mmio_reserve(reserve, &ctx->region);
+}
+
+void mmio_region_ctx_destroy(mmio_region_ctx* ctx) {
+    mmio_release(&ctx->region);
+    ctx->used = 0;
+}
+
+/* Commits enough memory for `used` bytes. Commits grow geometrically so
+ * that a steadily growing region only needs a logarithmic number of
+ * system calls. */
+static void region_ensure(mmio_region_ctx* ctx, size_t used) {
+    mmio_region* region = &ctx->region;
+
+    if (used <= region->committed) {
+        return;
+    }
+
+    size_t commit = region->committed * 2;
+    if (commit < REGION_MIN_COMMIT) {
+        commit = REGION_MIN_COMMIT;
+    }
+    if (commit < used) {
+        commit = used;
+    }
+    if (commit > region->reserved) {
+        commit = region->reserved;
+    }
+
+    if (used > region->reserved || !mmio_commit(region, commit)) {
+        fprintf(stderr, "mmio: region of %zu bytes exhausted\n",
+                region->reserved);
+        exit(1);
+    }
+}
+
+static void* mmio_region_allocate(void* ctx, void* ptr, size_t old_size,
+                                  size_t new_size) {
+    mmio_region_ctx* self = (mmio_region_ctx*) ctx;
+    uintptr_t base = (uintptr_t) self->region.ptr;
+
+    size_t aligned_old = region_align_up(old_size);
+    size_t aligned_new = region_align_up(new_size);
+
+    /* The last allocation is resized or freed in place */
+    if (ptr != NULL &&
+        (uintptr_t) ptr + aligned_old == base + self->used) {
+        size_t start = (uintptr_t) ptr - base;
+
+        region_ensure(self, start + aligned_new);
+        self->used = start + aligned_new;
+
+        return new_size == 0 ? NULL : ptr;
+    }
+
+    /* Anything else can not be freed */
+    if (new_size == 0) {
+        return NULL;
+    }
+
+    if (ptr != NULL && new_size <= old_size) {
+        return ptr;
+    }
+
+    region_ensure(self, self->used + aligned_new);
+
+    void* ret = (void*) (base + self->used);
+    self->used += aligned_new;
+
+    if (ptr != NULL) {
+        memcpy(ret, ptr, old_size);
+    }
+
+    return ret;
+}
+
+allocator_t mmio_region_alloc(mmio_region_ctx* ctx) {
+    return (allocator_t){
+        .alloc = mmio_region_allocate,
+        .ctx = ctx,
+    };
+}
@@ -7,8 +7,43 @@
 #define MMIO_ALLOC_H
 
 #include "alloc.h"
+#include "mmio.h"
 
+/**
+ * Allocates with mmio_virtual_alloc. Allocations whose size is a multiple of
+ * MMIO_HUGE_PAGE_SIZE are aligned to it and backed by transparent huge pages
+ * where supported.
+ */
 extern allocator_t mmio_alloc;
 
-#endif  // MMIO_ALLOC_H
+/**
+ * Context of a region allocator: hands out memory from a single reserved
+ * virtual region, committing pages as they are needed.
+ */
+typedef struct {
+    mmio_region region;
+
+    /* Bytes handed out from the start of the region */
+    size_t used;
+} mmio_region_ctx;
+
+/**
+ * Reserves `reserve` bytes of address space for a region allocator.
+ */
+bool mmio_region_ctx_init(mmio_region_ctx* ctx, size_t reserve);
+
+/**
+ * Releases the region and everything allocated from it.
+ */
+void mmio_region_ctx_destroy(mmio_region_ctx* ctx);
 
+/**
+ * Returns an allocator that allocates from `ctx`.
+ *
+ * Allocations are laid out contiguously. Only the most recent allocation can
+ * be resized in place or freed, which fits the way an arena uses its base
+ * allocator: blocks are allocated one after another and freed in reverse.
+ */
+allocator_t mmio_region_alloc(mmio_region_ctx* ctx);
+
+#endif  // MMIO_ALLOC_H
@@ -1,11 +1,13 @@
 #include "parser.h"
 
 #include <ctype.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "ast.h"
+#include "diag.h"
 
 typedef struct {
     lexer_t lexer;
@@ -16,8 +18,18 @@ typedef struct {
 
     ast_item_node* item_head;
     ast_item_node* item_tail;
+
+    /* Syntax errors unwind straight back to parse() */
+    jmp_buf on_error;
 } parser_t;
 
+/* Argument and type lists are collected in small vectors and frozen into
+ * the AST once complete. Most of them fit inline. */
+#define LIST_INLINE_SIZE 4
+
+typedef SMALL_VEC(ast_typename*, LIST_INLINE_SIZE) small_vec_typename;
+typedef SMALL_VEC(ast_expr_node*, LIST_INLINE_SIZE) small_vec_expr;
+
 static ast_typename* function_typename(parser_t* parser);
 static ast_typename* typename(parser_t* parser);
 
@@ -54,8 +66,10 @@ static ast_expr_node* boolean(parser_t* parser);
 static ast_expr_node* lambda(parser_t* parser);
 
 static void vsyntax_error(
-    const char* source, token* tok, char const* fmt, va_list args
+    parser_t* parser, token* tok, char const* fmt, va_list args
 ) {
+    const char* source = parser->lexer.src;
+    FILE* out = diag_stream();
     char* line_start = tok->span;
     char* line_end = tok->span;
     int line_len;
@@ -74,11 +88,14 @@ static void vsyntax_error(
 
     line_len = (int)(line_end - line_start);
 
-    fprintf(stderr, "Syntax error at %ld:%ld:\n", tok->line, tok->col);
-    vfprintf(stderr, fmt, args);
+    /* Files may be parsed on several threads, keep each report in one piece */
+    diag_lock(out);
+
+    fprintf(out, "Syntax error at %ld:%ld:\n", tok->line, tok->col);
+    vfprintf(out, fmt, args);
 
     fprintf(
-        stderr,
+        out,
         "\n%5ld | %.*s%s\n",
         tok->line,
         line_len,
@@ -87,58 +104,49 @@ static void vsyntax_error(
     );
 
     for (size_t i = 0; i < tok->col + 7; i++) {
-        fputc(' ', stderr);
+        fputc(' ', out);
     }
 
     for (size_t i = 0; i < tok->span_size; i++) {
-        fputc('^', stderr);
+        fputc('^', out);
     }
 
-    fputc('\n', stderr);
+    fputc('\n', out);
+
+    diag_unlock(out);
 
-    exit(1);
+    longjmp(parser->on_error, 1);
 }
 
-static void syntax_error(const char* source, token* tok, char const* fmt, ...) {
+static void syntax_error(parser_t* parser, token* tok, char const* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    vsyntax_error(source, tok, fmt, args);
+    vsyntax_error(parser, tok, fmt, args);
     va_end(args);
 }
 
 static void syntax_error_at_current(parser_t* parser, char const* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    vsyntax_error(parser->lexer.src, &parser->curr, fmt, args);
+    vsyntax_error(parser, &parser->curr, fmt, args);
     va_end(args);
 }
 
 static void syntax_error_at_previous(parser_t* parser, char const* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    vsyntax_error(parser->lexer.src, &parser->prev, fmt, args);
+    vsyntax_error(parser, &parser->prev, fmt, args);
     va_end(args);
 }
 
-static void lex_e_print(lex_error e) {
-    switch (e.type) {
-        case LEX_ERR_UNEXPECTED_CHAR: {
-            fprintf(stderr, "Unexpected character: '%c'", *e.span);
-            break;
-        }
+static void lex_error_report(parser_t* parser, lex_error e) {
+    FILE* out = diag_stream();
 
-        case LEX_ERR_UNTERMINATED_STRING: {
-            fprintf(
-                stderr,
-                "Unterminated string: %.*s",
-                (int)e.span_size,
-                e.span
-            );
-            break;
-        }
-    }
+    diag_lock(out);
+    lex_error_print(out, e);
+    diag_unlock(out);
 
-    exit(1);
+    longjmp(parser->on_error, 1);
 }
 
 static parser_t make_parser(allocator_t* allocator, lexer_t lexer) {
@@ -200,7 +208,7 @@ static token advance(parser_t* parser) {
 
     token_result res;
     while (!(res = lex_advance(&parser->lexer)).ok) {
-        lex_e_print(res.e);
+        lex_error_report(parser, res.e);
     }
 
     parser->curr = res.t;
@@ -242,18 +250,20 @@ static token expect(parser_t* parser, token_type tt, const char* fmt, ...) {
 
         va_list args;
         va_start(args, fmt);
-        vsyntax_error(parser->lexer.src, &offending, fmt, args);
+        vsyntax_error(parser, &offending, fmt, args);
         va_end(args);
     }
 
     return parser->prev;
 }
 
-static vec_typename typename_tuple_items(parser_t* parser, bool function) {
-    vec_typename items = vec_make(parser->allocator);
+static slice_typename typename_tuple_items(
+    parser_t* parser, bool function
+) {
+    small_vec_typename items = small_vec_make(parser->allocator);
     while (!is_eof(parser) && !match(parser, TOK_PAREN_CLOSE)) {
         ast_typename* param = typename(parser);
-        vec_push(&items, &param);
+        small_vec_push(&items, &param);
 
         if (!match(parser, TOK_COMMA)) {
             advance(parser);  // ')' handled below
@@ -269,13 +279,16 @@ static vec_typename typename_tuple_items(parser_t* parser, bool function) {
         );
     }
 
-    return items;
+    slice_typename ret;
+    small_vec_freeze(&items, &ret);
+
+    return ret;
 }
 
 static ast_typename* function_typename(parser_t* parser) {
     expect(parser, TOK_PAREN_OPEN, "expected '(' after 'fn'");
 
-    vec_typename params = typename_tuple_items(parser, true);
+    slice_typename params = typename_tuple_items(parser, true);
 
     ast_typename* return_type;
     if (match(parser, TOK_ARROW_RIGHT)) {
@@ -288,7 +301,7 @@ static ast_typename* function_typename(parser_t* parser) {
 }
 
 static ast_typename* typename_tuple(parser_t* parser) {
-    vec_typename items = typename_tuple_items(parser, false);
+    slice_typename items = typename_tuple_items(parser, false);
     return make_ast_typename_tuple(parser->allocator, items);
 }
 
@@ -661,12 +674,12 @@ static ast_expr_node* unary(parser_t* parser) {
     return function_call(parser);
 }
 
-static vec_expr arguments(parser_t* parser) {
-    vec_expr args = vec_make(parser->allocator);
+static slice_expr arguments(parser_t* parser) {
+    small_vec_expr args = small_vec_make(parser->allocator);
 
     while (!is_eof(parser) && peek(parser).type != TOK_PAREN_CLOSE) {
         ast_expr_node* arg = expr(parser);
-        vec_push(&args, &arg);
+        small_vec_push(&args, &arg);
 
         if (!match(parser, TOK_COMMA)) {
             break;
@@ -675,7 +688,10 @@ static vec_expr arguments(parser_t* parser) {
 
     expect(parser, TOK_PAREN_CLOSE, "expected a ')' after function arguments");
 
-    return args;
+    slice_expr ret;
+    small_vec_freeze(&args, &ret);
+
+    return ret;
 }
 
 static ast_expr_node* function_call(parser_t* parser) {
@@ -834,13 +850,23 @@ static ast_expr_node* lambda(parser_t* parser) {
     return make_ast_lambda(parser->allocator, params_list, body, return_type);
 }
 
-ast_item_node* parse(allocator_t* allocator, char* src, size_t src_len) {
+bool parse(
+    allocator_t* allocator, char* src, size_t src_len, ast_item_node** out
+) {
     parser_t parser = make_parser(allocator, make_lexer(src, src_len));
+
+    /* Whatever was allocated so far is left to the caller's allocator, the
+     * compiler always parses into an arena. */
+    if (setjmp(parser.on_error) != 0) {
+        return false;
+    }
+
     advance(&parser);
 
     while (!is_eof(&parser)) {
         insert_item(&parser, item(&parser));
     }
 
-    return parser.item_head;
+    *out = parser.item_head;
+    return true;
 }
@@ -1,11 +1,20 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 #include "alloc.h"
 #include "ast.h"
 
-ast_item_node* parse(allocator_t* allocator, char* src, size_t src_len);
+/**
+ * Parses `src` into a list of items stored in `out`.
+ *
+ * Returns false after printing the first syntax error to stderr. Nodes
+ * allocated before the error are not freed.
+ */
+bool parse(
+    allocator_t* allocator, char* src, size_t src_len, ast_item_node** out
+);
 
 #endif  // PARSER_H
@@ -0,0 +1,551 @@
+#include "regalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Registers handed out, in the order they are tried. rax, rcx, rdx, r10
+ * and r11 are left to the backend for the operands of instructions and
+ * moves. */
+static const x86_reg CALLER_SAVED[] = {X86_RSI, X86_RDI, X86_R8, X86_R9};
+static const x86_reg CALLEE_SAVED[REGALLOC_MAX_SAVED] = {
+    X86_RBX, X86_R12, X86_R13, X86_R14, X86_R15,
+};
+
+/* Where the System V ABI passes the parameters */
+static const x86_reg PARAM_REGS[] = {
+    X86_RDI, X86_RSI, X86_RDX, X86_RCX, X86_R8, X86_R9,
+};
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+typedef struct {
+    ir_value value;
+    size_t start;
+    size_t end;
+} interval;
+
+typedef struct {
+    allocator_t* allocator;
+    const ir_function* fn;
+    regalloc_result* out;
+
+    /* Indexed by ir_block */
+    size_t* block_ends;
+    uint64_t* live_out;
+
+    /* Positions of the instructions that call, in order */
+    size_t* calls;
+    size_t call_count;
+} allocation;
+
+static bool is_rematerialized(const ir_instr* instr) {
+    return instr->op == IR_CONST || instr->op == IR_FUNCTION ||
+           instr->op == IR_STRING;
+}
+
+static uint64_t* bits(allocation* self, uint64_t* sets, ir_block block) {
+    return sets + block * self->out->live_words;
+}
+
+static void set_bit(uint64_t* set, ir_value value) {
+    set[value / 64] |= (uint64_t)1 << (value % 64);
+}
+
+static void clear_bit(uint64_t* set, ir_value value) {
+    set[value / 64] &= ~((uint64_t)1 << (value % 64));
+}
+
+static bool has_bit(const uint64_t* set, ir_value value) {
+    return (set[value / 64] >> (value % 64)) & 1;
+}
+
+// Layout
+
+static void number(allocation* self) {
+    const ir_function* fn = self->fn;
+    regalloc_result* out = self->out;
+    size_t position = 0;
+
+    for (size_t i = 0; i < out->block_count; i++) {
+        ir_block b = out->order[i];
+        const ir_block_data* block = &fn->blocks.items[b];
+
+        out->block_starts[b] = position;
+
+        for (size_t p = 0; p < block->phis.len; p++) {
+            out->positions[block->phis.items[p]] = position;
+        }
+
+        position += 2;
+
+        for (size_t k = 0; k < block->instrs.len; k++) {
+            ir_value value = block->instrs.items[k];
+            const ir_instr* instr = &fn->values.items[value];
+
+            /* Parameters arrive with the call */
+            out->positions[value] = instr->op == IR_PARAM ? 0 : position;
+
+            if (instr->op == IR_CALL || instr->op == IR_CONCAT ||
+                instr->op == IR_STREQ || instr->op == IR_CLOSURE) {
+                self->calls[self->call_count++] = position;
+            }
+
+            position += 2;
+        }
+
+        self->block_ends[b] = position - 1;
+    }
+}
+
+// Liveness
+
+/* live_in = uses + (live_out - definitions), walking the block backwards */
+static void transfer(allocation* self, ir_block b, uint64_t* live) {
+    const ir_function* fn = self->fn;
+    const ir_block_data* block = &fn->blocks.items[b];
+
+    memcpy(
+        live, bits(self, self->live_out, b), self->out->live_words * 8
+    );
+
+    for (size_t k = block->instrs.len; k-- > 0;) {
+        ir_value value = block->instrs.items[k];
+        const ir_instr* instr = &fn->values.items[value];
+
+        clear_bit(live, value);
+
+        for (size_t a = 0; a < instr->args.len; a++) {
+            set_bit(live, instr->args.items[a]);
+        }
+    }
+
+    for (size_t p = 0; p < block->phis.len; p++) {
+        clear_bit(live, block->phis.items[p]);
+    }
+}
+
+/* live_out = the live_in of the successors, except their phi nodes, and
+ * what those pick for `b` */
+static void join(allocation* self, ir_block b, uint64_t* live_out) {
+    const ir_function* fn = self->fn;
+    ir_block succs[2];
+    size_t count = ir_successors(fn, b, succs);
+    size_t words = self->out->live_words;
+
+    memset(live_out, 0, words * 8);
+
+    for (size_t s = 0; s < count; s++) {
+        const ir_block_data* succ = &fn->blocks.items[succs[s]];
+        const uint64_t* live_in = bits(self, self->out->live_in, succs[s]);
+
+        for (size_t w = 0; w < words; w++) {
+            live_out[w] |= live_in[w];
+        }
+
+        for (size_t i = 0; i < succ->preds.len; i++) {
+            if (succ->preds.items[i] != b) {
+                continue;
+            }
+
+            for (size_t p = 0; p < succ->phis.len; p++) {
+                const ir_instr* phi = &fn->values.items[succ->phis.items[p]];
+                set_bit(live_out, phi->args.items[i]);
+            }
+        }
+    }
+}
+
+static void find_liveness(allocation* self) {
+    regalloc_result* out = self->out;
+    size_t words = out->live_words;
+    uint64_t* live = ALLOC_ARRAY(self->allocator, uint64_t, words);
+
+    for (bool changed = true; changed;) {
+        changed = false;
+
+        for (size_t i = out->block_count; i-- > 0;) {
+            ir_block b = out->order[i];
+
+            join(self, b, bits(self, self->live_out, b));
+            transfer(self, b, live);
+
+            uint64_t* live_in = bits(self, out->live_in, b);
+
+            if (memcmp(live, live_in, words * 8) != 0) {
+                memcpy(live_in, live, words * 8);
+                changed = true;
+            }
+        }
+    }
+
+    FREE_ARRAY(self->allocator, live, uint64_t, words);
+}
+
+// Intervals
+
+static size_t max_size(size_t a, size_t b) {
+    return a > b ? a : b;
+}
+
+static size_t min_size(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+/* Fills `intervals` with those of the values that need a place, and
+ * returns how many there are */
+static size_t build_intervals(allocation* self, interval* intervals) {
+    const ir_function* fn = self->fn;
+    regalloc_result* out = self->out;
+    size_t value_count = fn->values.len;
+    size_t* starts = ALLOC_ARRAY(self->allocator, size_t, value_count);
+    size_t* ends = ALLOC_ARRAY(self->allocator, size_t, value_count);
+    bool* used = ALLOC_ARRAY(self->allocator, bool, value_count);
+
+    for (size_t v = 0; v < value_count; v++) {
+        starts[v] = out->positions[v];
+        ends[v] = out->positions[v];
+        used[v] = false;
+    }
+
+    for (size_t i = 0; i < out->block_count; i++) {
+        ir_block b = out->order[i];
+        const ir_block_data* block = &fn->blocks.items[b];
+        const uint64_t* live_in = bits(self, out->live_in, b);
+        const uint64_t* live_out = bits(self, self->live_out, b);
+
+        for (size_t v = 0; v < value_count; v++) {
+            if (has_bit(live_in, v)) {
+                starts[v] = min_size(starts[v], out->block_starts[b]);
+            }
+
+            if (has_bit(live_out, v)) {
+                ends[v] = max_size(ends[v], self->block_ends[b]);
+                used[v] = true;
+            }
+        }
+
+        for (size_t k = 0; k < block->instrs.len; k++) {
+            ir_value value = block->instrs.items[k];
+            const ir_instr* instr = &fn->values.items[value];
+
+            for (size_t a = 0; a < instr->args.len; a++) {
+                ir_value arg = instr->args.items[a];
+
+                ends[arg] = max_size(ends[arg], out->positions[value]);
+                used[arg] = true;
+            }
+        }
+    }
+
+    size_t count = 0;
+
+    for (size_t i = 0; i < out->block_count; i++) {
+        const ir_block_data* block = &fn->blocks.items[out->order[i]];
+        const vec_ir_value* lists[] = {&block->phis, &block->instrs};
+
+        for (size_t l = 0; l < 2; l++) {
+            for (size_t k = 0; k < lists[l]->len; k++) {
+                ir_value v = lists[l]->items[k];
+
+                if (used[v] && !is_rematerialized(&fn->values.items[v])) {
+                    intervals[count++] = (interval){
+                        .value = v,
+                        .start = starts[v],
+                        .end = ends[v],
+                    };
+                }
+            }
+        }
+    }
+
+    FREE_ARRAY(self->allocator, used, bool, value_count);
+    FREE_ARRAY(self->allocator, ends, size_t, value_count);
+    FREE_ARRAY(self->allocator, starts, size_t, value_count);
+
+    return count;
+}
+
+static int compare_starts(const void* a, const void* b) {
+    const interval* x = a;
+    const interval* y = b;
+
+    if (x->start != y->start) {
+        return x->start < y->start ? -1 : 1;
+    }
+
+    return x->value < y->value ? -1 : x->value > y->value;
+}
+
+// Scan
+
+static bool crosses_call(allocation* self, const interval* i) {
+    size_t low = 0;
+    size_t high = self->call_count;
+
+    /* First call after the start */
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+
+        if (self->calls[mid] <= i->start) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low < self->call_count && self->calls[low] < i->end;
+}
+
+static bool is_callee_saved(x86_reg reg) {
+    for (size_t i = 0; i < COUNT(CALLEE_SAVED); i++) {
+        if (CALLEE_SAVED[i] == reg) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void give_slot(allocation* self, ir_value value) {
+    regalloc_location* location = &self->out->values[value];
+
+    location->has_slot = true;
+    location->slot = self->out->slot_count++;
+}
+
+static void give_reg(allocation* self, ir_value value, x86_reg reg) {
+    regalloc_result* out = self->out;
+
+    out->values[value].has_reg = true;
+    out->values[value].reg = reg;
+
+    if (!is_callee_saved(reg)) {
+        return;
+    }
+
+    for (size_t i = 0; i < out->saved_count; i++) {
+        if (out->saved[i] == reg) {
+            return;
+        }
+    }
+
+    out->saved[out->saved_count++] = reg;
+}
+
+/* Register `current` had best get, to save a move: the one its parameter
+ * comes in, or that of the operand it is computed over if it ends there.
+ * Returns false for none. */
+static bool hint(allocation* self, const interval* current, x86_reg* out) {
+    const ir_instr* instr = &self->fn->values.items[current->value];
+
+    if (instr->op == IR_PARAM) {
+        if ((size_t)instr->imm >= COUNT(PARAM_REGS)) {
+            return false;
+        }
+
+        *out = PARAM_REGS[instr->imm];
+        return true;
+    }
+
+    bool computed_over_first = instr->op == IR_ADD || instr->op == IR_SUB ||
+                               instr->op == IR_MUL || instr->op == IR_AND ||
+                               instr->op == IR_OR || instr->op == IR_XOR ||
+                               instr->op == IR_NEG || instr->op == IR_NOT;
+
+    if (!computed_over_first) {
+        return false;
+    }
+
+    const regalloc_location* first = &self->out->values[instr->args.items[0]];
+
+    if (!first->has_reg || first->split != REGALLOC_NEVER) {
+        return false;
+    }
+
+    *out = first->reg;
+    return true;
+}
+
+static void scan(allocation* self, interval* intervals, size_t count) {
+    regalloc_result* out = self->out;
+    bool taken[16] = {false};
+    interval* active[COUNT(CALLER_SAVED) + COUNT(CALLEE_SAVED)];
+    size_t active_count = 0;
+
+    for (size_t n = 0; n < count; n++) {
+        interval* current = &intervals[n];
+
+        /* Intervals that ended give their registers back */
+        for (size_t a = 0; a < active_count;) {
+            if (active[a]->end <= current->start) {
+                taken[out->values[active[a]->value].reg] = false;
+                active[a] = active[--active_count];
+            } else {
+                a++;
+            }
+        }
+
+        /* Caller-saved registers first, they cost nothing to use, unless
+         * a call would clobber them */
+        bool crosses = crosses_call(self, current);
+        x86_reg candidates[COUNT(CALLER_SAVED) + COUNT(CALLEE_SAVED)];
+        size_t candidate_count = 0;
+
+        if (!crosses) {
+            for (size_t i = 0; i < COUNT(CALLER_SAVED); i++) {
+                candidates[candidate_count++] = CALLER_SAVED[i];
+            }
+        }
+
+        for (size_t i = 0; i < COUNT(CALLEE_SAVED); i++) {
+            candidates[candidate_count++] = CALLEE_SAVED[i];
+        }
+
+        x86_reg preferred;
+
+        if (hint(self, current, &preferred) && !taken[preferred]) {
+            for (size_t i = 0; i < candidate_count; i++) {
+                if (candidates[i] == preferred) {
+                    candidates[i] = candidates[0];
+                    candidates[0] = preferred;
+                }
+            }
+        }
+
+        bool found = false;
+
+        for (size_t i = 0; i < candidate_count && !found; i++) {
+            if (!taken[candidates[i]]) {
+                give_reg(self, current->value, candidates[i]);
+                taken[candidates[i]] = true;
+                active[active_count++] = current;
+                found = true;
+            }
+        }
+
+        if (found) {
+            continue;
+        }
+
+        /* The interval ending last keeps its register the longest, it is
+         * the one to give it up */
+        size_t victim = active_count;
+
+        for (size_t a = 0; a < active_count; a++) {
+            x86_reg reg = out->values[active[a]->value].reg;
+
+            if ((!crosses || is_callee_saved(reg)) &&
+                (victim == active_count || active[a]->end > active[victim]->end
+                )) {
+                victim = a;
+            }
+        }
+
+        if (victim == active_count || active[victim]->end <= current->end) {
+            give_slot(self, current->value);
+            continue;
+        }
+
+        regalloc_location* split = &out->values[active[victim]->value];
+
+        split->split = current->start;
+        split->has_reg = current->start > active[victim]->start;
+        give_slot(self, active[victim]->value);
+        give_reg(self, current->value, split->reg);
+        active[victim] = current;
+    }
+}
+
+void regalloc_function(
+    allocator_t* allocator,
+    const ir_function* fn,
+    bool allocate,
+    regalloc_result* out
+) {
+    size_t block_count = fn->blocks.len;
+    size_t value_count = fn->values.len;
+    size_t words = (value_count + 63) / 64;
+
+    *out = (regalloc_result){
+        .order = ALLOC_ARRAY(allocator, ir_block, block_count),
+        .positions = ALLOC_ARRAY(allocator, size_t, value_count),
+        .block_starts = ALLOC_ARRAY(allocator, size_t, block_count),
+        .values = ALLOC_ARRAY(allocator, regalloc_location, value_count),
+        .slot_count = 0,
+        .saved_count = 0,
+        .live_in = ALLOC_ARRAY(allocator, uint64_t, (block_count * words)),
+        .live_words = words,
+    };
+
+    allocation self = {
+        .allocator = allocator,
+        .fn = fn,
+        .out = out,
+        .block_ends = ALLOC_ARRAY(allocator, size_t, block_count),
+        .live_out = ALLOC_ARRAY(allocator, uint64_t, (block_count * words)),
+        .calls = ALLOC_ARRAY(allocator, size_t, value_count),
+        .call_count = 0,
+    };
+
+    memset(out->live_in, 0, block_count * words * 8);
+    memset(self.live_out, 0, block_count * words * 8);
+
+    for (size_t v = 0; v < value_count; v++) {
+        out->positions[v] = 0;
+        out->values[v] = (regalloc_location){
+            .has_reg = false,
+            .split = REGALLOC_NEVER,
+            .has_slot = false,
+        };
+    }
+
+    out->block_count = ir_reverse_postorder(allocator, fn, out->order);
+
+    number(&self);
+    find_liveness(&self);
+
+    interval* intervals = ALLOC_ARRAY(allocator, interval, value_count);
+    size_t count = build_intervals(&self, intervals);
+
+    if (allocate) {
+        qsort(intervals, count, sizeof(interval), compare_starts);
+        scan(&self, intervals, count);
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            give_slot(&self, intervals[i].value);
+        }
+    }
+
+    FREE_ARRAY(allocator, intervals, interval, value_count);
+    FREE_ARRAY(allocator, self.calls, size_t, value_count);
+    FREE_ARRAY(allocator, self.live_out, uint64_t, (block_count * words));
+    FREE_ARRAY(allocator, self.block_ends, size_t, block_count);
+}
+
+void regalloc_free(
+    allocator_t* allocator, const ir_function* fn, regalloc_result* result
+) {
+    size_t block_count = fn->blocks.len;
+    size_t value_count = fn->values.len;
+
+    FREE_ARRAY(
+        allocator, result->live_in, uint64_t, (block_count * result->live_words)
+    );
+    FREE_ARRAY(allocator, result->values, regalloc_location, value_count);
+    FREE_ARRAY(allocator, result->block_starts, size_t, block_count);
+    FREE_ARRAY(allocator, result->positions, size_t, value_count);
+    FREE_ARRAY(allocator, result->order, ir_block, block_count);
+}
+
+bool regalloc_is_live_in(
+    const regalloc_result* result, ir_block block, ir_value value
+) {
+    return has_bit(result->live_in + block * result->live_words, value);
+}
+
+bool regalloc_in_reg(
+    const regalloc_result* result, ir_value value, size_t position
+) {
+    const regalloc_location* location = &result->values[value];
+    return location->has_reg && position < location->split;
+}
@@ -0,0 +1,105 @@
+/**
+ * Register allocation for the native backend
+ *
+ * Decides where every value of an IR function (see ir.h) lives, with the
+ * linear scan of Poletto and Sarkar: the blocks are laid out in reverse
+ * postorder and their instructions numbered, every value gets a live
+ * interval from its definition to its last use, and the intervals are
+ * handed registers in the order they start, each one freeing its register
+ * where it ends. Intervals are whole ranges, without the holes where a
+ * value is not live, which keeps the scan simple at the cost of registers
+ * held across blocks that do not need them.
+ *
+ * Values live across a call only get callee-saved registers, so the calls
+ * never have to save any. When no register is left, the interval that ends
+ * last gives its register up: it is split where the new one starts, and
+ * lives in a stack slot from there on. A value with a slot is stored to it
+ * as soon as it is defined, so the slot is valid anywhere the value is
+ * live, and the register can be reloaded from it on the edges that enter
+ * the part of the function where the value is in its register again.
+ *
+ * Constants, functions and strings do not take a register: they are put
+ * back wherever they are used.
+ */
+
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "alloc.h"
+#include "ir.h"
+#include "x86.h"
+
+/* Most callee-saved registers a function can use */
+#define REGALLOC_MAX_SAVED 5
+
+#define REGALLOC_NEVER SIZE_MAX
+
+typedef struct {
+    /* In `reg` from the definition until position `split`, REGALLOC_NEVER
+     * if for good */
+    bool has_reg;
+    x86_reg reg;
+    size_t split;
+
+    /* In stack slot `slot` from the definition on */
+    bool has_slot;
+    size_t slot;
+} regalloc_location;
+
+typedef struct {
+    /* The live blocks, in the order they are laid out */
+    ir_block* order;
+    size_t block_count;
+
+    /* Position of every instruction, indexed by ir_value, and of the start
+     * of every block, where its phi nodes are defined, indexed by
+     * ir_block */
+    size_t* positions;
+    size_t* block_starts;
+
+    /* Indexed by ir_value. Values that are never used, and constants,
+     * functions and strings have neither a register nor a slot. */
+    regalloc_location* values;
+    size_t slot_count;
+
+    /* The callee-saved registers the function uses */
+    x86_reg saved[REGALLOC_MAX_SAVED];
+    size_t saved_count;
+
+    /* Values live at the start of every block, a bit per value */
+    uint64_t* live_in;
+    size_t live_words;
+} regalloc_result;
+
+/**
+ * Lays out and allocates `fn`. Without `allocate` every value that needs
+ * a place gets a slot and none a register.
+ */
+void regalloc_function(
+    allocator_t* allocator,
+    const ir_function* fn,
+    bool allocate,
+    regalloc_result* out
+);
+
+void regalloc_free(
+    allocator_t* allocator, const ir_function* fn, regalloc_result* result
+);
+
+bool regalloc_is_live_in(
+    const regalloc_result* result, ir_block block, ir_value value
+);
+
+/**
+ * Whether `value` is in its register at `position`, rather than only in its
+ * slot or nowhere.
+ */
+bool regalloc_in_reg(
+    const regalloc_result* result, ir_value value, size_t position
+);
+
+#endif  // REGALLOC_H
@@ -0,0 +1,681 @@
+#include "resolve.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "closure.h"
+#include "diag.h"
+#include "tailcall.h"
+
+typedef struct {
+    const char* name;
+    size_t name_len;
+
+    size_t slot;
+    ast_typename* type;
+} scope_entry;
+
+typedef VEC(scope_entry) vec_scope_entry;
+
+typedef struct _function_scope {
+    struct _function_scope* parent;
+
+    /* Index in the function table */
+    size_t index;
+
+    /* Innermost last */
+    vec_scope_entry locals;
+
+    size_t next_slot;
+    size_t frame_size;
+
+    /* Last statement, if its value is returned */
+    ast_stmt_node* result;
+    ast_typename* return_type;
+} function_scope;
+
+typedef struct {
+    allocator_t* allocator;
+    resolved_program* program;
+
+    function_scope* fn;
+    bool ok;
+
+    /* Type of integer literals until they are used as something */
+    ast_typename literal;
+
+    ast_typename* i32;
+    ast_typename* boolean;
+    ast_typename* string;
+    ast_typename* unit;
+} resolver;
+
+AST_EXPR_WALKER(resolve_expr_walker, ast_typename*, resolver*)
+AST_STMT_WALKER(resolve_stmt_walker, int, resolver*)
+
+static resolve_expr_walker make_expr_walker(resolver* ctx);
+static resolve_stmt_walker make_stmt_walker(resolver* ctx);
+
+static void resolve_error(resolver* self, const char* fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    diag_vprintf(fmt, args);
+    va_end(args);
+
+    self->ok = false;
+}
+
+static bool is_unit(ast_typename* type) {
+    return type == NULL ||
+           (type->type == TYPE_NAME_TUPLE && type->as.tuple.items.len == 0);
+}
+
+static ast_typename* function_typename(
+    resolver* self, ast_param* params, ast_typename* return_type
+) {
+    size_t count = 0;
+    for (ast_param* param = params; param != NULL; param = param->next) {
+        count++;
+    }
+
+    slice_typename types = slice_empty();
+
+    if (count != 0) {
+        types.items = ALLOC_ARRAY(self->allocator, ast_typename*, count);
+        types.len = count;
+
+        size_t i = 0;
+        for (ast_param* param = params; param != NULL; param = param->next) {
+            types.items[i++] = param->type;
+        }
+    }
+
+    return make_ast_typename_function(self->allocator, types, return_type);
+}
+
+static size_t add_function(
+    resolver* self,
+    const char* name,
+    size_t name_len,
+    ast_param* params,
+    ast_stmt_node* body,
+    ast_typename* return_type,
+    ast_node_lambda* lambda
+) {
+    size_t param_count = 0;
+    for (ast_param* param = params; param != NULL; param = param->next) {
+        param_count++;
+    }
+
+    resolved_function fn = (resolved_function){
+        .name = name,
+        .name_len = name_len,
+        .params = params,
+        .param_count = param_count,
+        .body = body,
+        .type = function_typename(self, params, return_type),
+        .returns_value = !is_unit(return_type),
+        .frame_size = 0,
+        .parent = self->fn != NULL ? self->fn->index : RESOLVED_NO_FUNCTION,
+        .lambda = lambda,
+        .captures = NULL,
+        .capture_count = 0,
+    };
+
+    vec_push(&self->program->functions, &fn);
+    return self->program->functions.len - 1;
+}
+
+// Literals
+
+/* Wraps a literal to the range of `type`, the same way arithmetic on it
+ * wraps */
+static long double wrap_literal(ast_typename_integer* type, long double value) {
+    /* Literals are never negative, anything past 64 bits is out of the
+     * range of every type anyway */
+    uint64_t bits = value < 0x1p64L ? (uint64_t)value : UINT64_MAX;
+
+    switch (type->size) {
+        case INTEGER_SIZE_8:
+            return type->is_signed ? (int8_t)bits : (uint8_t)bits;
+        case INTEGER_SIZE_16:
+            return type->is_signed ? (int16_t)bits : (uint16_t)bits;
+        case INTEGER_SIZE_32:
+            break;
+    }
+
+    if (type->is_signed) {
+        return (int32_t)bits;
+    }
+
+    return (uint32_t)bits;
+}
+
+/* Gives the literals in `expr` the type they are used as */
+static void settle_literals(
+    resolver* self, ast_expr_node* expr, ast_typename* type
+) {
+    if (expr->value_type != &self->literal) {
+        return;
+    }
+
+    if (type == NULL || type->type != TYPE_NAME_INTEGER) {
+        type = self->i32;
+    }
+
+    expr->value_type = type;
+
+    switch (expr->type) {
+        case AST_NUM:
+            expr->num.value = wrap_literal(&type->as.integer, expr->num.value);
+            break;
+
+        case AST_UNARY:
+            settle_literals(self, expr->unary.expr, type);
+            break;
+
+        case AST_BINARY:
+            settle_literals(self, expr->binary.left, type);
+            settle_literals(self, expr->binary.right, type);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Names
+
+static scope_entry* lookup_local(
+    function_scope* fn, const char* name, size_t len
+) {
+    for (size_t i = fn->locals.len; i > 0; i--) {
+        scope_entry* entry = &fn->locals.items[i - 1];
+
+        if (entry->name_len == len && memcmp(entry->name, name, len) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/* Named functions are looked up among the first entries of the table, the
+ * last one declared wins */
+static size_t lookup_function(resolver* self, const char* name, size_t len) {
+    vec_resolved_function* functions = &self->program->functions;
+
+    for (size_t i = functions->len; i > 0; i--) {
+        resolved_function* fn = &functions->items[i - 1];
+
+        if (fn->parent == RESOLVED_NO_FUNCTION && fn->name_len == len &&
+            memcmp(fn->name, name, len) == 0) {
+            return i - 1;
+        }
+    }
+
+    return RESOLVED_NO_FUNCTION;
+}
+
+/* Takes the next `count` slots of the function */
+static size_t reserve_slots(resolver* self, size_t count) {
+    function_scope* fn = self->fn;
+    size_t slot = fn->next_slot;
+
+    fn->next_slot += count;
+
+    if (fn->next_slot > fn->frame_size) {
+        fn->frame_size = fn->next_slot;
+    }
+
+    return slot;
+}
+
+static size_t declare_local(
+    resolver* self, const char* name, size_t len, ast_typename* type
+) {
+    scope_entry entry = (scope_entry){
+        .name = name,
+        .name_len = len,
+        .slot = reserve_slots(self, 1),
+        .type = type,
+    };
+
+    vec_push(&self->fn->locals, &entry);
+    return entry.slot;
+}
+
+// Expression walker
+
+static ast_typename* resolve_expr(resolver* self, ast_expr_node* expr) {
+    resolve_expr_walker walker = make_expr_walker(self);
+
+    expr->value_type = resolve_expr_walker_walk(&walker, expr);
+    return expr->value_type;
+}
+
+static ast_typename* walk_iden(
+    resolve_expr_walker* self, ast_node_identifier* expr
+) {
+    resolver* ctx = self->ctx;
+
+    /* Variables of enclosing functions are declared again in lambdas that
+     * capture them */
+    scope_entry* entry = lookup_local(ctx->fn, expr->start, expr->len);
+
+    if (entry != NULL) {
+        expr->binding = (ast_binding){
+            .kind = AST_BINDING_LOCAL,
+            .index = entry->slot,
+        };
+
+        return entry->type;
+    }
+
+    size_t index = lookup_function(ctx, expr->start, expr->len);
+
+    if (index == RESOLVED_NO_FUNCTION) {
+        resolve_error(
+            ctx, "undeclared variable '%.*s'", (int)expr->len, expr->start
+        );
+
+        return ctx->unit;
+    }
+
+    expr->binding = (ast_binding){
+        .kind = AST_BINDING_FUNCTION,
+        .index = index,
+    };
+
+    return ctx->program->functions.items[index].type;
+}
+
+static bool is_comparison(token_type op) {
+    return op == TOK_EQ || op == TOK_NEQ || op == TOK_LT || op == TOK_GT ||
+           op == TOK_LTEQ || op == TOK_GTEQ;
+}
+
+static ast_typename* walk_binary(
+    resolve_expr_walker* self, ast_node_binary* expr
+) {
+    resolver* ctx = self->ctx;
+
+    ast_typename* left = resolve_expr(ctx, expr->left);
+    ast_typename* right = resolve_expr(ctx, expr->right);
+
+    if (expr->op == TOK_ASSIGN) {
+        settle_literals(ctx, expr->right, left);
+        return left;
+    }
+
+    if (expr->op == TOK_AND || expr->op == TOK_OR) {
+        return ctx->boolean;
+    }
+
+    /* The operands have the same type, unless one is a literal */
+    ast_typename* type = left == &ctx->literal ? right : left;
+
+    if (is_comparison(expr->op)) {
+        if (type == &ctx->literal) {
+            type = ctx->i32;
+        }
+
+        settle_literals(ctx, expr->left, type);
+        settle_literals(ctx, expr->right, type);
+
+        return ctx->boolean;
+    }
+
+    settle_literals(ctx, expr->left, type);
+    settle_literals(ctx, expr->right, type);
+
+    return type;
+}
+
+static ast_typename* walk_unary(
+    resolve_expr_walker* self, ast_node_unary* expr
+) {
+    ast_typename* type = resolve_expr(self->ctx, expr->expr);
+
+    if (expr->op == TOK_BANG) {
+        return self->ctx->boolean;
+    }
+
+    return type;
+}
+
+static ast_typename* walk_call(resolve_expr_walker* self, ast_node_call* expr) {
+    resolver* ctx = self->ctx;
+    ast_typename* fn = resolve_expr(ctx, expr->function);
+
+    if (fn->type != TYPE_NAME_FUNCTION) {
+        resolve_error(ctx, "can only call function types");
+        return ctx->unit;
+    }
+
+    slice_typename* params = &fn->as.function.params;
+
+    for (size_t i = 0; i < expr->args.len; i++) {
+        ast_expr_node* arg = expr->args.items[i];
+
+        resolve_expr(ctx, arg);
+        settle_literals(ctx, arg, i < params->len ? params->items[i] : NULL);
+    }
+
+    ast_typename* return_type = fn->as.function.return_type;
+    return return_type != NULL ? return_type : ctx->unit;
+}
+
+static ast_typename* walk_num(resolve_expr_walker* self, ast_node_num* expr) {
+    return &self->ctx->literal;
+}
+
+static ast_typename* walk_bool(resolve_expr_walker* self, ast_node_bool* expr) {
+    return self->ctx->boolean;
+}
+
+static ast_typename* walk_str(resolve_expr_walker* self, ast_node_str* expr) {
+    return self->ctx->string;
+}
+
+static void resolve_function(
+    resolver* self,
+    size_t index,
+    ast_param* params,
+    ast_stmt_node* body,
+    ast_typename* return_type
+);
+
+/* Where the variables `lambda` captures are in the current function */
+static resolved_capture* resolve_captures(
+    resolver* self, ast_node_lambda* lambda
+) {
+    size_t count = lambda->captures.len;
+
+    if (count == 0) {
+        return NULL;
+    }
+
+    resolved_capture* captures = ALLOC_ARRAY(
+        self->allocator, resolved_capture, count
+    );
+
+    for (size_t i = 0; i < count; i++) {
+        ast_capture* capture = &lambda->captures.items[i];
+        scope_entry* entry = lookup_local(
+            self->fn, capture->name, capture->len
+        );
+
+        if (entry == NULL) {
+            resolve_error(
+                self,
+                "BUG: captured variable '%.*s' is not in scope",
+                (int)capture->len,
+                capture->name
+            );
+
+            captures[i] = (resolved_capture){.slot = 0, .type = self->unit};
+            continue;
+        }
+
+        captures[i] = (resolved_capture){
+            .slot = entry->slot,
+            .type = entry->type,
+        };
+    }
+
+    return captures;
+}
+
+static ast_typename* walk_lambda(
+    resolve_expr_walker* self, ast_node_lambda* expr
+) {
+    resolver* ctx = self->ctx;
+    resolved_capture* captures = resolve_captures(ctx, expr);
+
+    /* The function, then the captured values */
+    if (expr->closure == AST_CLOSURE_STACK) {
+        expr->env_slot = reserve_slots(ctx, expr->captures.len + 1);
+    }
+
+    expr->index = add_function(
+        ctx,
+        "<lambda>",
+        sizeof("<lambda>") - 1,
+        expr->params,
+        expr->body,
+        expr->return_type,
+        expr
+    );
+
+    resolved_function* fn = &ctx->program->functions.items[expr->index];
+    fn->captures = captures;
+    fn->capture_count = expr->captures.len;
+
+    resolve_function(
+        ctx, expr->index, expr->params, expr->body, expr->return_type
+    );
+
+    return ctx->program->functions.items[expr->index].type;
+}
+
+static resolve_expr_walker make_expr_walker(resolver* ctx) {
+    return (resolve_expr_walker){
+        .walk_binary = walk_binary,
+        .walk_unary = walk_unary,
+        .walk_call = walk_call,
+        .walk_num = walk_num,
+        .walk_iden = walk_iden,
+        .walk_str = walk_str,
+        .walk_bool = walk_bool,
+        .walk_lambda = walk_lambda,
+        .ctx = ctx,
+    };
+}
+
+// Statement walker
+
+static void resolve_stmt_list(resolver* self, ast_stmt_node* stmts) {
+    resolve_stmt_walker walker = make_stmt_walker(self);
+
+    for (ast_stmt_node* curr = stmts; curr != NULL; curr = curr->next) {
+        resolve_stmt_walker_walk(&walker, curr);
+    }
+}
+
+static int walk_expr_stmt(resolve_stmt_walker* self, ast_node_expr_stmt* stmt) {
+    resolver* ctx = self->ctx;
+    function_scope* fn = ctx->fn;
+
+    resolve_expr(ctx, stmt->expr);
+
+    bool is_result = fn->result != NULL && &fn->result->expr_stmt == stmt;
+    settle_literals(ctx, stmt->expr, is_result ? fn->return_type : NULL);
+
+    return 0;
+}
+
+static int walk_var_decl(resolve_stmt_walker* self, ast_node_var_decl* stmt) {
+    resolver* ctx = self->ctx;
+    ast_typename* type = stmt->typename;
+
+    if (stmt->value != NULL) {
+        ast_typename* value_type = resolve_expr(ctx, stmt->value);
+
+        if (type == NULL) {
+            type = value_type != &ctx->literal ? value_type : ctx->i32;
+        }
+
+        settle_literals(ctx, stmt->value, type);
+    }
+
+    /* Declared after its value, which may refer to a shadowed variable */
+    stmt->slot = declare_local(
+        ctx, stmt->name.span, stmt->name.span_size, type
+    );
+
+    return 0;
+}
+
+static int walk_block(resolve_stmt_walker* self, ast_node_block* stmt) {
+    function_scope* fn = self->ctx->fn;
+
+    size_t saved_locals = fn->locals.len;
+    size_t saved_slot = fn->next_slot;
+
+    resolve_stmt_list(self->ctx, stmt->body);
+
+    fn->locals.len = saved_locals;
+    fn->next_slot = saved_slot;
+
+    return 0;
+}
+
+static int walk_if_else(resolve_stmt_walker* self, ast_node_if_else* stmt) {
+    resolve_expr(self->ctx, stmt->condition);
+    resolve_stmt_walker_walk(self, stmt->body);
+
+    if (stmt->else_body != NULL) {
+        resolve_stmt_walker_walk(self, stmt->else_body);
+    }
+
+    return 0;
+}
+
+static int walk_while(resolve_stmt_walker* self, ast_node_while* stmt) {
+    resolve_expr(self->ctx, stmt->condition);
+    resolve_stmt_walker_walk(self, stmt->body);
+
+    return 0;
+}
+
+static resolve_stmt_walker make_stmt_walker(resolver* ctx) {
+    return (resolve_stmt_walker){
+        .walk_expr_stmt = walk_expr_stmt,
+        .walk_var_decl = walk_var_decl,
+        .walk_block = walk_block,
+        .walk_if_else = walk_if_else,
+        .walk_while = walk_while,
+        .ctx = ctx,
+    };
+}
+
+// Functions
+
+static void resolve_function(
+    resolver* self,
+    size_t index,
+    ast_param* params,
+    ast_stmt_node* body,
+    ast_typename* return_type
+) {
+    function_scope scope = (function_scope){
+        .parent = self->fn,
+        .index = index,
+        .locals = vec_make(self->allocator),
+        .next_slot = 0,
+        .frame_size = 0,
+        .result = NULL,
+        .return_type = return_type,
+    };
+
+    self->fn = &scope;
+
+    for (ast_param* param = params; param != NULL; param = param->next) {
+        declare_local(
+            self, param->name.span, param->name.span_size, param->type
+        );
+    }
+
+    resolved_function* fn = &self->program->functions.items[index];
+
+    for (size_t i = 0; i < fn->capture_count; i++) {
+        ast_capture* capture = &fn->lambda->captures.items[i];
+        declare_local(
+            self, capture->name, capture->len, fn->captures[i].type
+        );
+    }
+
+    if (self->program->functions.items[index].returns_value) {
+        for (ast_stmt_node* curr = body; curr != NULL; curr = curr->next) {
+            scope.result = curr->type == AST_EXPR_STMT ? curr : NULL;
+        }
+    }
+
+    resolve_stmt_list(self, body);
+
+    self->program->functions.items[index].frame_size = scope.frame_size;
+    self->fn = scope.parent;
+
+    vec_free(&scope.locals);
+}
+
+bool resolve(
+    allocator_t* allocator,
+    ast_item_node* ast,
+    FILE* tail_report,
+    resolved_program* out
+) {
+    *out = (resolved_program){
+        .functions = vec_make(allocator),
+        .main = RESOLVED_NO_FUNCTION,
+    };
+
+    if (!closure_convert(allocator, ast)) {
+        return false;
+    }
+
+    tailcall_mark(allocator, ast, tail_report);
+
+    resolver self = (resolver){
+        .allocator = allocator,
+        .program = out,
+        .fn = NULL,
+        .ok = true,
+        .literal = {.type = TYPE_NAME_INTEGER},
+        .i32 = make_ast_typename_integer(allocator, true, INTEGER_SIZE_32),
+        .boolean = make_ast_typename(allocator, TYPE_NAME_BOOLEAN),
+        .string = make_ast_typename(allocator, TYPE_NAME_STRING),
+        .unit = make_ast_typename_unit(allocator),
+    };
+
+    /* Named functions get the first indices, so that they can be called
+     * before they are resolved */
+    for (ast_item_node* item = ast; item != NULL; item = item->next) {
+        if (item->type != AST_FN) {
+            continue;
+        }
+
+        ast_node_function* fn = &item->function;
+        size_t index = add_function(
+            &self,
+            fn->name.span,
+            fn->name.span_size,
+            fn->params,
+            fn->body,
+            fn->return_type,
+            NULL
+        );
+
+        if (fn->name.span_size == 4 && memcmp(fn->name.span, "main", 4) == 0) {
+            out->main = index;
+        }
+    }
+
+    size_t index = 0;
+    for (ast_item_node* item = ast; item != NULL; item = item->next) {
+        if (item->type != AST_FN) {
+            continue;
+        }
+
+        ast_node_function* fn = &item->function;
+        resolve_function(
+            &self, index++, fn->params, fn->body, fn->return_type
+        );
+    }
+
+    return self.ok;
+}
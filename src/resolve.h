@@ -0,0 +1,97 @@
+/**
+ * Name and type resolution
+ *
+ * Annotates a typechecked AST for the backends that walk it:
+ *
+ * - every identifier gets the binding it refers to, a slot in the frame of
+ *   its function or a function index,
+ * - every variable gets its slot, parameters take the first ones in order,
+ * - every expression gets its type, integer literals take the type of
+ *   what they are used as (i32 if nothing) and their values are wrapped to
+ *   it,
+ * - every function, named or lambda, gets an entry in the function table,
+ *   named functions first in the order they are declared,
+ * - every lambda gets what it captures (see closure.h): the variables are
+ *   declared again in the lambda, in the slots after its parameters,
+ * - every call is marked as a tail call or not (see tailcall.h).
+ *
+ * Slots are reused once the block that declared them ends, so a function's
+ * frame is only as large as the most variables alive at once.
+ */
+
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "alloc.h"
+#include "ast.h"
+#include "vec.h"
+
+/* Value of resolved_program.main and resolved_function.parent */
+#define RESOLVED_NO_FUNCTION ((size_t) -1)
+
+/* A variable a lambda captures */
+typedef struct {
+    /* Slot of the variable in the frame of the function that makes the
+     * lambda */
+    size_t slot;
+    ast_typename* type;
+} resolved_capture;
+
+typedef struct {
+    /* Not zero terminated, "<lambda>" for lambdas */
+    const char* name;
+    size_t name_len;
+
+    ast_param* params;
+    size_t param_count;
+    ast_stmt_node* body;
+
+    /* TYPE_NAME_FUNCTION */
+    ast_typename* type;
+
+    /* The function has a return type, and returns the value of its last
+     * statement if that is an expression */
+    bool returns_value;
+
+    /* Slots its parameters and variables need */
+    size_t frame_size;
+
+    /* Function a lambda is declared in, RESOLVED_NO_FUNCTION for named
+     * functions */
+    size_t parent;
+
+    /* NULL for named functions */
+    ast_node_lambda* lambda;
+
+    /* In the slots right after the parameters */
+    resolved_capture* captures;
+    size_t capture_count;
+} resolved_function;
+
+typedef VEC(resolved_function) vec_resolved_function;
+
+typedef struct {
+    vec_resolved_function functions;
+    size_t main;
+} resolved_program;
+
+/**
+ * Resolves `ast` in place and fills the function table at `out`. Type names
+ * made along the way come from `allocator`. The calls that are not tail
+ * calls are reported to `tail_report`, unless it is NULL (see tailcall.h).
+ *
+ * Returns false after printing to diag_stream() if a name cannot be
+ * resolved, or closure_convert() fails.
+ */
+bool resolve(
+    allocator_t* allocator,
+    ast_item_node* ast,
+    FILE* tail_report,
+    resolved_program* out
+);
+
+#endif  // RESOLVE_H
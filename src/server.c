@@ -0,0 +1,411 @@
+#include "server.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "diag.h"
+#include "mmio_alloc.h"
+#include "thread_alloc.h"
+
+#ifdef _WIN32
+
+int server_run(char* socket_path, const server_options* options) {
+    (void) socket_path;
+    (void) options;
+
+    fprintf(stderr, "The compile server is not supported on Windows\n");
+    return 1;
+}
+
+int server_connect(char* socket_path) {
+    (void) socket_path;
+    return -1;
+}
+
+bool server_request(
+    int connection,
+    server_request_kind kind,
+    const char* payload,
+    size_t length,
+    FILE* diagnostics,
+    int* status
+) {
+    (void) connection;
+    (void) kind;
+    (void) payload;
+    (void) length;
+    (void) diagnostics;
+    (void) status;
+    return false;
+}
+
+void server_disconnect(int connection) {
+    (void) connection;
+}
+
+#else
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Every worker keeps an arena of these blocks for as long as the server
+ * runs, blocks it no longer needs go back to a shared pool */
+#define SERVER_ARENA_BLOCK_SIZE ((size_t) 256 * 1024)
+
+/* Requests with a larger payload are refused */
+#define SERVER_MAX_PAYLOAD ((uint64_t) 1024 * 1024 * 1024)
+
+typedef struct {
+    int listener;
+    const server_options* options;
+    block_pool* pool;
+} server;
+
+static bool read_all(int fd, void* buffer, size_t size) {
+    char* ptr = buffer;
+
+    while (size > 0) {
+        ssize_t n = recv(fd, ptr, size, 0);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return false;
+        }
+
+        ptr += n;
+        size -= (size_t) n;
+    }
+
+    return true;
+}
+
+static bool write_all(int fd, const void* buffer, size_t size) {
+    const char* ptr = buffer;
+
+    while (size > 0) {
+        /* A peer that went away must not kill us with SIGPIPE */
+        ssize_t n = send(fd, ptr, size, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0) {
+            return false;
+        }
+
+        ptr += n;
+        size -= (size_t) n;
+    }
+
+    return true;
+}
+
+static int compile_payload(
+    server* self, allocator_t* allocator, uint32_t kind, char* payload,
+    size_t length
+) {
+    if (kind == SERVER_REQUEST_SOURCE) {
+        return self->options->compile(payload, length, allocator);
+    }
+
+    mmio_mapping mapping;
+
+    if (!mmio_open_path(payload, &self->options->input, &mapping)) {
+        fprintf(diag_stream(), "Unable to open file '%s'\n", payload);
+        return 1;
+    }
+
+    int status = self->options->compile(
+        (char*) mapping.ptr, mapping.length, allocator
+    );
+
+    mmio_unmap(&mapping);
+
+    return status;
+}
+
+/* Returns false if the connection should be closed */
+static bool serve_request(
+    server* self,
+    allocator_t* allocator,
+    int connection,
+    server_request_header* header
+) {
+    if (header->kind != SERVER_REQUEST_PATH &&
+        header->kind != SERVER_REQUEST_SOURCE) {
+        return false;
+    }
+
+    if (header->length > SERVER_MAX_PAYLOAD) {
+        return false;
+    }
+
+    /* One more byte for the zero the lexer stops at */
+    char* payload = ALLOC_ARRAY(allocator, char, header->length + 1);
+    if (!read_all(connection, payload, header->length)) {
+        return false;
+    }
+
+    payload[header->length] = '\0';
+
+    char* diagnostics = NULL;
+    size_t diagnostics_length = 0;
+    FILE* stream = open_memstream(&diagnostics, &diagnostics_length);
+
+    if (stream == NULL) {
+        perror("open_memstream");
+        return false;
+    }
+
+    diag_redirect(stream);
+    int status = compile_payload(
+        self, allocator, header->kind, payload, header->length
+    );
+    diag_redirect(NULL);
+
+    fclose(stream);
+
+    server_response_header response = (server_response_header){
+        .status = status,
+        .reserved = 0,
+        .length = diagnostics_length,
+    };
+
+    bool ret = write_all(connection, &response, sizeof(response)) &&
+               write_all(connection, diagnostics, diagnostics_length);
+
+    free(diagnostics);
+
+    return ret;
+}
+
+static void serve_connection(server* self, arena* arena, int connection) {
+    allocator_t allocator = arena_get_alloc(arena);
+    server_request_header header;
+
+    while (read_all(connection, &header, sizeof(header))) {
+        /* Everything a request allocates is dropped in one go once it has
+         * been answered. The arena keeps a block, the pool the rest. */
+        arena_checkpoint mark = arena_mark(arena);
+        bool keep_open = serve_request(self, &allocator, connection, &header);
+        arena_reset(arena, mark);
+
+        if (!keep_open) {
+            break;
+        }
+    }
+}
+
+static void* serve(void* ctx) {
+    server* self = ctx;
+    arena* arena = thread_arena(self->pool);
+
+    for (;;) {
+        int connection = accept(self->listener, NULL, NULL);
+
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+
+            perror("accept");
+            break;
+        }
+
+        serve_connection(self, arena, connection);
+        close(connection);
+    }
+
+    thread_arena_release();
+
+    return NULL;
+}
+
+/* Removed by the signal handler */
+static char* listening_path = NULL;
+
+static void stop(int signal) {
+    (void) signal;
+
+    unlink(listening_path);
+    _exit(0);
+}
+
+static bool make_address(char* socket_path, struct sockaddr_un* out) {
+    memset(out, 0, sizeof(*out));
+    out->sun_family = AF_UNIX;
+
+    if (strlen(socket_path) >= sizeof(out->sun_path)) {
+        fprintf(stderr, "Socket path too long: '%s'\n", socket_path);
+        return false;
+    }
+
+    strcpy(out->sun_path, socket_path);
+    return true;
+}
+
+/* A socket nobody is listening on is left behind by a server that did not
+ * shut down cleanly */
+static bool remove_stale_socket(char* socket_path) {
+    struct stat st;
+
+    if (lstat(socket_path, &st) != 0 || !S_ISSOCK(st.st_mode)) {
+        return true;
+    }
+
+    int connection = server_connect(socket_path);
+    if (connection >= 0) {
+        server_disconnect(connection);
+        fprintf(stderr, "A server is already listening on '%s'\n", socket_path);
+        return false;
+    }
+
+    unlink(socket_path);
+    return true;
+}
+
+int server_run(char* socket_path, const server_options* options) {
+    struct sockaddr_un address;
+
+    if (!make_address(socket_path, &address) ||
+        !remove_stale_socket(socket_path)) {
+        return 1;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    if (bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0) {
+        perror("bind");
+        close(listener);
+        return 1;
+    }
+
+    listening_path = socket_path;
+
+    struct sigaction action = {0};
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    if (listen(listener, SOMAXCONN) != 0) {
+        perror("listen");
+        unlink(socket_path);
+        close(listener);
+        return 1;
+    }
+
+    fprintf(
+        stderr, "Listening on %s with %zu workers\n", socket_path, options->jobs
+    );
+
+    server self = (server){
+        .listener = listener,
+        .options = options,
+        .pool = block_pool_make(&mmio_alloc, SERVER_ARENA_BLOCK_SIZE),
+    };
+
+    /* The calling thread is one of the workers */
+    pthread_t* threads = ALLOC_ARRAY(gpa(), pthread_t, options->jobs);
+    size_t started = 0;
+
+    while (started + 1 < options->jobs &&
+           pthread_create(&threads[started], NULL, serve, &self) == 0) {
+        started++;
+    }
+
+    serve(&self);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    FREE_ARRAY(gpa(), threads, pthread_t, options->jobs);
+    block_pool_destroy(self.pool);
+
+    unlink(socket_path);
+    close(listener);
+
+    return 1;
+}
+
+int server_connect(char* socket_path) {
+    struct sockaddr_un address;
+
+    if (!make_address(socket_path, &address)) {
+        return -1;
+    }
+
+    int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection < 0) {
+        return -1;
+    }
+
+    if (connect(connection, (struct sockaddr*) &address, sizeof(address)) != 0) {
+        close(connection);
+        return -1;
+    }
+
+    return connection;
+}
+
+bool server_request(
+    int connection,
+    server_request_kind kind,
+    const char* payload,
+    size_t length,
+    FILE* diagnostics,
+    int* status
+) {
+    server_request_header request = (server_request_header){
+        .kind = kind,
+        .reserved = 0,
+        .length = length,
+    };
+
+    if (!write_all(connection, &request, sizeof(request)) ||
+        !write_all(connection, payload, length)) {
+        return false;
+    }
+
+    server_response_header response;
+    if (!read_all(connection, &response, sizeof(response))) {
+        return false;
+    }
+
+    char buffer[4096];
+    uint64_t remaining = response.length;
+
+    while (remaining > 0) {
+        size_t chunk = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+
+        if (!read_all(connection, buffer, chunk)) {
+            return false;
+        }
+
+        fwrite(buffer, 1, chunk, diagnostics);
+        remaining -= chunk;
+    }
+
+    *status = response.status;
+    return true;
+}
+
+void server_disconnect(int connection) {
+    close(connection);
+}
+
+#endif
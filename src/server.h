@@ -0,0 +1,96 @@
+/**
+ * Compile server
+ *
+ * `onec --server <socket>` stays running and compiles on behalf of clients
+ * that connect to it over a Unix domain socket. The server keeps its arenas,
+ * block pool and input buffers warm from one request to the next, so a
+ * client only pays for connecting and the compilation itself.
+ *
+ * A connection carries any number of requests, each answered before the
+ * next one is read. A request is a `server_request_header` followed by
+ * `length` bytes of payload: a path for SERVER_REQUEST_PATH, the source
+ * itself for SERVER_REQUEST_SOURCE. The response is a
+ * `server_response_header` followed by `length` bytes of diagnostics.
+ * Headers are in the host's byte order, both ends run on the same machine.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "alloc.h"
+#include "mmio.h"
+
+typedef enum {
+    /* The payload is the absolute path of a file to compile */
+    SERVER_REQUEST_PATH = 1,
+
+    /* The payload is the source to compile */
+    SERVER_REQUEST_SOURCE = 2,
+} server_request_kind;
+
+typedef struct {
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t length;
+} server_request_header;
+
+typedef struct {
+    /* Exit status of the compilation */
+    int32_t status;
+    uint32_t reserved;
+
+    /* Bytes of diagnostics that follow */
+    uint64_t length;
+} server_response_header;
+
+/**
+ * Compiles `src`, which is followed by a zero byte, allocating from
+ * `allocator`. Diagnostics go to diag_stream(). Returns the exit status.
+ */
+typedef int (*server_compile_fn)(char* src, size_t len, allocator_t* allocator);
+
+typedef struct {
+    /* Worker threads, each serving one connection at a time */
+    size_t jobs;
+
+    /* How files named in requests are read */
+    mmio_input_options input;
+
+    server_compile_fn compile;
+} server_options;
+
+/**
+ * Listens on `socket_path` and serves clients until the process receives
+ * SIGINT or SIGTERM, at which point the socket is removed. A stale socket
+ * left at `socket_path` is replaced. Returns the exit status.
+ */
+int server_run(char* socket_path, const server_options* options);
+
+/**
+ * Connects to the server listening on `socket_path`. Returns a connection,
+ * or -1 if no server could be reached.
+ */
+int server_connect(char* socket_path);
+
+/**
+ * Sends a request over `connection` and waits for its response. The
+ * diagnostics are written to `diagnostics` and the exit status stored in
+ * `status`. Returns false if the connection failed.
+ */
+bool server_request(
+    int connection,
+    server_request_kind kind,
+    const char* payload,
+    size_t length,
+    FILE* diagnostics,
+    int* status
+);
+
+void server_disconnect(int connection);
+
+#endif  // SERVER_H
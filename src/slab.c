@@ -0,0 +1,171 @@
+#include "slab.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SLAB_CLASSES (SLAB_MAX_SIZE / SLAB_GRANULE)
+
+/* A freed allocation, the link is stored in the allocation itself */
+typedef struct _free_slot {
+    struct _free_slot* next;
+} free_slot;
+
+typedef struct _slab_block {
+    struct _slab_block* prev;
+    size_t size;
+} slab_block;
+
+struct _slab {
+    allocator_t* base;
+    size_t block_size;
+
+    /* Most recently allocated block, small allocations that are not on a
+     * free list are bumped out of it */
+    slab_block* list;
+    uintptr_t ptr;
+    uintptr_t end;
+
+    free_slot* free[SLAB_CLASSES];
+
+    slab_stats stats;
+};
+
+/* Blocks, and with them every slot, are aligned to the granule */
+static size_t block_header_size() {
+    return (sizeof(slab_block) + SLAB_GRANULE - 1) & ~(SLAB_GRANULE - 1);
+}
+
+slab* slab_make(allocator_t* base, size_t block_size) {
+    slab* ret = ALLOC(base, slab);
+
+    *ret = (slab){
+        .base = base,
+        .block_size = block_size,
+        .list = NULL,
+        .ptr = 0,
+        .end = 0,
+    };
+
+    return ret;
+}
+
+void slab_destroy(slab* self) {
+    allocator_t* base = self->base;
+    slab_block* curr = self->list;
+
+    while (curr != NULL) {
+        slab_block* prev = curr->prev;
+        FREE_ARRAY(base, (void*) curr, char, curr->size);
+        curr = prev;
+    }
+
+    FREE(base, self, slab);
+}
+
+slab_stats slab_get_stats(slab* self) {
+    return self->stats;
+}
+
+static size_t class_of(size_t size) {
+    return (size + SLAB_GRANULE - 1) / SLAB_GRANULE - 1;
+}
+
+static size_t class_size(size_t class) {
+    return (class + 1) * SLAB_GRANULE;
+}
+
+static void* slot_alloc(slab* self, size_t class) {
+    size_t size = class_size(class);
+
+    self->stats.live_bytes += size;
+    if (self->stats.live_bytes > self->stats.peak_live_bytes) {
+        self->stats.peak_live_bytes = self->stats.live_bytes;
+    }
+
+    free_slot* slot = self->free[class];
+    if (slot != NULL) {
+        self->free[class] = slot->next;
+        self->stats.reused++;
+        return slot;
+    }
+
+    if (self->ptr + size > self->end) {
+        /* What is left of the current block is abandoned, it is smaller
+         * than the largest class. */
+        slab_block* block =
+            (slab_block*) ALLOC_ARRAY(self->base, char, self->block_size);
+
+        *block = (slab_block){
+            .prev = self->list,
+            .size = self->block_size,
+        };
+
+        self->list = block;
+        self->ptr = (uintptr_t) block + block_header_size();
+        self->end = (uintptr_t) block + block->size;
+        self->stats.blocks++;
+    }
+
+    void* ret = (void*) self->ptr;
+    self->ptr += size;
+
+    return ret;
+}
+
+static void slot_free(slab* self, void* ptr, size_t class) {
+    free_slot* slot = (free_slot*) ptr;
+
+    slot->next = self->free[class];
+    self->free[class] = slot;
+
+    self->stats.live_bytes -= class_size(class);
+}
+
+static void* slab_alloc(void* ctx, void* ptr, size_t old_size, size_t new_size) {
+    slab* self = (slab*) ctx;
+    allocator_t* base = self->base;
+
+    bool old_small = ptr != NULL && old_size != 0 && old_size <= SLAB_MAX_SIZE;
+    bool new_small = new_size != 0 && new_size <= SLAB_MAX_SIZE;
+
+    /* Neither side involves a slot */
+    if (!old_small && !new_small) {
+        if (ptr == NULL && new_size == 0) {
+            return NULL;
+        }
+
+        return base->alloc(base->ctx, ptr, old_size, new_size);
+    }
+
+    if (old_small && new_small && class_of(old_size) == class_of(new_size)) {
+        return ptr;
+    }
+
+    void* ret = NULL;
+
+    if (new_small) {
+        ret = slot_alloc(self, class_of(new_size));
+    } else if (new_size != 0) {
+        ret = ALLOC_ARRAY(base, char, new_size);
+    }
+
+    if (ptr != NULL && ret != NULL) {
+        memcpy(ret, ptr, old_size < new_size ? old_size : new_size);
+    }
+
+    if (old_small) {
+        slot_free(self, ptr, class_of(old_size));
+    } else if (ptr != NULL) {
+        FREE_ARRAY(base, ptr, char, old_size);
+    }
+
+    return ret;
+}
+
+allocator_t slab_get_alloc(slab* self) {
+    return (allocator_t){
+        .alloc = slab_alloc,
+        .ctx = self,
+    };
+}
@@ -0,0 +1,59 @@
+/**
+ * Slab allocator
+ *
+ * Small allocations are rounded up to a size class and carved out of large
+ * blocks. Freed allocations go on their size class' free list and are handed
+ * back out by the next allocation of the same class, so objects that are
+ * allocated and freed all the time take a constant amount of memory.
+ * Allocations larger than SLAB_MAX_SIZE go straight to the base allocator.
+ *
+ * The base allocator can be an arena: the slab then recycles what the arena
+ * would otherwise drop, and destroying the arena frees the slab's blocks.
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "alloc.h"
+
+/* Size classes are multiples of SLAB_GRANULE up to SLAB_MAX_SIZE */
+#define SLAB_GRANULE 16
+#define SLAB_MAX_SIZE 512
+
+typedef struct _slab slab;
+
+typedef struct {
+    /* Blocks allocated from the base allocator */
+    size_t blocks;
+
+    /* Bytes of small allocations currently in use, rounded up to their
+     * size class */
+    size_t live_bytes;
+    size_t peak_live_bytes;
+
+    /* Allocations served from a free list */
+    size_t reused;
+} slab_stats;
+
+/**
+ * Initializes a new slab allocator.
+ *
+ * @param base Allocator to get blocks and large allocations from
+ * @param block_size Size of the blocks to carve small allocations out of
+ */
+slab* slab_make(allocator_t* base, size_t block_size);
+
+/**
+ * Destroys the slab and frees its blocks. Large allocations still alive are
+ * not freed.
+ */
+void slab_destroy(slab* self);
+
+/**
+ * Returns the allocator which can be used to make allocations from this slab.
+ */
+allocator_t slab_get_alloc(slab* self);
+
+slab_stats slab_get_stats(slab* self);
+
+#endif  // SLAB_H
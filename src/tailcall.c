@@ -0,0 +1,439 @@
+#include "tailcall.h"
+
+#include <string.h>
+
+#include "vec.h"
+
+/* Where an expression or statement is in the function it is in */
+typedef enum {
+    POSITION_NONE,
+
+    /* Its value is the function's result */
+    POSITION_RESULT,
+
+    /* Nothing follows it, in a function without a result */
+    POSITION_LAST,
+} position;
+
+typedef enum {
+    TAIL_CALL,
+
+    KEEP_POSITION,
+    KEEP_ENVIRONMENT,
+    KEEP_RESULT,
+} decision;
+
+static const char* const REASONS[] = {
+    [KEEP_POSITION] = "not in tail position",
+    [KEEP_ENVIRONMENT] = "the frame holds a closure environment",
+    [KEEP_RESULT] = "the callee may return a value",
+};
+
+/* A parameter or variable, and the result type of the function it holds
+ * when that is known */
+typedef struct {
+    const char* name;
+    size_t len;
+
+    bool known;
+    ast_typename* return_type;
+} local;
+
+typedef VEC(local) vec_local;
+
+typedef struct {
+    ast_item_node* ast;
+    FILE* report;
+    vec_local scope;
+
+    /* Function being walked, and whether its frame holds the environment
+     * of a closure */
+    const char* name;
+    size_t name_len;
+    bool holds_env;
+} marker;
+
+static bool is_unit(ast_typename* type) {
+    return type == NULL ||
+           (type->type == TYPE_NAME_TUPLE && type->as.tuple.items.len == 0);
+}
+
+// Names
+
+static local* lookup_local(marker* self, const char* name, size_t len) {
+    for (size_t i = self->scope.len; i > 0; i--) {
+        local* l = &self->scope.items[i - 1];
+
+        if (l->len == len && memcmp(l->name, name, len) == 0) {
+            return l;
+        }
+    }
+
+    return NULL;
+}
+
+/* Named functions, the last one declared wins */
+static ast_node_function* lookup_function(
+    marker* self, const char* name, size_t len
+) {
+    ast_node_function* found = NULL;
+
+    for (ast_item_node* item = self->ast; item != NULL; item = item->next) {
+        ast_node_function* fn = &item->function;
+
+        if (item->type == AST_FN && fn->name.span_size == len &&
+            memcmp(fn->name.span, name, len) == 0) {
+            found = fn;
+        }
+    }
+
+    return found;
+}
+
+/* The result type of the function `callee` evaluates to, if it is known */
+static bool result_of(
+    marker* self, ast_expr_node* callee, ast_typename** out
+) {
+    if (callee->type == AST_LAMBDA) {
+        *out = callee->lambda.return_type;
+        return true;
+    }
+
+    if (callee->type != AST_IDEN) {
+        return false;
+    }
+
+    ast_node_identifier* iden = &callee->identifier;
+    local* l = lookup_local(self, iden->start, iden->len);
+
+    if (l != NULL) {
+        *out = l->return_type;
+        return l->known;
+    }
+
+    ast_node_function* fn = lookup_function(self, iden->start, iden->len);
+
+    if (fn != NULL) {
+        *out = fn->return_type;
+    }
+
+    return fn != NULL;
+}
+
+static void declare(
+    marker* self, token name, ast_typename* type, ast_expr_node* value
+) {
+    local l = {
+        .name = name.span,
+        .len = name.span_size,
+        .known = false,
+        .return_type = NULL,
+    };
+
+    if (type != NULL) {
+        l.known = type->type == TYPE_NAME_FUNCTION;
+        l.return_type = l.known ? type->as.function.return_type : NULL;
+    } else if (value != NULL) {
+        l.known = result_of(self, value, &l.return_type);
+    }
+
+    vec_push(&self->scope, &l);
+}
+
+// Closure environments
+
+static bool stmts_make_env(ast_stmt_node* stmts);
+
+/* Whether `expr` makes a closure that keeps its environment in the frame,
+ * not counting the ones made in the lambdas it has */
+static bool makes_env(ast_expr_node* expr) {
+    switch (expr->type) {
+        case AST_BINARY:
+            return makes_env(expr->binary.left) ||
+                   makes_env(expr->binary.right);
+
+        case AST_UNARY:
+            return makes_env(expr->unary.expr);
+
+        case AST_CALL:
+            for (size_t i = 0; i < expr->call.args.len; i++) {
+                if (makes_env(expr->call.args.items[i])) {
+                    return true;
+                }
+            }
+
+            return makes_env(expr->call.function);
+
+        case AST_LAMBDA:
+            return expr->lambda.closure == AST_CLOSURE_STACK;
+
+        default:
+            return false;
+    }
+}
+
+static bool stmt_makes_env(ast_stmt_node* stmt) {
+    switch (stmt->type) {
+        case AST_EXPR_STMT:
+            return makes_env(stmt->expr_stmt.expr);
+
+        case AST_VAR_DECL:
+            return stmt->var_decl.value != NULL &&
+                   makes_env(stmt->var_decl.value);
+
+        case AST_BLOCK:
+            return stmts_make_env(stmt->block.body);
+
+        case AST_IF_ELSE:
+            return makes_env(stmt->if_else.condition) ||
+                   stmt_makes_env(stmt->if_else.body) ||
+                   (stmt->if_else.else_body != NULL &&
+                    stmt_makes_env(stmt->if_else.else_body));
+
+        case AST_WHILE:
+            return makes_env(stmt->while_.condition) ||
+                   stmt_makes_env(stmt->while_.body);
+    }
+
+    return false;
+}
+
+static bool stmts_make_env(ast_stmt_node* stmts) {
+    for (ast_stmt_node* curr = stmts; curr != NULL; curr = curr->next) {
+        if (stmt_makes_env(curr)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Walking
+
+static void walk_expr(marker* self, ast_expr_node* expr, position pos);
+static void walk_function(
+    marker* self,
+    const char* name,
+    size_t name_len,
+    ast_param* params,
+    ast_stmt_node* body,
+    ast_typename* return_type
+);
+
+static decision decide(marker* self, ast_node_call* call, position pos) {
+    if (pos == POSITION_NONE) {
+        return KEEP_POSITION;
+    }
+
+    if (self->holds_env) {
+        return KEEP_ENVIRONMENT;
+    }
+
+    if (pos == POSITION_LAST) {
+        ast_typename* result = NULL;
+        bool known = call->lambda != NULL
+                         ? (result = call->lambda->return_type, true)
+                         : result_of(self, call->function, &result);
+
+        if (!known || !is_unit(result)) {
+            return KEEP_RESULT;
+        }
+    }
+
+    return TAIL_CALL;
+}
+
+static void report(marker* self, ast_node_call* call, decision d) {
+    ast_expr_node* callee = call->function;
+
+    fprintf(self->report, "%.*s -> ", (int)self->name_len, self->name);
+
+    if (callee->type == AST_IDEN) {
+        fprintf(
+            self->report,
+            "%.*s",
+            (int)callee->identifier.len,
+            callee->identifier.start
+        );
+    } else {
+        fprintf(self->report, callee->type == AST_LAMBDA ? "<lambda>" : "?");
+    }
+
+    fprintf(self->report, ": %s\n", REASONS[d]);
+}
+
+static void walk_call(marker* self, ast_node_call* call, position pos) {
+    decision d = decide(self, call, pos);
+
+    call->tail = d == TAIL_CALL;
+
+    if (!call->tail && self->report != NULL) {
+        report(self, call, d);
+    }
+
+    walk_expr(self, call->function, POSITION_NONE);
+
+    for (size_t i = 0; i < call->args.len; i++) {
+        walk_expr(self, call->args.items[i], POSITION_NONE);
+    }
+}
+
+static void walk_expr(marker* self, ast_expr_node* expr, position pos) {
+    switch (expr->type) {
+        case AST_NUM:
+        case AST_BOOL:
+        case AST_STR:
+        case AST_IDEN:
+            return;
+
+        case AST_BINARY: {
+            token_type op = expr->binary.op;
+            bool logical = op == TOK_AND || op == TOK_OR;
+
+            walk_expr(self, expr->binary.left, POSITION_NONE);
+            walk_expr(
+                self,
+                expr->binary.right,
+                logical && pos == POSITION_RESULT ? pos : POSITION_NONE
+            );
+            return;
+        }
+
+        case AST_UNARY:
+            walk_expr(self, expr->unary.expr, POSITION_NONE);
+            return;
+
+        case AST_CALL:
+            walk_call(self, &expr->call, pos);
+            return;
+
+        case AST_LAMBDA: {
+            ast_node_lambda* lambda = &expr->lambda;
+
+            walk_function(
+                self,
+                "<lambda>",
+                sizeof("<lambda>") - 1,
+                lambda->params,
+                lambda->body,
+                lambda->return_type
+            );
+            return;
+        }
+    }
+}
+
+/* Walks `stmts`, the last of them at `pos` */
+static void walk_stmts(marker* self, ast_stmt_node* stmts, position pos);
+
+static void walk_stmt(marker* self, ast_stmt_node* stmt, position pos) {
+    /* Only expressions have a value */
+    position nested = pos == POSITION_LAST ? pos : POSITION_NONE;
+
+    switch (stmt->type) {
+        case AST_EXPR_STMT:
+            walk_expr(self, stmt->expr_stmt.expr, pos);
+            return;
+
+        case AST_VAR_DECL: {
+            ast_node_var_decl* decl = &stmt->var_decl;
+
+            if (decl->value != NULL) {
+                walk_expr(self, decl->value, POSITION_NONE);
+            }
+
+            /* Declared after its value, which may refer to a shadowed
+             * variable */
+            declare(self, decl->name, decl->typename, decl->value);
+            return;
+        }
+
+        case AST_BLOCK: {
+            size_t saved = self->scope.len;
+
+            walk_stmts(self, stmt->block.body, nested);
+
+            self->scope.len = saved;
+            return;
+        }
+
+        case AST_IF_ELSE:
+            walk_expr(self, stmt->if_else.condition, POSITION_NONE);
+            walk_stmt(self, stmt->if_else.body, nested);
+
+            if (stmt->if_else.else_body != NULL) {
+                walk_stmt(self, stmt->if_else.else_body, nested);
+            }
+
+            return;
+
+        case AST_WHILE:
+            walk_expr(self, stmt->while_.condition, POSITION_NONE);
+            walk_stmt(self, stmt->while_.body, POSITION_NONE);
+            return;
+    }
+}
+
+static void walk_stmts(marker* self, ast_stmt_node* stmts, position pos) {
+    for (ast_stmt_node* curr = stmts; curr != NULL; curr = curr->next) {
+        walk_stmt(self, curr, curr->next == NULL ? pos : POSITION_NONE);
+    }
+}
+
+static void walk_function(
+    marker* self,
+    const char* name,
+    size_t name_len,
+    ast_param* params,
+    ast_stmt_node* body,
+    ast_typename* return_type
+) {
+    marker outer = *self;
+
+    self->name = name;
+    self->name_len = name_len;
+    self->holds_env = stmts_make_env(body);
+
+    for (ast_param* param = params; param != NULL; param = param->next) {
+        declare(self, param->name, param->type, NULL);
+    }
+
+    walk_stmts(
+        self, body, is_unit(return_type) ? POSITION_LAST : POSITION_RESULT
+    );
+
+    self->scope.len = outer.scope.len;
+    self->name = outer.name;
+    self->name_len = outer.name_len;
+    self->holds_env = outer.holds_env;
+}
+
+void tailcall_mark(allocator_t* allocator, ast_item_node* ast, FILE* report) {
+    marker self = {
+        .ast = ast,
+        .report = report,
+        .scope = vec_make(allocator),
+        .name = NULL,
+        .name_len = 0,
+        .holds_env = false,
+    };
+
+    for (ast_item_node* item = ast; item != NULL; item = item->next) {
+        if (item->type != AST_FN) {
+            continue;
+        }
+
+        ast_node_function* fn = &item->function;
+
+        walk_function(
+            &self,
+            fn->name.span,
+            fn->name.span_size,
+            fn->params,
+            fn->body,
+            fn->return_type
+        );
+    }
+
+    vec_free(&self.scope);
+}
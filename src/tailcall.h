@@ -0,0 +1,41 @@
+/**
+ * Tail calls
+ *
+ * A call is in tail position when the function it is made in returns what
+ * it returns:
+ *
+ * - the last statement of a function with a result, or the right operand
+ *   of && or || there,
+ * - the last statement of a function without a result, and the last
+ *   statement of a block or of either branch of an `if` there, as long as
+ *   the function it calls has no result either.
+ *
+ * Such a call is a tail call unless the function it is made in makes a
+ * closure that keeps its environment in the frame (see closure.h), which
+ * the callee may still use.
+ *
+ * The VM and the native backend make a tail call by handing the caller's
+ * frame over to the callee, so recursion through tail calls, direct, mutual
+ * or through function values, runs in constant stack space. The native
+ * backend makes a tail call whose stack arguments do not fit in those of
+ * the caller as a plain call, and reports it with the others (see
+ * codegen.h). The tree-walking interpreter makes them like any other call.
+ */
+
+#ifndef TAILCALL_H
+#define TAILCALL_H
+
+#include <stdio.h>
+
+#include "alloc.h"
+#include "ast.h"
+
+/**
+ * Marks the tail calls of a closure converted AST in place. Running it again
+ * on the same AST gives the same result. Unless `report` is NULL, every
+ * other call is printed to it with why it is not a tail call. Scratch
+ * memory comes from `allocator`.
+ */
+void tailcall_mark(allocator_t* allocator, ast_item_node* ast, FILE* report);
+
+#endif  // TAILCALL_H
@@ -43,6 +43,55 @@ int main() {
 
     arena_destroy(ar);
 
+    ar = arena_make(&mmio_alloc, 4096);
+    alloc = arena_get_alloc(ar);
+
+    /* The most recent allocation grows and shrinks in place */
+    long* tip = ALLOC_ARRAY(&alloc, long, 8);
+    tip[3] = 777;
+    long* resized = RESIZE_ARRAY(&alloc, tip, long, 8, 16);
+    assert(resized == tip);
+    resized = RESIZE_ARRAY(&alloc, tip, long, 16, 4);
+    assert(resized == tip);
+    assert(tip[3] == 777);
+
+    /* Freeing the most recent allocation makes its memory available again */
+    FREE_ARRAY(&alloc, tip, long, 4);
+    resized = ALLOC_ARRAY(&alloc, long, 2);
+    assert(resized == tip);
+
+    /* Allocations larger than a block can be resized too */
+    long* big = ALLOC_ARRAY(&alloc, long, 1024);
+    big[1023] = 4242;
+    big = RESIZE_ARRAY(&alloc, big, long, 1024, 4096);
+    assert(big[1023] == 4242);
+    FREE_ARRAY(&alloc, big, long, 4096);
+
+    /* Resetting to a checkpoint frees everything allocated since */
+    long* kept = ALLOC_ARRAY(&alloc, long, 4);
+    kept[0] = 1111;
+
+    arena_checkpoint mark = arena_mark(ar);
+    size_t blocks = arena_get_stats(ar).blocks;
+
+    long* scratch = ALLOC_ARRAY(&alloc, long, 4);
+    for (size_t i = 0; i < 1024; i++) {
+        ALLOC_ARRAY(&alloc, long, 16);
+    }
+    ALLOC_ARRAY(&alloc, long, 4096);
+
+    /* Allocations made before the checkpoint are not grown in place */
+    resized = RESIZE_ARRAY(&alloc, kept, long, 4, 8);
+    assert(resized != kept);
+
+    arena_reset(ar, mark);
+    assert(arena_get_stats(ar).blocks == blocks);
+    assert(kept[0] == 1111);
+    resized = ALLOC_ARRAY(&alloc, long, 4);
+    assert(resized == scratch);
+
+    arena_destroy(ar);
+
     return 0;
 }
 
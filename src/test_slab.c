@@ -0,0 +1,55 @@
+#include "arena.h"
+#include "mmio_alloc.h"
+#include "slab.h"
+
+#include <assert.h>
+
+int main() {
+    arena* ar = arena_make(&mmio_alloc, 4096);
+    allocator_t arena_alloc = arena_get_alloc(ar);
+
+    slab* sl = slab_make(&arena_alloc, 4096);
+    allocator_t alloc = slab_get_alloc(sl);
+
+    // a freed slot is handed to the next allocation of its class
+    long* a = ALLOC_ARRAY(&alloc, long, 3);
+    long* b = ALLOC_ARRAY(&alloc, long, 3);
+    assert(a != b);
+
+    FREE_ARRAY(&alloc, a, long, 3);
+    long* c = ALLOC_ARRAY(&alloc, long, 4);
+    assert(c == a);
+
+    // resizing within the class keeps the allocation
+    c[0] = 42;
+    long* resized = RESIZE_ARRAY(&alloc, c, long, 4, 3);
+    assert(resized == c);
+
+    // resizing to another class moves it
+    resized = RESIZE_ARRAY(&alloc, c, long, 3, 32);
+    assert(resized != c);
+    assert(resized[0] == 42);
+
+    // large allocations survive a move to the base allocator and back
+    resized[31] = 7;
+    long* large = RESIZE_ARRAY(&alloc, resized, long, 32, 1024);
+    assert(large[0] == 42 && large[31] == 7);
+    resized = RESIZE_ARRAY(&alloc, large, long, 1024, 8);
+    assert(resized[0] == 42);
+
+    // memory stays flat when objects are freed as fast as they are made
+    for (int i = 0; i < 100000; i++) {
+        long* tmp = ALLOC_ARRAY(&alloc, long, 6);
+        tmp[5] = i;
+        FREE_ARRAY(&alloc, tmp, long, 6);
+    }
+
+    slab_stats stats = slab_get_stats(sl);
+    assert(stats.blocks == 1);
+    assert(stats.reused >= 100000);
+
+    slab_destroy(sl);
+    arena_destroy(ar);
+
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include "mmio_alloc.h"
+#include "thread_alloc.h"
+
+#include <assert.h>
+#include <pthread.h>
+
+#define THREADS 4
+
+static void* fill(void* arg) {
+    allocator_t alloc = thread_cache_alloc((block_pool*) arg);
+
+    for (int unit = 0; unit < 16; unit++) {
+        int* first = ALLOC(&alloc, int);
+        *first = unit;
+
+        /* Spill over a few blocks */
+        for (int i = 0; i < 1024; i++) {
+            long* v = ALLOC_ARRAY(&alloc, long, 4);
+            v[3] = i;
+        }
+
+        assert(*first == unit);
+
+        thread_arena_release();
+    }
+
+    return NULL;
+}
+
+int main() {
+    block_pool* pool = block_pool_make(&mmio_alloc, 4096);
+
+    pthread_t handles[THREADS];
+
+    for (int i = 0; i < THREADS; i++) {
+        pthread_create(&handles[i], NULL, fill, pool);
+    }
+
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(handles[i], NULL);
+    }
+
+    /* Every arena was released, so all the blocks are back in the pool and
+     * most requests were served by recycled blocks. */
+    block_pool_stats stats = block_pool_get_stats(pool);
+    assert(stats.cached == stats.created);
+    assert(stats.reused > stats.created);
+
+    block_pool_destroy(pool);
+
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include "arena.h"
+#include "mmio_alloc.h"
+#include "vec.h"
+
+#include <assert.h>
+
+typedef VEC(int) vec_int;
+typedef SLICE(int) slice_int;
+
+int main() {
+    arena* ar = arena_make(&mmio_alloc, 4096);
+    allocator_t alloc = arena_get_alloc(ar);
+
+    // reserve allocates exactly what is asked for
+    vec_int v = vec_make(&alloc);
+    vec_reserve(&v, 3);
+    assert(v.capacity == 3);
+
+    int values[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+
+    // already has the room
+    vec_push_n(&v, values, 3);
+    assert(v.capacity == 3);
+    assert(v.len == 3 && v.items[2] == 3);
+
+    // grows once, by doubling
+    vec_push_n(&v, values + 3, 7);
+    assert(v.len == 10);
+    assert(v.capacity == 12);
+    for (int i = 0; i < 10; i++) {
+        assert(v.items[i] == i + 1);
+    }
+
+    vec_shrink_to_fit(&v);
+    assert(v.capacity == 10);
+
+    // extending from a slice
+    slice_int s = {values, 4};
+    vec_extend_from(&v, &s);
+    assert(v.len == 14);
+    assert(v.items[13] == 4);
+
+    vec_int empty = vec_make(&alloc);
+    vec_reserve(&empty, 8);
+    vec_shrink_to_fit(&empty);
+    assert(empty.items == NULL && empty.capacity == 0);
+
+    vec_free(&v);
+
+    arena_destroy(ar);
+
+    return 0;
+}
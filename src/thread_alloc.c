@@ -0,0 +1,161 @@
+#include "thread_alloc.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* A cached block, the link is stored in the block itself */
+typedef struct _free_block {
+    struct _free_block* next;
+} free_block;
+
+struct _block_pool {
+    allocator_t* base;
+    size_t block_size;
+
+    /* Guards `free` and `stats`. Critical sections are a handful of
+     * instructions, so we spin rather than sleep. */
+    atomic_flag lock;
+
+    free_block* free;
+    block_pool_stats stats;
+};
+
+static void pool_lock(block_pool* pool) {
+    while (atomic_flag_test_and_set_explicit(&pool->lock, memory_order_acquire)
+    ) {
+    }
+}
+
+static void pool_unlock(block_pool* pool) {
+    atomic_flag_clear_explicit(&pool->lock, memory_order_release);
+}
+
+block_pool* block_pool_make(allocator_t* base, size_t block_size) {
+    block_pool* pool = ALLOC(base, block_pool);
+
+    *pool = (block_pool){
+        .base = base,
+        .block_size = block_size,
+        .lock = ATOMIC_FLAG_INIT,
+        .free = NULL,
+    };
+
+    return pool;
+}
+
+void block_pool_destroy(block_pool* pool) {
+    free_block* curr = pool->free;
+
+    while (curr != NULL) {
+        free_block* next = curr->next;
+        FREE_ARRAY(pool->base, (void*) curr, char, pool->block_size);
+        curr = next;
+    }
+
+    FREE(pool->base, pool, block_pool);
+}
+
+static void* block_pool_alloc(
+    void* ctx, void* ptr, size_t old_size, size_t new_size
+) {
+    block_pool* pool = (block_pool*) ctx;
+
+    /* Only whole blocks are pooled */
+    if (ptr == NULL && new_size == pool->block_size) {
+        pool_lock(pool);
+
+        free_block* b = pool->free;
+        if (b != NULL) {
+            pool->free = b->next;
+            pool->stats.cached--;
+            pool->stats.reused++;
+        } else {
+            pool->stats.created++;
+        }
+
+        pool_unlock(pool);
+
+        return b != NULL ? (void*) b : ALLOC_ARRAY(pool->base, char, new_size);
+    }
+
+    if (new_size == 0 && old_size == pool->block_size) {
+        free_block* b = (free_block*) ptr;
+
+        pool_lock(pool);
+
+        b->next = pool->free;
+        pool->free = b;
+        pool->stats.cached++;
+
+        pool_unlock(pool);
+
+        return NULL;
+    }
+
+    return pool->base->alloc(pool->base->ctx, ptr, old_size, new_size);
+}
+
+allocator_t block_pool_get_alloc(block_pool* pool) {
+    return (allocator_t){
+        .alloc = block_pool_alloc,
+        .ctx = pool,
+    };
+}
+
+block_pool_stats block_pool_get_stats(block_pool* pool) {
+    pool_lock(pool);
+    block_pool_stats stats = pool->stats;
+    pool_unlock(pool);
+
+    return stats;
+}
+
+/* The calling thread's arena and the pool backing it */
+static _Thread_local arena* local_arena = NULL;
+static _Thread_local block_pool* local_pool = NULL;
+static _Thread_local allocator_t local_pool_alloc;
+
+arena* thread_arena(block_pool* pool) {
+    if (local_arena != NULL && local_pool == pool) {
+        return local_arena;
+    }
+
+    if (local_arena != NULL) {
+        fprintf(stderr, "BUG: thread arena requested from a second pool\n");
+        abort();
+    }
+
+    /* The arena keeps a pointer to its base allocator, it must live as
+     * long as the arena does. */
+    local_pool = pool;
+    local_pool_alloc = block_pool_get_alloc(pool);
+    local_arena = arena_make(&local_pool_alloc, pool->block_size);
+
+    return local_arena;
+}
+
+void thread_arena_release() {
+    if (local_arena == NULL) {
+        return;
+    }
+
+    arena_destroy(local_arena);
+
+    local_arena = NULL;
+    local_pool = NULL;
+}
+
+static void* thread_cache_allocate(
+    void* ctx, void* ptr, size_t old_size, size_t new_size
+) {
+    allocator_t alloc = arena_get_alloc(thread_arena((block_pool*) ctx));
+    return alloc.alloc(alloc.ctx, ptr, old_size, new_size);
+}
+
+allocator_t thread_cache_alloc(block_pool* pool) {
+    return (allocator_t){
+        .alloc = thread_cache_allocate,
+        .ctx = pool,
+    };
+}
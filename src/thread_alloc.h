@@ -0,0 +1,67 @@
+/**
+ * Thread caching allocation.
+ *
+ * A block pool is a central, thread-safe cache of fixed size blocks. Each
+ * thread allocates from its own arena, which needs no synchronisation, and
+ * the arena gets its blocks from the pool. Blocks freed by one arena are
+ * recycled by the next one, on any thread.
+ */
+
+#ifndef THREAD_ALLOC_H
+#define THREAD_ALLOC_H
+
+#include "alloc.h"
+#include "arena.h"
+
+typedef struct _block_pool block_pool;
+
+typedef struct {
+    /* Blocks allocated from the base allocator */
+    size_t created;
+
+    /* Requests served with a recycled block */
+    size_t reused;
+
+    /* Blocks currently sitting in the pool */
+    size_t cached;
+} block_pool_stats;
+
+/**
+ * Makes a pool of `block_size` blocks.
+ *
+ * @param base Thread-safe allocator to get blocks from. It also serves
+ *             requests that are not exactly one block.
+ */
+block_pool* block_pool_make(allocator_t* base, size_t block_size);
+
+/**
+ * Frees all the blocks cached by the pool. Blocks still held by arenas are
+ * not affected.
+ */
+void block_pool_destroy(block_pool* pool);
+
+/**
+ * Returns a thread-safe allocator that hands out and takes back blocks.
+ */
+allocator_t block_pool_get_alloc(block_pool* pool);
+
+block_pool_stats block_pool_get_stats(block_pool* pool);
+
+/**
+ * Returns the calling thread's arena, making it on first use. The arena gets
+ * its blocks from `pool`. A thread has one arena at a time.
+ */
+arena* thread_arena(block_pool* pool);
+
+/**
+ * Destroys the calling thread's arena, returning its blocks to the pool.
+ */
+void thread_arena_release();
+
+/**
+ * Returns an allocator that allocates from the arena of whichever thread
+ * calls it. A single such allocator can be shared by all threads.
+ */
+allocator_t thread_cache_alloc(block_pool* pool);
+
+#endif  // THREAD_ALLOC_H
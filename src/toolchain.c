@@ -0,0 +1,67 @@
+#include "toolchain.h"
+
+#include <errno.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "alloc.h"
+#include "diag.h"
+
+extern char** environ;
+
+static void toolchain_error(
+    const char* fmt, const char* driver, const char* detail
+) {
+    diag_printf(fmt, driver, detail);
+}
+
+bool toolchain_link(
+    const char* const* inputs, size_t count, const char* output
+) {
+    const char* driver = getenv("CC");
+
+    if (driver == NULL || driver[0] == '\0') {
+        driver = "cc";
+    }
+
+    /* driver -o output inputs... NULL */
+    size_t argc = count + 4;
+    char** argv = ALLOC_ARRAY(gpa(), char*, argc);
+
+    argv[0] = (char*)driver;
+    argv[1] = "-o";
+    argv[2] = (char*)output;
+    memcpy(argv + 3, inputs, count * sizeof(char*));
+    argv[count + 3] = NULL;
+
+    pid_t pid;
+    int err = posix_spawnp(&pid, driver, NULL, NULL, argv, environ);
+
+    FREE_ARRAY(gpa(), argv, char*, argc);
+
+    if (err != 0) {
+        toolchain_error("Could not run '%s': %s", driver, strerror(err));
+        return false;
+    }
+
+    int status;
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            toolchain_error(
+                "Could not wait for '%s': %s", driver, strerror(errno)
+            );
+            return false;
+        }
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        toolchain_error("'%s' failed to link '%s'", driver, output);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,25 @@
+/**
+ * System toolchain
+ *
+ * The native backend leaves assembling and linking to the C compiler
+ * driver of the system, `cc` unless $CC names another one.
+ */
+
+#ifndef TOOLCHAIN_H
+#define TOOLCHAIN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Assembles and links `inputs`, assembly or object files, into the
+ * executable `output`, together with the C library.
+ *
+ * Returns false after printing to diag_stream() if the driver cannot be run
+ * or fails.
+ */
+bool toolchain_link(
+    const char* const* inputs, size_t count, const char* output
+);
+
+#endif  // TOOLCHAIN_H
@@ -4,6 +4,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "arena.h"
+#include "diag.h"
+#include "slab.h"
+
+/* Block sizes of the scratch arena the typechecker allocates from */
+#define SCRATCH_BLOCK_SIZE (16 * 1024)
+#define SCRATCH_MAX_BLOCK_SIZE (1024 * 1024)
+
+/* Size of the blocks type resolutions and environments are carved from */
+#define OBJECT_BLOCK_SIZE (64 * 1024)
+
 typedef struct _typeres typeres;
 
 typedef struct {
@@ -33,12 +44,38 @@ static ast_expr_tc_t make_expr_tc(tc_ctx* ctx);
 
 static void environment_push(allocator_t* allocator, environment** env);
 static void environment_pop(allocator_t* allocator, environment** env);
+static void declare_function(tc_ctx* ctx, ast_node_function* fn);
 
 bool typecheck(allocator_t* allocator, ast_item_node* ast) {
-    tc_ctx ctx = (tc_ctx){.allocator = allocator, .env = NULL};
+    // type resolutions do not outlive the typecheck, they are all allocated
+    // from a scratch arena. They are freed as soon as they are no longer
+    // needed, the slab on top of the arena reuses them right away.
+    arena* scratch = arena_make_with_options(
+        allocator,
+        &(arena_options){
+            .block_size = SCRATCH_BLOCK_SIZE,
+            .max_block_size = SCRATCH_MAX_BLOCK_SIZE,
+        }
+    );
+    allocator_t scratch_alloc = arena_get_alloc(scratch);
+    slab* objects = slab_make(&scratch_alloc, OBJECT_BLOCK_SIZE);
+    allocator_t objects_alloc = slab_get_alloc(objects);
+
+    tc_ctx ctx = (tc_ctx){
+        .allocator = &objects_alloc,
+        .env = NULL,
+    };
 
     // global environment
-    environment_push(allocator, &ctx.env);
+    environment_push(ctx.allocator, &ctx.env);
+
+    // functions can call each other regardless of the order they are
+    // declared in
+    for (ast_item_node* item = ast; item != NULL; item = item->next) {
+        if (item->type == AST_FN) {
+            declare_function(&ctx, &item->function);
+        }
+    }
 
     bool ret = true;
 
@@ -51,7 +88,10 @@ bool typecheck(allocator_t* allocator, ast_item_node* ast) {
     }
 
     // global environment
-    environment_pop(allocator, &ctx.env);
+    environment_pop(ctx.allocator, &ctx.env);
+
+    slab_destroy(objects);
+    arena_destroy(scratch);
 
     return ret;
 }
@@ -213,6 +253,7 @@ static typeres* typeres_dup(allocator_t* allocator, typeres* src) {
  */
 static vec_typeres vec_typeres_dup(allocator_t* allocator, vec_typeres* src) {
     vec_typeres ret = vec_make(allocator);
+    vec_reserve(&ret, src->len);
 
     typeres** item;
     vec_foreach(src, item) {
@@ -346,11 +387,22 @@ static typeres* make_typeres_from_ast(
     allocator_t* allocator, ast_typename* typename
 );
 
+static size_t count_params(ast_param* params) {
+    size_t count = 0;
+    for (ast_param* curr = params; curr != NULL; curr = curr->next) {
+        count++;
+    }
+
+    return count;
+}
+
 static vec_typeres make_typeres_vec_from_ast_params(
     allocator_t* allocator, ast_param* params
 ) {
     vec_typeres ret = vec_make(allocator);
 
+    vec_reserve(&ret, count_params(params));
+
     ast_param* curr = params;
     while (curr != NULL) {
         typeres* param_type = make_typeres_from_ast(allocator, curr->type);
@@ -365,6 +417,7 @@ static typeres* make_typeres_from_ast(
     allocator_t* allocator, ast_typename* typename
 ) {
     typeres* res = ALLOC(allocator, typeres);
+    res->is_err = false;
 
     switch (typename->type) {
         case TYPE_NAME_BOOLEAN: {
@@ -387,6 +440,7 @@ static typeres* make_typeres_from_ast(
             res->type = TYPE_RES_TUPLE;
 
             res->tuple.items = (vec_typeres)vec_make(allocator);
+            vec_reserve(&res->tuple.items, typename->as.tuple.items.len);
             ast_typename** item;
             vec_foreach(&typename->as.tuple.items, item) {
                 typeres* item_res = make_typeres_from_ast(allocator, *item);
@@ -400,6 +454,9 @@ static typeres* make_typeres_from_ast(
             res->type = TYPE_RES_FUNCTION;
 
             res->function.params = (vec_typeres)vec_make(allocator);
+            vec_reserve(
+                &res->function.params, typename->as.function.params.len
+            );
             ast_typename** param;
             vec_foreach(&typename->as.function.params, param) {
                 typeres* param_res = make_typeres_from_ast(allocator, *param);
@@ -499,10 +556,8 @@ static typeres* environment_lookup_symbol(environment* env, token name) {
 static void report_type_err(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
+    diag_vprintf(fmt, args);
     va_end(args);
-
-    fputc('\n', stderr);
 }
 
 // Expression walker
@@ -853,7 +908,7 @@ typeres* walk_call(ast_expr_tc_t* self, ast_node_call* expr) {
     }
 
     vec_typeres* params = &fn_res->function.params;
-    vec_expr* args = &expr->args;
+    slice_expr* args = &expr->args;
 
     // minimum of both lengths
     size_t len = params->len < args->len ? params->len : args->len;
@@ -900,8 +955,6 @@ typeres* walk_iden(ast_expr_tc_t* self, ast_node_identifier* expr) {
 }
 
 typeres* walk_lambda(ast_expr_tc_t* self, ast_node_lambda* expr) {
-    environment_push(self->ctx->allocator, &self->ctx->env);
-
     vec_typeres params =
         make_typeres_vec_from_ast_params(self->ctx->allocator, expr->params);
     typeres* return_type =
@@ -909,6 +962,8 @@ typeres* walk_lambda(ast_expr_tc_t* self, ast_node_lambda* expr) {
     typeres* ret =
         make_typeres_function(self->ctx->allocator, params, return_type);
 
+    environment_push(self->ctx->allocator, &self->ctx->env);
+
     bool passes = true;
 
     if (expr->body != NULL) {
@@ -1083,19 +1138,18 @@ ast_stmt_tc_t make_stmt_tc(tc_ctx* ctx) {
 
 // Item walker
 
-int walk_function(ast_item_tc_t* self, ast_node_function* fn) {
+static void declare_function(tc_ctx* ctx, ast_node_function* fn) {
     vec_typeres params =
-        make_typeres_vec_from_ast_params(self->ctx->allocator, fn->params);
+        make_typeres_vec_from_ast_params(ctx->allocator, fn->params);
     typeres* return_type =
-        make_typeres_from_ast(self->ctx->allocator, fn->return_type);
+        make_typeres_from_ast(ctx->allocator, fn->return_type);
     typeres* fn_type =
-        make_typeres_function(self->ctx->allocator, params, return_type);
+        make_typeres_function(ctx->allocator, params, return_type);
 
-    // FIXME: We want to be able to call other functions regardless of whether
-    // they were declared before or after the current function. This will
-    // probably require us to take two separate passes
-    environment_put_symbol(self->ctx->env, fn->name, fn_type);
+    environment_put_symbol(ctx->env, fn->name, fn_type);
+}
 
+int walk_function(ast_item_tc_t* self, ast_node_function* fn) {
     environment_push(self->ctx->allocator, &self->ctx->env);
 
     ast_param* curr = fn->params;
@@ -54,10 +54,204 @@
                                                                            \
     } while (0);
 
+/**
+ * Makes room for at least `count` more items. Grows to exactly the needed
+ * capacity, for when the final length is known up front.
+ */
+#define vec_reserve(v, count)                         \
+    do {                                              \
+        size_t _vec_reserve_len = (v)->len + (count); \
+        if (_vec_reserve_len > (v)->capacity) {       \
+            (v)->items = RESIZE_ARRAY(                \
+                (v)->allocator,                       \
+                (v)->items,                           \
+                typeof(*((v)->items)),                \
+                (v)->capacity,                        \
+                _vec_reserve_len                      \
+            );                                        \
+            (v)->capacity = _vec_reserve_len;         \
+        }                                             \
+    } while (0)
+
+/**
+ * Appends `count` items from `src` with a single copy. Grows the same way
+ * as vec_push, at most once.
+ */
+#define vec_push_n(v, src, count)                                            \
+    do {                                                                     \
+        size_t _vec_push_n_count = (count);                                  \
+        size_t _vec_push_n_len = (v)->len + _vec_push_n_count;               \
+        if (_vec_push_n_len > (v)->capacity) {                               \
+            size_t new_capacity =                                            \
+                (v)->capacity == 0 ? VEC_INITIAL_SIZE : (v)->capacity;       \
+            while (new_capacity < _vec_push_n_len) {                         \
+                new_capacity *= 2;                                           \
+            }                                                                \
+                                                                             \
+            (v)->items = RESIZE_ARRAY(                                       \
+                (v)->allocator,                                              \
+                (v)->items,                                                  \
+                typeof(*((v)->items)),                                       \
+                (v)->capacity,                                               \
+                new_capacity                                                 \
+            );                                                               \
+            (v)->capacity = new_capacity;                                    \
+        }                                                                    \
+                                                                             \
+        memcpy(                                                              \
+            (v)->items + (v)->len,                                           \
+            src,                                                             \
+            sizeof(*((v)->items)) * _vec_push_n_count                        \
+        );                                                                   \
+        (v)->len = _vec_push_n_len;                                          \
+    } while (0)
+
+/**
+ * Appends all the items of `other`, a vector or a slice.
+ */
+#define vec_extend_from(v, other) vec_push_n(v, (other)->items, (other)->len)
+
+/**
+ * Trims the capacity down to the length, freeing the buffer of an empty
+ * vector.
+ */
+#define vec_shrink_to_fit(v)                   \
+    do {                                       \
+        if ((v)->len == 0) {                   \
+            vec_free(v);                       \
+        } else if ((v)->capacity > (v)->len) { \
+            (v)->items = RESIZE_ARRAY(         \
+                (v)->allocator,                \
+                (v)->items,                    \
+                typeof(*((v)->items)),         \
+                (v)->capacity,                 \
+                (v)->len                       \
+            );                                 \
+            (v)->capacity = (v)->len;          \
+        }                                      \
+    } while (0)
+
 #define vec_get(v, inx) inx >= (v)->len ? NULL : &(v)->items[inx]
 
 #define vec_foreach(v, item) \
     item = (v)->items;       \
     for (size_t i = 0; i < (v)->len; i++, (item)++)
 
+/**
+ * Small vector: keeps the first N items inline and only allocates once it
+ * outgrows them. Items are read with small_vec_items(), the storage moves
+ * when the vector spills.
+ */
+#define SMALL_VEC(item_type, n)    \
+    struct {                       \
+        item_type* heap;           \
+        size_t len;                \
+        size_t heap_capacity;      \
+        allocator_t* allocator;    \
+        item_type inline_items[n]; \
+    }
+
+#define small_vec_make(allocator_) \
+    {.heap = NULL, .len = 0, .heap_capacity = 0, .allocator = allocator_}
+
+#define small_vec_inline_capacity(v) \
+    (sizeof((v)->inline_items) / sizeof(*(v)->inline_items))
+
+#define small_vec_items(v) \
+    ((v)->heap != NULL ? (v)->heap : (v)->inline_items)
+
+#define small_vec_push(v, item)                                              \
+    do {                                                                     \
+        if ((v)->heap == NULL &&                                             \
+            (v)->len == small_vec_inline_capacity(v)) {                      \
+            (v)->heap_capacity = small_vec_inline_capacity(v) * 2;           \
+            (v)->heap = ALLOC_ARRAY(                                         \
+                (v)->allocator, typeof(*item), (v)->heap_capacity            \
+            );                                                               \
+            memcpy((v)->heap, (v)->inline_items, sizeof((v)->inline_items)); \
+        } else if ((v)->heap != NULL && (v)->len == (v)->heap_capacity) {    \
+            (v)->heap = RESIZE_ARRAY(                                        \
+                (v)->allocator,                                              \
+                (v)->heap,                                                   \
+                typeof(*item),                                               \
+                (v)->heap_capacity,                                          \
+                (v)->heap_capacity * 2                                       \
+            );                                                               \
+            (v)->heap_capacity *= 2;                                         \
+        }                                                                    \
+                                                                             \
+        memcpy(small_vec_items(v) + (v)->len++, item, sizeof(*item));        \
+    } while (0)
+
+#define small_vec_free(v)             \
+    do {                              \
+        if ((v)->heap != NULL) {      \
+            FREE_ARRAY(               \
+                (v)->allocator,       \
+                (v)->heap,            \
+                typeof(*((v)->heap)), \
+                (v)->heap_capacity    \
+            );                        \
+        }                             \
+                                      \
+        (v)->heap = NULL;             \
+        (v)->len = 0;                 \
+        (v)->heap_capacity = 0;       \
+    } while (0)
+
+/**
+ * Slice: a frozen, exactly sized list. It has the same `items` and `len`
+ * as a vector, so vec_get and vec_foreach work on it too.
+ */
+#define SLICE(item_type)  \
+    struct {              \
+        item_type* items; \
+        size_t len;       \
+    }
+
+#define slice_empty() {NULL, 0}
+
+/**
+ * Moves the items of a small vector to the slice at `out`. Spilled items
+ * are kept where they are and trimmed to size, inline ones are copied to an
+ * exactly sized allocation. Empty vectors need no allocation at all.
+ */
+#define small_vec_freeze(v, out)                               \
+    do {                                                       \
+        if ((v)->heap != NULL) {                               \
+            (out)->items = RESIZE_ARRAY(                       \
+                (v)->allocator,                                \
+                (v)->heap,                                     \
+                typeof(*((v)->heap)),                          \
+                (v)->heap_capacity,                            \
+                (v)->len                                       \
+            );                                                 \
+        } else if ((v)->len != 0) {                            \
+            (out)->items = ALLOC_ARRAY(                        \
+                (v)->allocator, typeof(*((v)->heap)), (v)->len \
+            );                                                 \
+            memcpy(                                            \
+                (out)->items,                                  \
+                (v)->inline_items,                             \
+                sizeof(*((v)->heap)) * (v)->len                \
+            );                                                 \
+        } else {                                               \
+            (out)->items = NULL;                               \
+        }                                                      \
+                                                               \
+        (out)->len = (v)->len;                                 \
+                                                               \
+        (v)->heap = NULL;                                      \
+        (v)->len = 0;                                          \
+        (v)->heap_capacity = 0;                                \
+    } while (0)
+
+#define slice_free(allocator, s)                                            \
+    do {                                                                    \
+        FREE_ARRAY(allocator, (s)->items, typeof(*((s)->items)), (s)->len); \
+                                                                            \
+        (s)->items = NULL;                                                  \
+        (s)->len = 0;                                                       \
+    } while (0)
+
 #endif  // VEC_H
\ No newline at end of file
@@ -0,0 +1,405 @@
+#include "vm.h"
+
+#include <string.h>
+
+#include "diag.h"
+
+#if defined(__GNUC__) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO
+#endif
+
+typedef struct {
+    /* State of the caller, restored on return */
+    const bc_function* fn;
+    const bc_instr* pc;
+    int64_t* base;
+} vm_frame;
+
+struct _vm {
+    allocator_t* allocator;
+    const bc_module* module;
+
+    int64_t* stack;
+    vm_frame* frames;
+
+    uint64_t instructions;
+};
+
+vm* vm_make(allocator_t* allocator, const bc_module* module) {
+    vm* self = ALLOC(allocator, vm);
+
+    *self = (vm){
+        .allocator = allocator,
+        .module = module,
+        .stack = ALLOC_ARRAY(allocator, int64_t, VM_STACK_SIZE),
+        .frames = ALLOC_ARRAY(allocator, vm_frame, VM_MAX_FRAMES),
+        .instructions = 0,
+    };
+
+    return self;
+}
+
+void vm_destroy(vm* self) {
+    allocator_t* allocator = self->allocator;
+
+    FREE_ARRAY(allocator, self->frames, vm_frame, VM_MAX_FRAMES);
+    FREE_ARRAY(allocator, self->stack, int64_t, VM_STACK_SIZE);
+    FREE(allocator, self, vm);
+}
+
+uint64_t vm_instructions(const vm* self) {
+    return self->instructions;
+}
+
+static void runtime_error(const bc_function* fn, const char* message) {
+    diag_printf(
+        "Runtime error in %.*s: %s", (int)fn->name_len, fn->name, message
+    );
+}
+
+static bc_string* concat(allocator_t* allocator, bc_string* a, bc_string* b) {
+    bc_string* s = ALLOC_ARRAY(
+        allocator, char, (sizeof(bc_string) + a->len + b->len)
+    );
+
+    s->len = a->len + b->len;
+    memcpy(s->chars, a->chars, a->len);
+    memcpy(s->chars + a->len, b->chars, b->len);
+
+    return s;
+}
+
+static bool string_equal(bc_string* a, bc_string* b) {
+    return a->len == b->len && memcmp(a->chars, b->chars, a->len) == 0;
+}
+
+/* Brings a 64 bit result back into the range of the type */
+#define WRAP_I8(v) ((int64_t)(int8_t)(v))
+#define WRAP_I16(v) ((int64_t)(int16_t)(v))
+#define WRAP_I32(v) ((int64_t)(int32_t)(v))
+#define WRAP_U8(v) ((int64_t)(uint8_t)(v))
+#define WRAP_U16(v) ((int64_t)(uint16_t)(v))
+#define WRAP_U32(v) ((int64_t)(uint32_t)(v))
+
+#define R(x) base[x]
+#define RA R(BC_A(instr))
+#define RB R(BC_B(instr))
+#define RC R(BC_C(instr))
+
+#ifdef VM_COMPUTED_GOTO
+
+#define CASE(name) op_##name:
+#define NEXT                                \
+    do {                                    \
+        instr = *pc++;                      \
+        executed++;                         \
+        goto* dispatch_table[BC_OP(instr)]; \
+    } while (0)
+#define DISPATCH_BEGIN NEXT;
+#define DISPATCH_END
+
+#else
+
+#define CASE(name) case BC_##name:
+#define NEXT continue
+#define DISPATCH_BEGIN      \
+    for (;;) {              \
+        instr = *pc++;      \
+        executed++;         \
+        switch (BC_OP(instr)) {
+#define DISPATCH_END \
+    default:         \
+        goto done;   \
+        }            \
+        }
+
+#endif
+
+/* Registers are computed in 64 bits and wrapped, the operands are already
+ * in range so 64 bit division cannot overflow */
+#define INTEGER_HANDLERS(T)                                       \
+    CASE(ADD_##T) {                                               \
+        RA = WRAP_##T((uint64_t)RB + (uint64_t)RC);               \
+        NEXT;                                                     \
+    }                                                             \
+    CASE(SUB_##T) {                                               \
+        RA = WRAP_##T((uint64_t)RB - (uint64_t)RC);               \
+        NEXT;                                                     \
+    }                                                             \
+    CASE(MUL_##T) {                                               \
+        RA = WRAP_##T((uint64_t)RB * (uint64_t)RC);               \
+        NEXT;                                                     \
+    }                                                             \
+    CASE(DIV_##T) {                                               \
+        if (RC == 0) {                                            \
+            goto division_by_zero;                                \
+        }                                                         \
+        RA = WRAP_##T(RB / RC);                                   \
+        NEXT;                                                     \
+    }                                                             \
+    CASE(MOD_##T) {                                               \
+        if (RC == 0) {                                            \
+            goto division_by_zero;                                \
+        }                                                         \
+        RA = WRAP_##T(RB % RC);                                   \
+        NEXT;                                                     \
+    }                                                             \
+    CASE(NEG_##T) {                                               \
+        RA = WRAP_##T(-(uint64_t)RB);                             \
+        NEXT;                                                     \
+    }
+
+/* Enters function `index`, whose registers start after register A */
+#define CALL_FUNCTION(index)                                       \
+    do {                                                           \
+        const bc_function* callee = &functions[index];             \
+        int64_t* callee_base = base + BC_A(instr) + 1;             \
+                                                                   \
+        if (frame_count == VM_MAX_FRAMES ||                        \
+            callee_base + callee->register_count > stack_end) {    \
+            goto stack_overflow;                                   \
+        }                                                          \
+                                                                   \
+        frames[frame_count++] = (vm_frame){fn, pc, base};          \
+        fn = callee;                                               \
+        pc = callee->code;                                         \
+        base = callee_base;                                        \
+    } while (0)
+
+/* Replaces the current function with function `index`, moving its `count`
+ * arguments from after register A down to the start of the frame */
+#define TAIL_CALL_FUNCTION(index, count)                       \
+    do {                                                       \
+        const bc_function* callee = &functions[index];         \
+        int64_t* args = base + BC_A(instr) + 1;                \
+                                                               \
+        if (base + callee->register_count > stack_end) {       \
+            goto stack_overflow;                               \
+        }                                                      \
+                                                               \
+        memmove(base, args, (count) * sizeof(int64_t));        \
+        fn = callee;                                           \
+        pc = callee->code;                                     \
+    } while (0)
+
+/* Leaves the current function, stops if it is the one vm_call entered */
+#define RETURN(value)                             \
+    do {                                          \
+        base[-1] = (value);                       \
+                                                  \
+        if (frame_count == 0) {                   \
+            goto done;                            \
+        }                                         \
+                                                  \
+        frame_count--;                            \
+        fn = frames[frame_count].fn;              \
+        pc = frames[frame_count].pc;              \
+        base = frames[frame_count].base;          \
+    } while (0)
+
+bool vm_call(
+    vm* self,
+    size_t function,
+    const int64_t* args,
+    size_t arg_count,
+    int64_t* result
+) {
+#ifdef VM_COMPUTED_GOTO
+    static void* const dispatch_table[] = {
+#define BC_OPCODE_LABEL(name, format) &&op_##name,
+        BC_OPCODES(BC_OPCODE_LABEL)
+#undef BC_OPCODE_LABEL
+    };
+#endif
+
+    const bc_function* functions = self->module->functions.items;
+    const int64_t* constants = self->module->constants.items;
+
+    vm_frame* frames = self->frames;
+    size_t frame_count = 0;
+
+    int64_t* const stack_end = self->stack + VM_STACK_SIZE;
+    const bc_function* fn = &functions[function];
+
+    const bc_instr* pc = fn->code;
+    bc_instr instr;
+    uint64_t executed = 0;
+    bool ok = true;
+
+    /* Register 0 receives the result, like the callee register of a
+     * CALL */
+    int64_t* base = self->stack + 1;
+    self->stack[0] = 0;
+
+    if (base + fn->register_count > stack_end) {
+        goto stack_overflow;
+    }
+
+    memcpy(base, args, arg_count * sizeof(int64_t));
+
+    DISPATCH_BEGIN
+
+    CASE(MOV) {
+        RA = RB;
+        NEXT;
+    }
+    CASE(LOADI) {
+        RA = BC_SBX(instr);
+        NEXT;
+    }
+    CASE(LOADK) {
+        RA = constants[BC_BX(instr)];
+        NEXT;
+    }
+    CASE(LOADF) {
+        RA = (int64_t)BC_BX(instr) << 1;
+        NEXT;
+    }
+    CASE(CLOSURE) {
+        size_t count = BC_C(instr) + 1;
+        int64_t* env = ALLOC_ARRAY(self->allocator, int64_t, count);
+
+        memcpy(env, &RB, count * sizeof(int64_t));
+        RA = (intptr_t)env | 1;
+        NEXT;
+    }
+    CASE(LCLOSURE) {
+        RA = (intptr_t)&RB | 1;
+        NEXT;
+    }
+    CASE(LOADE) {
+        RA = ((int64_t*)(intptr_t)RB)[BC_C(instr) + 1];
+        NEXT;
+    }
+
+    INTEGER_HANDLERS(I8)
+    INTEGER_HANDLERS(I16)
+    INTEGER_HANDLERS(I32)
+    INTEGER_HANDLERS(U8)
+    INTEGER_HANDLERS(U16)
+    INTEGER_HANDLERS(U32)
+
+    CASE(BAND) {
+        RA = RB & RC;
+        NEXT;
+    }
+    CASE(BOR) {
+        RA = RB | RC;
+        NEXT;
+    }
+    CASE(BXOR) {
+        RA = RB ^ RC;
+        NEXT;
+    }
+    CASE(EQ) {
+        RA = RB == RC;
+        NEXT;
+    }
+    CASE(LT) {
+        RA = RB < RC;
+        NEXT;
+    }
+    CASE(GT) {
+        RA = RB > RC;
+        NEXT;
+    }
+    CASE(NOT) {
+        RA = !RB;
+        NEXT;
+    }
+
+    CASE(CONCAT) {
+        RA = (intptr_t)concat(
+            self->allocator,
+            (bc_string*)(intptr_t)RB,
+            (bc_string*)(intptr_t)RC
+        );
+        NEXT;
+    }
+    CASE(STREQ) {
+        RA = string_equal((bc_string*)(intptr_t)RB, (bc_string*)(intptr_t)RC);
+        NEXT;
+    }
+
+    CASE(JMP) {
+        pc += BC_SJ(instr);
+        NEXT;
+    }
+    CASE(JMPF) {
+        if (!RA) {
+            pc += BC_SBX(instr);
+        }
+        NEXT;
+    }
+    CASE(JMPT) {
+        if (RA) {
+            pc += BC_SBX(instr);
+        }
+        NEXT;
+    }
+
+    CASE(CALL) {
+        int64_t function = RA;
+
+        if (function & 1) {
+            int64_t* env = (int64_t*)(intptr_t)(function - 1);
+
+            /* The environment goes after the arguments, see closure.h */
+            CALL_FUNCTION(env[0] >> 1);
+            base[BC_C(instr)] = (intptr_t)env;
+        } else {
+            CALL_FUNCTION(function >> 1);
+        }
+
+        NEXT;
+    }
+    CASE(CALLK) {
+        CALL_FUNCTION(BC_BX(instr));
+        NEXT;
+    }
+    CASE(TAILCALL) {
+        int64_t function = RA;
+
+        if (function & 1) {
+            int64_t* env = (int64_t*)(intptr_t)(function - 1);
+
+            TAIL_CALL_FUNCTION(env[0] >> 1, BC_C(instr));
+            base[BC_C(instr)] = (intptr_t)env;
+        } else {
+            TAIL_CALL_FUNCTION(function >> 1, BC_C(instr));
+        }
+
+        NEXT;
+    }
+    CASE(TAILCALLK) {
+        size_t index = BC_BX(instr);
+
+        TAIL_CALL_FUNCTION(index, functions[index].param_count);
+        NEXT;
+    }
+    CASE(RET) {
+        RETURN(RA);
+        NEXT;
+    }
+    CASE(RET0) {
+        RETURN(0);
+        NEXT;
+    }
+
+    DISPATCH_END
+
+division_by_zero:
+    runtime_error(fn, "division by zero");
+    ok = false;
+    goto done;
+
+stack_overflow:
+    runtime_error(fn, "stack overflow");
+    ok = false;
+
+done:
+    self->instructions += executed;
+    *result = self->stack[0];
+
+    return ok;
+}
@@ -0,0 +1,62 @@
+/**
+ * Bytecode virtual machine
+ *
+ * Runs the functions of a bc_module (see bytecode.h). All the registers of
+ * the active calls live on one stack, a call's registers start right after
+ * the register the callee was loaded into, so arguments are passed without
+ * copying. A tail call moves its arguments down to where the registers of
+ * the caller start and takes over its frame instead.
+ *
+ * The interpreter loop dispatches with computed gotos when the compiler
+ * supports them, every handler jumping straight to the next one, and with a
+ * switch otherwise. Defining VM_NO_COMPUTED_GOTO forces the switch, to
+ * compare the two.
+ */
+
+#ifndef VM_H
+#define VM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "alloc.h"
+#include "bytecode.h"
+
+/* Registers on the stack, shared by all the active calls */
+#define VM_STACK_SIZE (1 << 20)
+
+/* Calls that can be active at the same time */
+#define VM_MAX_FRAMES (1 << 16)
+
+typedef struct _vm vm;
+
+/**
+ * Makes a VM for `module`, which must outlive it. Strings made while
+ * running come from `allocator` and are only released with it.
+ */
+vm* vm_make(allocator_t* allocator, const bc_module* module);
+
+void vm_destroy(vm* self);
+
+/**
+ * Calls function `function` of the module with `arg_count` arguments and
+ * stores what it returns in `result`.
+ *
+ * Returns false after printing to diag_stream() on a runtime error:
+ * division by zero or running out of stack.
+ */
+bool vm_call(
+    vm* self,
+    size_t function,
+    const int64_t* args,
+    size_t arg_count,
+    int64_t* result
+);
+
+/**
+ * Instructions executed by all the calls made so far.
+ */
+uint64_t vm_instructions(const vm* self);
+
+#endif  // VM_H
@@ -0,0 +1,1018 @@
+#include "x86.h"
+
+#include <string.h>
+
+#include "vec.h"
+
+typedef struct {
+    x86_section section;
+    size_t offset;
+} label_entry;
+
+/* A 32 bit field of .text waiting for the position of a label or symbol */
+typedef struct {
+    size_t offset;
+    x86_reloc_kind kind;
+
+    bool is_label;
+    size_t target;
+} fixup;
+
+typedef VEC(x86_symbol_info) vec_symbol;
+typedef VEC(label_entry) vec_label;
+typedef VEC(uint8_t) vec_byte;
+typedef VEC(fixup) vec_fixup;
+typedef VEC(x86_reloc) vec_reloc;
+
+struct _x86_asm {
+    allocator_t* allocator;
+
+    /* Where the assembly goes, NULL when encoding */
+    FILE* out;
+
+    vec_symbol symbols;
+    vec_label labels;
+
+    vec_byte sections[X86_SECTION_COUNT];
+    vec_fixup fixups;
+    vec_reloc relocs;
+
+    /* Instructions encoded so far */
+    size_t instruction_count;
+
+    /* Function being emitted, to close it with its size */
+    bool in_function;
+    x86_symbol function;
+};
+
+static const char* const REG_NAMES[][4] = {
+    {"al", "ax", "eax", "rax"},
+    {"cl", "cx", "ecx", "rcx"},
+    {"dl", "dx", "edx", "rdx"},
+    {"bl", "bx", "ebx", "rbx"},
+    {"spl", "sp", "esp", "rsp"},
+    {"bpl", "bp", "ebp", "rbp"},
+    {"sil", "si", "esi", "rsi"},
+    {"dil", "di", "edi", "rdi"},
+    {"r8b", "r8w", "r8d", "r8"},
+    {"r9b", "r9w", "r9d", "r9"},
+    {"r10b", "r10w", "r10d", "r10"},
+    {"r11b", "r11w", "r11d", "r11"},
+    {"r12b", "r12w", "r12d", "r12"},
+    {"r13b", "r13w", "r13d", "r13"},
+    {"r14b", "r14w", "r14d", "r14"},
+    {"r15b", "r15w", "r15d", "r15"},
+};
+
+static const char* const ALU_NAMES[] = {
+    [X86_ADD] = "add",
+    [X86_OR] = "or",
+    [X86_AND] = "and",
+    [X86_SUB] = "sub",
+    [X86_XOR] = "xor",
+    [X86_CMP] = "cmp",
+};
+
+static const char* const COND_NAMES[] = {
+    [X86_CC_B] = "b",
+    [X86_CC_AE] = "ae",
+    [X86_CC_E] = "e",
+    [X86_CC_NE] = "ne",
+    [X86_CC_BE] = "be",
+    [X86_CC_A] = "a",
+    [X86_CC_L] = "l",
+    [X86_CC_GE] = "ge",
+    [X86_CC_LE] = "le",
+    [X86_CC_G] = "g",
+};
+
+static size_t width_index(x86_width width) {
+    switch (width) {
+        case X86_BYTE:
+            return 0;
+        case X86_WORD:
+            return 1;
+        case X86_DWORD:
+            return 2;
+        case X86_QWORD:
+            break;
+    }
+
+    return 3;
+}
+
+static const char* reg_name(x86_reg reg, x86_width width) {
+    return REG_NAMES[reg][width_index(width)];
+}
+
+static char suffix(x86_width width) {
+    return "bwlq"[width_index(width)];
+}
+
+static void write_operand(x86_asm* self, x86_operand op, x86_width width) {
+    switch (op.kind) {
+        case X86_OPERAND_REG:
+            fprintf(self->out, "%%%s", reg_name(op.reg, width));
+            break;
+
+        case X86_OPERAND_IMM:
+            fprintf(self->out, "$%d", op.value);
+            break;
+
+        case X86_OPERAND_MEM:
+            fprintf(
+                self->out, "%d(%%%s)", op.value, reg_name(op.reg, X86_QWORD)
+            );
+            break;
+    }
+}
+
+static void write_symbol(x86_asm* self, x86_symbol symbol) {
+    x86_symbol_info* s = &self->symbols.items[symbol];
+    fwrite(s->name, 1, s->len, self->out);
+}
+
+// Encoding
+
+/* An instruction being encoded, at most 15 bytes */
+typedef struct {
+    uint8_t bytes[16];
+    size_t len;
+} insn;
+
+enum {
+    /* REX.W, 64 bit operands */
+    ENC_W = 1,
+
+    /* Operand size prefix, 16 bit operands */
+    ENC_OPSIZE = 2,
+
+    /* The ModRM reg or rm field is a byte register. spl, bpl, sil and dil
+     * take a REX prefix, without one they would be ah, ch, dh and bh. */
+    ENC_BYTE_REG = 4,
+    ENC_BYTE_RM = 8,
+};
+
+static void put(insn* i, uint8_t byte) {
+    i->bytes[i->len++] = byte;
+}
+
+static void put16(insn* i, uint16_t value) {
+    put(i, value);
+    put(i, value >> 8);
+}
+
+static void put32(insn* i, uint32_t value) {
+    put16(i, value);
+    put16(i, value >> 16);
+}
+
+static void put64(insn* i, uint64_t value) {
+    put32(i, value);
+    put32(i, value >> 32);
+}
+
+static bool fits_int8(int64_t value) {
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+/* Prefixes, REX and opcode of an instruction whose ModRM holds register
+ * or opcode extension `reg` and operand `rm`. Opcodes above 0xff are two
+ * bytes, 0x0f and the low byte. */
+static void put_opcode(
+    insn* i, unsigned flags, unsigned opcode, unsigned reg, x86_operand rm
+) {
+    if (flags & ENC_OPSIZE) {
+        put(i, 0x66);
+    }
+
+    uint8_t rex = 0x40;
+
+    if (flags & ENC_W) {
+        rex |= 8;
+    }
+
+    if (reg & 8) {
+        rex |= 4;
+    }
+
+    if (rm.kind != X86_OPERAND_IMM && (rm.reg & 8)) {
+        rex |= 1;
+    }
+
+    bool byte_reg = (flags & ENC_BYTE_REG) && reg >= 4 && reg < 8;
+    bool byte_rm = (flags & ENC_BYTE_RM) && rm.kind == X86_OPERAND_REG &&
+                   rm.reg >= 4 && rm.reg < 8;
+
+    if (rex != 0x40 || byte_reg || byte_rm) {
+        put(i, rex);
+    }
+
+    if (opcode > 0xff) {
+        put(i, opcode >> 8);
+    }
+
+    put(i, opcode);
+}
+
+static void put_modrm(insn* i, unsigned reg, x86_operand rm) {
+    reg &= 7;
+
+    if (rm.kind == X86_OPERAND_REG) {
+        put(i, 0xc0 | reg << 3 | (rm.reg & 7));
+        return;
+    }
+
+    unsigned base = rm.reg & 7;
+    int32_t disp = rm.value;
+
+    /* rbp and r13 have no form without a displacement */
+    unsigned mod = disp == 0 && base != X86_RBP ? 0
+                   : fits_int8(disp)            ? 1
+                                                : 2;
+
+    put(i, mod << 6 | reg << 3 | base);
+
+    /* rsp and r12 need a SIB byte, with no index */
+    if (base == X86_RSP) {
+        put(i, 0x24);
+    }
+
+    if (mod == 1) {
+        put(i, disp);
+    } else if (mod == 2) {
+        put32(i, disp);
+    }
+}
+
+static void encode(
+    insn* i, unsigned flags, unsigned opcode, unsigned reg, x86_operand rm
+) {
+    put_opcode(i, flags, opcode, reg, rm);
+    put_modrm(i, reg, rm);
+}
+
+/* An instruction addressing memory relative to the next one */
+static void encode_rip(insn* i, unsigned flags, unsigned opcode, unsigned reg) {
+    put_opcode(i, flags, opcode, reg, X86_REG(X86_RAX));
+    put(i, (reg & 7) << 3 | 5);
+    put32(i, 0);
+}
+
+static unsigned width_flags(x86_width width) {
+    switch (width) {
+        case X86_BYTE:
+            return ENC_BYTE_REG | ENC_BYTE_RM;
+        case X86_WORD:
+            return ENC_OPSIZE;
+        case X86_DWORD:
+            break;
+        case X86_QWORD:
+            return ENC_W;
+    }
+
+    return 0;
+}
+
+static void emit(x86_asm* self, insn* i) {
+    self->instruction_count++;
+    vec_push_n(&self->sections[X86_SECTION_TEXT], i->bytes, i->len);
+}
+
+/* Emits `i`, whose last 4 bytes are a field for the position of `target`
+ * relative to the end of the field */
+static void emit_fixup(
+    x86_asm* self, insn* i, bool is_label, size_t target, x86_reloc_kind kind
+) {
+    fixup f = {
+        .offset = self->sections[X86_SECTION_TEXT].len + i->len - 4,
+        .kind = kind,
+        .is_label = is_label,
+        .target = target,
+    };
+
+    vec_push(&self->fixups, &f);
+    emit(self, i);
+}
+
+static void put_le32(uint8_t* at, uint32_t value) {
+    at[0] = value;
+    at[1] = value >> 8;
+    at[2] = value >> 16;
+    at[3] = value >> 24;
+}
+
+/* Resolves the fields within .text, and leaves the others to the linker */
+static void resolve_fixups(x86_asm* self) {
+    uint8_t* text = self->sections[X86_SECTION_TEXT].items;
+
+    for (size_t i = 0; i < self->fixups.len; i++) {
+        fixup* f = &self->fixups.items[i];
+        x86_reloc reloc = {
+            .kind = f->kind,
+            .offset = f->offset,
+            .symbol = X86_NO_SYMBOL,
+            .addend = -4,
+        };
+
+        if (f->is_label) {
+            label_entry* label = &self->labels.items[f->target];
+
+            if (label->section == X86_SECTION_TEXT) {
+                put_le32(text + f->offset, label->offset - (f->offset + 4));
+                continue;
+            }
+
+            reloc.addend += label->offset;
+        } else {
+            x86_symbol_info* symbol = &self->symbols.items[f->target];
+
+            if (symbol->kind != X86_SYMBOL_EXTERN) {
+                put_le32(text + f->offset, symbol->offset - (f->offset + 4));
+                continue;
+            }
+
+            reloc.symbol = f->target;
+        }
+
+        vec_push(&self->relocs, &reloc);
+    }
+}
+
+// Output
+
+static x86_asm* make(allocator_t* allocator, FILE* out) {
+    x86_asm* self = ALLOC(allocator, x86_asm);
+
+    *self = (x86_asm){
+        .allocator = allocator,
+        .out = out,
+        .symbols = vec_make(allocator),
+        .labels = vec_make(allocator),
+        .fixups = vec_make(allocator),
+        .relocs = vec_make(allocator),
+        .in_function = false,
+    };
+
+    for (size_t i = 0; i < X86_SECTION_COUNT; i++) {
+        self->sections[i] = (vec_byte)vec_make(allocator);
+    }
+
+    return self;
+}
+
+x86_asm* x86_asm_make(allocator_t* allocator, FILE* out) {
+    x86_asm* self = make(allocator, out);
+
+    fprintf(out, "\t.text\n");
+
+    return self;
+}
+
+x86_asm* x86_asm_make_binary(allocator_t* allocator) {
+    return make(allocator, NULL);
+}
+
+void x86_asm_destroy(x86_asm* self) {
+    allocator_t* allocator = self->allocator;
+
+    for (size_t i = 0; i < self->symbols.len; i++) {
+        x86_symbol_info* s = &self->symbols.items[i];
+        FREE_ARRAY(allocator, (char*)s->name, char, s->len);
+    }
+
+    for (size_t i = 0; i < X86_SECTION_COUNT; i++) {
+        vec_free(&self->sections[i]);
+    }
+
+    vec_free(&self->symbols);
+    vec_free(&self->labels);
+    vec_free(&self->fixups);
+    vec_free(&self->relocs);
+    FREE(allocator, self, x86_asm);
+}
+
+x86_symbol x86_symbol_make(
+    x86_asm* self, const char* name, size_t len, x86_symbol_kind kind
+) {
+    char* copy = ALLOC_ARRAY(self->allocator, char, len);
+    memcpy(copy, name, len);
+
+    x86_symbol_info s = {
+        .name = copy,
+        .len = len,
+        .kind = kind,
+        .defined = false,
+        .offset = 0,
+        .size = 0,
+    };
+
+    vec_push(&self->symbols, &s);
+
+    return self->symbols.len - 1;
+}
+
+static void end_function(x86_asm* self) {
+    if (!self->in_function) {
+        return;
+    }
+
+    self->in_function = false;
+
+    if (self->out == NULL) {
+        x86_symbol_info* s = &self->symbols.items[self->function];
+        s->size = self->sections[X86_SECTION_TEXT].len - s->offset;
+        return;
+    }
+
+    fprintf(self->out, "\t.size ");
+    write_symbol(self, self->function);
+    fprintf(self->out, ", .-");
+    write_symbol(self, self->function);
+    fprintf(self->out, "\n");
+}
+
+void x86_end(x86_asm* self) {
+    end_function(self);
+
+    if (self->out == NULL) {
+        resolve_fixups(self);
+        return;
+    }
+
+    /* The stack does not need to be executable */
+    fprintf(self->out, "\n\t.section .note.GNU-stack,\"\",@progbits\n");
+}
+
+x86_object x86_asm_object(const x86_asm* self) {
+    x86_object object = {
+        .symbols = self->symbols.items,
+        .symbol_count = self->symbols.len,
+        .relocs = self->relocs.items,
+        .reloc_count = self->relocs.len,
+        .instruction_count = self->instruction_count,
+    };
+
+    for (size_t i = 0; i < X86_SECTION_COUNT; i++) {
+        object.sections[i] = self->sections[i].items;
+        object.section_sizes[i] = self->sections[i].len;
+    }
+
+    return object;
+}
+
+void x86_function(x86_asm* self, x86_symbol symbol) {
+    end_function(self);
+
+    self->in_function = true;
+    self->function = symbol;
+
+    /* Functions are aligned, which also keeps the lowest bit of their
+     * addresses clear for closures (see closure.h) */
+    if (self->out == NULL) {
+        uint8_t pad = 0xcc;
+
+        while (self->sections[X86_SECTION_TEXT].len % 16 != 0) {
+            vec_push(&self->sections[X86_SECTION_TEXT], &pad);
+        }
+
+        self->symbols.items[symbol].defined = true;
+        self->symbols.items[symbol].offset =
+            self->sections[X86_SECTION_TEXT].len;
+        return;
+    }
+
+    fprintf(self->out, "\n");
+
+    if (self->symbols.items[symbol].kind == X86_SYMBOL_GLOBAL) {
+        fprintf(self->out, "\t.globl ");
+        write_symbol(self, symbol);
+        fprintf(self->out, "\n");
+    }
+
+    fprintf(self->out, "\t.type ");
+    write_symbol(self, symbol);
+    fprintf(self->out, ", @function\n\t.p2align 4\n");
+    write_symbol(self, symbol);
+    fprintf(self->out, ":\n");
+}
+
+x86_label x86_label_make(x86_asm* self) {
+    label_entry label = {.section = X86_SECTION_TEXT, .offset = 0};
+    vec_push(&self->labels, &label);
+
+    return self->labels.len - 1;
+}
+
+static void bind_in(x86_asm* self, x86_label label, x86_section section) {
+    self->labels.items[label] = (label_entry){
+        .section = section,
+        .offset = self->sections[section].len,
+    };
+}
+
+void x86_bind(x86_asm* self, x86_label label) {
+    if (self->out == NULL) {
+        bind_in(self, label, X86_SECTION_TEXT);
+        return;
+    }
+
+    fprintf(self->out, ".L%zu:\n", label);
+}
+
+x86_label x86_string(x86_asm* self, const char* str, size_t len) {
+    x86_label label = x86_label_make(self);
+    FILE* out = self->out;
+
+    if (out == NULL) {
+        static const uint8_t padding[8] = {0};
+        vec_byte* rodata = &self->sections[X86_SECTION_RODATA];
+        insn header = {.len = 0};
+
+        vec_push_n(rodata, padding, (-rodata->len & 7));
+        bind_in(self, label, X86_SECTION_RODATA);
+
+        put64(&header, len);
+        vec_push_n(rodata, header.bytes, header.len);
+        vec_push_n(rodata, str, len);
+
+        return label;
+    }
+
+    fprintf(out, "\t.section .rodata\n\t.p2align 3\n");
+    fprintf(out, ".L%zu:\n", label);
+    fprintf(out, "\t.quad %zu\n\t.ascii \"", len);
+
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = str[i];
+
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c >= ' ' && c < 0x7f) {
+            fputc(c, out);
+        } else {
+            fprintf(out, "\\%03o", c);
+        }
+    }
+
+    fprintf(out, "\"\n\t.text\n");
+
+    return label;
+}
+
+// Instructions
+
+void x86_mov(x86_asm* self, x86_reg dst, x86_operand src) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tmovq ");
+        write_operand(self, src, X86_QWORD);
+        fprintf(self->out, ", %%%s\n", reg_name(dst, X86_QWORD));
+        return;
+    }
+
+    insn i = {.len = 0};
+
+    if (src.kind == X86_OPERAND_IMM) {
+        encode(&i, ENC_W, 0xc7, 0, X86_REG(dst));
+        put32(&i, src.value);
+    } else {
+        encode(&i, ENC_W, 0x8b, dst, src);
+    }
+
+    emit(self, &i);
+}
+
+void x86_mov_imm(x86_asm* self, x86_reg dst, int64_t value) {
+    if (value >= INT32_MIN && value <= INT32_MAX) {
+        x86_mov(self, dst, X86_IMM((int32_t)value));
+        return;
+    }
+
+    /* Writing the low half clears the high one */
+    bool low_half = value >= 0 && value <= UINT32_MAX;
+
+    if (self->out != NULL) {
+        fprintf(
+            self->out,
+            "\t%s $%lld, %%%s\n",
+            low_half ? "movl" : "movabsq",
+            (long long)value,
+            reg_name(dst, low_half ? X86_DWORD : X86_QWORD)
+        );
+        return;
+    }
+
+    insn i = {.len = 0};
+
+    put_opcode(&i, low_half ? 0 : ENC_W, 0xb8 + (dst & 7), 0, X86_REG(dst));
+
+    if (low_half) {
+        put32(&i, value);
+    } else {
+        put64(&i, value);
+    }
+
+    emit(self, &i);
+}
+
+void x86_store(x86_asm* self, x86_reg base, int32_t disp, x86_reg src) {
+    if (self->out != NULL) {
+        fprintf(
+            self->out,
+            "\tmovq %%%s, %d(%%%s)\n",
+            reg_name(src, X86_QWORD),
+            disp,
+            reg_name(base, X86_QWORD)
+        );
+        return;
+    }
+
+    insn i = {.len = 0};
+    encode(&i, ENC_W, 0x89, src, X86_MEM(base, disp));
+    emit(self, &i);
+}
+
+void x86_lea(x86_asm* self, x86_reg dst, x86_reg base, int32_t disp) {
+    if (self->out != NULL) {
+        fprintf(
+            self->out,
+            "\tleaq %d(%%%s), %%%s\n",
+            disp,
+            reg_name(base, X86_QWORD),
+            reg_name(dst, X86_QWORD)
+        );
+        return;
+    }
+
+    insn i = {.len = 0};
+    encode(&i, ENC_W, 0x8d, dst, X86_MEM(base, disp));
+    emit(self, &i);
+}
+
+void x86_lea_label(x86_asm* self, x86_reg dst, x86_label label) {
+    if (self->out != NULL) {
+        fprintf(
+            self->out,
+            "\tleaq .L%zu(%%rip), %%%s\n",
+            label,
+            reg_name(dst, X86_QWORD)
+        );
+        return;
+    }
+
+    insn i = {.len = 0};
+    encode_rip(&i, ENC_W, 0x8d, dst);
+    emit_fixup(self, &i, true, label, X86_RELOC_PC32);
+}
+
+void x86_lea_symbol(x86_asm* self, x86_reg dst, x86_symbol symbol) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tleaq ");
+        write_symbol(self, symbol);
+        fprintf(self->out, "(%%rip), %%%s\n", reg_name(dst, X86_QWORD));
+        return;
+    }
+
+    insn i = {.len = 0};
+    encode_rip(&i, ENC_W, 0x8d, dst);
+    emit_fixup(self, &i, false, symbol, X86_RELOC_PC32);
+}
+
+/* The immediate of a group 1 instruction or of imul, sign extended from a
+ * byte if it fits in one */
+static void put_imm(insn* i, x86_width width, int32_t value, bool short_form) {
+    if (short_form) {
+        put(i, value);
+    } else if (width == X86_WORD) {
+        put16(i, value);
+    } else {
+        put32(i, value);
+    }
+}
+
+void x86_alu(
+    x86_asm* self, x86_alu_op op, x86_width width, x86_reg dst, x86_operand src
+) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\t%s%c ", ALU_NAMES[op], suffix(width));
+        write_operand(self, src, width);
+        fprintf(self->out, ", %%%s\n", reg_name(dst, width));
+        return;
+    }
+
+    insn i = {.len = 0};
+    unsigned flags = width_flags(width);
+
+    if (src.kind != X86_OPERAND_IMM) {
+        /* op r, r/m: 0x02 for bytes, 0x03 otherwise */
+        encode(&i, flags, op << 3 | (width == X86_BYTE ? 2 : 3), dst, src);
+    } else if (width == X86_BYTE) {
+        encode(&i, ENC_BYTE_RM, 0x80, op, X86_REG(dst));
+        put(&i, src.value);
+    } else {
+        bool short_form = fits_int8(src.value);
+
+        encode(&i, flags, short_form ? 0x83 : 0x81, op, X86_REG(dst));
+        put_imm(&i, width, src.value, short_form);
+    }
+
+    emit(self, &i);
+}
+
+void x86_imul(x86_asm* self, x86_width width, x86_reg dst, x86_operand src) {
+    if (width == X86_BYTE) {
+        width = X86_DWORD;
+    }
+
+    if (self->out != NULL) {
+        fprintf(self->out, "\timul%c ", suffix(width));
+        write_operand(self, src, width);
+
+        if (src.kind == X86_OPERAND_IMM) {
+            fprintf(self->out, ", %%%s", reg_name(dst, width));
+        }
+
+        fprintf(self->out, ", %%%s\n", reg_name(dst, width));
+        return;
+    }
+
+    insn i = {.len = 0};
+    unsigned flags = width_flags(width);
+
+    if (src.kind != X86_OPERAND_IMM) {
+        encode(&i, flags, 0x0faf, dst, src);
+    } else {
+        bool short_form = fits_int8(src.value);
+
+        encode(&i, flags, short_form ? 0x6b : 0x69, dst, X86_REG(dst));
+        put_imm(&i, width, src.value, short_form);
+    }
+
+    emit(self, &i);
+}
+
+/* An instruction of group 3 (0xf7) on a 64 bit register */
+static void encode_group3(x86_asm* self, unsigned ext, x86_reg reg) {
+    insn i = {.len = 0};
+    encode(&i, ENC_W, 0xf7, ext, X86_REG(reg));
+    emit(self, &i);
+}
+
+void x86_neg(x86_asm* self, x86_reg reg) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tnegq %%%s\n", reg_name(reg, X86_QWORD));
+        return;
+    }
+
+    encode_group3(self, 3, reg);
+}
+
+void x86_extend(x86_asm* self, x86_reg reg, x86_width width, bool is_signed) {
+    if (width == X86_QWORD) {
+        return;
+    }
+
+    /* Zero extending to 32 bits clears the high half as well */
+    x86_width to = is_signed ? X86_QWORD : X86_DWORD;
+
+    if (self->out != NULL) {
+        if (width == X86_DWORD) {
+            fprintf(
+                self->out,
+                "\t%s %%%s, %%%s\n",
+                is_signed ? "movslq" : "movl",
+                reg_name(reg, X86_DWORD),
+                reg_name(reg, to)
+            );
+            return;
+        }
+
+        fprintf(
+            self->out,
+            "\tmov%c%c%c %%%s, %%%s\n",
+            is_signed ? 's' : 'z',
+            suffix(width),
+            suffix(to),
+            reg_name(reg, width),
+            reg_name(reg, to)
+        );
+        return;
+    }
+
+    insn i = {.len = 0};
+    unsigned flags = is_signed ? ENC_W : 0;
+    unsigned opcode;
+
+    switch (width) {
+        case X86_BYTE:
+            flags |= ENC_BYTE_RM;
+            opcode = is_signed ? 0x0fbe : 0x0fb6;
+            break;
+
+        case X86_WORD:
+            opcode = is_signed ? 0x0fbf : 0x0fb7;
+            break;
+
+        default:
+            /* movsxd, or a 32 bit mov */
+            opcode = is_signed ? 0x63 : 0x8b;
+            break;
+    }
+
+    encode(&i, flags, opcode, reg, X86_REG(reg));
+    emit(self, &i);
+}
+
+void x86_cqo(x86_asm* self) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tcqto\n");
+        return;
+    }
+
+    insn i = {.bytes = {0x48, 0x99}, .len = 2};
+    emit(self, &i);
+}
+
+void x86_idiv(x86_asm* self, x86_reg divisor) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tidivq %%%s\n", reg_name(divisor, X86_QWORD));
+        return;
+    }
+
+    encode_group3(self, 7, divisor);
+}
+
+void x86_div(x86_asm* self, x86_reg divisor) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tdivq %%%s\n", reg_name(divisor, X86_QWORD));
+        return;
+    }
+
+    encode_group3(self, 6, divisor);
+}
+
+void x86_test(x86_asm* self, x86_reg a, x86_reg b) {
+    if (self->out != NULL) {
+        fprintf(
+            self->out,
+            "\ttestq %%%s, %%%s\n",
+            reg_name(b, X86_QWORD),
+            reg_name(a, X86_QWORD)
+        );
+        return;
+    }
+
+    insn i = {.len = 0};
+    encode(&i, ENC_W, 0x85, b, X86_REG(a));
+    emit(self, &i);
+}
+
+void x86_set(x86_asm* self, x86_cond cond, x86_reg reg) {
+    if (self->out != NULL) {
+        fprintf(
+            self->out,
+            "\tset%s %%%s\n\tmovzbl %%%s, %%%s\n",
+            COND_NAMES[cond],
+            reg_name(reg, X86_BYTE),
+            reg_name(reg, X86_BYTE),
+            reg_name(reg, X86_DWORD)
+        );
+        return;
+    }
+
+    insn i = {.len = 0};
+    encode(&i, ENC_BYTE_RM, 0x0f90 | cond, 0, X86_REG(reg));
+    emit(self, &i);
+
+    x86_extend(self, reg, X86_BYTE, false);
+}
+
+void x86_jmp(x86_asm* self, x86_label label) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tjmp .L%zu\n", label);
+        return;
+    }
+
+    insn i = {.len = 0};
+    put(&i, 0xe9);
+    put32(&i, 0);
+    emit_fixup(self, &i, true, label, X86_RELOC_PC32);
+}
+
+void x86_jcc(x86_asm* self, x86_cond cond, x86_label label) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tj%s .L%zu\n", COND_NAMES[cond], label);
+        return;
+    }
+
+    insn i = {.len = 0};
+    put(&i, 0x0f);
+    put(&i, 0x80 | cond);
+    put32(&i, 0);
+    emit_fixup(self, &i, true, label, X86_RELOC_PC32);
+}
+
+void x86_call(x86_asm* self, x86_symbol symbol) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tcall ");
+        write_symbol(self, symbol);
+
+        if (self->symbols.items[symbol].kind == X86_SYMBOL_EXTERN) {
+            fprintf(self->out, "@PLT");
+        }
+
+        fprintf(self->out, "\n");
+        return;
+    }
+
+    insn i = {.len = 0};
+    put(&i, 0xe8);
+    put32(&i, 0);
+    emit_fixup(self, &i, false, symbol, X86_RELOC_PLT32);
+}
+
+void x86_call_reg(x86_asm* self, x86_reg reg) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tcall *%%%s\n", reg_name(reg, X86_QWORD));
+        return;
+    }
+
+    insn i = {.len = 0};
+    encode(&i, 0, 0xff, 2, X86_REG(reg));
+    emit(self, &i);
+}
+
+void x86_jmp_symbol(x86_asm* self, x86_symbol symbol) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tjmp ");
+        write_symbol(self, symbol);
+
+        if (self->symbols.items[symbol].kind == X86_SYMBOL_EXTERN) {
+            fprintf(self->out, "@PLT");
+        }
+
+        fprintf(self->out, "\n");
+        return;
+    }
+
+    insn i = {.len = 0};
+    put(&i, 0xe9);
+    put32(&i, 0);
+    emit_fixup(self, &i, false, symbol, X86_RELOC_PLT32);
+}
+
+void x86_jmp_reg(x86_asm* self, x86_reg reg) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tjmp *%%%s\n", reg_name(reg, X86_QWORD));
+        return;
+    }
+
+    insn i = {.len = 0};
+    encode(&i, 0, 0xff, 4, X86_REG(reg));
+    emit(self, &i);
+}
+
+/* push and pop take the register in the opcode */
+static void encode_short(x86_asm* self, unsigned opcode, x86_reg reg) {
+    insn i = {.len = 0};
+    put_opcode(&i, 0, opcode + (reg & 7), 0, X86_REG(reg));
+    emit(self, &i);
+}
+
+void x86_push(x86_asm* self, x86_reg reg) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tpushq %%%s\n", reg_name(reg, X86_QWORD));
+        return;
+    }
+
+    encode_short(self, 0x50, reg);
+}
+
+void x86_pop(x86_asm* self, x86_reg reg) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tpopq %%%s\n", reg_name(reg, X86_QWORD));
+        return;
+    }
+
+    encode_short(self, 0x58, reg);
+}
+
+void x86_leave(x86_asm* self) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tleave\n");
+        return;
+    }
+
+    insn i = {.bytes = {0xc9}, .len = 1};
+    emit(self, &i);
+}
+
+void x86_ret(x86_asm* self) {
+    if (self->out != NULL) {
+        fprintf(self->out, "\tret\n");
+        return;
+    }
+
+    insn i = {.bytes = {0xc3}, .len = 1};
+    emit(self, &i);
+}
@@ -0,0 +1,272 @@
+/**
+ * x86-64 instruction emitter
+ *
+ * The native backend (see codegen.h) describes its output one instruction
+ * at a time through these functions. An emitter either writes it out as GNU
+ * assembly in AT&T syntax, or encodes it to machine code: the contents of
+ * the .text and .rodata sections, the symbols defined and used, and the
+ * relocations left for the linker, ready for an object file writer (see
+ * elf_writer.h). Only the instruction forms the backend needs are here.
+ *
+ * Functions and data are named by symbols, which end up in the symbol table
+ * of the object file, and branch targets by labels, which are local to the
+ * output. Both are small integers handed out by the emitter. Branches and
+ * calls within .text are resolved by the emitter itself.
+ */
+
+#ifndef X86_H
+#define X86_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "alloc.h"
+
+/* In the order of their encoding */
+typedef enum {
+    X86_RAX,
+    X86_RCX,
+    X86_RDX,
+    X86_RBX,
+    X86_RSP,
+    X86_RBP,
+    X86_RSI,
+    X86_RDI,
+    X86_R8,
+    X86_R9,
+    X86_R10,
+    X86_R11,
+    X86_R12,
+    X86_R13,
+    X86_R14,
+    X86_R15,
+} x86_reg;
+
+/* Operand size in bytes */
+typedef enum {
+    X86_BYTE = 1,
+    X86_WORD = 2,
+    X86_DWORD = 4,
+    X86_QWORD = 8,
+} x86_width;
+
+/* Arithmetic group 1, valued as the opcode extension they are encoded
+ * with */
+typedef enum {
+    X86_ADD = 0,
+    X86_OR = 1,
+    X86_AND = 4,
+    X86_SUB = 5,
+    X86_XOR = 6,
+    X86_CMP = 7,
+} x86_alu_op;
+
+/* Condition codes, valued as the low nibble of Jcc and SETcc */
+typedef enum {
+    X86_CC_B = 0x2,
+    X86_CC_AE = 0x3,
+    X86_CC_E = 0x4,
+    X86_CC_NE = 0x5,
+    X86_CC_BE = 0x6,
+    X86_CC_A = 0x7,
+    X86_CC_L = 0xc,
+    X86_CC_GE = 0xd,
+    X86_CC_LE = 0xe,
+    X86_CC_G = 0xf,
+} x86_cond;
+
+typedef enum {
+    X86_OPERAND_REG,
+    X86_OPERAND_IMM,
+
+    /* disp(base) */
+    X86_OPERAND_MEM,
+} x86_operand_kind;
+
+/* Source operand of the instructions that take a register, an immediate or
+ * memory. Immediates are sign extended from 32 bits. */
+typedef struct {
+    x86_operand_kind kind;
+    x86_reg reg;
+    int32_t value;
+} x86_operand;
+
+#define X86_REG(r) ((x86_operand){.kind = X86_OPERAND_REG, .reg = (r)})
+#define X86_IMM(v) ((x86_operand){.kind = X86_OPERAND_IMM, .value = (v)})
+#define X86_MEM(base, disp) \
+    ((x86_operand){.kind = X86_OPERAND_MEM, .reg = (base), .value = (disp)})
+
+typedef enum {
+    /* Defined here, only visible to this output */
+    X86_SYMBOL_LOCAL,
+
+    /* Defined here, visible to the linker */
+    X86_SYMBOL_GLOBAL,
+
+    /* Defined elsewhere, a C library function */
+    X86_SYMBOL_EXTERN,
+} x86_symbol_kind;
+
+typedef size_t x86_symbol;
+typedef size_t x86_label;
+
+typedef enum {
+    X86_SECTION_TEXT,
+    X86_SECTION_RODATA,
+
+    X86_SECTION_COUNT,
+} x86_section;
+
+typedef struct {
+    /* Not zero terminated */
+    const char* name;
+    size_t len;
+    x86_symbol_kind kind;
+
+    /* Whether a function was started at the symbol, where it starts in
+     * .text, and its size */
+    bool defined;
+    size_t offset;
+    size_t size;
+} x86_symbol_info;
+
+typedef enum {
+    /* R_X86_64_PC32, the target relative to the end of the field */
+    X86_RELOC_PC32,
+
+    /* R_X86_64_PLT32, same for a call, which the linker may send through
+     * the procedure linkage table */
+    X86_RELOC_PLT32,
+} x86_reloc_kind;
+
+/* A 32 bit field of .text the linker fills in */
+typedef struct {
+    x86_reloc_kind kind;
+    size_t offset;
+
+    /* The target is a symbol, or an offset into .rodata when `symbol` is
+     * X86_NO_SYMBOL */
+    x86_symbol symbol;
+    int64_t addend;
+} x86_reloc;
+
+#define X86_NO_SYMBOL ((x86_symbol) -1)
+
+/* Machine code made by an emitter, valid until it is destroyed */
+typedef struct {
+    const uint8_t* sections[X86_SECTION_COUNT];
+    size_t section_sizes[X86_SECTION_COUNT];
+
+    /* Indexed by x86_symbol */
+    const x86_symbol_info* symbols;
+    size_t symbol_count;
+
+    const x86_reloc* relocs;
+    size_t reloc_count;
+
+    /* Instructions in .text */
+    size_t instruction_count;
+} x86_object;
+
+typedef struct _x86_asm x86_asm;
+
+/**
+ * Makes an emitter writing assembly to `out`.
+ */
+x86_asm* x86_asm_make(allocator_t* allocator, FILE* out);
+
+/**
+ * Makes an emitter encoding machine code, see x86_asm_object.
+ */
+x86_asm* x86_asm_make_binary(allocator_t* allocator);
+
+void x86_asm_destroy(x86_asm* self);
+
+/**
+ * Makes a symbol named `name`, which is copied. Names made by the backend
+ * may contain dots, which keeps them apart from C names.
+ */
+x86_symbol x86_symbol_make(
+    x86_asm* self, const char* name, size_t len, x86_symbol_kind kind
+);
+
+/**
+ * Starts function `symbol` here, and ends the last one.
+ */
+void x86_function(x86_asm* self, x86_symbol symbol);
+
+/**
+ * Ends the last function and the output. Must come last.
+ */
+void x86_end(x86_asm* self);
+
+/**
+ * The machine code of a binary emitter, after x86_end.
+ */
+x86_object x86_asm_object(const x86_asm* self);
+
+x86_label x86_label_make(x86_asm* self);
+
+/**
+ * Places `label` at the next instruction.
+ */
+void x86_bind(x86_asm* self, x86_label label);
+
+/**
+ * Adds a string constant to the read only data: its length as 64 bits,
+ * followed by its bytes. Returns the label of the length.
+ */
+x86_label x86_string(x86_asm* self, const char* str, size_t len);
+
+// Instructions, 64 bit unless they take a width
+
+void x86_mov(x86_asm* self, x86_reg dst, x86_operand src);
+void x86_mov_imm(x86_asm* self, x86_reg dst, int64_t value);
+void x86_store(x86_asm* self, x86_reg base, int32_t disp, x86_reg src);
+void x86_lea(x86_asm* self, x86_reg dst, x86_reg base, int32_t disp);
+void x86_lea_label(x86_asm* self, x86_reg dst, x86_label label);
+void x86_lea_symbol(x86_asm* self, x86_reg dst, x86_symbol symbol);
+
+void x86_alu(
+    x86_asm* self, x86_alu_op op, x86_width width, x86_reg dst, x86_operand src
+);
+
+/* No byte form, bytes are multiplied as double words */
+void x86_imul(x86_asm* self, x86_width width, x86_reg dst, x86_operand src);
+
+void x86_neg(x86_asm* self, x86_reg reg);
+
+/**
+ * Sign or zero extends the low `width` bytes of `reg` to all of it.
+ */
+void x86_extend(x86_asm* self, x86_reg reg, x86_width width, bool is_signed);
+
+/* rdx:rax divided by `divisor`, quotient in rax and remainder in rdx */
+void x86_cqo(x86_asm* self);
+void x86_idiv(x86_asm* self, x86_reg divisor);
+void x86_div(x86_asm* self, x86_reg divisor);
+
+void x86_test(x86_asm* self, x86_reg a, x86_reg b);
+
+/**
+ * Sets `reg` to 1 if `cond` holds and to 0 otherwise.
+ */
+void x86_set(x86_asm* self, x86_cond cond, x86_reg reg);
+
+void x86_jmp(x86_asm* self, x86_label label);
+void x86_jcc(x86_asm* self, x86_cond cond, x86_label label);
+void x86_call(x86_asm* self, x86_symbol symbol);
+void x86_call_reg(x86_asm* self, x86_reg reg);
+
+/* Jumps to a function, for tail calls */
+void x86_jmp_symbol(x86_asm* self, x86_symbol symbol);
+void x86_jmp_reg(x86_asm* self, x86_reg reg);
+
+void x86_push(x86_asm* self, x86_reg reg);
+void x86_pop(x86_asm* self, x86_reg reg);
+void x86_leave(x86_asm* self);
+void x86_ret(x86_asm* self);
+
+#endif  // X86_H
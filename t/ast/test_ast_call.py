@@ -14,3 +14,8 @@ def test_call():
     # Error: arguments should be separated by a comma
     assert stmt2sexpr("a(b c);") == ""
     assert stmt2sexpr("a(b c d);") == ""
+
+    # More arguments than fit inline
+    assert stmt2sexpr("a(b, c, d, e, f, g, h, i, j, k);") == (
+        "(call a b c d e f g h i j k)"
+    )
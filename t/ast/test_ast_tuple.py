@@ -12,3 +12,7 @@ def test_tuple_type():
     assert stmt2sexpr("let pair: (string, i32);") == "(let pair :(string, i32) NULL)"
 
     assert stmt2sexpr("let pair: ((string, i32), (string, i32));") == "(let pair :((string, i32), (string, i32)) NULL)"
+
+    assert stmt2sexpr("let many: (i8, i16, i32, u8, u16, u32, string, string, i8, i8);") == (
+        "(let many :(i8, i16, i32, u8, u16, u32, string, string, i8, i8) NULL)"
+    )
@@ -0,0 +1,62 @@
+import json
+
+from lib import compile_files
+
+CODE = """
+fn add(a: i32, b: i32) -> i32 {
+    a + b;
+}
+
+fn main() {
+    let x = add(1, 2);
+    let f = fn(y: i32) -> i32 { y * 2; };
+}
+"""
+
+
+def test_alloc_stats_json():
+    (stderr, status) = compile_files([CODE], ["--alloc-stats=json"])
+    assert status == 0
+
+    stats = json.loads(stderr[stderr.index("{"):])
+
+    assert stats["allocations"] > 0
+    assert stats["unknown_frees"] == 0
+    assert stats["peak_bytes"] >= stats["current_bytes"]
+
+    sites = stats["sites"]
+    assert sum(site["allocations"] for site in sites) == stats["allocations"]
+    assert all(site["file"].endswith(".c") for site in sites)
+
+    histogram = stats["histogram"]
+    assert sum(bucket["count"] for bucket in histogram) == (
+        stats["allocations"] + stats["resizes"]
+    )
+
+
+def test_alloc_stats_table():
+    (stderr, status) = compile_files([CODE], ["--alloc-stats"])
+    assert status == 0
+
+    assert "allocations:" in stderr
+    assert "site" in stderr
+    assert "size" in stderr
+
+
+def test_callbacks_do_not_allocate():
+    code = """
+    fn apply(f: fn(i32) -> i32, x: i32) -> i32 { f(x); }
+    fn main() {
+        let k = 3;
+        let mut i = 0;
+        while i < %d { apply(fn(x: i32) -> i32 { x * k; }, i); i = i + 1; }
+    }
+    """
+
+    def allocations(n: int) -> int:
+        (stderr, status) = compile_files([code % n], ["--alloc-stats=json"])
+        assert status == 0
+
+        return json.loads(stderr[stderr.index("{"):])["allocations"]
+
+    assert allocations(10) == allocations(1000)
@@ -0,0 +1,77 @@
+import subprocess
+
+from lib import batch, code2sexpr, code2token_list, typecheck_passes
+
+PROGRAMS = [
+    "fn main() { let a = 1 + 2; }",
+    "",
+    "fn f(a: i32, b: i32) -> i32 { a * b; } fn main() { let c = f(1, 2); }",
+    "fn main() { let a: string = 1; }",
+    "fn main() { let f = fn(x: u8) -> u8 { x; }; if true { f(1); } }",
+]
+
+
+def test_sexpr_matches_helper():
+    results = batch("sexpr", PROGRAMS)
+
+    assert len(results) == len(PROGRAMS)
+    for program, (status, output, diagnostics) in zip(PROGRAMS, results):
+        assert status == 0
+        assert output.strip() == code2sexpr(program)
+        assert diagnostics == ""
+
+
+def test_tokens_match_helper():
+    for program, (status, output, _) in zip(PROGRAMS, batch("tokens", PROGRAMS)):
+        assert status == 0
+        assert output == code2token_list(program)
+
+
+def test_typecheck_matches_helper():
+    for program, (status, _, _) in zip(PROGRAMS, batch("typecheck", PROGRAMS)):
+        assert (status == 0) == typecheck_passes(program)
+
+
+def test_errors_are_framed():
+    results = batch(
+        "compile",
+        ["fn main() { let = ; }", 'fn main() { let a = "x; }', PROGRAMS[0]],
+    )
+
+    assert [status for (status, _, _) in results] == [1, 1, 0]
+    assert "Syntax error" in results[0][2]
+    assert "Unterminated string" in results[1][2]
+    assert results[2] == (0, "", "")
+
+
+def test_length_prefixed_input():
+    programs = [p.encode() for p in PROGRAMS[:2]]
+    stdin = b"".join(b"%d\n%s" % (len(p), p) for p in programs)
+
+    proc = subprocess.run(
+        ["onec", "--batch=typecheck", "--batch-input=length"],
+        input=stdin,
+        stdout=subprocess.PIPE,
+    )
+
+    assert proc.returncode == 0
+    assert proc.stdout == b"0 0 0\n0 0 0\n"
+
+
+def test_malformed_length_prefixed_input():
+    proc = subprocess.run(
+        ["onec", "--batch=tokens", "--batch-input=length"],
+        input=b"100\nfn main",
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+    )
+
+    assert proc.returncode == 1
+    assert b"Malformed" in proc.stderr
+
+
+def test_many_snippets():
+    programs = [f"fn main() {{ let a: i32 = {i}; }}" for i in range(5000)]
+    results = batch("typecheck", programs)
+
+    assert results == [(0, "", "")] * 5000
@@ -0,0 +1,38 @@
+import tempfile
+
+from lib import invoke_onec
+
+CODE = b"""
+fn main() {
+    let a = 1;
+    let b: string = "hello";
+}
+"""
+
+
+def compile_with(code: bytes, args: list[str]) -> int:
+    with tempfile.NamedTemporaryFile() as tmp:
+        tmp.write(code)
+        tmp.flush()
+        (_, status) = invoke_onec([tmp.name, *args])
+        return status
+
+
+def test_read_and_mmap_strategies():
+    # small enough to be read by default, forced to be mapped
+    assert compile_with(CODE, []) == 0
+    assert compile_with(CODE, ["--mmap-threshold=0"]) == 0
+    assert compile_with(CODE, ["--mmap-threshold=0", "--mmap-populate"]) == 0
+
+
+def test_page_sized_file():
+    # a mapping of this file would end exactly on a page boundary with no
+    # terminating zero after it
+    code = CODE + b" " * (4096 - len(CODE))
+    assert len(code) == 4096
+
+    assert compile_with(code, ["--mmap-threshold=0"]) == 0
+
+
+def test_invalid_threshold():
+    assert compile_with(CODE, ["--mmap-threshold=lots"]) == 1
@@ -0,0 +1,58 @@
+from lib import compile_files
+
+VALID = "fn main() { let a = 1 + 2; }\n"
+
+
+def status_lines(stderr: str) -> list[str]:
+    return [line for line in stderr.splitlines() if line.endswith((": ok", ": failed"))]
+
+
+def test_all_files_compile():
+    (stderr, status) = compile_files([VALID] * 8, ["--jobs=4"])
+
+    assert status == 0
+    assert status_lines(stderr) == [f"f{i}.one: ok" for i in range(8)]
+
+
+def test_failures_are_reported_per_file():
+    sources = [
+        VALID,
+        "fn main() { let a: string = 1; }",
+        "fn main() { let = ; }",
+        None,
+        VALID,
+    ]
+
+    (stderr, status) = compile_files(sources, ["--jobs=2"])
+
+    assert status == 1
+    assert status_lines(stderr) == [
+        "f0.one: ok",
+        "f1.one: failed",
+        "f2.one: failed",
+        "f3.one: failed",
+        "f4.one: ok",
+    ]
+    assert "Syntax error" in stderr
+
+
+def test_single_worker():
+    (stderr, status) = compile_files([VALID] * 3, ["--jobs=1", "--arena-stats"])
+
+    assert status == 0
+    assert len(status_lines(stderr)) == 3
+    assert "block pool:" in stderr
+
+
+def test_invalid_jobs():
+    (_, status) = compile_files([VALID, VALID], ["--jobs=0"])
+    assert status == 1
+
+
+def test_modes_take_a_single_file():
+    for flag in ["--emit-bytecode", "--interp", "--jit", "-O0", "--emit-ir"]:
+        (stderr, status) = compile_files([VALID, VALID], [flag])
+
+        assert status == 1
+        assert "take a single source file" in stderr
+        assert status_lines(stderr) == []
@@ -0,0 +1,135 @@
+import os
+import socket
+import struct
+import subprocess
+import tempfile
+import threading
+
+import pytest
+
+VALID = "fn main() { let a = 1 + 2; }\n"
+TYPE_ERROR = "fn main() { let a: string = 1; }\n"
+
+REQUEST_SOURCE = 2
+
+
+@pytest.fixture
+def server():
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, "onec.sock")
+        proc = subprocess.Popen(
+            ["onec", "--server", path, "--jobs=4"],
+            stderr=subprocess.PIPE,
+        )
+
+        # The server announces itself once it is accepting connections
+        assert proc.stderr.readline().startswith(b"Listening on")
+
+        yield (path, tmp)
+
+        proc.terminate()
+        proc.wait()
+
+        assert not os.path.exists(path)
+
+
+def client(socket_path: str, args: list[str], stdin: str = "") -> tuple[str, int]:
+    proc = subprocess.run(
+        ["onec", "--client", socket_path, *args],
+        input=stdin.encode(),
+        stderr=subprocess.PIPE,
+    )
+
+    return (proc.stderr.decode(), proc.returncode)
+
+
+def request(conn: socket.socket, source: str) -> tuple[str, int]:
+    """
+    Sends a source to the server over an open connection.
+    """
+    payload = source.encode()
+    conn.sendall(struct.pack("=IIQ", REQUEST_SOURCE, 0, len(payload)) + payload)
+
+    header = conn.recv(16, socket.MSG_WAITALL)
+    (status, _, length) = struct.unpack("=iIQ", header)
+
+    diagnostics = conn.recv(length, socket.MSG_WAITALL) if length else b""
+    return (diagnostics.decode(), status)
+
+
+def test_client_sends_paths(server):
+    (socket_path, tmp) = server
+
+    ok = os.path.join(tmp, "ok.one")
+    bad = os.path.join(tmp, "bad.one")
+
+    with open(ok, "w") as f:
+        f.write(VALID)
+    with open(bad, "w") as f:
+        f.write(TYPE_ERROR)
+
+    assert client(socket_path, [ok]) == ("", 0)
+
+    (stderr, status) = client(socket_path, [ok, bad])
+    assert status == 1
+    assert "incompatible assignment" in stderr
+    assert f"{ok}: ok" in stderr
+    assert f"{bad}: failed" in stderr
+
+
+def test_client_sends_stdin(server):
+    (socket_path, _) = server
+
+    assert client(socket_path, ["-"], stdin=VALID)[1] == 0
+    assert client(socket_path, ["-"], stdin="fn main() { let = ; }")[1] == 1
+
+
+def test_missing_file(server):
+    (socket_path, tmp) = server
+
+    (stderr, status) = client(socket_path, [os.path.join(tmp, "missing.one")])
+    assert status == 1
+    assert "Unable to open file" in stderr
+
+
+def test_many_requests_per_connection(server):
+    (socket_path, _) = server
+
+    with socket.socket(socket.AF_UNIX) as conn:
+        conn.connect(socket_path)
+
+        for _ in range(100):
+            assert request(conn, VALID) == ("", 0)
+
+        (diagnostics, status) = request(conn, TYPE_ERROR)
+        assert status == 1
+        assert "incompatible assignment" in diagnostics
+
+
+def test_concurrent_clients(server):
+    (socket_path, _) = server
+    results = []
+
+    def run(source: str):
+        with socket.socket(socket.AF_UNIX) as conn:
+            conn.connect(socket_path)
+            results.extend(request(conn, source)[1] for _ in range(20))
+
+    threads = [
+        threading.Thread(target=run, args=(VALID if i % 2 else TYPE_ERROR,))
+        for i in range(8)
+    ]
+
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    assert sorted(results) == [0] * 80 + [1] * 80
+
+
+def test_no_server():
+    with tempfile.TemporaryDirectory() as tmp:
+        (stderr, status) = client(os.path.join(tmp, "none.sock"), ["-"], VALID)
+        assert status == 1
+        assert "Unable to connect" in stderr
@@ -0,0 +1,28 @@
+from lib import invoke_onec
+
+
+def test_compiles_from_stdin():
+    code = """
+    fn main() {
+        let message: string = "hello";
+        let a = 1 + 2;
+    }
+    """
+
+    (_, status) = invoke_onec(["-"], stdin=code)
+    assert status == 0
+
+
+def test_large_input_from_stdin():
+    # larger than the initial read buffer, so it has to grow
+    code = "".join(
+        f"fn f{i}(a: i32) -> i32 {{ let x = a + {i}; }}\n" for i in range(20000)
+    )
+
+    (_, status) = invoke_onec(["-"], stdin=code)
+    assert status == 0
+
+
+def test_stdin_type_error():
+    (_, status) = invoke_onec(["-"], stdin="fn main() { let a: string = 1; }")
+    assert status == 1
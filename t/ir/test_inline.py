@@ -0,0 +1,99 @@
+import subprocess
+
+import pytest
+
+from lib import run
+
+
+def inlining(code: str, *flags: str) -> tuple[str, str]:
+    """
+    Returns the IR of 'code' and the inlining decisions.
+    """
+    proc = subprocess.run(
+        ["onec", "-", "--emit-ir", "--print-inlining", *flags],
+        input=code.encode(),
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+    )
+
+    assert proc.returncode == 0
+    return (proc.stdout.decode(), proc.stderr.decode())
+
+
+def test_small_functions_are_inlined():
+    code = """
+    fn add(a: i32, b: i32) -> i32 { a + b; }
+    fn main() -> i32 { add(1, 2); }
+    """
+    (ir, decisions) = inlining(code)
+
+    assert decisions == "main -> add: inlined, small (2 instructions)\n"
+    assert "call" not in ir.split("function 1 main")[1]
+    assert "const i32 3\n" in ir
+
+
+def test_recursive_functions_are_not_inlined():
+    code = """
+    fn even(n: i32) -> i32 { let r = 1; if n > 0 { r = odd(n - 1); } r; }
+    fn odd(n: i32) -> i32 { let r = 0; if n > 0 { r = even(n - 1); } r; }
+    fn main() -> i32 { even(10); }
+    """
+    (_, decisions) = inlining(code)
+
+    assert "even -> odd: not inlined, recursive\n" in decisions
+    assert "odd -> even: not inlined, recursive\n" in decisions
+
+
+def test_single_call_sites_are_inlined():
+    body = " ".join(f"s = s * 3 + {i};" for i in range(20))
+    code = f"""
+    fn big(n: i32) -> i32 {{ let mut s = n; {body} s; }}
+    fn main() -> i32 {{ big(1) & 127; }}
+    """
+    (_, decisions) = inlining(code)
+
+    assert "main -> big: inlined, single call site" in decisions
+
+    twice = code.replace("big(1) & 127", "(big(1) + big(2)) & 127")
+    (_, decisions) = inlining(twice)
+
+    assert "main -> big: not inlined, too large" in decisions
+
+
+def test_callbacks_are_inlined():
+    code = """
+    fn apply(f: fn(i32) -> i32, x: i32) -> i32 { f(x); }
+    fn main() -> i32 {
+        let k = 3;
+        apply(fn(x: i32) -> i32 { x * k; }, 5);
+    }
+    """
+    (ir, decisions) = inlining(code)
+
+    assert "apply -> ?: not inlined, unknown callee\n" in decisions
+    assert "main -> apply: inlined, small" in decisions
+    assert "main -> lambda.2: inlined, small" in decisions
+    assert "const i32 15\n" in ir
+    assert "closure" not in ir.split("function 1 main")[1]
+
+
+@pytest.mark.parametrize("backend", ["native", "jit"])
+def test_division_by_zero_names_the_inlined_function(backend):
+    code = """
+    fn div(a: i32, b: i32) -> i32 { a / b; }
+    fn main() -> i32 { let z = 0; div(1, z); }
+    """
+    (status, err) = run(code, backend)
+
+    assert status == 1
+    assert err == "Runtime error in div: division by zero\n"
+
+
+def test_print_inlining_is_only_for_the_native_backend():
+    proc = subprocess.run(
+        ["onec", "-", "--print-inlining"],
+        input=b"fn main() {}",
+        stderr=subprocess.PIPE,
+    )
+
+    assert proc.returncode == 1
@@ -0,0 +1,151 @@
+import pytest
+
+from lib import invoke_onec
+
+
+def emit_ir(code: str, *flags: str) -> str:
+    (out, status) = invoke_onec(["-", "--emit-ir", *flags], stdin=code)
+
+    assert status == 0
+    return out
+
+
+def test_emit_ir():
+    code = "fn main() -> i32 { let a = 1; a + 2; }"
+
+    assert emit_ir(code, "-O0") == (
+        "function 0 main (0 params) -> i32\n"
+        "  b0:\n"
+        "    v0 = const i32 1\n"
+        "    v1 = const i32 2\n"
+        "    v2 = add i32 v0, v1\n"
+        "    ret v2\n"
+    )
+
+
+def test_constants_are_folded():
+    code = "fn main() -> i32 { let a = 1; a + 2; }"
+
+    assert emit_ir(code) == (
+        "function 0 main (0 params) -> i32\n"
+        "  b0:\n"
+        "    v2 = const i32 3\n"
+        "    ret v2\n"
+    )
+
+
+def test_folding_wraps_to_the_type():
+    code = "fn main() -> u8 { let a: u8 = 200; a + 100; }"
+
+    assert "const u8 44\n" in emit_ir(code)
+
+
+def test_division_by_zero_is_not_folded():
+    code = "fn main() -> i32 { let a = 0; 1 / a; }"
+
+    assert "div i32" in emit_ir(code)
+
+
+def test_constant_branches_are_removed():
+    code = """
+    fn main() -> i32 {
+        let mut r = 1;
+        if 2 > 1 { r = 42; } else { r = 7; }
+        r;
+    }
+    """
+
+    out = emit_ir(code)
+
+    assert " b1:" not in out
+    assert out.endswith(" = const i32 42\n    ret v5\n")
+
+
+def test_loops_get_phi_nodes():
+    code = """
+    fn f(n: i32) -> i32 {
+        let mut s = 0;
+        let mut i = 0;
+        while i < n { s = s + i; i = i + 1; }
+        s;
+    }
+    """
+    out = emit_ir(code)
+
+    assert out.count(" = phi i32 ") == 2
+    assert "  b1: preds b0, b3\n" in out
+
+
+def test_common_subexpressions_are_computed_once():
+    code = "fn f(a: i32, b: i32) -> i32 { (a * b + 1) + (b * a + 1); }"
+    out = emit_ir(code)
+
+    assert out.count(" = mul ") == 1
+    assert out.count(" = add ") == 2
+
+
+def test_unused_values_are_removed():
+    code = """
+    fn f(a: i32) -> i32 {
+        let unused = a * 3;
+        let also_unused = unused + 1;
+        a;
+    }
+    """
+
+    assert emit_ir(code) == (
+        "function 0 f (1 params) -> i32\n"
+        "  b0:\n"
+        "    v0 = param i32 0\n"
+        "    ret v0\n"
+    )
+
+
+def test_calls_are_kept():
+    code = """
+    fn f(g: fn() -> i32) { let unused = g(); }
+    """
+
+    assert " = call i32 " in emit_ir(code)
+
+
+def test_tail_calls_end_their_block():
+    code = """
+    fn even(n: i32) -> boolean { n == 0 || odd(n - 1); }
+    fn odd(n: i32) -> boolean { !(n == 0) && even(n - 1); }
+    """
+    out = emit_ir(code)
+
+    assert "    tail_call v" in out
+    assert " call " not in out
+
+
+def test_emit_ir_takes_no_output():
+    (_, status) = invoke_onec(["-", "--emit-ir", "-S"])
+
+    assert status == 1
+
+
+@pytest.mark.parametrize("optimize", [[], ["-O0"]])
+def test_optimized_and_unoptimized_agree(optimize):
+    code = """
+    fn collatz(n: u32) -> u32 {
+        let mut steps: u32 = 0;
+        let mut x = n;
+        while x > 1 {
+            if (x & 1) == 0 { x = x / 2; } else { x = x * 3 + 1; }
+            steps = steps + 1;
+        }
+        steps;
+    }
+    fn main() -> u32 {
+        let mut total: u32 = 0;
+        let mut i: u32 = 1;
+        while i < 30 && !(total > 1000) { total = total + collatz(i); i = i + 1; }
+        total;
+    }
+    """
+    (_, expected) = invoke_onec(["-"], stdin=code)
+    (_, status) = invoke_onec(["-", "--jit", *optimize], stdin=code)
+
+    assert status == expected
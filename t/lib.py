@@ -1,4 +1,6 @@
+import os
 import subprocess
+import tempfile
 
 
 def invoke_onec(args: list[str], stdin: str = "") -> tuple[str, int]:
@@ -16,6 +18,34 @@ def invoke_onec(args: list[str], stdin: str = "") -> tuple[str, int]:
     return (proc.stdout.read().decode(), exit_code)
 
 
+def compile_files(
+    sources: list[str | None], args: list[str] = []
+) -> tuple[str, int]:
+    """
+    Compiles one file per source in a single invocation of onec. A source of
+    None stands for a file that does not exist. Returns what was printed to
+    stderr, with the directory of the files stripped, and the exit status.
+    """
+    with tempfile.TemporaryDirectory() as tmp:
+        paths = []
+
+        for i, source in enumerate(sources):
+            path = os.path.join(tmp, f"f{i}.one")
+            paths.append(path)
+
+            if source is not None:
+                with open(path, "w") as f:
+                    f.write(source)
+
+        proc = subprocess.run(
+            ["onec", *paths, *args],
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.PIPE,
+        )
+
+        return (proc.stderr.decode().replace(tmp + os.sep, ""), proc.returncode)
+
+
 def code2sexpr(code: str) -> str:
     """
     Converts 'code' to an S-expression.
@@ -70,3 +100,65 @@ def code2token_list(code: str) -> str:
 
     proc.wait()
     return proc.stdout.read().decode()
+
+
+def batch(stage: str, programs: list[str]) -> list[tuple[int, str, str]]:
+    """
+    Runs all the programs through one stage of onec in a single process.
+    Returns (status, output, diagnostics) for each program.
+    """
+    proc = subprocess.run(
+        ["onec", f"--batch={stage}"],
+        input=b"\0".join(program.encode() for program in programs),
+        stdout=subprocess.PIPE,
+        check=True,
+    )
+
+    results = []
+    out = proc.stdout
+
+    while out:
+        (header, out) = out.split(b"\n", 1)
+        (status, output_len, diagnostics_len) = map(int, header.split())
+
+        output = out[:output_len].decode()
+        diagnostics = out[output_len : output_len + diagnostics_len].decode()
+        out = out[output_len + diagnostics_len :]
+
+        results.append((status, output, diagnostics))
+
+    return results
+
+
+def run(code: str, backend: str = "vm") -> tuple[int, str]:
+    """
+    Compiles 'code' and runs its main function on 'backend', "vm", "interp",
+    "native" or "jit". Returns the exit status, which is what main returns, and
+    what was printed to stderr.
+    """
+    if backend == "native":
+        with tempfile.TemporaryDirectory() as tmp:
+            exe = os.path.join(tmp, "main")
+            proc = subprocess.run(
+                ["onec", "-", "-o", exe],
+                input=code.encode(),
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+            )
+
+            if proc.returncode == 0:
+                proc = subprocess.run(
+                    [exe], stdout=subprocess.PIPE, stderr=subprocess.PIPE
+                )
+
+            return (proc.returncode, proc.stderr.decode())
+
+    flags = {"vm": [], "interp": ["--interp"], "jit": ["--jit"]}[backend]
+    proc = subprocess.run(
+        ["onec", "-", *flags],
+        input=code.encode(),
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+    )
+
+    return (proc.returncode, proc.stderr.decode())
@@ -0,0 +1,591 @@
+import os
+import re
+import subprocess
+import tempfile
+
+import pytest
+
+from lib import invoke_onec, run
+
+
+@pytest.fixture(params=["vm", "interp", "native", "jit"])
+def backend(request) -> str:
+    """
+    Backend the programs run on.
+    """
+    return request.param
+
+
+def test_main_result_is_exit_status(backend):
+    assert run("fn main() -> i32 { 42; }", backend) == (42, "")
+
+
+def test_main_without_result(backend):
+    assert run("fn main() { let a = 1 + 2; }", backend) == (0, "")
+
+
+def test_no_main(backend):
+    assert run("fn f(a: i32) -> i32 { a; }", backend) == (0, "")
+
+
+def test_arithmetic(backend):
+    assert run("fn main() -> i32 { (7 + 3) * 4 - 20 / 5 % 3; }", backend)[0] == 39
+    assert run("fn main() -> i32 { let a = 5; -a + 10; }", backend)[0] == 5
+    assert run("fn main() -> i32 { (12 & 10) | (1 ^ 3); }", backend)[0] == 10
+
+
+def test_integer_types_wrap(backend):
+    assert run("fn main() -> u8 { let a: u8 = 200; a + 100; }", backend)[0] == 44
+    assert run("fn main() -> u8 { let a: u8 = 3; a - 4; }", backend)[0] == 255
+
+    code = """
+    fn main() -> i32 {
+        let a: i8 = 127;
+        let b: i8 = a + 1;
+        let r = 0;
+        if b < 0 { r = 1; }
+        r;
+    }
+    """
+    assert run(code, backend)[0] == 1
+
+    code = """
+    fn main() -> i32 {
+        let a: u16 = 65535;
+        let b: u16 = a * a;
+        let r = 0;
+        if b == 1 { r = 1; }
+        r;
+    }
+    """
+    assert run(code, backend)[0] == 1
+
+
+def test_division_at_width(backend):
+    code = """
+    fn main() -> i32 {
+        let a: i8 = -128;
+        let b: i8 = -1;
+        let c: i8 = a / b;
+        let d: u8 = 250;
+        let e: u8 = d / 7 + d % 7;
+        let r = 0;
+        if c < 0 { r = r + 1; }
+        if e == 40 { r = r + 2; }
+        r + -7 / 2 * 10;
+    }
+    """
+    assert run(code, backend)[0] == 3 - 30 + 256
+
+
+def test_unsigned_comparison(backend):
+    code = """
+    fn main() -> i32 {
+        let a: u32 = 4000000000;
+        let b: u32 = 5;
+        let r = 0;
+        if b < a { r = r + 1; }
+        if a > b { r = r + 2; }
+        if a + a < a { r = r + 4; }
+        r;
+    }
+    """
+    assert run(code, backend)[0] == 7
+
+
+def test_while_loop(backend):
+    code = """
+    fn main() -> i32 {
+        let mut s = 0;
+        let mut i = 0;
+        while i < 100 { s = s + i; i = i + 1; }
+        s % 256;
+    }
+    """
+    assert run(code, backend)[0] == 4950 % 256
+
+
+def test_if_else(backend):
+    code = """
+    fn pick(a: boolean, b: boolean) -> i32 {
+        let r = 0;
+        if a && b { r = 1; } else if a || b { r = 2; } else { r = 3; }
+        r;
+    }
+
+    fn main() -> i32 {
+        pick(true, true) * 100 + pick(false, true) * 10 + pick(false, false);
+    }
+    """
+    assert run(code, backend)[0] == 123
+
+
+def test_recursion(backend):
+    code = """
+    fn fib(n: i32) -> i32 {
+        let mut r = n;
+        if n > 1 { r = fib(n - 1) + fib(n - 2); }
+        r;
+    }
+
+    fn main() -> i32 { fib(20) % 256; }
+    """
+    assert run(code, backend)[0] == 6765 % 256
+
+
+def test_lambdas_and_function_values(backend):
+    code = """
+    fn apply(f: fn(i32) -> i32, a: i32) -> i32 { f(a); }
+    fn inc(a: i32) -> i32 { a + 1; }
+
+    fn main() -> i32 {
+        let double = fn(a: i32) -> i32 { a * 2; };
+        let g = inc;
+        apply(double, 10) + apply(g, 1) + double(g(0));
+    }
+    """
+    assert run(code, backend)[0] == 24
+
+
+def test_shadowed_function(backend):
+    code = """
+    fn f() -> i32 { 1; }
+    fn main() -> i32 {
+        let f = fn() -> i32 { 2; };
+        f();
+    }
+    """
+    assert run(code, backend)[0] == 2
+
+
+def test_strings(backend):
+    code = """
+    fn main() -> i32 {
+        let s = "ab" + "c";
+        let r = 0;
+        if s == "abc" { r = 1; }
+        r;
+    }
+    """
+    assert run(code, backend)[0] == 1
+
+
+def test_division_by_zero(backend):
+    (status, err) = run("fn main() -> i32 { let z = 0; 10 / z; }", backend)
+
+    assert status == 1
+    assert err == "Runtime error in main: division by zero\n"
+
+
+def test_stack_overflow(backend):
+    if backend in ("native", "jit"):
+        pytest.skip("native code runs on the machine stack, unchecked")
+
+    code = "fn f(n: i32) -> i32 { f(n + 1) + 1; } fn main() { f(0); }"
+    (status, err) = run(code, backend)
+
+    assert status == 1
+    assert err == "Runtime error in f: stack overflow\n"
+
+
+def test_tail_calls_do_not_grow_the_stack(backend):
+    if backend == "interp":
+        pytest.skip("the interpreter makes tail calls like any other call")
+
+    code = """
+    fn even(n: i32) -> boolean { n == 0 || odd(n - 1); }
+    fn odd(n: i32) -> boolean { !(n == 0) && even(n - 1); }
+    fn main() -> i32 {
+        let mut r = 0;
+        if even(1000000) { r = r + 1; }
+        if odd(999999) { r = r + 2; }
+        if even(999999) { r = r + 4; }
+        r;
+    }
+    """
+    assert run(code, backend) == (3, "")
+
+    code = """
+    fn down(n: i32, next: fn(i32, fn(i32))) {
+        if n == 0 { let done = true; } else { next(n - 1, down); }
+    }
+    fn bounce(n: i32, back: fn(i32, fn(i32))) { back(n, bounce); }
+    fn main() -> i32 { down(1000000, bounce); 5; }
+    """
+    assert run(code, backend) == (5, "")
+
+
+def test_tail_calls_to_closures(backend):
+    code = """
+    fn make(k: i32) -> fn(i32) -> i32 { fn(x: i32) -> i32 { x * k; }; }
+    fn apply(x: i32, f: fn(i32) -> i32) -> i32 { f(x); }
+    fn main() -> i32 {
+        let k = 2;
+        let g = fn(x: i32) -> i32 { x * k + 1; };
+        apply(21, g) + apply(10, make(3));
+    }
+    """
+    assert run(code, backend) == (73, "")
+
+
+def test_arguments_past_the_registers(backend):
+    many = """
+    fn many(
+        a: i32, b: i32, c: i32, d: i32, e: i32, f: i32, g: i32, h: i32, i: i32
+    ) -> i32 {
+        a + 2 * b + 3 * c + 4 * d + 5 * e + 6 * f + 7 * g + 8 * h + 9 * i;
+    }
+    """
+
+    code = many + """
+    fn main() -> i32 {
+        let m = many;
+        many(1, 2, 3, 4, 5, 6, 7, 8, 9) - m(9, 8, 7, 6, 5, 4, 3, 2, 1);
+    }
+    """
+    assert run(code, backend) == (120, "")
+
+    code = many + """
+    fn direct(n: i32) -> i32 { many(n, 0, 0, 0, 0, 0, 0, 0, 1); }
+    fn through(
+        n: i32,
+        f: fn(i32, i32, i32, i32, i32, i32, i32, i32, i32) -> i32
+    ) -> i32 {
+        f(0, 0, 0, 0, 0, 0, 0, n, 1);
+    }
+    fn main() -> i32 { direct(5) + through(3, many); }
+    """
+    assert run(code, backend) == (47, "")
+
+    code = """
+    fn six(f: fn(i32, i32, i32, i32, i32, i32) -> i32) -> i32 {
+        f(1, 2, 3, 4, 5, 6);
+    }
+    fn make(k: i32) -> fn(i32, i32, i32, i32, i32, i32) -> i32 {
+        fn(a: i32, b: i32, c: i32, d: i32, e: i32, f: i32) -> i32 {
+            a + b + c + d + e + f * k;
+        };
+    }
+    fn main() -> i32 {
+        let k = 10;
+        let add = fn(a: i32, b: i32, c: i32, d: i32, e: i32, f: i32) -> i32 {
+            a + b + c + d + e + f + k;
+        };
+        let g = make(2);
+        six(add) + g(1, 1, 1, 1, 1, 1) + six(make(3));
+    }
+    """
+    assert run(code, backend) == (31 + 7 + 33, "")
+
+
+def test_print_non_tail_calls():
+    code = """
+    fn f(n: i32) -> i32 { f(n) + 1; }
+    fn g(n: i32) -> i32 { let h = fn(x: i32) -> i32 { x * n; }; apply(h); }
+    fn apply(h: fn(i32) -> i32) -> i32 { h(2); }
+    fn u() { f(1); }
+    """
+    proc = subprocess.run(
+        ["onec", "-", "--print-non-tail-calls"],
+        input=code.encode(),
+        stderr=subprocess.PIPE,
+    )
+
+    assert proc.returncode == 0
+    assert proc.stderr.decode() == (
+        "f -> f: not in tail position\n"
+        "g -> apply: the frame holds a closure environment\n"
+        "u -> f: the callee may return a value\n"
+    )
+
+
+def test_tail_calls_past_the_argument_registers(backend):
+    if backend == "interp":
+        pytest.skip("the interpreter makes tail calls like any other call")
+
+    code = """
+    fn f(
+        a: i32, b: i32, c: i32, d: i32, e: i32, g: i32, h: i32, n: i32
+    ) -> boolean {
+        n == 0 || f(b, c, d, e, g, h, a, n - 1);
+    }
+    fn main() -> i32 {
+        let mut r = 0;
+        if f(1, 2, 3, 4, 5, 6, 7, 1000001) { r = 4; }
+        r;
+    }
+    """
+    assert run(code, backend) == (4, "")
+
+
+def test_print_tail_calls_made_as_calls():
+    code = """
+    fn g(
+        a: i32, b: i32, c: i32, d: i32, e: i32, f: i32, h: i32, i: i32, j: i32
+    ) -> i32 {
+        a + j;
+    }
+    fn f(a: i32, b: i32, c: i32, d: i32, e: i32, x: i32, h: i32) -> i32 {
+        g(a, b, c, d, e, x, h, 1, 2);
+    }
+    fn main() -> i32 { f(1, 2, 3, 4, 5, 6, 7); }
+    """
+    proc = subprocess.run(
+        ["onec", "-", "--jit", "-O0", "--print-non-tail-calls"],
+        input=code.encode(),
+        stderr=subprocess.PIPE,
+    )
+
+    assert proc.returncode == 3
+    assert proc.stderr.decode() == (
+        "f -> g: the callee takes more stack arguments than the caller\n"
+        "main -> f: the callee takes more stack arguments than the caller\n"
+    )
+
+
+def test_captured_variables(backend):
+    code = """
+    fn main() -> i32 {
+        let a = 3;
+        let b = 4;
+        let f = fn(x: i32) -> i32 { x * a + b; };
+        fn(x: i32) -> i32 { x - a; }(10) + f(2);
+    }
+    """
+    assert run(code, backend)[0] == 17
+
+
+def test_captures_past_the_argument_registers(backend):
+    code = """
+    fn main() -> i32 {
+        let x = 1;
+        let y = 2;
+        let z = 3;
+        let g = fn(a: i32, b: i32, c: i32, d: i32, e: i32) -> i32 {
+            a + b + c + d + e + x + y + z;
+        };
+        let h = fn(a: i32, b: i32, c: i32, d: i32, e: i32, f: i32) -> i32 {
+            a + b + c + d + e + f * z;
+        };
+        g(1, 2, 3, 4, 5) + h(1, 1, 1, 1, 1, 1) +
+            (fn(a: i32, b: i32, c: i32, d: i32) -> i32 {
+                a + b + c + d + x + y + z;
+            })(1, 1, 1, 1);
+    }
+    """
+    assert run(code, backend) == (21 + 8 + 10, "")
+
+
+def test_nested_captures(backend):
+    code = """
+    fn main() -> i32 {
+        let a = 3;
+        let f = fn(x: i32) -> i32 {
+            let b = x * 2;
+            fn() -> i32 { a + b; }();
+        };
+        f(5);
+    }
+    """
+    assert run(code, backend)[0] == 13
+
+
+def test_closure_callbacks(backend):
+    code = """
+    fn apply(f: fn(i32) -> i32, x: i32) -> i32 { f(x); }
+    fn twice(f: fn(i32) -> i32, x: i32) -> i32 { apply(f, apply(f, x)); }
+    fn main() -> i32 {
+        let k = 3;
+        let mut s = 0;
+        let mut i = 0;
+        while i < 10 {
+            s = s + twice(fn(x: i32) -> i32 { x + k + i; }, 0);
+            i = i + 1;
+        }
+        s;
+    }
+    """
+    assert run(code, backend)[0] == 150
+
+
+def test_escaping_closures(backend):
+    code = """
+    fn adder(k: i32) -> fn(i32) -> i32 { fn(x: i32) -> i32 { x + k; }; }
+    fn main() -> i32 {
+        let add2 = adder(2);
+        let add5 = adder(5);
+        let mut f = add2;
+        let g = f;
+        f = add5;
+        add2(1) * 10 + f(1) + g(0) * 50;
+    }
+    """
+    assert run(code, backend)[0] == 136
+
+
+def test_captures_are_values(backend):
+    code = """
+    fn main() -> i32 {
+        let mut a = 1;
+        let f = fn() -> i32 { a; };
+        let g = f;
+        a = 2;
+        let a = 10;
+        g() + a;
+    }
+    """
+    assert run(code, backend)[0] == 11
+
+
+def test_captured_variables_cannot_be_assigned(backend):
+    code = "fn main() { let mut x = 1; fn() { x = 2; }(); }"
+    (status, err) = run(code, backend)
+
+    assert status == 1
+    assert err == "lambdas cannot assign captured variables: 'x'\n"
+
+
+def test_emit_bytecode():
+    (out, status) = invoke_onec(
+        ["-", "--emit-bytecode"], stdin="fn main() -> i32 { 1 + 2; }"
+    )
+
+    assert status == 0
+    assert out == (
+        "function 0 main (0 params, 2 registers)\n"
+        "     0  LOADI    r0, 1\n"
+        "     1  LOADI    r1, 2\n"
+        "     2  ADD_I32  r0, r0, r1\n"
+        "     3  RET      r0\n"
+    )
+
+
+def test_emit_bytecode_tail_calls():
+    code = "fn f(n: i32) -> i32 { g(n); } fn g(n: i32) -> i32 { n; }"
+    (out, status) = invoke_onec(["-", "--emit-bytecode"], stdin=code)
+
+    assert status == 0
+    assert "TAILCALLK r1, 1\n" in out
+
+
+def test_if_body_variables_are_resolved(backend):
+    # the typechecker does not look into if bodies yet
+    (status, err) = run("fn main() { if true { let a = b; } }", backend)
+
+    assert status == 1
+    assert err == "undeclared variable 'b'\n"
+
+
+def test_emit_assembly():
+    code = "fn add(a: u8) -> u8 { a + 100; } fn main() -> u8 { add(200); }"
+    (out, status) = invoke_onec(["-", "-S"], stdin=code)
+
+    assert status == 0
+    assert "\t.globl main\n" in out
+    assert "one.main:\n" in out
+    assert "\taddb $100, %dil\n" in out
+    assert "\tmovzbl %dil, %edi\n" in out
+
+
+def test_emit_assembly_registers():
+    code = "fn mul(a: i16, b: i16) -> i16 { a * b; } fn main() -> i16 { mul(300, 7); }"
+    (out, status) = invoke_onec(["-", "-S"], stdin=code)
+
+    assert status == 0
+    assert "\timulw %si, %di\n" in out
+    assert "(%rbp)" not in out
+
+    (out, status) = invoke_onec(["-", "-S", "--no-regalloc"], stdin=code)
+
+    assert status == 0
+    assert "\timulw -16(%rbp), %ax\n" in out
+
+
+def test_register_pressure():
+    # more values live across calls than there are callee-saved registers
+    code = """
+    fn g(a: i32, b: i32) -> i32 { (a * 3 + b) & 1023; }
+    fn main() -> i32 {
+        let mut a = 1; let mut b = 2; let mut c = 3; let mut d = 4;
+        let mut e = 5; let mut f = 6; let mut h = 7; let mut j = 8;
+        let mut k = 9; let mut l = 10; let mut m = 11; let mut n = 12;
+        let mut i = 0;
+        while i < 100 {
+            a = a + b; b = b ^ c; c = c + d; d = d * 3; e = g(e, f);
+            f = f + h; h = h - j; j = j + k; k = k ^ l; l = l + m;
+            m = g(m, n); n = n + a;
+            i = i + 1;
+        }
+        (a + b + c + d + e + f + h + j + k + l + m + n) & 127;
+    }
+    """
+
+    for flags in [["--jit"], ["--jit", "--no-regalloc"]]:
+        (_, status) = invoke_onec(["-"] + flags, stdin=code)
+        assert status == 57
+
+
+def test_emit_object():
+    code = """
+    fn greet() -> string { "hello" + " world"; }
+    fn main() -> i32 {
+        let mut r = 1;
+        if greet() == "hello world" { r = 42; }
+        r;
+    }
+    """
+
+    with tempfile.TemporaryDirectory() as tmp:
+        obj = os.path.join(tmp, "main.o")
+        (_, status) = invoke_onec(["-", "-c", "-o", obj], stdin=code)
+        assert status == 0
+
+        readelf = subprocess.run(
+            ["readelf", "-s", "-r", "-W", obj], capture_output=True, text=True
+        )
+        assert readelf.returncode == 0
+        assert re.search(r"FUNC +GLOBAL +DEFAULT +1 main$", readelf.stdout, re.M)
+        assert re.search(r"FUNC +LOCAL +DEFAULT +1 one.greet$", readelf.stdout, re.M)
+        assert re.search(r"R_X86_64_PLT32 .* malloc - 4$", readelf.stdout, re.M)
+        assert re.search(r"R_X86_64_PC32 .* \.rodata - 4$", readelf.stdout, re.M)
+        assert "div_zero" not in readelf.stdout
+
+        objdump = subprocess.run(
+            ["objdump", "-d", obj], capture_output=True, text=True
+        )
+        assert objdump.returncode == 0
+        assert "<one.main>:" in objdump.stdout
+        assert "(bad)" not in objdump.stdout
+
+        exe = os.path.join(tmp, "main")
+        assert subprocess.run(["cc", obj, "-o", exe]).returncode == 0
+        assert subprocess.run([exe]).returncode == 42
+
+
+def test_jit_perf_map():
+    code = "fn twice(x: i32) -> i32 { x * 2; } fn main() -> i32 { twice(21); }"
+    proc = subprocess.Popen(
+        ["onec", "-", "--jit", "--perf-map"],
+        stdin=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+    )
+    proc.communicate(code.encode())
+    path = f"/tmp/perf-{proc.pid}.map"
+
+    try:
+        assert proc.returncode == 42
+
+        with open(path) as f:
+            lines = f.read().splitlines()
+    finally:
+        if os.path.exists(path):
+            os.remove(path)
+
+    names = {line.split(" ")[2] for line in lines}
+    assert {"one.twice", "one.main", "main"} <= names
+
+    for line in lines:
+        (address, size, _) = line.split(" ")
+        assert int(address, 16) != 0
+        assert int(size, 16) != 0
+